@@ -2,7 +2,34 @@
 
 mkdir -p build
 
-sources=("hw4.c" "player_automated.c" "player_interactive.c")
+sources=("admin.c" "analytics_dump.c" "connect_bench.c" "gateway.c" "hw4.c" "leaderboard.c" "player_automated.c" "player_interactive.c" "simulator.c" "tournament.c" "transport_bench.c")
+
+# extra translation units and flags each executable is built with
+declare -A dependencies=(
+    ["admin.c"]="snapshot.c"
+    ["analytics_dump.c"]="analytics.c engine.c memory_account.c rules.c"
+    ["connect_bench.c"]="transport.c"
+    ["gateway.c"]="cluster.c transport.c"
+    ["hw4.c"]="analytics.c cluster.c cpu_budget.c engine.c handoff.c latency.c memory_account.c ratings.c rules.c snapshot.c trace.c transport.c"
+    ["leaderboard.c"]="ratings.c"
+    ["player_automated.c"]="client.c transport.c"
+    ["player_interactive.c"]="client.c transport.c"
+    ["transport_bench.c"]="transport.c"
+    ["simulator.c"]="engine.c memory_account.c rules.c strategy.c"
+    ["tournament.c"]="analytics.c engine.c memory_account.c rules.c strategy.c work_pool.c"
+)
+declare -A flags=(
+    ["analytics_dump.c"]="-pthread"
+    ["hw4.c"]="-pthread"
+    ["leaderboard.c"]="-O2"
+    ["simulator.c"]="-O2 -pthread"
+    ["tournament.c"]="-O2 -pthread"
+)
+# libraries go after the sources, the linker only takes what the objects before them need
+declare -A libraries=(
+    ["hw4.c"]="-lm"
+    ["leaderboard.c"]="-lm"
+)
 
 if [ "$#" -gt 0 ]; then
     sources=("$@")
@@ -12,8 +39,12 @@ fi
 
 for src in "${sources[@]}"; do
     base_name=$(basename "$src" .c)
-    gcc -g "./src/$src" -o "build/$base_name"
+    extra_sources=()
+    for dependency in ${dependencies[$src]}; do
+        extra_sources+=("./src/$dependency")
+    done
+    gcc -g ${flags[$src]} "./src/$src" "${extra_sources[@]}" ${libraries[$src]} -o "build/$base_name" || exit 1
     echo "Compiled $src to build/$base_name"
 done
 
-echo "Compilation complete."
\ No newline at end of file
+echo "Compilation complete."
@@ -12,7 +12,7 @@ echo "Starting server..."
 echo ""
 
 if [ -f "./build/hw4" ]; then
-    ./build/hw4
+    ./build/hw4 "$@"
 else
     echo "Error: ./build/hw4 does not exist. Server failed to start."
     exit 1
@@ -0,0 +1,173 @@
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+// Admin views of the games running on this host. Every server started with -a <dir> publishes
+// its game in <dir>, this tool only maps those files read-only and copies them under their
+// sequence locks, so listing games or dumping a board never pauses a game.
+//
+//   ./build/admin [-d dir] list                      one line per live game
+//   ./build/admin [-d dir] board <game_id> <player>  the player's board, the way print_board() shows it
+
+#define DEFAULT_SNAPSHOT_DIR "/tmp"
+
+int64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool is_process_alive(int pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+bool has_snapshot_name(const char *name) {
+    size_t length = strlen(name);
+    size_t suffix_length = strlen(SNAPSHOT_FILE_SUFFIX);
+    return strncmp(name, "battleship-", 11) == 0 && length > suffix_length
+        && strcmp(name + length - suffix_length, SNAPSHOT_FILE_SUFFIX) == 0;
+}
+
+int list_games(const char *dir) {
+    DIR *directory = opendir(dir);
+    if (directory == NULL) {
+        fprintf(stderr, "[Admin] - [ERROR] Could not open '%s'.\n", dir);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-8s %-8s %-10s %-8s %-11s %-5s %-7s %-9s %s\n", "GAME", "PID", "RULES", "PHASE", "BOARD", "TURN", "SHIPS", "SHOTS", "IDLE");
+    int games = 0;
+    int stale = 0;
+    int64_t now = now_ms();
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (!has_snapshot_name(entry->d_name)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        GameSnapshotReader reader;
+        GameSnapshotCopy copy;
+        if (!open_snapshot_reader(&reader, path)) {
+            continue;
+        }
+        bool copied = read_game_snapshot(&reader, &copy, 0, NULL, 0);
+        close_snapshot_reader(&reader);
+        if (!copied) {
+            fprintf(stderr, "[Admin] - [ERROR] %s stayed busy, skipped.\n", path);
+            continue;
+        }
+        // a server that crashed leaves its file behind
+        if (!is_process_alive(copy.pid)) {
+            stale++;
+            continue;
+        }
+
+        const GameSnapshotSummary *summary = &copy.summary;
+        char board[32] = "-";
+        char turn[8] = "-";
+        char ships[16] = "-";
+        char shots[24];
+        if (summary->width > 0) {
+            snprintf(board, sizeof(board), "%dx%d", summary->width, summary->height);
+        }
+        if (summary->turn != 0) {
+            snprintf(turn, sizeof(turn), "P%d", summary->turn);
+        }
+        if (summary->phase >= GAME_PHASE_PLAYING) {
+            snprintf(ships, sizeof(ships), "%d/%d", summary->ships_remaining[0], summary->ships_remaining[1]);
+        }
+        snprintf(shots, sizeof(shots), "%d/%d", summary->shots_taken[0], summary->shots_taken[1]);
+
+        printf("%-8d %-8d %-10s %-8s %-11s %-5s %-7s %-9s %.1fs\n", copy.game_id, copy.pid, copy.rules, game_phase_name(summary->phase),
+               board, turn, ships, shots, (now - summary->updated_ms) / 1000.0);
+        games++;
+    }
+    closedir(directory);
+
+    printf("%d live game%s", games, games == 1 ? "" : "s");
+    if (stale > 0) {
+        printf(", %d stale snapshot%s of exited servers", stale, stale == 1 ? "" : "s");
+    }
+    printf("\n");
+    return EXIT_SUCCESS;
+}
+
+int print_game_board(const char *dir, int game_id, int player) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), SNAPSHOT_FILE_FORMAT, dir, game_id);
+
+    GameSnapshotReader reader;
+    GameSnapshotCopy copy;
+    if (!open_snapshot_reader(&reader, path)) {
+        fprintf(stderr, "[Admin] - [ERROR] No snapshot of game %d in '%s'.\n", game_id, dir);
+        return EXIT_FAILURE;
+    }
+    if (!read_game_snapshot(&reader, &copy, 0, NULL, 0) || copy.cells_per_board == 0) {
+        fprintf(stderr, "[Admin] - [ERROR] Game %d has no boards yet.\n", game_id);
+        close_snapshot_reader(&reader);
+        return EXIT_FAILURE;
+    }
+
+    // the size never changes once set, so a buffer for it fits every later copy
+    size_t capacity = copy.cells_per_board;
+    signed char *cells = malloc(capacity);
+    if (cells == NULL || !read_game_snapshot(&reader, &copy, player - 1, cells, capacity)) {
+        fprintf(stderr, "[Admin] - [ERROR] Could not copy the board of game %d.\n", game_id);
+        free(cells);
+        close_snapshot_reader(&reader);
+        return EXIT_FAILURE;
+    }
+    close_snapshot_reader(&reader);
+
+    int width = copy.summary.width;
+    int height = copy.summary.height;
+    printf("Game %d, Player %d's board (%s, %d ships left)\n", copy.game_id, player, game_phase_name(copy.summary.phase), copy.summary.ships_remaining[player - 1]);
+    printf("Board (%d x %d):\n", width, height);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            printf("%d ", cells[i * width + j]);
+        }
+        printf("\n");
+    }
+    free(cells);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = DEFAULT_SNAPSHOT_DIR;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d snapshot_dir] [list | board <game_id> <player>]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc || strcmp(argv[optind], "list") == 0) {
+        return list_games(dir);
+    }
+    if (strcmp(argv[optind], "board") == 0 && optind + 2 < argc) {
+        int player = atoi(argv[optind + 2]);
+        if (player != 1 && player != 2) {
+            fprintf(stderr, "[Admin] - [ERROR] The player is 1 or 2.\n");
+            return EXIT_FAILURE;
+        }
+        return print_game_board(dir, atoi(argv[optind + 1]), player);
+    }
+
+    fprintf(stderr, "Usage: %s [-d snapshot_dir] [list | board <game_id> <player>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
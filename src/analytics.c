@@ -0,0 +1,915 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "analytics.h"
+
+#define ANALYTICS_BLOCK_HEADER_SIZE 20
+// a batch is written once it holds this many records, or when it is this old
+#define ANALYTICS_BATCH_RECORDS 4096
+#define ANALYTICS_BATCH_MS 1000
+#define ANALYTICS_MAX_DICTIONARY 64
+
+typedef struct ColumnBuffer {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} ColumnBuffer;
+
+typedef struct ColumnReader {
+    const unsigned char *data;
+    size_t length;
+    size_t offset;
+    bool failed;
+} ColumnReader;
+
+static int64_t realtime_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+GameRecord *create_game_record(int shot_count) {
+    if (shot_count < 0) {
+        return NULL;
+    }
+    GameRecord *record = calloc(1, sizeof(GameRecord) + (size_t)shot_count * sizeof(int32_t));
+    if (record != NULL) {
+        record->shot_count = shot_count;
+    }
+    return record;
+}
+
+void fill_game_record_shots(GameRecord *record, const Board *fired_by_1, const Board *fired_by_2) {
+    const Board *boards[2] = { fired_by_1, fired_by_2 };
+    int taken[2] = { 0, 0 };
+    int counts[2] = { fired_by_1 != NULL ? fired_by_1->shot_count : 0, fired_by_2 != NULL ? fired_by_2->shot_count : 0 };
+    int shot = 0;
+
+    // every valid shot hands the turn over, so the two logs interleave starting with player 1
+    for (int turn = 0; taken[0] < counts[0] || taken[1] < counts[1]; turn = 1 - turn) {
+        if (taken[turn] >= counts[turn]) {
+            continue;
+        }
+        int row, col;
+        char hit_or_miss;
+        get_logged_shot(boards[turn], taken[turn]++, &row, &col, &hit_or_miss);
+        record->shots[shot++] = ANALYTICS_SHOT(row * boards[turn]->width + col, hit_or_miss == 'H');
+    }
+    record->shot_count = shot;
+}
+
+// ---------------------------------------------------------------- encoding
+
+static void column_put_bytes(ColumnBuffer *buffer, const void *bytes, size_t length) {
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        unsigned char *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+static void column_put_u32(ColumnBuffer *buffer, uint32_t value) {
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    column_put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+static void column_put_varint(ColumnBuffer *buffer, uint64_t value) {
+    unsigned char bytes[10];
+    int length = 0;
+    do {
+        bytes[length] = (unsigned char)(value & 0x7f);
+        value >>= 7;
+        if (value != 0) {
+            bytes[length] |= 0x80;
+        }
+        length++;
+    } while (value != 0);
+    column_put_bytes(buffer, bytes, length);
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// collects one column's values, then encodes them with the column's encoding
+typedef struct ColumnValues {
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} ColumnValues;
+
+static void column_add(ColumnValues *column, int64_t value) {
+    if (column->failed) {
+        return;
+    }
+    if (column->count == column->capacity) {
+        size_t capacity = column->capacity > 0 ? column->capacity * 2 : 1024;
+        int64_t *values = realloc(column->values, capacity * sizeof(int64_t));
+        if (values == NULL) {
+            column->failed = true;
+            return;
+        }
+        column->values = values;
+        column->capacity = capacity;
+    }
+    column->values[column->count++] = value;
+}
+
+// 'prefix' (NULL for none) goes in front of the values inside the column, the dictionary uses it
+static void encode_column(ColumnBuffer *out, ColumnBuffer *scratch, AnalyticsColumn id, ColumnEncoding encoding, const ColumnValues *column,
+                          const ColumnBuffer *prefix) {
+    scratch->length = 0;
+    switch (encoding) {
+        case ENCODING_VARINT:
+            for (size_t i = 0; i < column->count; i++) {
+                column_put_varint(scratch, (uint64_t)column->values[i]);
+            }
+            break;
+        case ENCODING_DELTA: {
+            int64_t previous = 0;
+            for (size_t i = 0; i < column->count; i++) {
+                column_put_varint(scratch, zigzag(column->values[i] - previous));
+                previous = column->values[i];
+            }
+            break;
+        }
+        case ENCODING_RUN_LENGTH:
+        case ENCODING_DICTIONARY:
+            for (size_t i = 0; i < column->count;) {
+                size_t run = 1;
+                while (i + run < column->count && column->values[i + run] == column->values[i]) {
+                    run++;
+                }
+                column_put_varint(scratch, zigzag(column->values[i]));
+                column_put_varint(scratch, run);
+                i += run;
+            }
+            break;
+        case ENCODING_BITS:
+            for (size_t i = 0; i < column->count; i += 8) {
+                unsigned char byte = 0;
+                for (size_t bit = 0; bit < 8 && i + bit < column->count; bit++) {
+                    byte |= (unsigned char)((column->values[i + bit] != 0) << bit);
+                }
+                column_put_bytes(scratch, &byte, 1);
+            }
+            break;
+    }
+    scratch->failed = scratch->failed || column->failed;
+
+    size_t prefix_length = prefix != NULL ? prefix->length : 0;
+    unsigned char header[2] = { (unsigned char)id, (unsigned char)encoding };
+    column_put_bytes(out, header, sizeof(header));
+    column_put_u32(out, (uint32_t)(prefix_length + scratch->length));
+    if (prefix != NULL) {
+        column_put_bytes(out, prefix->data, prefix->length);
+        out->failed = out->failed || prefix->failed;
+    }
+    column_put_bytes(out, scratch->data, scratch->length);
+    out->failed = out->failed || scratch->failed;
+}
+
+// Encodes 'records' as one block into 'out'. Rule set names are the only strings, they go into
+// the dictionary in front of the rules column.
+static bool encode_block(ColumnBuffer *out, GameRecord **records, int count) {
+    ColumnValues columns[ANALYTICS_COLUMN_COUNT];
+    memset(columns, 0, sizeof(columns));
+    const char *dictionary[ANALYTICS_MAX_DICTIONARY];
+    int dictionary_size = 0;
+
+    for (int i = 0; i < count; i++) {
+        const GameRecord *record = records[i];
+        int index = 0;
+        while (index < dictionary_size && strcmp(dictionary[index], record->rules) != 0) {
+            index++;
+        }
+        if (index == dictionary_size && dictionary_size < ANALYTICS_MAX_DICTIONARY) {
+            dictionary[dictionary_size++] = record->rules;
+        }
+        // past the dictionary's size the last entry stands in, never happens with the built-in sets
+        if (index >= ANALYTICS_MAX_DICTIONARY) {
+            index = ANALYTICS_MAX_DICTIONARY - 1;
+        }
+
+        column_add(&columns[COLUMN_GAME_ID], record->game_id);
+        column_add(&columns[COLUMN_STARTED_MS], record->started_ms);
+        column_add(&columns[COLUMN_DURATION_MS], record->duration_ms);
+        column_add(&columns[COLUMN_WIDTH], record->width);
+        column_add(&columns[COLUMN_HEIGHT], record->height);
+        column_add(&columns[COLUMN_WINNER], record->winner);
+        column_add(&columns[COLUMN_END_REASON], record->end_reason);
+        column_add(&columns[COLUMN_RULES], index);
+        column_add(&columns[COLUMN_FLEET_SIZE], record->fleet_size);
+        for (int player = 0; player < 2; player++) {
+            for (int piece = 0; piece < record->fleet_size; piece++) {
+                const Piece *placed = &record->placements[player][piece];
+                column_add(&columns[COLUMN_PLACEMENTS], placed->type);
+                column_add(&columns[COLUMN_PLACEMENTS], placed->rotation);
+                column_add(&columns[COLUMN_PLACEMENTS], placed->row);
+                column_add(&columns[COLUMN_PLACEMENTS], placed->col);
+            }
+        }
+        column_add(&columns[COLUMN_SHOT_COUNT], record->shot_count);
+        for (int shot = 0; shot < record->shot_count; shot++) {
+            column_add(&columns[COLUMN_SHOT_CELLS], ANALYTICS_SHOT_CELL(record->shots[shot]));
+            column_add(&columns[COLUMN_SHOT_HITS], ANALYTICS_SHOT_HIT(record->shots[shot]));
+        }
+    }
+
+    static const ColumnEncoding encodings[ANALYTICS_COLUMN_COUNT] = {
+        [COLUMN_GAME_ID] = ENCODING_DELTA,
+        [COLUMN_STARTED_MS] = ENCODING_DELTA,
+        [COLUMN_DURATION_MS] = ENCODING_VARINT,
+        [COLUMN_WIDTH] = ENCODING_RUN_LENGTH,
+        [COLUMN_HEIGHT] = ENCODING_RUN_LENGTH,
+        [COLUMN_WINNER] = ENCODING_RUN_LENGTH,
+        [COLUMN_END_REASON] = ENCODING_RUN_LENGTH,
+        [COLUMN_RULES] = ENCODING_DICTIONARY,
+        [COLUMN_FLEET_SIZE] = ENCODING_RUN_LENGTH,
+        [COLUMN_PLACEMENTS] = ENCODING_VARINT,
+        [COLUMN_SHOT_COUNT] = ENCODING_VARINT,
+        [COLUMN_SHOT_CELLS] = ENCODING_VARINT,
+        [COLUMN_SHOT_HITS] = ENCODING_BITS,
+    };
+
+    ColumnBuffer strings = {0};
+    column_put_varint(&strings, dictionary_size);
+    for (int i = 0; i < dictionary_size; i++) {
+        size_t length = strlen(dictionary[i]);
+        column_put_varint(&strings, length);
+        column_put_bytes(&strings, dictionary[i], length);
+    }
+
+    ColumnBuffer scratch = {0};
+    for (int id = 0; id < ANALYTICS_COLUMN_COUNT; id++) {
+        encode_column(out, &scratch, id, encodings[id], &columns[id], id == COLUMN_RULES ? &strings : NULL);
+    }
+    free(strings.data);
+    free(scratch.data);
+    for (int id = 0; id < ANALYTICS_COLUMN_COUNT; id++) {
+        free(columns[id].values);
+    }
+    return !out->failed;
+}
+
+// ---------------------------------------------------------------- files
+
+static bool write_all(int fd, const unsigned char *data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = write(fd, data + written, length - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+// Appends one block to <dir>/games.bsgc under an exclusive flock, first moving the file aside
+// when it has reached the rotation size. Other servers notice the rename because the path no
+// longer names the file they have open.
+static bool append_block(AnalyticsWriter *writer, const unsigned char *block, size_t length) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/" ANALYTICS_FILE_NAME, writer->dir);
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            return false;
+        }
+
+        struct stat opened, named;
+        if (fstat(fd, &opened) != 0 || stat(path, &named) != 0 || opened.st_ino != named.st_ino || opened.st_dev != named.st_dev) {
+            // rotated between our open and our lock
+            flock(fd, LOCK_UN);
+            close(fd);
+            continue;
+        }
+
+        if (opened.st_size > 0 && (size_t)opened.st_size + length > writer->rotate_bytes) {
+            char rotated[PATH_MAX + 64];
+            snprintf(rotated, sizeof(rotated), "%s/games-%lld-%d.bsgc", writer->dir, (long long)realtime_ms(), (int)getpid());
+            rename(path, rotated);
+            flock(fd, LOCK_UN);
+            close(fd);
+            continue;
+        }
+
+        bool written = write_all(fd, block, length);
+        flock(fd, LOCK_UN);
+        close(fd);
+        return written;
+    }
+    return false;
+}
+
+static void write_batch(AnalyticsWriter *writer, GameRecord **batch, int count) {
+    if (count == 0) {
+        return;
+    }
+
+    ColumnBuffer payload = {0};
+    ColumnBuffer block = {0};
+    bool encoded = encode_block(&payload, batch, count);
+    column_put_u32(&block, ANALYTICS_BLOCK_MAGIC);
+    column_put_u32(&block, ANALYTICS_VERSION);
+    column_put_u32(&block, (uint32_t)count);
+    column_put_u32(&block, ANALYTICS_COLUMN_COUNT);
+    column_put_u32(&block, (uint32_t)payload.length);
+    column_put_bytes(&block, payload.data, payload.length);
+
+    if (!encoded || block.failed || !append_block(writer, block.data, block.length)) {
+        fprintf(stderr, "[Analytics] - [ERROR] Could not write %d game records to %s.\n", count, writer->dir);
+    }
+    else {
+        __atomic_fetch_add(&writer->written, count, __ATOMIC_RELAXED);
+    }
+
+    free(payload.data);
+    free(block.data);
+    for (int i = 0; i < count; i++) {
+        free(batch[i]);
+    }
+}
+
+static Heatmap *find_heatmap(AnalyticsWriter *writer, int width, int height) {
+    for (int i = 0; i < writer->heatmap_count; i++) {
+        if (writer->heatmaps[i].width == width && writer->heatmaps[i].height == height) {
+            return &writer->heatmaps[i];
+        }
+    }
+    if (writer->heatmap_count == ANALYTICS_MAX_HEATMAPS || width <= 0 || height <= 0) {
+        return NULL;
+    }
+
+    Heatmap *heatmap = &writer->heatmaps[writer->heatmap_count];
+    size_t cells = (size_t)width * height;
+    heatmap->shots = calloc(cells, sizeof(uint64_t));
+    heatmap->hits = calloc(cells, sizeof(uint64_t));
+    if (heatmap->shots == NULL || heatmap->hits == NULL) {
+        free(heatmap->shots);
+        free(heatmap->hits);
+        return NULL;
+    }
+    heatmap->width = width;
+    heatmap->height = height;
+    heatmap->games = 0;
+    writer->heatmap_count++;
+    return heatmap;
+}
+
+static void add_to_heatmap(AnalyticsWriter *writer, const GameRecord *record) {
+    if (record->shot_count == 0) {
+        return;
+    }
+    Heatmap *heatmap = find_heatmap(writer, record->width, record->height);
+    if (heatmap == NULL) {
+        return;
+    }
+    size_t cells = (size_t)heatmap->width * heatmap->height;
+    heatmap->games++;
+    for (int i = 0; i < record->shot_count; i++) {
+        size_t cell = (size_t)ANALYTICS_SHOT_CELL(record->shots[i]);
+        if (cell < cells) {
+            heatmap->shots[cell]++;
+            heatmap->hits[cell] += ANALYTICS_SHOT_HIT(record->shots[i]);
+        }
+    }
+}
+
+static bool read_exactly(int fd, void *data, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = read(fd, (char *)data + done, length - done);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        done += result;
+    }
+    return true;
+}
+
+// header: magic, version, width, height as four bytes each, then games and the shot and hit
+// counts per cell as eight bytes each, host byte order
+static void merge_heatmap(AnalyticsWriter *writer, const Heatmap *heatmap) {
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), ANALYTICS_HEATMAP_FORMAT, writer->dir, heatmap->width, heatmap->height);
+    size_t cells = (size_t)heatmap->width * heatmap->height;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        fprintf(stderr, "[Analytics] - [ERROR] Could not open heatmap %s.\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    Heatmap merged = { .width = heatmap->width, .height = heatmap->height, .games = heatmap->games };
+    merged.shots = malloc(cells * sizeof(uint64_t));
+    merged.hits = malloc(cells * sizeof(uint64_t));
+    if (merged.shots != NULL && merged.hits != NULL) {
+        uint32_t header[4];
+        uint64_t games;
+        if (read_exactly(fd, header, sizeof(header)) && header[0] == ANALYTICS_HEATMAP_MAGIC && header[1] == ANALYTICS_VERSION
+            && (int)header[2] == heatmap->width && (int)header[3] == heatmap->height && read_exactly(fd, &games, sizeof(games))
+            && read_exactly(fd, merged.shots, cells * sizeof(uint64_t)) && read_exactly(fd, merged.hits, cells * sizeof(uint64_t))) {
+            merged.games += games;
+        }
+        else {
+            memset(merged.shots, 0, cells * sizeof(uint64_t));
+            memset(merged.hits, 0, cells * sizeof(uint64_t));
+        }
+        for (size_t i = 0; i < cells; i++) {
+            merged.shots[i] += heatmap->shots[i];
+            merged.hits[i] += heatmap->hits[i];
+        }
+
+        header[0] = ANALYTICS_HEATMAP_MAGIC;
+        header[1] = ANALYTICS_VERSION;
+        header[2] = (uint32_t)heatmap->width;
+        header[3] = (uint32_t)heatmap->height;
+        if (lseek(fd, 0, SEEK_SET) != 0 || !write_all(fd, (unsigned char *)header, sizeof(header))
+            || !write_all(fd, (unsigned char *)&merged.games, sizeof(merged.games))
+            || !write_all(fd, (unsigned char *)merged.shots, cells * sizeof(uint64_t))
+            || !write_all(fd, (unsigned char *)merged.hits, cells * sizeof(uint64_t))) {
+            fprintf(stderr, "[Analytics] - [ERROR] Could not write heatmap %s.\n", path);
+        }
+    }
+
+    free(merged.shots);
+    free(merged.hits);
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// ---------------------------------------------------------------- writer thread
+
+static bool analytics_ready(AnalyticsWriter *writer, int memory_order) {
+    AnalyticsSlot *slot = &writer->slots[writer->dequeue_position % writer->capacity];
+    return __atomic_load_n(&slot->sequence, memory_order) == writer->dequeue_position + 1;
+}
+
+static GameRecord *analytics_take(AnalyticsWriter *writer) {
+    if (!analytics_ready(writer, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    AnalyticsSlot *slot = &writer->slots[writer->dequeue_position % writer->capacity];
+    GameRecord *record = slot->record;
+    // hands the slot back to the producers one lap later
+    __atomic_store_n(&slot->sequence, writer->dequeue_position + writer->capacity, __ATOMIC_RELEASE);
+    writer->dequeue_position++;
+    return record;
+}
+
+// Sleeps until a record or the stop arrives, or for at most 'timeout_ms' (-1 for no limit).
+static void analytics_wait(AnalyticsWriter *writer, int timeout_ms) {
+    // pairs with the producer publishing a slot and reading writer_sleeping, one of the two sees the other
+    __atomic_store_n(&writer->writer_sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!analytics_ready(writer, __ATOMIC_SEQ_CST) && !__atomic_load_n(&writer->stopping, __ATOMIC_SEQ_CST)) {
+        struct pollfd pfd = { .fd = writer->wakeup_fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            // only clears the count, the queue and the stop flag are read again by the caller
+            uint64_t count;
+            ssize_t cleared = read(writer->wakeup_fd, &count, sizeof(count));
+            (void)cleared;
+        }
+    }
+    __atomic_store_n(&writer->writer_sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static void analytics_wake(AnalyticsWriter *writer) {
+    uint64_t one = 1;
+    // fails only with EAGAIN, when the count is already far above zero
+    ssize_t written = write(writer->wakeup_fd, &one, sizeof(one));
+    (void)written;
+}
+
+static void *analytics_writer_main(void *argument) {
+    AnalyticsWriter *writer = argument;
+    // a small queue never holds a batch's worth at once, it is written as soon as it is as full as the queue
+    int batch_records = writer->capacity < ANALYTICS_BATCH_RECORDS ? (int)writer->capacity : ANALYTICS_BATCH_RECORDS;
+    GameRecord **batch = malloc(batch_records * sizeof(GameRecord *));
+    int count = 0;
+    int64_t batch_started = 0;
+
+    while (batch != NULL) {
+        // read before draining, so nothing submitted before the stop can be left behind
+        bool stopping = __atomic_load_n(&writer->stopping, __ATOMIC_ACQUIRE);
+        GameRecord *record;
+        while ((record = analytics_take(writer)) != NULL) {
+            if (count == 0) {
+                batch_started = realtime_ms();
+            }
+            add_to_heatmap(writer, record);
+            batch[count++] = record;
+            if (count == batch_records) {
+                write_batch(writer, batch, count);
+                count = 0;
+            }
+        }
+
+        int64_t batch_age = count > 0 ? realtime_ms() - batch_started : 0;
+        if (count > 0 && (stopping || batch_age >= ANALYTICS_BATCH_MS)) {
+            write_batch(writer, batch, count);
+            count = 0;
+        }
+        if (stopping) {
+            break;
+        }
+        // an empty batch has no deadline, the writer sleeps until the next record or the stop
+        analytics_wait(writer, count > 0 ? (int)(ANALYTICS_BATCH_MS - batch_age) : -1);
+    }
+
+    free(batch);
+    for (int i = 0; i < writer->heatmap_count; i++) {
+        merge_heatmap(writer, &writer->heatmaps[i]);
+        free(writer->heatmaps[i].shots);
+        free(writer->heatmaps[i].hits);
+    }
+    writer->heatmap_count = 0;
+    return NULL;
+}
+
+bool start_analytics_writer(AnalyticsWriter *writer, const char *dir, size_t rotate_bytes, size_t queue_capacity) {
+    if (snprintf(writer->dir, sizeof(writer->dir), "%s", dir) >= (int)sizeof(writer->dir) || queue_capacity == 0) {
+        return false;
+    }
+    writer->rotate_bytes = rotate_bytes > 0 ? rotate_bytes : ANALYTICS_DEFAULT_ROTATE_BYTES;
+    writer->stopping = false;
+    writer->enqueue_position = 0;
+    writer->dequeue_position = 0;
+    writer->submitted = 0;
+    writer->dropped = 0;
+    writer->written = 0;
+    writer->heatmap_count = 0;
+    writer->writer_sleeping = 0;
+    writer->capacity = queue_capacity;
+    writer->slots = malloc(queue_capacity * sizeof(AnalyticsSlot));
+    writer->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (writer->slots == NULL || writer->wakeup_fd < 0) {
+        free(writer->slots);
+        writer->slots = NULL;
+        if (writer->wakeup_fd >= 0) {
+            close(writer->wakeup_fd);
+        }
+        writer->running = false;
+        return false;
+    }
+    for (size_t i = 0; i < queue_capacity; i++) {
+        writer->slots[i].sequence = i;
+        writer->slots[i].record = NULL;
+    }
+
+    writer->running = pthread_create(&writer->thread, NULL, analytics_writer_main, writer) == 0;
+    if (!writer->running) {
+        free(writer->slots);
+        writer->slots = NULL;
+        close(writer->wakeup_fd);
+    }
+    return writer->running;
+}
+
+bool analytics_submit(AnalyticsWriter *writer, GameRecord *record) {
+    if (record == NULL) {
+        return false;
+    }
+    if (!writer->running) {
+        free(record);
+        return false;
+    }
+
+    size_t position = __atomic_load_n(&writer->enqueue_position, __ATOMIC_RELAXED);
+    while (true) {
+        AnalyticsSlot *slot = &writer->slots[position % writer->capacity];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&writer->enqueue_position, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->record = record;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_SEQ_CST);
+                __atomic_fetch_add(&writer->submitted, 1, __ATOMIC_RELAXED);
+                if (__atomic_load_n(&writer->writer_sleeping, __ATOMIC_SEQ_CST)) {
+                    analytics_wake(writer);
+                }
+                return true;
+            }
+        }
+        else if (difference < 0) {
+            // the writer is a whole queue behind, the record is not worth stalling a game for
+            __atomic_fetch_add(&writer->dropped, 1, __ATOMIC_RELAXED);
+            free(record);
+            return false;
+        }
+        else {
+            position = __atomic_load_n(&writer->enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void stop_analytics_writer(AnalyticsWriter *writer) {
+    if (!writer->running) {
+        return;
+    }
+    __atomic_store_n(&writer->stopping, true, __ATOMIC_SEQ_CST);
+    analytics_wake(writer);
+    pthread_join(writer->thread, NULL);
+    writer->running = false;
+    free(writer->slots);
+    writer->slots = NULL;
+    close(writer->wakeup_fd);
+}
+
+// ---------------------------------------------------------------- reading
+
+static uint64_t column_get_varint(ColumnReader *reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader->offset >= reader->length) {
+            reader->failed = true;
+            return 0;
+        }
+        unsigned char byte = reader->data[reader->offset++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    reader->failed = true;
+    return 0;
+}
+
+static uint32_t decode_u32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+// expands one encoded column into 'count' values
+static bool decode_column(ColumnReader *reader, ColumnEncoding encoding, int64_t *values, size_t count) {
+    switch (encoding) {
+        case ENCODING_VARINT:
+            for (size_t i = 0; i < count; i++) {
+                values[i] = (int64_t)column_get_varint(reader);
+            }
+            break;
+        case ENCODING_DELTA: {
+            int64_t previous = 0;
+            for (size_t i = 0; i < count; i++) {
+                previous += unzigzag(column_get_varint(reader));
+                values[i] = previous;
+            }
+            break;
+        }
+        case ENCODING_RUN_LENGTH:
+        case ENCODING_DICTIONARY:
+            for (size_t i = 0; i < count && !reader->failed;) {
+                int64_t value = unzigzag(column_get_varint(reader));
+                uint64_t run = column_get_varint(reader);
+                if (run == 0 || run > count - i) {
+                    reader->failed = true;
+                    break;
+                }
+                for (uint64_t j = 0; j < run; j++) {
+                    values[i++] = value;
+                }
+            }
+            break;
+        case ENCODING_BITS:
+            if (reader->length - reader->offset < (count + 7) / 8) {
+                reader->failed = true;
+                break;
+            }
+            for (size_t i = 0; i < count; i++) {
+                values[i] = (reader->data[reader->offset + i / 8] >> (i % 8)) & 1;
+            }
+            reader->offset += (count + 7) / 8;
+            break;
+        default:
+            reader->failed = true;
+    }
+    return !reader->failed;
+}
+
+static bool visit_block(const unsigned char *payload, size_t length, uint32_t count,
+                        void (*visit)(const GameRecord *record, void *context), void *context) {
+    int64_t *columns[ANALYTICS_COLUMN_COUNT] = {0};
+    char dictionary[ANALYTICS_MAX_DICTIONARY][RULE_SET_NAME_LENGTH];
+    int dictionary_size = 0;
+    bool valid = true;
+    size_t offset = 0;
+
+    // fixed columns first, the variable ones size themselves from fleet_size and shot_count
+    for (int id = 0; id < ANALYTICS_COLUMN_COUNT && valid; id++) {
+        if (length - offset < 6 || payload[offset] != id) {
+            valid = false;
+            break;
+        }
+        ColumnEncoding encoding = payload[offset + 1];
+        uint32_t column_length = decode_u32(payload + offset + 2);
+        offset += 6;
+        if (column_length > length - offset) {
+            valid = false;
+            break;
+        }
+        ColumnReader reader = { .data = payload + offset, .length = column_length, .offset = 0, .failed = false };
+        offset += column_length;
+
+        size_t values = count;
+        if (id == COLUMN_PLACEMENTS) {
+            values = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                values += 8 * (size_t)columns[COLUMN_FLEET_SIZE][i];
+            }
+        }
+        else if (id == COLUMN_SHOT_CELLS || id == COLUMN_SHOT_HITS) {
+            values = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                values += (size_t)columns[COLUMN_SHOT_COUNT][i];
+            }
+        }
+        if (id == COLUMN_RULES) {
+            uint64_t entries = column_get_varint(&reader);
+            for (uint64_t i = 0; i < entries && !reader.failed; i++) {
+                uint64_t name_length = column_get_varint(&reader);
+                if (i >= ANALYTICS_MAX_DICTIONARY || name_length >= RULE_SET_NAME_LENGTH || name_length > reader.length - reader.offset) {
+                    reader.failed = true;
+                    break;
+                }
+                memcpy(dictionary[i], reader.data + reader.offset, name_length);
+                dictionary[i][name_length] = '\0';
+                reader.offset += name_length;
+                dictionary_size++;
+            }
+        }
+
+        columns[id] = malloc((values > 0 ? values : 1) * sizeof(int64_t));
+        valid = columns[id] != NULL && !reader.failed && decode_column(&reader, encoding, columns[id], values);
+        if (valid && id == COLUMN_FLEET_SIZE) {
+            for (uint32_t i = 0; i < count; i++) {
+                valid = valid && columns[id][i] >= 0 && columns[id][i] <= MAX_FLEET_SIZE;
+            }
+        }
+        if (valid && id == COLUMN_SHOT_COUNT) {
+            for (uint32_t i = 0; i < count; i++) {
+                valid = valid && columns[id][i] >= 0 && columns[id][i] <= INT32_MAX / 2;
+            }
+        }
+    }
+
+    size_t placement = 0;
+    size_t shot = 0;
+    for (uint32_t i = 0; i < count && valid; i++) {
+        GameRecord *record = create_game_record((int)columns[COLUMN_SHOT_COUNT][i]);
+        if (record == NULL) {
+            valid = false;
+            break;
+        }
+        record->game_id = columns[COLUMN_GAME_ID][i];
+        record->started_ms = columns[COLUMN_STARTED_MS][i];
+        record->duration_ms = columns[COLUMN_DURATION_MS][i];
+        record->width = (int32_t)columns[COLUMN_WIDTH][i];
+        record->height = (int32_t)columns[COLUMN_HEIGHT][i];
+        record->winner = (int32_t)columns[COLUMN_WINNER][i];
+        record->end_reason = (int32_t)columns[COLUMN_END_REASON][i];
+        int64_t rules = columns[COLUMN_RULES][i];
+        snprintf(record->rules, sizeof(record->rules), "%s", rules >= 0 && rules < dictionary_size ? dictionary[rules] : "?");
+        record->fleet_size = (int32_t)columns[COLUMN_FLEET_SIZE][i];
+        for (int player = 0; player < 2; player++) {
+            for (int piece = 0; piece < record->fleet_size; piece++) {
+                Piece *placed = &record->placements[player][piece];
+                placed->type = (int)columns[COLUMN_PLACEMENTS][placement++];
+                placed->rotation = (int)columns[COLUMN_PLACEMENTS][placement++];
+                placed->row = (int)columns[COLUMN_PLACEMENTS][placement++];
+                placed->col = (int)columns[COLUMN_PLACEMENTS][placement++];
+            }
+        }
+        for (int j = 0; j < record->shot_count; j++, shot++) {
+            record->shots[j] = ANALYTICS_SHOT(columns[COLUMN_SHOT_CELLS][shot], columns[COLUMN_SHOT_HITS][shot]);
+        }
+        visit(record, context);
+        free(record);
+    }
+
+    for (int id = 0; id < ANALYTICS_COLUMN_COUNT; id++) {
+        free(columns[id]);
+    }
+    return valid;
+}
+
+bool read_game_records(const char *path, void (*visit)(const GameRecord *record, void *context), void *context) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool valid = true;
+    unsigned char header[ANALYTICS_BLOCK_HEADER_SIZE];
+    while (valid) {
+        ssize_t got = read(fd, header, 1);
+        if (got == 0) {
+            break;
+        }
+        if (got != 1 || !read_exactly(fd, header + 1, sizeof(header) - 1) || decode_u32(header) != ANALYTICS_BLOCK_MAGIC
+            || decode_u32(header + 4) != ANALYTICS_VERSION || decode_u32(header + 12) != ANALYTICS_COLUMN_COUNT) {
+            valid = false;
+            break;
+        }
+
+        uint32_t count = decode_u32(header + 8);
+        size_t length = decode_u32(header + 16);
+        unsigned char *payload = malloc(length > 0 ? length : 1);
+        valid = payload != NULL && read_exactly(fd, payload, length) && visit_block(payload, length, count, visit, context);
+        free(payload);
+    }
+    close(fd);
+    return valid;
+}
+
+bool read_heatmap(const char *path, Heatmap *heatmap) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    uint32_t header[4];
+    heatmap->shots = NULL;
+    heatmap->hits = NULL;
+    bool valid = read_exactly(fd, header, sizeof(header)) && header[0] == ANALYTICS_HEATMAP_MAGIC && header[1] == ANALYTICS_VERSION
+        && header[2] > 0 && header[3] > 0 && (uint64_t)header[2] * header[3] <= (1u << 28);
+    if (valid) {
+        size_t cells = (size_t)header[2] * header[3];
+        heatmap->width = (int)header[2];
+        heatmap->height = (int)header[3];
+        heatmap->shots = malloc(cells * sizeof(uint64_t));
+        heatmap->hits = malloc(cells * sizeof(uint64_t));
+        valid = heatmap->shots != NULL && heatmap->hits != NULL && read_exactly(fd, &heatmap->games, sizeof(heatmap->games))
+            && read_exactly(fd, heatmap->shots, cells * sizeof(uint64_t)) && read_exactly(fd, heatmap->hits, cells * sizeof(uint64_t));
+    }
+    close(fd);
+    if (!valid) {
+        free(heatmap->shots);
+        free(heatmap->hits);
+        heatmap->shots = NULL;
+        heatmap->hits = NULL;
+    }
+    return valid;
+}
+
+const char *game_end_reason_name(int reason) {
+    switch (reason) {
+        case GAME_END_SUNK:
+            return "sunk";
+        case GAME_END_FORFEIT:
+            return "forfeit";
+        case GAME_END_DISCONNECT:
+            return "disconnect";
+        case GAME_END_RATE_LIMIT:
+            return "rate limit";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "engine.h"
+#include "rules.h"
+
+// Analytics export of finished games. Game threads hand a GameRecord to a background writer
+// through a bounded lock-free queue and never wait: when the queue is full the record is dropped
+// and counted. The writer batches records into column-oriented blocks, appends them to
+// <dir>/games.bsgc and rotates that file by size. It also adds every shot to an in-memory heatmap
+// per board size, merged into <dir>/heatmap-<width>x<height>.bshm when the writer stops.
+//
+// A block is a 20-byte header (magic, version, record count, column count, payload bytes, four
+// bytes each, little endian) and then one column after another, each an id byte, an encoding
+// byte, a four-byte length and the encoded values. Every column holds one value per record, in
+// record order, except placements (2 * fleet_size pieces of four values per record), shot_cells
+// and shot_hits (shot_count values per record). Blocks are self-contained, so any number of
+// servers can append to the same file.
+
+#define ANALYTICS_BLOCK_MAGIC 0x43475342u
+#define ANALYTICS_HEATMAP_MAGIC 0x4d485342u
+#define ANALYTICS_VERSION 1
+#define ANALYTICS_FILE_NAME "games.bsgc"
+#define ANALYTICS_HEATMAP_FORMAT "%s/heatmap-%dx%d.bshm"
+#define ANALYTICS_DEFAULT_ROTATE_BYTES (16 << 20)
+// queue slots for runners that finish many games at once, a server process only ever exports its own game
+#define ANALYTICS_QUEUE_CAPACITY 65536
+#define ANALYTICS_SERVER_QUEUE_CAPACITY 4
+#define ANALYTICS_MAX_HEATMAPS 64
+
+// a shot in turn order, player 1 shoots first and the players alternate
+#define ANALYTICS_SHOT(cell, hit) ((int32_t)(cell) * 2 + ((hit) ? 1 : 0))
+#define ANALYTICS_SHOT_CELL(shot) ((shot) / 2)
+#define ANALYTICS_SHOT_HIT(shot) ((shot) % 2 == 1)
+
+typedef enum GameEndReason {
+    GAME_END_SUNK = 0,
+    GAME_END_FORFEIT = 1,
+    GAME_END_DISCONNECT = 2,
+    GAME_END_RATE_LIMIT = 3
+} GameEndReason;
+
+typedef enum AnalyticsColumn {
+    COLUMN_GAME_ID = 0,
+    COLUMN_STARTED_MS = 1,
+    COLUMN_DURATION_MS = 2,
+    COLUMN_WIDTH = 3,
+    COLUMN_HEIGHT = 4,
+    COLUMN_WINNER = 5,
+    COLUMN_END_REASON = 6,
+    COLUMN_RULES = 7,
+    COLUMN_FLEET_SIZE = 8,
+    COLUMN_PLACEMENTS = 9,
+    COLUMN_SHOT_COUNT = 10,
+    COLUMN_SHOT_CELLS = 11,
+    COLUMN_SHOT_HITS = 12,
+    ANALYTICS_COLUMN_COUNT
+} AnalyticsColumn;
+
+typedef enum ColumnEncoding {
+    // unsigned LEB128 varints
+    ENCODING_VARINT = 0,
+    // zigzag varints of the difference to the previous value
+    ENCODING_DELTA = 1,
+    // (zigzag value, run length) varint pairs
+    ENCODING_RUN_LENGTH = 2,
+    // the distinct strings (varint length and bytes each), then run-length coded indexes
+    ENCODING_DICTIONARY = 3,
+    // one bit per value, eight to a byte, lowest bit first
+    ENCODING_BITS = 4
+} ColumnEncoding;
+
+typedef struct GameRecord {
+    int64_t game_id;
+    // CLOCK_REALTIME milliseconds when both players were in, and how long the game ran from there
+    int64_t started_ms;
+    int64_t duration_ms;
+    int32_t width;
+    int32_t height;
+    // 1 or 2, 0 if nobody won
+    int32_t winner;
+    int32_t end_reason;
+    char rules[RULE_SET_NAME_LENGTH];
+    int32_t fleet_size;
+    // all zero for a player that never placed a valid fleet
+    Piece placements[2][MAX_FLEET_SIZE];
+    int32_t shot_count;
+    // ANALYTICS_SHOT() values in turn order
+    int32_t shots[];
+} GameRecord;
+
+typedef struct AnalyticsSlot {
+    size_t sequence;
+    GameRecord *record;
+} AnalyticsSlot;
+
+// hit counts per cell of every game played on one board size
+typedef struct Heatmap {
+    int width;
+    int height;
+    uint64_t games;
+    uint64_t *shots;
+    uint64_t *hits;
+} Heatmap;
+
+typedef struct AnalyticsWriter {
+    char dir[PATH_MAX];
+    size_t rotate_bytes;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    // multi-producer single-consumer ring, producers claim 'enqueue_position' with a CAS
+    AnalyticsSlot *slots;
+    size_t capacity;
+    size_t enqueue_position;
+    size_t dequeue_position;
+    uint64_t submitted;
+    uint64_t dropped;
+    uint64_t written;
+    // the idle writer sleeps on 'wakeup_fd', producers only write it while 'writer_sleeping' is set
+    int wakeup_fd;
+    int writer_sleeping;
+    // only touched by the writer thread
+    Heatmap heatmaps[ANALYTICS_MAX_HEATMAPS];
+    int heatmap_count;
+} AnalyticsWriter;
+
+// A record with room for 'shot_count' shots, NULL when out of memory. The fixed fields start zeroed.
+GameRecord *create_game_record(int shot_count);
+// Fills the shots from the two boards' shot logs, 'fired_by_1' is the board player 1 shot at.
+// The record must have room for both logs.
+void fill_game_record_shots(GameRecord *record, const Board *fired_by_1, const Board *fired_by_2);
+
+// Starts the writer thread with room for 'queue_capacity' records in flight. Records go to 'dir',
+// the file is rotated once it reaches 'rotate_bytes'.
+bool start_analytics_writer(AnalyticsWriter *writer, const char *dir, size_t rotate_bytes, size_t queue_capacity);
+// Hands 'record' to the writer, which frees it. Never blocks: returns false and frees the record
+// if the queue is full or the writer is not running.
+bool analytics_submit(AnalyticsWriter *writer, GameRecord *record);
+// Writes everything still queued, merges the heatmaps into their files and joins the thread.
+void stop_analytics_writer(AnalyticsWriter *writer);
+
+// Calls 'visit' for every record in a games file, false if the file is damaged or unreadable.
+bool read_game_records(const char *path, void (*visit)(const GameRecord *record, void *context), void *context);
+// Loads a heatmap file, the caller frees heatmap->shots and heatmap->hits.
+bool read_heatmap(const char *path, Heatmap *heatmap);
+const char *game_end_reason_name(int reason);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "analytics.h"
+
+// Prints the files the analytics writer produces: one line per game for games*.bsgc files, with
+// -v also both fleets and every shot, and the shot counts and hit rates of heatmap-*.bshm files.
+
+typedef struct DumpOptions {
+    bool verbose;
+    long games;
+} DumpOptions;
+
+void print_record(const GameRecord *record, void *context) {
+    DumpOptions *options = context;
+    time_t started = (time_t)(record->started_ms / 1000);
+    struct tm started_tm;
+    char started_text[32] = "-";
+    if (record->started_ms > 0 && localtime_r(&started, &started_tm) != NULL) {
+        strftime(started_text, sizeof(started_text), "%Y-%m-%d %H:%M:%S", &started_tm);
+    }
+
+    char outcome[32] = "no winner";
+    if (record->winner != 0) {
+        snprintf(outcome, sizeof(outcome), "P%d won", record->winner);
+    }
+    printf("game %lld  %dx%d %s  %s (%s)  %d shots  %.3f s  started %s\n", (long long)record->game_id, record->width, record->height,
+           record->rules, outcome, game_end_reason_name(record->end_reason), record->shot_count, record->duration_ms / 1000.0, started_text);
+    options->games++;
+
+    if (!options->verbose) {
+        return;
+    }
+    for (int player = 0; player < 2; player++) {
+        printf("  P%d fleet:", player + 1);
+        for (int i = 0; i < record->fleet_size; i++) {
+            const Piece *piece = &record->placements[player][i];
+            printf(" %d %d %d %d", piece->type, piece->rotation, piece->col, piece->row);
+        }
+        printf("\n");
+    }
+    printf("  shots:");
+    for (int i = 0; i < record->shot_count; i++) {
+        int cell = ANALYTICS_SHOT_CELL(record->shots[i]);
+        int width = record->width > 0 ? record->width : 1;
+        printf(" P%d:%d,%d%s", i % 2 + 1, cell / width, cell % width, ANALYTICS_SHOT_HIT(record->shots[i]) ? "H" : "M");
+    }
+    printf("\n");
+}
+
+bool print_heatmap(const char *path) {
+    Heatmap heatmap;
+    if (!read_heatmap(path, &heatmap)) {
+        return false;
+    }
+
+    printf("Heatmap %dx%d over %llu games, shots per cell:\n", heatmap.width, heatmap.height, (unsigned long long)heatmap.games);
+    for (int row = 0; row < heatmap.height; row++) {
+        for (int col = 0; col < heatmap.width; col++) {
+            printf("%llu ", (unsigned long long)heatmap.shots[row * heatmap.width + col]);
+        }
+        printf("\n");
+    }
+    printf("Hit rate per cell (%%):\n");
+    for (int row = 0; row < heatmap.height; row++) {
+        for (int col = 0; col < heatmap.width; col++) {
+            size_t cell = (size_t)row * heatmap.width + col;
+            printf("%d ", heatmap.shots[cell] > 0 ? (int)(100 * heatmap.hits[cell] / heatmap.shots[cell]) : 0);
+        }
+        printf("\n");
+    }
+
+    free(heatmap.shots);
+    free(heatmap.hits);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    DumpOptions options = { .verbose = false, .games = 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+            case 'v':
+                options.verbose = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-v] games.bsgc|heatmap-WxH.bshm ...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-v] games.bsgc|heatmap-WxH.bshm ...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        size_t length = strlen(argv[i]);
+        bool is_heatmap = length > 5 && strcmp(argv[i] + length - 5, ".bshm") == 0;
+        bool read = is_heatmap ? print_heatmap(argv[i]) : read_game_records(argv[i], print_record, &options);
+        if (!read) {
+            fprintf(stderr, "[Analytics] - [ERROR] Could not read '%s'.\n", argv[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+    if (options.games > 0) {
+        printf("%ld games\n", options.games);
+    }
+    return status;
+}
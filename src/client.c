@@ -0,0 +1,588 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "client.h"
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// " <integer>" at 'position', returns the position after it or NULL
+static const char *parse_field(const char *position, int *value) {
+    if (position[0] != ' ') {
+        return NULL;
+    }
+    position++;
+    bool negative = position[0] == '-';
+    if (negative) {
+        position++;
+    }
+    if (!is_digit(position[0])) {
+        return NULL;
+    }
+    long parsed = 0;
+    while (is_digit(position[0])) {
+        if (parsed < INT_MAX) {
+            parsed = parsed * 10 + (position[0] - '0');
+        }
+        position++;
+    }
+    if (parsed > INT_MAX) {
+        parsed = INT_MAX;
+    }
+    *value = negative ? -(int)parsed : (int)parsed;
+    return position;
+}
+
+bool client_next_shot(const char **position, ClientShot *shot) {
+    const char *next = *position;
+    if (next[0] != ' ' || (next[1] != 'H' && next[1] != 'M')) {
+        return false;
+    }
+    char result = next[1];
+    int col, row;
+    if ((next = parse_field(next + 2, &col)) == NULL || (next = parse_field(next, &row)) == NULL) {
+        return false;
+    }
+    shot->result = result;
+    shot->col = col;
+    shot->row = row;
+    *position = next;
+    return true;
+}
+
+void client_parse_reply(const char *text, int length, ClientReply *reply) {
+    const char *end = NULL;
+
+    reply->type = length > 0 ? text[0] : CLIENT_REPLY_CLOSED;
+    reply->valid = false;
+    reply->code = -1;
+    reply->ships_remaining = -1;
+    reply->shot_result = '\0';
+    reply->cursor = -1;
+    reply->shot_count = 0;
+    reply->shots = "";
+    reply->token[0] = '\0';
+    reply->text = text;
+    reply->length = length;
+
+    switch (reply->type) {
+        case 'A':
+            reply->valid = length == 1;
+            break;
+        case 'E':
+        case 'H':
+            end = parse_field(text + 1, &reply->code);
+            reply->valid = end != NULL && end[0] == '\0';
+            break;
+        case 'R':
+            end = parse_field(text + 1, &reply->ships_remaining);
+            if (end != NULL && end[0] == ' ' && (end[1] == 'H' || end[1] == 'M') && end[2] == '\0') {
+                reply->shot_result = end[1];
+                reply->valid = true;
+            }
+            break;
+        case 'T': {
+            int token_length = 0;
+            end = text + 1;
+            if (end[0] == ' ') {
+                end++;
+                while (token_length < CLIENT_TOKEN_SIZE - 1 && end[token_length] > ' ') {
+                    reply->token[token_length] = end[token_length];
+                    token_length++;
+                }
+            }
+            reply->token[token_length] = '\0';
+            reply->valid = token_length > 0 && end[token_length] == '\0';
+            break;
+        }
+        case 'G': {
+            end = parse_field(text + 1, &reply->ships_remaining);
+            if (end == NULL) {
+                break;
+            }
+            // a delta reply has the cursor where a full history has its first shot letter
+            if (end[0] == ' ' && is_digit(end[1]) && (end = parse_field(end, &reply->cursor)) == NULL) {
+                break;
+            }
+            reply->shots = end;
+            ClientShot shot;
+            while (client_next_shot(&end, &shot)) {
+                reply->shot_count++;
+            }
+            // a full history that did not fit in one packet ends in a cut-off shot
+            reply->valid = end[0] == '\0' || reply->cursor < 0;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void watch_output(ClientConnection *connection, bool watch) {
+    if (connection->watching_output == watch) {
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN | (watch ? EPOLLOUT : 0), .data.ptr = connection };
+    epoll_ctl(connection->loop->epoll_fd, EPOLL_CTL_MOD, connection->transport.socket_fd, &event);
+    connection->watching_output = watch;
+}
+
+// the next 'count' queued requests just went out
+static void mark_written(ClientConnection *connection, int count) {
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < count && connection->in_flight < connection->request_count; i++) {
+        int index = (connection->request_head + connection->in_flight) % CLIENT_MAX_PIPELINE;
+        connection->requests[index].sent_ns = now;
+        connection->in_flight++;
+    }
+}
+
+// Writes as much of the queued output as the framing and the socket allow. Unframed, a packet
+// only goes out once the one before it was answered, and its newline is never sent.
+static bool flush_output(ClientConnection *connection) {
+    Transport *transport = &connection->transport;
+
+    while (connection->output_sent < connection->output_length) {
+        bool framed = connection->framing == CLIENT_FRAMED || transport->channel != NULL;
+        if (!framed && connection->in_flight > 0) {
+            break;
+        }
+        char *start = connection->output + connection->output_sent;
+        int queued = connection->output_length - connection->output_sent;
+        char *newline = memchr(start, '\n', queued);
+
+        if (transport->channel != NULL) {
+            if (!transport_send(transport, start, newline - start)) {
+                return false;
+            }
+            connection->output_sent += (int)(newline - start) + 1;
+            mark_written(connection, 1);
+            continue;
+        }
+
+        int length = framed ? queued : (int)(newline - start);
+        ssize_t written = send(transport->socket_fd, start, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        connection->output_sent += (int)written;
+        if (framed) {
+            int packets = 0;
+            for (ssize_t i = 0; i < written; i++) {
+                packets += start[i] == '\n';
+            }
+            mark_written(connection, packets);
+        }
+        else if (written == length) {
+            connection->output_sent++;
+            mark_written(connection, 1);
+        }
+    }
+
+    if (connection->output_sent == connection->output_length) {
+        connection->output_sent = 0;
+        connection->output_length = 0;
+    }
+    // an unframed packet waiting for its turn needs a reply, not room in the socket
+    bool blocked = connection->output_sent < connection->output_length
+        && (connection->framing == CLIENT_FRAMED || connection->in_flight == 0);
+    if (transport->channel == NULL) {
+        watch_output(connection, blocked);
+    }
+    return true;
+}
+
+static bool queue_packet(ClientConnection *connection, const char *packet, size_t length, void *tag, bool internal) {
+    if (connection->request_count == CLIENT_MAX_PIPELINE) {
+        errno = ENOBUFS;
+        return false;
+    }
+    if (connection->output_length + (int)length + 1 > CLIENT_OUTPUT_SIZE) {
+        // the written part is dead space
+        memmove(connection->output, connection->output + connection->output_sent, connection->output_length - connection->output_sent);
+        connection->output_length -= connection->output_sent;
+        connection->output_sent = 0;
+        if (connection->output_length + (int)length + 1 > CLIENT_OUTPUT_SIZE) {
+            errno = ENOBUFS;
+            return false;
+        }
+    }
+
+    memcpy(connection->output + connection->output_length, packet, length);
+    connection->output[connection->output_length + length] = '\n';
+    connection->output_length += (int)length + 1;
+
+    int index = (connection->request_head + connection->request_count) % CLIENT_MAX_PIPELINE;
+    connection->requests[index].tag = tag;
+    connection->requests[index].sent_ns = 0;
+    connection->requests[index].internal = internal;
+    connection->requests[index].token = length == 1 && packet[0] == 'T';
+    connection->request_count++;
+    return true;
+}
+
+static void drop_requests(ClientConnection *connection) {
+    connection->request_count = 0;
+    connection->in_flight = 0;
+    connection->output_sent = 0;
+    connection->output_length = 0;
+}
+
+static void deliver(ClientConnection *connection, ClientReply *reply) {
+    reply->tag = NULL;
+    reply->unsolicited = true;
+    reply->round_trip_ns = 0;
+
+    if (connection->in_flight > 0 && (reply->type != 'T' || connection->requests[connection->request_head].token)) {
+        ClientRequest *request = &connection->requests[connection->request_head];
+        connection->request_head = (connection->request_head + 1) % CLIENT_MAX_PIPELINE;
+        connection->request_count--;
+        connection->in_flight--;
+        reply->round_trip_ns = monotonic_ns() - request->sent_ns;
+        if (request->internal && reply->type != 'H') {
+            return;
+        }
+        reply->tag = request->tag;
+        reply->unsolicited = request->internal;
+    }
+    if (reply->type == 'H') {
+        connection->game_over = true;
+        drop_requests(connection);
+    }
+    connection->handler(connection, reply);
+}
+
+static void dispatch(ClientConnection *connection, char *text, int length) {
+    ClientReply reply;
+    text[length] = '\0';
+    client_parse_reply(text, length, &reply);
+    deliver(connection, &reply);
+}
+
+// Splits what arrived on a stream socket into replies.
+static void split_input(ClientConnection *connection) {
+    char *input = connection->input;
+
+    if (connection->framing == CLIENT_FRAMING_PENDING) {
+        if (connection->input_length == 1 && input[0] == 'A') {
+            // the newline is still on its way
+            return;
+        }
+        if (connection->input_length >= 2 && input[0] == 'A' && input[1] == '\n') {
+            connection->framing = CLIENT_FRAMED;
+            char ack[] = "A";
+            dispatch(connection, ack, 1);
+            connection->input_length -= 2;
+            memmove(input, input + 2, connection->input_length);
+        }
+        else {
+            connection->framing = CLIENT_UNFRAMED;
+        }
+    }
+
+    if (connection->framing == CLIENT_UNFRAMED) {
+        int length = connection->input_length;
+        connection->input_length = 0;
+        dispatch(connection, input, length);
+        return;
+    }
+
+    int offset = 0;
+    while (offset < connection->input_length && !connection->closed) {
+        char *line = input + offset;
+        char *newline = memchr(line, '\n', connection->input_length - offset);
+        if (newline == NULL) {
+            break;
+        }
+        int length = (int)(newline - line);
+        offset += length + 1;
+        dispatch(connection, line, length);
+    }
+    connection->input_length -= offset;
+    memmove(input, input + offset, connection->input_length);
+    // only a broken server sends a line longer than the buffer
+    if (connection->input_length == CLIENT_INPUT_SIZE - 1) {
+        connection->input_length = 0;
+        dispatch(connection, input, CLIENT_INPUT_SIZE - 1);
+    }
+}
+
+static void free_connection(ClientConnection *connection) {
+    ClientLoop *loop = connection->loop;
+
+    // a connection on the ready list is freed by the run that takes it off
+    if (connection->ready) {
+        return;
+    }
+    if (connection->previous != NULL) {
+        connection->previous->next = connection->next;
+    }
+    else {
+        loop->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->previous = connection->previous;
+    }
+    loop->connection_count--;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, connection->transport.socket_fd, NULL);
+    if (connection->transport.rx_eventfd >= 0) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, connection->transport.rx_eventfd, NULL);
+    }
+    transport_close(&connection->transport);
+    free(connection);
+}
+
+static void hang_up(ClientConnection *connection, int hang_up_errno) {
+    ClientReply reply;
+    char empty[] = "";
+
+    drop_requests(connection);
+    connection->input_length = 0;
+    client_parse_reply(empty, 0, &reply);
+    reply.tag = NULL;
+    reply.unsolicited = true;
+    reply.round_trip_ns = 0;
+    errno = hang_up_errno;
+    connection->handler(connection, &reply);
+    connection->closed = true;
+}
+
+static void mark_ready(ClientConnection *connection) {
+    if (!connection->ready) {
+        connection->ready = true;
+        connection->next_ready = connection->loop->ready;
+        connection->loop->ready = connection;
+    }
+}
+
+static void process_connection(ClientConnection *connection, uint32_t events) {
+    Transport *transport = &connection->transport;
+
+    connection->dispatching = true;
+    if ((events & EPOLLOUT) && !flush_output(connection)) {
+        hang_up(connection, errno);
+    }
+    int replies = 0;
+    while (!connection->closed) {
+        int space = CLIENT_INPUT_SIZE - connection->input_length;
+        bool kept_reply = transport->pending_length > 0;
+        int nbytes = transport_receive_nonblocking(transport, connection->input + connection->input_length, space);
+        if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            break;
+        }
+        if (nbytes <= 0 && replies > 0) {
+            // the caller sees the replies first and may be done before the hang-up is reported
+            mark_ready(connection);
+            break;
+        }
+        if (nbytes <= 0) {
+            hang_up(connection, nbytes == 0 ? 0 : errno);
+            break;
+        }
+        if (transport->channel != NULL) {
+            // one packet per ring slot
+            dispatch(connection, connection->input, nbytes);
+            replies++;
+            continue;
+        }
+        connection->input_length += nbytes;
+        split_input(connection);
+        if (kept_reply) {
+            // The reply the handshake kept is handled from the ready list, and the socket can
+            // report a hang-up right behind it in the same run. Left on the list, the hang-up waits
+            // until the caller has seen the reply.
+            mark_ready(connection);
+        }
+        // epoll reports the socket again if there is more
+        break;
+    }
+    if (!connection->closed && !flush_output(connection)) {
+        hang_up(connection, errno);
+    }
+    connection->dispatching = false;
+    // another event of this run may still point at it, so it is freed once the run is over
+    if (connection->closed) {
+        mark_ready(connection);
+    }
+}
+
+bool client_loop_init(ClientLoop *loop) {
+    loop->connection_count = 0;
+    loop->connections = NULL;
+    loop->ready = NULL;
+    loop->running = false;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return loop->epoll_fd >= 0;
+}
+
+static void free_closed_connections(ClientLoop *loop) {
+    ClientConnection **link = &loop->ready;
+    while (*link != NULL) {
+        ClientConnection *connection = *link;
+        if (!connection->closed) {
+            link = &connection->next_ready;
+            continue;
+        }
+        *link = connection->next_ready;
+        connection->ready = false;
+        free_connection(connection);
+    }
+}
+
+int client_loop_run(ClientLoop *loop, int timeout_ms) {
+    struct epoll_event events[CLIENT_EVENTS_PER_WAIT];
+    int processed = 0;
+
+    // connections that get ready again while these are handled wait for the next run
+    ClientConnection *ready = loop->ready;
+    loop->ready = NULL;
+    loop->running = true;
+    while (ready != NULL) {
+        ClientConnection *connection = ready;
+        ready = connection->next_ready;
+        connection->ready = false;
+        if (connection->closed) {
+            free_connection(connection);
+            continue;
+        }
+        process_connection(connection, 0);
+        processed++;
+        timeout_ms = 0;
+    }
+    loop->running = false;
+
+    int count = epoll_wait(loop->epoll_fd, events, CLIENT_EVENTS_PER_WAIT, timeout_ms);
+    if (count < 0) {
+        free_closed_connections(loop);
+        return errno == EINTR ? processed : -1;
+    }
+    loop->running = true;
+    for (int i = 0; i < count; i++) {
+        ClientConnection *connection = events[i].data.ptr;
+        // a shared-memory connection can report its socket and its eventfd in one run, and the
+        // first event may have left it closed or with a hang-up to report next run
+        if (!connection->ready) {
+            process_connection(connection, events[i].events);
+            processed++;
+        }
+    }
+    loop->running = false;
+    free_closed_connections(loop);
+    return processed;
+}
+
+void client_loop_close(ClientLoop *loop) {
+    loop->ready = NULL;
+    while (loop->connections != NULL) {
+        loop->connections->ready = false;
+        free_connection(loop->connections);
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    loop->epoll_fd = -1;
+}
+
+ClientConnection *client_connect(ClientLoop *loop, TransportKind kind, int player_number, const char *unix_dir,
+                                 ClientReplyHandler handler, void *context) {
+    ClientConnection *connection = malloc(sizeof(ClientConnection));
+    if (connection == NULL) {
+        return NULL;
+    }
+    memset(connection, 0, sizeof(ClientConnection));
+    connection->loop = loop;
+    connection->player_number = player_number;
+    connection->handler = handler;
+    connection->context = context;
+
+    if (!transport_connect(&connection->transport, kind, player_number, unix_dir)) {
+        int connect_errno = errno;
+        free(connection);
+        errno = connect_errno;
+        return NULL;
+    }
+
+    Transport *transport = &connection->transport;
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, transport->socket_fd, &event) < 0
+        || (transport->channel != NULL && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, transport->rx_eventfd, &event) < 0)) {
+        int epoll_errno = errno;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, transport->socket_fd, NULL);
+        transport_close(transport);
+        free(connection);
+        errno = epoll_errno;
+        return NULL;
+    }
+
+    connection->next = loop->connections;
+    connection->previous = NULL;
+    if (loop->connections != NULL) {
+        loop->connections->previous = connection;
+    }
+    loop->connections = connection;
+    loop->connection_count++;
+
+    if (transport->channel != NULL) {
+        connection->framing = CLIENT_FRAMED;
+    }
+    else {
+        connection->framing = CLIENT_FRAMING_PENDING;
+        queue_packet(connection, "P", 1, NULL, true);
+        flush_output(connection);
+    }
+    // the ring only wakes the loop once it has been looked at, and a reply the shared-memory
+    // handshake kept for later has no event coming either
+    if (transport->channel != NULL || transport->pending_length > 0) {
+        mark_ready(connection);
+    }
+    return connection;
+}
+
+bool client_send(ClientConnection *connection, const char *packet, void *tag) {
+    size_t length = strlen(packet);
+    if (connection->closed || connection->game_over || length == 0 || length >= SHM_RING_SLOT_SIZE || memchr(packet, '\n', length) != NULL) {
+        errno = EINVAL;
+        return false;
+    }
+    if (!queue_packet(connection, packet, length, tag, false)) {
+        return false;
+    }
+    // From inside a handler the flush waits until the replies of the current read are handled. A
+    // failed write is left to the loop, the socket reports the hang-up as well.
+    if (!connection->dispatching) {
+        flush_output(connection);
+    }
+    return true;
+}
+
+int client_outstanding(const ClientConnection *connection) {
+    // the library's 'P' can only be the oldest request
+    bool asked_for_framing = connection->request_count > 0 && connection->requests[connection->request_head].internal;
+    return connection->request_count - (asked_for_framing ? 1 : 0);
+}
+
+void client_close(ClientConnection *connection) {
+    connection->closed = true;
+    if (connection->dispatching || connection->loop->running) {
+        mark_ready(connection);
+        return;
+    }
+    free_connection(connection);
+}
@@ -0,0 +1,163 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "transport.h"
+
+// Client library for players and bots. One ClientLoop drives any number of connections from a
+// single thread with epoll, and each connection pipelines its requests: they are written as soon
+// as they are queued, and since the server answers every packet exactly once and in order, each
+// reply goes to the oldest request still waiting for one.
+//
+// A stream socket does not keep packets apart, so on TCP and Unix sockets the connection first
+// sends 'P'. A server that answers "A\n" reads newline-terminated packets from then on and ends
+// every reply with '\n'. A server that answers anything else gets one request at a time and every
+// read counts as one reply, which is all the old clients ever did. The shared-memory rings keep
+// packets apart already.
+//
+// An 'H' ends the game. It answers the oldest waiting request (or none, when the opponent forfeits
+// while nothing is waiting), and the requests queued behind it are dropped unanswered.
+//
+// Replies are parsed in place, nothing is allocated after client_connect().
+
+// requests a connection can have queued or waiting for a reply
+#define CLIENT_MAX_PIPELINE 32
+#define CLIENT_OUTPUT_SIZE 4096
+#define CLIENT_INPUT_SIZE 4096
+#define CLIENT_TOKEN_SIZE 17
+#define CLIENT_EVENTS_PER_WAIT 64
+
+// the type of the reply delivered once when a connection drops, with errno 0 if the server
+// closed it and the error otherwise; the connection is freed at the end of that run
+#define CLIENT_REPLY_CLOSED '\0'
+
+typedef enum ClientFraming {
+    // the 'P' is on its way, requests queued meanwhile wait for its answer
+    CLIENT_FRAMING_PENDING,
+    CLIENT_FRAMED,
+    CLIENT_UNFRAMED
+} ClientFraming;
+
+typedef struct ClientReply {
+    // the packet letter, 'A', 'E', 'H', 'R', 'G' or 'T', or CLIENT_REPLY_CLOSED
+    char type;
+    // false if the reply does not have the format its letter calls for
+    bool valid;
+    // E: the error code, H: 1 for a win and 0 for a loss
+    int code;
+    // R and G
+    int ships_remaining;
+    // R: 'H' or 'M'
+    char shot_result;
+    // G: the new cursor of a "Q <Cursor>" reply, -1 for a full history
+    int cursor;
+    // G: the number of complete shots, walk them from 'shots' with client_next_shot()
+    int shot_count;
+    const char *shots;
+    // T: the resume token
+    char token[CLIENT_TOKEN_SIZE];
+    // the whole reply, NUL-terminated, only valid until the handler returns
+    const char *text;
+    int length;
+    // the tag client_send() was given, NULL for a reply nobody asked for
+    void *tag;
+    bool unsolicited;
+    // from the moment the request was written to its reply
+    uint64_t round_trip_ns;
+} ClientReply;
+
+typedef struct ClientShot {
+    // 'H' or 'M'
+    char result;
+    int col;
+    int row;
+} ClientShot;
+
+typedef struct ClientLoop ClientLoop;
+typedef struct ClientConnection ClientConnection;
+
+typedef void (*ClientReplyHandler)(ClientConnection *connection, const ClientReply *reply);
+
+typedef struct ClientRequest {
+    void *tag;
+    uint64_t sent_ns;
+    // the library's own 'P', never shown to the handler unless it is answered by an 'H'
+    bool internal;
+    // a bare 'T', the only request a 'T' reply can answer, any other 'T' is the server's push
+    bool token;
+} ClientRequest;
+
+struct ClientConnection {
+    ClientLoop *loop;
+    Transport transport;
+    int player_number;
+    ClientFraming framing;
+    ClientReplyHandler handler;
+    // for the caller, the library never touches it
+    void *context;
+
+    // a ring of queued requests, the first 'in_flight' of them are written and wait for replies
+    ClientRequest requests[CLIENT_MAX_PIPELINE];
+    int request_head;
+    int request_count;
+    int in_flight;
+
+    // queued packets, each ending in '\n', and how much of them is written
+    char output[CLIENT_OUTPUT_SIZE];
+    int output_sent;
+    int output_length;
+    bool watching_output;
+
+    // received bytes not yet split into replies
+    char input[CLIENT_INPUT_SIZE];
+    int input_length;
+
+    bool game_over;
+    // set by client_close() from inside a run, the connection is freed once the run is over
+    bool closed;
+    bool dispatching;
+    bool ready;
+
+    ClientConnection *next;
+    ClientConnection *previous;
+    ClientConnection *next_ready;
+};
+
+struct ClientLoop {
+    int epoll_fd;
+    int connection_count;
+    ClientConnection *connections;
+    // connections with work that no fd will announce, handled by the next client_loop_run(), and
+    // closed ones waiting to be freed
+    ClientConnection *ready;
+    bool running;
+};
+
+bool client_loop_init(ClientLoop *loop);
+// Waits up to 'timeout_ms' (-1 for ever) for replies and room to write, and calls the handlers.
+// Returns the number of connections that had something to do, 0 on a timeout or signal, -1 on error.
+int client_loop_run(ClientLoop *loop, int timeout_ms);
+// closes every connection that is still open, without calling their handlers
+void client_loop_close(ClientLoop *loop);
+
+// Connects as player 1 or 2 and asks for framed packets. The connect itself, and the handshake
+// of a shared-memory channel, block: the server only reads player 1 once player 2 has connected,
+// so a process playing both seats over shared memory connects player 2 first.
+ClientConnection *client_connect(ClientLoop *loop, TransportKind kind, int player_number, const char *unix_dir,
+                                 ClientReplyHandler handler, void *context);
+// Queues one packet, without its newline, and writes it as soon as the framing allows. 'tag'
+// comes back with the reply. False, with nothing queued, when the pipeline or the output buffer
+// is full, the game is over or the connection is closed.
+bool client_send(ClientConnection *connection, const char *packet, void *tag);
+// the caller's requests that are queued or waiting for a reply
+int client_outstanding(const ClientConnection *connection);
+// Closes the connection and drops its requests. Safe to call from any handler.
+void client_close(ClientConnection *connection);
+
+// Parses one reply in place. 'text' must stay valid and NUL-terminated while 'reply' is used.
+void client_parse_reply(const char *text, int length, ClientReply *reply);
+// Reads the next shot of a G reply and moves 'position' past it, false after the last one.
+bool client_next_shot(const char **position, ClientShot *shot);
+
+#endif
@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cluster.h"
+
+#define CLUSTER_BACKLOG 16
+
+typedef struct ClusterMatchMessage {
+    uint32_t magic;
+    uint32_t match_id;
+} ClusterMatchMessage;
+
+static bool fill_address(struct sockaddr_un *address, const char *path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    return snprintf(address->sun_path, sizeof(address->sun_path), "%s", path) < (int)sizeof(address->sun_path);
+}
+
+int cluster_listen_backend(const char *path) {
+    struct sockaddr_un address;
+    if (!fill_address(&address, path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, CLUSTER_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int cluster_connect_backend(const char *path) {
+    struct sockaddr_un address;
+    if (!fill_address(&address, path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool cluster_send_match(int backend_fd, uint32_t match_id, int player1_fd, int player2_fd) {
+    ClusterMatchMessage match = { .magic = CLUSTER_MATCH_MAGIC, .match_id = match_id };
+    int fds[2] = { player1_fd, player2_fd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = &match, .iov_len = sizeof(match) };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(backend_fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t)sizeof(match);
+}
+
+int cluster_receive_match(int gateway_fd, uint32_t *match_id, int player_fds[2]) {
+    ClusterMatchMessage match;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { .iov_base = &match, .iov_len = sizeof(match) };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+
+    ssize_t received;
+    do {
+        received = recvmsg(gateway_fd, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received == 0) {
+        return 0;
+    }
+    if (received < 0) {
+        return -1;
+    }
+
+    // whatever fds came along are closed unless the message is a whole match
+    int fd_count = 0;
+    int fds[2] = { -1, -1 };
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (fd_count < 2) {
+                    fds[fd_count] = fd;
+                }
+                else {
+                    close(fd);
+                }
+                fd_count++;
+            }
+        }
+    }
+    if (received != (ssize_t)sizeof(match) || match.magic != CLUSTER_MATCH_MAGIC || fd_count != 2 || (message.msg_flags & MSG_CTRUNC)) {
+        for (int i = 0; i < 2; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        return -1;
+    }
+
+    *match_id = match.match_id;
+    player_fds[0] = fds[0];
+    player_fds[1] = fds[1];
+    return 1;
+}
@@ -0,0 +1,32 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local cluster mode. The gateway (build/gateway) owns the players' ports, pairs the connections
+// into matches and picks a backend for each match on a consistent-hash ring of match ids. A
+// backend is a server started with -B <dir>/<name>.backend: it listens on that SOCK_SEQPACKET
+// socket and forks one game process per match it is given. A match travels as one message,
+// CLUSTER_MATCH_MAGIC and the match id, with both players' connections attached as SCM_RIGHTS, so
+// the gateway is out of the data path as soon as the message is sent.
+//
+// Backends join by creating their socket in the gateway's directory and leave by closing it. A
+// game process holds its connections itself, so a backend that leaves or crashes takes none of
+// the games already running with it, and the ring only moves the match ids next to its points.
+
+#define CLUSTER_BACKEND_SUFFIX ".backend"
+#define CLUSTER_DEFAULT_BACKEND_DIR "/tmp/battleship-backends"
+#define CLUSTER_MATCH_MAGIC 0x484d5342u
+
+// binds and listens on a backend socket, replacing a file left behind by an earlier backend
+int cluster_listen_backend(const char *path);
+// connects the gateway to a backend, -1 if nobody listens on 'path'
+int cluster_connect_backend(const char *path);
+// Hands a match to a backend without blocking. False with errno EAGAIN when the backend is
+// behind, any other errno when it is gone. The caller still owns the player fds either way.
+bool cluster_send_match(int backend_fd, uint32_t match_id, int player1_fd, int player2_fd);
+// 1 with a match and both player fds, 0 when the gateway hung up, -1 on a malformed message
+int cluster_receive_match(int gateway_fd, uint32_t *match_id, int player_fds[2]);
+
+#endif
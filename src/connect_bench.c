@@ -0,0 +1,343 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "transport.h"
+
+// Connect-storm benchmark for the gateway (build/gateway with backends behind it). All clients
+// connect at once, alternating between the two seats, and each one sends its Begin packet as soon
+// as it is connected. A client is done at its first reply, which needs the gateway to have accepted
+// it, paired it and handed the match to a backend, and the game process to have read the packet.
+// The bench reports how many connections were answered per second and the time from connect() to
+// the first reply. Connections the kernel dropped from a full SYN or accept queue show up as a
+// p99 near one second or more, the client's first SYN retransmit, and in the host's TcpExt
+// counters, which the bench reads before and after the storm.
+//
+// Raise the gateway's -q and net.core.somaxconn to take bigger storms. -F connects with
+// TCP_FASTOPEN_CONNECT, so clients holding a cookie send their Begin with the SYN.
+
+#define BUFFER_SIZE 1024
+#define EVENTS_PER_WAIT 256
+#define DEFAULT_CLIENTS 2000
+#define DEFAULT_TIMEOUT_SECONDS 30
+
+typedef enum ClientState {
+    CLIENT_CONNECTING,
+    CLIENT_WAITING,
+    CLIENT_ANSWERED,
+    CLIENT_FAILED
+} ClientState;
+
+typedef struct BenchClient {
+    int fd;
+    int seat;
+    ClientState state;
+    long started_ns;
+    long answered_ns;
+} BenchClient;
+
+// the TcpExt counters of /proc/net/netstat a connect storm moves, for the whole host
+typedef struct ListenCounters {
+    long overflows;
+    long drops;
+    long syn_cookies;
+    long syn_drops;
+} ListenCounters;
+
+typedef struct BenchOptions {
+    TransportKind kind;
+    const char *unix_dir;
+    bool fast_open;
+} BenchOptions;
+
+long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+int compare_long(const void *left, const void *right) {
+    long l = *(const long *)left;
+    long r = *(const long *)right;
+    return (l > r) - (l < r);
+}
+
+// /proc/net/netstat holds a line of TcpExt names followed by a line of their values.
+bool read_listen_counters(ListenCounters *counters) {
+    FILE *file = fopen("/proc/net/netstat", "r");
+    if (file == NULL) {
+        return false;
+    }
+    static char names[8192];
+    static char values[8192];
+    bool found = false;
+    while (!found && fgets(names, sizeof(names), file) != NULL && fgets(values, sizeof(values), file) != NULL) {
+        if (strncmp(names, "TcpExt:", 7) != 0) {
+            continue;
+        }
+        found = true;
+        char *name_state;
+        char *value_state;
+        char *name = strtok_r(names, " \n", &name_state);
+        char *value = strtok_r(values, " \n", &value_state);
+        while (name != NULL && value != NULL) {
+            long number = atol(value);
+            if (strcmp(name, "ListenOverflows") == 0) {
+                counters->overflows = number;
+            }
+            else if (strcmp(name, "ListenDrops") == 0) {
+                counters->drops = number;
+            }
+            else if (strcmp(name, "TCPReqQFullDoCookies") == 0) {
+                counters->syn_cookies = number;
+            }
+            else if (strcmp(name, "TCPReqQFullDrop") == 0) {
+                counters->syn_drops = number;
+            }
+            name = strtok_r(NULL, " \n", &name_state);
+            value = strtok_r(NULL, " \n", &value_state);
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+// Starts a nonblocking connect. Returns the fd, or -1 with errno EAGAIN when a Unix listener's
+// backlog is full and the connect has to be tried again.
+int start_connect(const BenchOptions *options, int seat) {
+    int port = seat == 0 ? TRANSPORT_PORT_PLAYER01 : TRANSPORT_PORT_PLAYER02;
+    int fd;
+    int result;
+
+    if (options->kind == TRANSPORT_TCP) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        int enable = 1;
+        if (options->fast_open) {
+            setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable, sizeof(enable));
+        }
+        struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(port) };
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        result = connect(fd, (struct sockaddr *)&address, sizeof(address));
+    }
+    else {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        struct sockaddr_un address = { .sun_family = AF_UNIX };
+        snprintf(address.sun_path, sizeof(address.sun_path), TRANSPORT_UNIX_PATH_FORMAT, options->unix_dir, port);
+        result = connect(fd, (struct sockaddr *)&address, sizeof(address));
+    }
+
+    if (result < 0 && errno != EINPROGRESS) {
+        int connect_errno = errno;
+        close(fd);
+        errno = connect_errno;
+        return -1;
+    }
+    return fd;
+}
+
+void fail_client(BenchClient *client, int *failures) {
+    close(client->fd);
+    client->fd = -1;
+    client->state = CLIENT_FAILED;
+    (*failures)++;
+}
+
+// Connected: the Begin packet goes out and the client waits for the reply.
+void send_begin(int epoll_fd, BenchClient *client, int *failures) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        fail_client(client, failures);
+        return;
+    }
+    const char *packet = client->seat == 0 ? "B 10 10" : "B";
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = client };
+    if (send(client->fd, packet, strlen(packet), MSG_NOSIGNAL) != (ssize_t)strlen(packet)
+        || epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event) < 0) {
+        fail_client(client, failures);
+        return;
+    }
+    client->state = CLIENT_WAITING;
+}
+
+void read_reply(BenchClient *client, int *answered, int *failures) {
+    char buffer[BUFFER_SIZE];
+    ssize_t nbytes = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (nbytes < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (nbytes <= 0) {
+        fail_client(client, failures);
+        return;
+    }
+    client->answered_ns = monotonic_ns();
+    client->state = CLIENT_ANSWERED;
+    // the game ends on the hang-up, its opponent gets an H if it was still waiting
+    close(client->fd);
+    client->fd = -1;
+    (*answered)++;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = { .kind = TRANSPORT_TCP, .unix_dir = TRANSPORT_DEFAULT_UNIX_DIR, .fast_open = false };
+    int count = DEFAULT_CLIENTS;
+    int timeout_seconds = DEFAULT_TIMEOUT_SECONDS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "T:d:n:t:F")) != -1) {
+        switch (opt) {
+            case 'T':
+                if (!parse_transport_kind(optarg, &options.kind) || options.kind == TRANSPORT_SHM) {
+                    fprintf(stderr, "[Bench] - [ERROR] Unknown transport '%s', expected tcp or unix.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                options.unix_dir = optarg;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 't':
+                timeout_seconds = atoi(optarg);
+                break;
+            case 'F':
+                options.fast_open = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-T tcp|unix] [-d unix_socket_dir] [-n clients] [-t timeout_seconds] [-F]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (count < 2) {
+        count = 2;
+    }
+    if (timeout_seconds < 1) {
+        timeout_seconds = 1;
+    }
+
+    // one fd per client, plus a few for stdio and epoll
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)count + 16) {
+        limit.rlim_cur = limit.rlim_max < (rlim_t)count + 16 ? limit.rlim_max : (rlim_t)count + 16;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < (rlim_t)count + 16) {
+            fprintf(stderr, "[Bench] - [ERROR] %d clients need %d fds, the limit is %ld.\n", count, count + 16, (long)limit.rlim_cur);
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchClient *clients = calloc(count, sizeof(BenchClient));
+    long *samples = malloc(count * sizeof(long));
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (clients == NULL || samples == NULL || epoll_fd < 0) {
+        fprintf(stderr, "[Bench] - [ERROR] Could not set up %d clients.\n", count);
+        return EXIT_FAILURE;
+    }
+
+    int started = 0;
+    int answered = 0;
+    int failures = 0;
+    int connect_retries = 0;
+    ListenCounters counters_before = {0};
+    ListenCounters counters_after = {0};
+    bool have_counters = options.kind == TRANSPORT_TCP && read_listen_counters(&counters_before);
+    long bench_started_ns = monotonic_ns();
+    long deadline_ns = bench_started_ns + timeout_seconds * 1000000000L;
+
+    while (answered + failures < count && monotonic_ns() < deadline_ns) {
+        // every client that is not connecting yet tries now, a full Unix backlog is tried again next round
+        while (started < count) {
+            BenchClient *client = &clients[started];
+            client->seat = started % 2;
+            client->started_ns = monotonic_ns();
+            client->fd = start_connect(&options, client->seat);
+            if (client->fd < 0 && errno == EAGAIN) {
+                connect_retries++;
+                break;
+            }
+            started++;
+            struct epoll_event event = { .events = EPOLLOUT, .data.ptr = client };
+            if (client->fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event) < 0) {
+                if (client->fd >= 0) {
+                    close(client->fd);
+                }
+                client->fd = -1;
+                client->state = CLIENT_FAILED;
+                failures++;
+                continue;
+            }
+            client->state = CLIENT_CONNECTING;
+        }
+
+        struct epoll_event events[EVENTS_PER_WAIT];
+        int ready = epoll_wait(epoll_fd, events, EVENTS_PER_WAIT, started < count ? 1 : 100);
+        for (int i = 0; i < ready; i++) {
+            BenchClient *client = events[i].data.ptr;
+            if (client->state == CLIENT_CONNECTING) {
+                send_begin(epoll_fd, client, &failures);
+            }
+            else if (client->state == CLIENT_WAITING) {
+                read_reply(client, &answered, &failures);
+            }
+        }
+    }
+    long bench_ended_ns = monotonic_ns();
+    have_counters = have_counters && read_listen_counters(&counters_after);
+
+    int sample_count = 0;
+    long last_answer_ns = bench_started_ns;
+    int unanswered = 0;
+    for (int i = 0; i < count; i++) {
+        if (clients[i].state == CLIENT_ANSWERED) {
+            samples[sample_count++] = clients[i].answered_ns - clients[i].started_ns;
+            if (clients[i].answered_ns > last_answer_ns) {
+                last_answer_ns = clients[i].answered_ns;
+            }
+        }
+        else if (clients[i].state != CLIENT_FAILED) {
+            unanswered++;
+        }
+        if (clients[i].fd >= 0) {
+            close(clients[i].fd);
+        }
+    }
+    close(epoll_fd);
+
+    printf("[Bench] - [INFO] %d clients over %s%s in %.3f s: %d answered, %d failed, %d still waiting at the end, %d connects retried.\n",
+           count, transport_kind_name(options.kind), options.fast_open ? " with TCP_FASTOPEN_CONNECT" : "",
+           (bench_ended_ns - bench_started_ns) / 1e9, answered, failures, unanswered, connect_retries);
+    if (sample_count > 0) {
+        qsort(samples, sample_count, sizeof(long), compare_long);
+        double seconds = (last_answer_ns - bench_started_ns) / 1e9;
+        printf("[Bench] - [INFO] %.0f connections answered per second.\n", seconds > 0 ? sample_count / seconds : 0.0);
+        printf("[Bench] - [INFO] time to first response: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               samples[sample_count / 2] / 1e6, samples[(int)(sample_count * 0.9)] / 1e6,
+               samples[(int)(sample_count * 0.99)] / 1e6, samples[sample_count - 1] / 1e6);
+    }
+    if (have_counters) {
+        printf("[Bench] - [INFO] host TCP during the storm: %ld accept queue overflows, %ld listen drops, %ld SYN queue overflows answered with cookies, %ld dropped.\n",
+               counters_after.overflows - counters_before.overflows, counters_after.drops - counters_before.drops,
+               counters_after.syn_cookies - counters_before.syn_cookies, counters_after.syn_drops - counters_before.syn_drops);
+    }
+
+    free(samples);
+    free(clients);
+    return answered == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,89 @@
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include "cpu_budget.h"
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void refill(CpuBudget *budget) {
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    budget->tokens += (now - budget->last_refill_ns) / 1e9 * budget->rate;
+    if (budget->tokens > budget->burst) {
+        budget->tokens = budget->burst;
+    }
+    budget->last_refill_ns = now;
+}
+
+static void charge(CpuBudget *budget, uint64_t now_cpu_ns) {
+    uint64_t used = now_cpu_ns - budget->slice_started_ns;
+    budget->spent_ns += used;
+    budget->slices++;
+    if (budget->rate > 0) {
+        refill(budget);
+        budget->tokens -= used;
+    }
+}
+
+// sleeps off a debt, the budget is back at zero afterwards
+static void throttle(CpuBudget *budget) {
+    if (budget->rate <= 0) {
+        return;
+    }
+    refill(budget);
+    if (budget->tokens >= 0) {
+        return;
+    }
+
+    uint64_t wait_ns = (uint64_t)(-budget->tokens / budget->rate * 1e9);
+    struct timespec wait = { .tv_sec = wait_ns / 1000000000ULL, .tv_nsec = wait_ns % 1000000000ULL };
+    while (nanosleep(&wait, &wait) != 0 && errno == EINTR) {
+    }
+    budget->throttled_ns += wait_ns;
+    refill(budget);
+}
+
+void init_cpu_budget(CpuBudget *budget, double ms_per_second, double burst_ms, long slice_us) {
+    budget->rate = ms_per_second * 1e6;
+    budget->burst = burst_ms * 1e6;
+    budget->tokens = budget->burst;
+    budget->last_refill_ns = clock_ns(CLOCK_MONOTONIC);
+    budget->slice_ns = (uint64_t)slice_us * 1000;
+    budget->slice_started_ns = 0;
+    budget->pending_units = 0;
+    budget->spent_ns = 0;
+    budget->slices = 0;
+    budget->throttled_ns = 0;
+}
+
+void cpu_budget_begin(CpuBudget *budget) {
+    throttle(budget);
+    budget->pending_units = 0;
+    budget->slice_started_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void cpu_budget_progress(CpuBudget *budget, long units) {
+    budget->pending_units += units;
+    if (budget->pending_units < CPU_BUDGET_CHECK_UNITS) {
+        return;
+    }
+    budget->pending_units = 0;
+
+    uint64_t now = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if (now - budget->slice_started_ns < budget->slice_ns) {
+        return;
+    }
+    charge(budget, now);
+    // lets every other runnable game on this core take a turn before the next slice
+    sched_yield();
+    throttle(budget);
+    budget->slice_started_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void cpu_budget_end(CpuBudget *budget) {
+    charge(budget, clock_ns(CLOCK_THREAD_CPUTIME_ID));
+    budget->slice_started_ns = 0;
+}
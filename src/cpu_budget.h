@@ -0,0 +1,40 @@
+#ifndef CPU_BUDGET_H
+#define CPU_BUDGET_H
+
+#include <stdint.h>
+
+// Cooperative slicing of expensive per-game work. Every server process runs one game, so the
+// loop all games share is the host's CPU scheduler, and a game busy printing or scanning a huge
+// board keeps its core from every game queued behind it. Long loops report their progress with
+// cpu_budget_progress(). Every CPU_BUDGET_CHECK_UNITS units it reads the thread's CPU clock,
+// yields the core once the running slice is used up and, once the game has spent its CPU budget,
+// sleeps until the budget refills. Only the game doing the expensive work waits for it, and
+// small boards never get as far as reading the clock.
+
+// cells between two looks at the CPU clock, about a few microseconds of work
+#define CPU_BUDGET_CHECK_UNITS 4096
+
+typedef struct CpuBudget {
+    // CPU nanoseconds the game may spend per second and may save up, a rate of 0 disables the budget
+    double rate;
+    double burst;
+    double tokens;
+    uint64_t last_refill_ns;
+    // CPU nanoseconds a slice runs before the core is yielded
+    uint64_t slice_ns;
+    // thread CPU time when the running slice started, 0 outside cpu_budget_begin() / cpu_budget_end()
+    uint64_t slice_started_ns;
+    long pending_units;
+    uint64_t spent_ns;
+    uint64_t slices;
+    uint64_t throttled_ns;
+} CpuBudget;
+
+void init_cpu_budget(CpuBudget *budget, double ms_per_second, double burst_ms, long slice_us);
+// starts an expensive operation, waiting first if the game is over its budget
+void cpu_budget_begin(CpuBudget *budget);
+// 'units' more cells done, may yield the core or sleep
+void cpu_budget_progress(CpuBudget *budget, long units);
+void cpu_budget_end(CpuBudget *budget);
+
+#endif
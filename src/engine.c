@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "memory_account.h"
+#include "rules.h"
+
+size_t board_memory_bytes(int width, int height) {
+    if (width <= 0 || height <= 0 || (size_t)width > SIZE_MAX / 2 / sizeof(int) / (size_t)height) {
+        return 0;
+    }
+    // cells and shot log, one int each per cell
+    return sizeof(Board) + (size_t)width * height * 2 * sizeof(int);
+}
+
+// log entries go up to width * height * 2 - 1
+static int packed_shot_bytes(const Board *board) {
+    size_t largest = (size_t)board->width * board->height * 2;
+    int bytes = 1;
+    while (bytes < (int)sizeof(int) && largest > ((size_t)1 << (8 * bytes))) {
+        bytes++;
+    }
+    return bytes;
+}
+
+// never 0, so the packed log is a real block even before the first shot
+static size_t packed_shot_log_bytes(const Board *board) {
+    size_t bytes = (size_t)board->shot_count * packed_shot_bytes(board);
+    return bytes > 0 ? bytes : 1;
+}
+
+Board* create_board(const RuleSet *rules, int width, int height, MemoryAccount *account) {
+    if (rules == NULL || board_memory_bytes(width, height) == 0) {
+        return NULL;
+    }
+
+    Board* board = malloc(sizeof(Board));
+    if (board == NULL) {
+        return NULL;
+    }
+
+    board->rules = rules;
+    board->account = account;
+    board->width = width;
+    board->height = height;
+    board->packed = NULL;
+    board->packed_size = 0;
+    board->packed_shot_log = NULL;
+    board->packed_shot_log_size = 0;
+    board->cells = calloc((size_t)width * height, sizeof(int));
+    board->shot_log = malloc((size_t)width * height * sizeof(int));
+
+    if (board->cells == NULL || board->shot_log == NULL) {
+        free(board->cells);
+        free(board->shot_log);
+        free(board);
+        return NULL;
+    }
+
+    reset_board(board);
+    return board;
+}
+
+bool delete_board(Board *board) {
+    if (board == NULL) {
+        return false;
+    }
+
+    size_t cell_count = (size_t)board->width * board->height;
+    memory_free(board->account, board->cells, cell_count * sizeof(int));
+    memory_free(board->account, board->packed, board->packed_size);
+    memory_free(board->account, board->shot_log, cell_count * sizeof(int));
+    memory_free(board->account, board->packed_shot_log, board->packed_shot_log_size);
+    memory_free(board->account, board, sizeof(Board));
+
+    return true;
+}
+
+// clears a board for another game of the same size without reallocating it
+void reset_board(Board *board) {
+    if (board->cells != NULL) {
+        memset(board->cells, 0, (size_t)board->width * board->height * sizeof(int));
+    }
+    board->pieces_remaining = board->rules->fleet_size;
+    board->initialized = false;
+    board->shot_count = 0;
+    for (int i = 0; i <= board->rules->fleet_size; i++) {
+        board->ship_cells_remaining[i] = i == 0 ? 0 : board->rules->cells_per_piece;
+    }
+}
+
+bool is_valid_board_size(const RuleSet *rules, int width, int height) {
+    if (width < rules->min_board_size || height < rules->min_board_size) {
+        return false;
+    }
+    // not enough for the fleet to fit, but a board with fewer cells never can
+    if ((long long)width * height < (long long)rules->fleet_size * rules->cells_per_piece) {
+        return false;
+    }
+    return rules->max_board_size == 0 || (width <= rules->max_board_size && height <= rules->max_board_size);
+}
+
+bool is_position_out_of_bounds_on_board(const Board *board, int piece_row_idx, int piece_col_idx, int new_row_offset, int new_col_offset) {
+    if (board == NULL) {
+        return true;
+    }
+
+    // negative anchors are out of bounds even if an offset would bring them back on the board
+    if (piece_row_idx < 0 || piece_col_idx < 0) {
+        return true;
+    }
+
+    int new_row_idx = piece_row_idx + new_row_offset;
+    int new_col_idx = piece_col_idx + new_col_offset;
+
+    return !(new_row_idx >= 0 && new_col_idx >= 0 && new_row_idx < board->height && new_col_idx < board->width);
+}
+
+// The checks themselves live in rules.c, specialized per built-in rule set.
+EngineResult check_piece_types(const Board *board, const Piece *pieces) {
+    return board->rules->check_types(board->rules, board, pieces);
+}
+
+EngineResult check_piece_rotations(const Board *board, const Piece *pieces) {
+    return board->rules->check_rotations(board->rules, board, pieces);
+}
+
+// types and rotations must already be in range
+EngineResult check_pieces_fit(const Board *board, const Piece *pieces) {
+    return board->rules->check_fit(board->rules, board, pieces);
+}
+
+EngineResult check_pieces_overlap(const Board *board, const Piece *pieces) {
+    return board->rules->check_overlap(board->rules, board, pieces);
+}
+
+EngineResult validate_pieces(const Board *board, const Piece *pieces) {
+    return board->rules->validate(board->rules, board, pieces);
+}
+
+void fill_board_with_pieces(Board *board, const Piece *pieces) {
+    board->rules->fill(board->rules, board, pieces);
+    board->initialized = true;
+}
+
+bool try_place_piece(Board *board, const Piece *piece, int piece_number) {
+    return board->rules->place_piece(board->rules, board, piece, piece_number);
+}
+
+EngineResult check_shot(const Board *target, int row, int col) {
+    if (is_position_out_of_bounds_on_board(target, row, col, 0, 0)) {
+        return ENGINE_CELL_OUT_OF_BOUNDS;
+    }
+    if (target->cells[row * target->width + col] < 0) {
+        return ENGINE_CELL_ALREADY_GUESSED;
+    }
+    return ENGINE_OK;
+}
+
+EngineResult resolve_shot(Board *target, int row, int col, char *hit_or_miss) {
+    EngineResult result = check_shot(target, row, col);
+    if (result != ENGINE_OK) {
+        return result;
+    }
+
+    int *cell = &target->cells[row * target->width + col];
+    bool hit = *cell > 0;
+    if (hit) {
+        if (--target->ship_cells_remaining[*cell] == 0) {
+            target->pieces_remaining--;
+        }
+        *cell = CELL_HIT;
+        *hit_or_miss = 'H';
+    }
+    else {
+        *cell = CELL_MISS;
+        *hit_or_miss = 'M';
+    }
+
+    // a cell can only be shot once, so the log never outgrows width * height entries
+    target->shot_log[target->shot_count++] = (row * target->width + col) * 2 + (hit ? 1 : 0);
+    return ENGINE_OK;
+}
+
+int get_logged_shot_entry(const Board *board, int index) {
+    if (board->packed_shot_log == NULL) {
+        return board->shot_log[index];
+    }
+    int bytes = packed_shot_bytes(board);
+    const unsigned char *packed = board->packed_shot_log + (size_t)index * bytes;
+    int entry = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        entry = (entry << 8) | packed[i];
+    }
+    return entry;
+}
+
+void get_logged_shot(const Board *board, int index, int *row, int *col, char *hit_or_miss) {
+    int entry = get_logged_shot_entry(board, index);
+    int cell = entry / 2;
+
+    *row = cell / board->width;
+    *col = cell % board->width;
+    *hit_or_miss = (entry & 1) ? 'H' : 'M';
+}
+
+int remaining_pieces_on_board(const Board *board) {
+    if (board == NULL) {
+        return -1;
+    }
+    return board->pieces_remaining;
+}
+
+bool pack_board(Board *board) {
+    if (board == NULL || board->cells == NULL || board->shot_log == NULL) {
+        return false;
+    }
+
+    size_t cell_count = (size_t)board->width * board->height;
+    int shot_bytes = packed_shot_bytes(board);
+
+    // byte i only overlaps ints up to i, which have been read by then
+    signed char *packed = (signed char *)board->cells;
+    for (size_t i = 0; i < cell_count; i++) {
+        packed[i] = (signed char)board->cells[i];
+    }
+    // entry i only overlaps ints up to i as well, the widest entry is as wide as an int
+    unsigned char *packed_shots = (unsigned char *)board->shot_log;
+    for (int i = 0; i < board->shot_count; i++) {
+        int entry = board->shot_log[i];
+        for (int b = 0; b < shot_bytes; b++) {
+            packed_shots[(size_t)i * shot_bytes + b] = (unsigned char)(entry >> (8 * b));
+        }
+    }
+
+    board->cells = NULL;
+    board->shot_log = NULL;
+    board->packed = packed;
+    board->packed_size = cell_count * sizeof(int);
+    board->packed_shot_log = packed_shots;
+    board->packed_shot_log_size = cell_count * sizeof(int);
+    // a shrinking realloc() that fails leaves the block as it was, still holding the packed data,
+    // and the account keeps all of it
+    signed char *shrunk = realloc(packed, cell_count);
+    if (shrunk != NULL) {
+        board->packed = shrunk;
+        board->packed_size = cell_count;
+        memory_release(board->account, cell_count * sizeof(int) - cell_count);
+    }
+    unsigned char *shrunk_shots = realloc(packed_shots, packed_shot_log_bytes(board));
+    if (shrunk_shots != NULL) {
+        board->packed_shot_log = shrunk_shots;
+        board->packed_shot_log_size = packed_shot_log_bytes(board);
+        memory_release(board->account, cell_count * sizeof(int) - board->packed_shot_log_size);
+    }
+    return true;
+}
+
+bool unpack_board(Board *board) {
+    if (board == NULL || board->packed == NULL || board->packed_shot_log == NULL) {
+        return false;
+    }
+
+    size_t cell_count = (size_t)board->width * board->height;
+    size_t growth = (cell_count * sizeof(int) - board->packed_size) + (cell_count * sizeof(int) - board->packed_shot_log_size);
+    if (!memory_reserve(board->account, growth)) {
+        return false;
+    }
+
+    // a growing realloc() keeps the packed data, or fails and leaves the block as it was
+    unsigned char *shot_block = realloc(board->packed_shot_log, cell_count * sizeof(int));
+    if (shot_block == NULL) {
+        memory_release(board->account, growth);
+        return false;
+    }
+    board->packed_shot_log = shot_block;
+    signed char *cell_block = realloc(board->packed, cell_count * sizeof(int));
+    if (cell_block == NULL) {
+        // the log block stays grown and packed, delete_board() releases what the account knows of it
+        memory_release(board->account, growth);
+        return false;
+    }
+
+    // widened from the end, int i only overlaps bytes from i on, which have been read by then
+    int *cells = (int *)cell_block;
+    for (size_t i = cell_count; i-- > 0;) {
+        signed char cell = cell_block[i];
+        cells[i] = cell;
+    }
+    int *shot_log = (int *)shot_block;
+    for (int i = board->shot_count - 1; i >= 0; i--) {
+        int entry = get_logged_shot_entry(board, i);
+        shot_log[i] = entry;
+    }
+
+    board->packed = NULL;
+    board->packed_size = 0;
+    board->packed_shot_log = NULL;
+    board->packed_shot_log_size = 0;
+    board->cells = cells;
+    board->shot_log = shot_log;
+    return true;
+}
@@ -0,0 +1,117 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Battleship rules with no sockets, no logging and no global state. Every function only touches
+// the boards and pieces it is handed, so any number of games can run side by side on any thread.
+
+// Fleet sizes, shapes and board limits come from the board's rule set (rules.h). These are only
+// the upper bounds every rule set has to fit in.
+#define MAX_FLEET_SIZE 16
+#define MAX_CELLS_PER_PIECE 8
+
+// cell values: 0 is water, 1 to the fleet size is the ship occupying the cell
+#define CELL_EMPTY 0
+#define CELL_MISS -1
+#define CELL_HIT -2
+
+// results line up with the protocol error codes so the server can send them as "E <code>"
+typedef enum EngineResult {
+    ENGINE_OK = 0,
+    ENGINE_SHAPE_OUT_OF_RANGE = 300,
+    ENGINE_ROTATION_OUT_OF_RANGE = 301,
+    ENGINE_SHIP_DOES_NOT_FIT = 302,
+    ENGINE_SHIPS_OVERLAP = 303,
+    ENGINE_CELL_OUT_OF_BOUNDS = 400,
+    ENGINE_CELL_ALREADY_GUESSED = 401
+} EngineResult;
+
+struct RuleSet;
+struct MemoryAccount;
+
+typedef struct Board {
+    // fleet, shapes and size limits, must outlive the board
+    const struct RuleSet *rules;
+    // quota the board's memory counts against, NULL if untracked
+    struct MemoryAccount *account;
+    int pieces_remaining;
+    bool initialized;
+    int width;
+    int height;
+    // row-major, width * height cells
+    int *cells;
+    // one byte per cell while the owning player is detached, NULL otherwise
+    signed char *packed;
+    // what the account holds for 'packed', still the unpacked size if the shrinking realloc() failed
+    size_t packed_size;
+    // unhit cells left per ship, index 0 unused
+    int ship_cells_remaining[MAX_FLEET_SIZE + 1];
+    // shots taken at this board in order, shot i has sequence number i + 1 and is stored as
+    // (row * width + col) * 2 + 1 for a hit, + 0 for a miss. Room for one shot per cell.
+    int *shot_log;
+    int shot_count;
+    // the shot log while the owning player is detached, shot_count entries of
+    // packed_shot_bytes() bytes each, NULL otherwise
+    unsigned char *packed_shot_log;
+    // what the account holds for 'packed_shot_log', like packed_size
+    size_t packed_shot_log_size;
+} Board;
+
+// format: <Piece_type Piece_rotation Piece_column Piece_row>
+typedef struct Piece {
+    // ranges from 1 to the rule set's shape count
+    int type;
+    // ranges from 1 to the rule set's rotation count
+    int rotation;
+    int row;
+    int col;
+} Piece;
+
+// Bytes create_board() allocates for a width x height board, 0 if the size cannot be represented.
+size_t board_memory_bytes(int width, int height);
+// width is the number of cols, and height is number of rows. The caller reserves
+// board_memory_bytes() on 'account' first, so a board over quota is refused before anything is
+// allocated, and keeps that reservation if creation fails. From then on the board charges its own
+// repacking to 'account' and delete_board() gives everything back.
+Board* create_board(const struct RuleSet *rules, int width, int height, struct MemoryAccount *account);
+bool delete_board(Board *board);
+void reset_board(Board *board);
+bool is_valid_board_size(const struct RuleSet *rules, int width, int height);
+
+bool is_position_out_of_bounds_on_board(const Board *board, int row, int col, int row_offset, int col_offset);
+
+// Initialize checks, each looks at a whole fleet of the board's rule set. validate_pieces() runs
+// them in order so the lowest error code wins, the individual checks are exposed for callers
+// that want to time or report them one by one.
+EngineResult check_piece_types(const Board *board, const Piece *pieces);
+EngineResult check_piece_rotations(const Board *board, const Piece *pieces);
+EngineResult check_pieces_fit(const Board *board, const Piece *pieces);
+EngineResult check_pieces_overlap(const Board *board, const Piece *pieces);
+EngineResult validate_pieces(const Board *board, const Piece *pieces);
+
+// pieces must have passed validate_pieces()
+void fill_board_with_pieces(Board *board, const Piece *pieces);
+// draws a single piece as ship 'piece_number' if it is in range, fits and only covers water,
+// lets callers build a fleet one piece at a time without revalidating the earlier ones
+bool try_place_piece(Board *board, const Piece *piece, int piece_number);
+
+// E 400 / E 401 checks for a shot without touching the board
+EngineResult check_shot(const Board *target, int row, int col);
+// marks the shot on the target board, 'hit_or_miss' receives 'H' or 'M' on ENGINE_OK
+EngineResult resolve_shot(Board *target, int row, int col, char *hit_or_miss);
+int remaining_pieces_on_board(const Board *board);
+// reads shot 'index' (0 based) of the log back as a cell and 'H' or 'M'
+void get_logged_shot(const Board *board, int index, int *row, int *col, char *hit_or_miss);
+// the raw log entry of shot 'index', whether the log is packed or not
+int get_logged_shot_entry(const Board *board, int index);
+
+// Detached boards are stored at one byte per cell, cells only hold CELL_HIT to MAX_FLEET_SIZE,
+// and the shot log keeps only the shots taken, each in as few bytes as the board size allows.
+// Both are narrowed in place and then shrunk, so packing never needs more memory than the board
+// already holds and cannot fail on the quota. Unpacking grows them back and can.
+bool pack_board(Board *board);
+bool unpack_board(Board *board);
+
+#endif
@@ -0,0 +1,633 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "cluster.h"
+#include "transport.h"
+
+// Front door of a local cluster. The gateway listens on the players' ports, pairs the oldest
+// waiting player 1 with the oldest waiting player 2 into a match, numbers it, and hands both
+// connections to the backend that owns the match id on a consistent-hash ring. Each backend has
+// 'virtual_nodes' points on the ring, so one joining or leaving only moves the ids next to its own
+// points, about 1/n of them. Backends are servers started with -B <backend_dir>/<name>.backend. The
+// directory is scanned every second for new ones, and a backend whose socket hangs up leaves the
+// ring at once. A backend that is behind on its messages gets the match's next backend on the ring.
+//
+// A connect storm is taken in batches: each listener that epoll reports gets up to
+// GATEWAY_ACCEPT_BATCH accepts before the next one is served, so both seats fill at the same pace
+// and the players are paired between batches. The TCP listeners defer the accept until the first
+// packet is in (TCP_DEFER_ACCEPT), so clients that never send one never take a place in the queue.
+//
+//   ./build/gateway [-d backend_dir] [-u unix_socket_dir] [-v virtual_nodes] [-q listen_backlog]
+
+#define GATEWAY_ACCEPT_BATCH 64
+#define GATEWAY_DEFER_ACCEPT_SECONDS 5
+#define GATEWAY_MAX_BACKENDS 64
+#define GATEWAY_MAX_WAITING 4096
+#define GATEWAY_DEFAULT_VIRTUAL_NODES 128
+#define GATEWAY_MAX_VIRTUAL_NODES 1024
+#define GATEWAY_RESCAN_MS 1000
+#define GATEWAY_EVENTS_PER_WAIT 64
+
+// every struct an epoll event points at starts with its kind
+typedef enum GatewayEntryKind {
+    GATEWAY_LISTENER,
+    GATEWAY_WAITING_PLAYER,
+    GATEWAY_BACKEND
+} GatewayEntryKind;
+
+typedef struct Listener {
+    GatewayEntryKind kind;
+    int fd;
+    // 0 for player 1, 1 for player 2
+    int seat;
+    char unix_path[PATH_MAX];
+} Listener;
+
+typedef struct WaitingPlayer {
+    GatewayEntryKind kind;
+    int fd;
+    int seat;
+    struct WaitingPlayer *next;
+    struct WaitingPlayer *previous;
+} WaitingPlayer;
+
+typedef struct Backend {
+    GatewayEntryKind kind;
+    // -1 for a free slot
+    int fd;
+    char name[NAME_MAX + 1];
+    long matches;
+} Backend;
+
+typedef struct RingPoint {
+    uint64_t hash;
+    int backend;
+} RingPoint;
+
+typedef struct Gateway {
+    int epoll_fd;
+    const char *backend_dir;
+    int virtual_nodes;
+    int listen_backlog;
+    Listener listeners[4];
+    int listener_count;
+    // per seat, oldest first
+    WaitingPlayer *waiting_head[2];
+    WaitingPlayer *waiting_tail[2];
+    int waiting_count[2];
+    Backend backends[GATEWAY_MAX_BACKENDS];
+    int backend_count;
+    RingPoint *ring;
+    int ring_size;
+    uint32_t last_match_id;
+    long matches_routed;
+} Gateway;
+
+volatile sig_atomic_t gateway_stopping = 0;
+
+void gateway_info(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("[Gateway] - [INFO] ");
+    vprintf(format, args);
+    printf("\n");
+    fflush(stdout);
+    va_end(args);
+}
+
+void gateway_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[Gateway] - [ERROR] ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+void stop_gateway(int signal_number) {
+    (void)signal_number;
+    gateway_stopping = 1;
+}
+
+long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+// ---------------------------------------------------------------- ring
+
+// splitmix64's finalizer, spreads sequential match ids over the whole ring
+uint64_t mix_hash(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+uint64_t hash_text(const char *text) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *text != '\0'; text++) {
+        hash = (hash ^ (unsigned char)*text) * 0x100000001b3ull;
+    }
+    return mix_hash(hash);
+}
+
+int compare_ring_points(const void *left, const void *right) {
+    const RingPoint *l = left;
+    const RingPoint *r = right;
+    if (l->hash != r->hash) {
+        return l->hash < r->hash ? -1 : 1;
+    }
+    return l->backend - r->backend;
+}
+
+// A backend's points only depend on its name, so one that restarts under the same name gets the
+// same share of the ids back.
+bool rebuild_ring(Gateway *gateway) {
+    RingPoint *ring = NULL;
+    int size = gateway->backend_count * gateway->virtual_nodes;
+    if (size > 0 && (ring = malloc(size * sizeof(RingPoint))) == NULL) {
+        gateway_error("Out of memory for a ring of %d points.", size);
+        return false;
+    }
+
+    int point = 0;
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; i++) {
+        if (gateway->backends[i].fd < 0) {
+            continue;
+        }
+        for (int node = 0; node < gateway->virtual_nodes; node++) {
+            char key[NAME_MAX + 16];
+            snprintf(key, sizeof(key), "%s#%d", gateway->backends[i].name, node);
+            ring[point].hash = hash_text(key);
+            ring[point].backend = i;
+            point++;
+        }
+    }
+    if (size > 0) {
+        qsort(ring, size, sizeof(RingPoint), compare_ring_points);
+    }
+
+    free(gateway->ring);
+    gateway->ring = ring;
+    gateway->ring_size = size;
+    return true;
+}
+
+// index of the first point at or after 'hash', wrapping around to 0
+int first_ring_point(const Gateway *gateway, uint64_t hash) {
+    int low = 0;
+    int high = gateway->ring_size;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (gateway->ring[middle].hash < hash) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low == gateway->ring_size ? 0 : low;
+}
+
+// ---------------------------------------------------------------- backends
+
+void drop_backend(Gateway *gateway, int index) {
+    Backend *backend = &gateway->backends[index];
+    epoll_ctl(gateway->epoll_fd, EPOLL_CTL_DEL, backend->fd, NULL);
+    close(backend->fd);
+    backend->fd = -1;
+    gateway->backend_count--;
+    rebuild_ring(gateway);
+    gateway_info("Backend %s left after %ld matches, %d backends.", backend->name, backend->matches, gateway->backend_count);
+}
+
+bool has_backend_suffix(const char *name) {
+    size_t length = strlen(name);
+    size_t suffix_length = strlen(CLUSTER_BACKEND_SUFFIX);
+    return length > suffix_length && strcmp(name + length - suffix_length, CLUSTER_BACKEND_SUFFIX) == 0;
+}
+
+// Connects to every backend socket in the directory that is not on the ring yet. Sockets left
+// behind by backends that exited refuse the connection and are skipped.
+void scan_backends(Gateway *gateway) {
+    DIR *directory = opendir(gateway->backend_dir);
+    if (directory == NULL) {
+        return;
+    }
+
+    bool joined = false;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL && gateway->backend_count < GATEWAY_MAX_BACKENDS) {
+        if (!has_backend_suffix(entry->d_name)) {
+            continue;
+        }
+        char name[NAME_MAX + 1];
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(entry->d_name) - strlen(CLUSTER_BACKEND_SUFFIX)), entry->d_name);
+
+        int free_slot = -1;
+        bool known = false;
+        for (int i = 0; i < GATEWAY_MAX_BACKENDS; i++) {
+            if (gateway->backends[i].fd >= 0 && strcmp(gateway->backends[i].name, name) == 0) {
+                known = true;
+                break;
+            }
+            if (gateway->backends[i].fd < 0 && free_slot < 0) {
+                free_slot = i;
+            }
+        }
+        if (known || free_slot < 0) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", gateway->backend_dir, entry->d_name);
+        int fd = cluster_connect_backend(path);
+        if (fd < 0) {
+            continue;
+        }
+
+        Backend *backend = &gateway->backends[free_slot];
+        struct epoll_event event = { .events = EPOLLRDHUP, .data.ptr = backend };
+        if (epoll_ctl(gateway->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            continue;
+        }
+        backend->kind = GATEWAY_BACKEND;
+        backend->fd = fd;
+        backend->matches = 0;
+        snprintf(backend->name, sizeof(backend->name), "%s", name);
+        gateway->backend_count++;
+        joined = true;
+        gateway_info("Backend %s joined, %d backends.", name, gateway->backend_count);
+    }
+    closedir(directory);
+
+    if (joined) {
+        rebuild_ring(gateway);
+    }
+}
+
+// ---------------------------------------------------------------- players
+
+void enqueue_player(Gateway *gateway, WaitingPlayer *player, bool at_front) {
+    int seat = player->seat;
+    if (at_front) {
+        player->previous = NULL;
+        player->next = gateway->waiting_head[seat];
+        if (player->next != NULL) {
+            player->next->previous = player;
+        }
+        else {
+            gateway->waiting_tail[seat] = player;
+        }
+        gateway->waiting_head[seat] = player;
+    }
+    else {
+        player->next = NULL;
+        player->previous = gateway->waiting_tail[seat];
+        if (player->previous != NULL) {
+            player->previous->next = player;
+        }
+        else {
+            gateway->waiting_head[seat] = player;
+        }
+        gateway->waiting_tail[seat] = player;
+    }
+    gateway->waiting_count[seat]++;
+}
+
+void dequeue_player(Gateway *gateway, WaitingPlayer *player) {
+    int seat = player->seat;
+    if (player->previous != NULL) {
+        player->previous->next = player->next;
+    }
+    else {
+        gateway->waiting_head[seat] = player->next;
+    }
+    if (player->next != NULL) {
+        player->next->previous = player->previous;
+    }
+    else {
+        gateway->waiting_tail[seat] = player->previous;
+    }
+    gateway->waiting_count[seat]--;
+}
+
+// The fd is out of epoll before it is closed: a connection handed to a backend is still open
+// there, and epoll would keep reporting it.
+void release_player(Gateway *gateway, WaitingPlayer *player) {
+    epoll_ctl(gateway->epoll_fd, EPOLL_CTL_DEL, player->fd, NULL);
+    close(player->fd);
+    free(player);
+}
+
+// Offers the match to its owner on the ring, then to the next distinct backends clockwise.
+bool route_match(Gateway *gateway, WaitingPlayer *player1, WaitingPlayer *player2) {
+    uint32_t match_id = gateway->last_match_id + 1;
+    int start = first_ring_point(gateway, mix_hash(match_id));
+    bool tried[GATEWAY_MAX_BACKENDS] = { false };
+    bool gone[GATEWAY_MAX_BACKENDS] = { false };
+    int routed_to = -1;
+
+    for (int i = 0; i < gateway->ring_size && routed_to < 0; i++) {
+        int backend = gateway->ring[(start + i) % gateway->ring_size].backend;
+        if (tried[backend]) {
+            continue;
+        }
+        tried[backend] = true;
+        if (cluster_send_match(gateway->backends[backend].fd, match_id, player1->fd, player2->fd)) {
+            routed_to = backend;
+        }
+        else if (errno != EAGAIN) {
+            gone[backend] = true;
+        }
+    }
+    // the ring is only rebuilt once the walk over it is done
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; i++) {
+        if (gone[i]) {
+            drop_backend(gateway, i);
+        }
+    }
+    if (routed_to < 0) {
+        return false;
+    }
+
+    gateway->last_match_id = match_id;
+    gateway->matches_routed++;
+    gateway->backends[routed_to].matches++;
+    gateway_info("Match %u routed to backend %s.", match_id, gateway->backends[routed_to].name);
+    return true;
+}
+
+// Pairs waiting players for as long as both seats have one and some backend takes the match.
+// Players a backend could not take go back to the front of their queues.
+void pair_players(Gateway *gateway) {
+    while (gateway->waiting_head[0] != NULL && gateway->waiting_head[1] != NULL && gateway->ring_size > 0) {
+        WaitingPlayer *player1 = gateway->waiting_head[0];
+        WaitingPlayer *player2 = gateway->waiting_head[1];
+        dequeue_player(gateway, player1);
+        dequeue_player(gateway, player2);
+        if (!route_match(gateway, player1, player2)) {
+            enqueue_player(gateway, player2, true);
+            enqueue_player(gateway, player1, true);
+            if (gateway->ring_size > 0) {
+                gateway_error("Every backend is behind, match %u waits for the next rescan.", gateway->last_match_id + 1);
+            }
+            return;
+        }
+        release_player(gateway, player1);
+        release_player(gateway, player2);
+    }
+}
+
+void accept_players(Gateway *gateway, Listener *listener) {
+    // the listener stays ready while connections are left, epoll reports it again
+    for (int accepted = 0; accepted < GATEWAY_ACCEPT_BATCH; accepted++) {
+        // blocking, like the connections the server accepts itself
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        WaitingPlayer *player = gateway->waiting_count[listener->seat] < GATEWAY_MAX_WAITING ? malloc(sizeof(WaitingPlayer)) : NULL;
+        if (player == NULL) {
+            gateway_error("Too many players wait for seat %d, closing a connection.", listener->seat + 1);
+            close(fd);
+            continue;
+        }
+        player->kind = GATEWAY_WAITING_PLAYER;
+        player->fd = fd;
+        player->seat = listener->seat;
+        // a player that hangs up while waiting must not be paired, what it sends is for the game
+        struct epoll_event event = { .events = EPOLLRDHUP, .data.ptr = player };
+        if (epoll_ctl(gateway->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(player);
+            continue;
+        }
+        enqueue_player(gateway, player, false);
+    }
+}
+
+// ---------------------------------------------------------------- setup
+
+bool add_listener(Gateway *gateway, int fd, int seat, const char *unix_path) {
+    Listener *listener = &gateway->listeners[gateway->listener_count];
+    listener->kind = GATEWAY_LISTENER;
+    listener->fd = fd;
+    listener->seat = seat;
+    snprintf(listener->unix_path, sizeof(listener->unix_path), "%s", unix_path != NULL ? unix_path : "");
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = listener };
+    if (epoll_ctl(gateway->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return false;
+    }
+    gateway->listener_count++;
+    return true;
+}
+
+int listen_tcp(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int enable = 1;
+    int defer_seconds = GATEWAY_DEFER_ACCEPT_SECONDS;
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY, .sin_port = htons(port) };
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0
+        || bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    // both only make admission cheaper, the gateway works the same without them
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_seconds, sizeof(defer_seconds)) < 0) {
+        gateway_info("TCP_DEFER_ACCEPT refused on port %d.", port);
+    }
+    if (!transport_enable_fast_open(fd, backlog)) {
+        gateway_info("TCP_FASTOPEN refused on port %d.", port);
+    }
+    if (listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listen_unix(const char *path, int backlog) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (snprintf(address.sun_path, sizeof(address.sun_path), "%s", path) >= (int)sizeof(address.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool open_listeners(Gateway *gateway, const char *unix_socket_dir) {
+    int ports[2] = { TRANSPORT_PORT_PLAYER01, TRANSPORT_PORT_PLAYER02 };
+    for (int seat = 0; seat < 2; seat++) {
+        int fd = listen_tcp(ports[seat], gateway->listen_backlog);
+        if (fd < 0 || !add_listener(gateway, fd, seat, NULL)) {
+            gateway_error("Could not listen on port %d.", ports[seat]);
+            return false;
+        }
+        if (unix_socket_dir == NULL) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), TRANSPORT_UNIX_PATH_FORMAT, unix_socket_dir, ports[seat]);
+        fd = listen_unix(path, gateway->listen_backlog);
+        if (fd < 0 || !add_listener(gateway, fd, seat, path)) {
+            gateway_error("Could not listen on %s.", path);
+            return false;
+        }
+    }
+    return true;
+}
+
+void close_gateway(Gateway *gateway) {
+    for (int i = 0; i < gateway->listener_count; i++) {
+        close(gateway->listeners[i].fd);
+        if (gateway->listeners[i].unix_path[0] != '\0') {
+            unlink(gateway->listeners[i].unix_path);
+        }
+    }
+    for (int seat = 0; seat < 2; seat++) {
+        while (gateway->waiting_head[seat] != NULL) {
+            WaitingPlayer *player = gateway->waiting_head[seat];
+            dequeue_player(gateway, player);
+            release_player(gateway, player);
+        }
+    }
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; i++) {
+        if (gateway->backends[i].fd >= 0) {
+            gateway_info("Backend %s: %ld matches.", gateway->backends[i].name, gateway->backends[i].matches);
+            close(gateway->backends[i].fd);
+        }
+    }
+    free(gateway->ring);
+    close(gateway->epoll_fd);
+}
+
+int main(int argc, char **argv) {
+    Gateway gateway = { .backend_dir = CLUSTER_DEFAULT_BACKEND_DIR, .virtual_nodes = GATEWAY_DEFAULT_VIRTUAL_NODES,
+                        .listen_backlog = TRANSPORT_DEFAULT_BACKLOG };
+    const char *unix_socket_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:u:v:q:")) != -1) {
+        switch (opt) {
+            case 'd':
+                gateway.backend_dir = optarg;
+                break;
+            case 'u':
+                unix_socket_dir = optarg;
+                break;
+            case 'v':
+                gateway.virtual_nodes = atoi(optarg);
+                if (gateway.virtual_nodes < 1 || gateway.virtual_nodes > GATEWAY_MAX_VIRTUAL_NODES) {
+                    gateway_error("The virtual nodes per backend go from 1 to %d.", GATEWAY_MAX_VIRTUAL_NODES);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                if (!parse_backlog_option(optarg, &gateway.listen_backlog)) {
+                    gateway_error("The listen backlog goes from 1 to 65535.");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d backend_dir] [-u unix_socket_dir] [-v virtual_nodes] [-q listen_backlog]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; i++) {
+        gateway.backends[i].fd = -1;
+    }
+    if (mkdir(gateway.backend_dir, 0755) < 0 && errno != EEXIST) {
+        gateway_error("Could not create '%s'.", gateway.backend_dir);
+        return EXIT_FAILURE;
+    }
+    gateway.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (gateway.epoll_fd < 0 || !open_listeners(&gateway, unix_socket_dir)) {
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction stop_action = { .sa_handler = stop_gateway };
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGTERM, &stop_action, NULL);
+    sigaction(SIGINT, &stop_action, NULL);
+
+    gateway_info("Routing matches to the backends in %s, %d points each on the ring.", gateway.backend_dir, gateway.virtual_nodes);
+    scan_backends(&gateway);
+    long next_scan = monotonic_ms() + GATEWAY_RESCAN_MS;
+
+    struct epoll_event events[GATEWAY_EVENTS_PER_WAIT];
+    while (!gateway_stopping) {
+        long timeout = next_scan - monotonic_ms();
+        int count = epoll_wait(gateway.epoll_fd, events, GATEWAY_EVENTS_PER_WAIT, timeout > 0 ? (int)timeout : 0);
+        if (count < 0 && errno != EINTR) {
+            gateway_error("epoll_wait() failed.");
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            GatewayEntryKind kind = *(GatewayEntryKind *)events[i].data.ptr;
+            if (kind == GATEWAY_LISTENER) {
+                accept_players(&gateway, events[i].data.ptr);
+            }
+            else if (kind == GATEWAY_WAITING_PLAYER) {
+                WaitingPlayer *player = events[i].data.ptr;
+                gateway_info("A player %d hung up before a match.", player->seat + 1);
+                dequeue_player(&gateway, player);
+                release_player(&gateway, player);
+            }
+            else {
+                Backend *backend = events[i].data.ptr;
+                if (backend->fd >= 0) {
+                    drop_backend(&gateway, (int)(backend - gateway.backends));
+                }
+            }
+        }
+
+        if (monotonic_ms() >= next_scan) {
+            scan_backends(&gateway);
+            next_scan = monotonic_ms() + GATEWAY_RESCAN_MS;
+        }
+        pair_players(&gateway);
+    }
+
+    gateway_info("Stopping after %ld matches.", gateway.matches_routed);
+    close_gateway(&gateway);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "handoff.h"
+
+// magic, version, payload length and fd count, four bytes each
+#define HANDOFF_HEADER_SIZE 16
+
+void init_handoff_buffer(HandoffBuffer *buffer) {
+    memset(buffer, 0, sizeof(HandoffBuffer));
+}
+
+void free_handoff_buffer(HandoffBuffer *buffer, bool close_fds) {
+    free(buffer->data);
+    if (close_fds) {
+        for (int i = 0; i < buffer->fd_count; i++) {
+            close(buffer->fds[i]);
+        }
+    }
+    init_handoff_buffer(buffer);
+}
+
+static void encode_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint32_t decode_u32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+void handoff_put_bytes(HandoffBuffer *buffer, const void *bytes, size_t length) {
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+void handoff_put_i32(HandoffBuffer *buffer, int32_t value) {
+    unsigned char bytes[4];
+    encode_u32(bytes, (uint32_t)value);
+    handoff_put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+void handoff_put_i64(HandoffBuffer *buffer, int64_t value) {
+    handoff_put_i32(buffer, (int32_t)(uint32_t)((uint64_t)value & 0xffffffffu));
+    handoff_put_i32(buffer, (int32_t)(uint32_t)((uint64_t)value >> 32));
+}
+
+void handoff_put_double(HandoffBuffer *buffer, double value) {
+    int64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    handoff_put_i64(buffer, bits);
+}
+
+void handoff_put_string(HandoffBuffer *buffer, const char *string) {
+    size_t length = strlen(string);
+    handoff_put_i32(buffer, (int32_t)length);
+    handoff_put_bytes(buffer, string, length);
+}
+
+void handoff_put_fd(HandoffBuffer *buffer, int fd) {
+    if (fd < 0) {
+        handoff_put_i32(buffer, -1);
+        return;
+    }
+    if (buffer->fd_count >= HANDOFF_MAX_FDS) {
+        buffer->failed = true;
+        return;
+    }
+    buffer->fds[buffer->fd_count] = fd;
+    handoff_put_i32(buffer, buffer->fd_count++);
+}
+
+void handoff_get_bytes(HandoffBuffer *buffer, void *bytes, size_t length) {
+    if (buffer->failed || buffer->offset + length > buffer->length) {
+        buffer->failed = true;
+        memset(bytes, 0, length);
+        return;
+    }
+    memcpy(bytes, buffer->data + buffer->offset, length);
+    buffer->offset += length;
+}
+
+int32_t handoff_get_i32(HandoffBuffer *buffer) {
+    unsigned char bytes[4];
+    handoff_get_bytes(buffer, bytes, sizeof(bytes));
+    return (int32_t)decode_u32(bytes);
+}
+
+int64_t handoff_get_i64(HandoffBuffer *buffer) {
+    uint64_t low = (uint32_t)handoff_get_i32(buffer);
+    uint64_t high = (uint32_t)handoff_get_i32(buffer);
+    return (int64_t)(low | (high << 32));
+}
+
+double handoff_get_double(HandoffBuffer *buffer) {
+    int64_t bits = handoff_get_i64(buffer);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void handoff_get_string(HandoffBuffer *buffer, char *string, size_t size) {
+    int32_t length = handoff_get_i32(buffer);
+    if (length < 0 || (size_t)length >= size) {
+        buffer->failed = true;
+        string[0] = '\0';
+        return;
+    }
+    handoff_get_bytes(buffer, string, length);
+    string[buffer->failed ? 0 : length] = '\0';
+}
+
+int handoff_get_fd(HandoffBuffer *buffer) {
+    int32_t slot = handoff_get_i32(buffer);
+    if (slot == -1) {
+        return -1;
+    }
+    if (slot < 0 || slot >= buffer->fd_count) {
+        buffer->failed = true;
+        return -1;
+    }
+    return buffer->fds[slot];
+}
+
+bool handoff_send(int socket_fd, const HandoffBuffer *buffer) {
+    if (buffer->failed) {
+        return false;
+    }
+
+    unsigned char header[HANDOFF_HEADER_SIZE];
+    encode_u32(header, HANDOFF_MAGIC);
+    encode_u32(header + 4, HANDOFF_VERSION);
+    encode_u32(header + 8, (uint32_t)buffer->length);
+    encode_u32(header + 12, (uint32_t)buffer->fd_count);
+
+    // the fds ride along with the header, so they arrive before any of the payload
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(header) };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (buffer->fd_count > 0) {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(buffer->fd_count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(buffer->fd_count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), buffer->fds, buffer->fd_count * sizeof(int));
+    }
+    if (sendmsg(socket_fd, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(header)) {
+        return false;
+    }
+
+    size_t sent = 0;
+    while (sent < buffer->length) {
+        ssize_t written = send(socket_fd, buffer->data + sent, buffer->length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        sent += written;
+    }
+    return true;
+}
+
+static long handoff_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// waits until 'socket_fd' is readable or the deadline passed
+static bool wait_readable(int socket_fd, long deadline_ms) {
+    while (true) {
+        long remaining = deadline_ms - handoff_now_ms();
+        if (remaining <= 0) {
+            return false;
+        }
+        struct pollfd pfd = { .fd = socket_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, (int)remaining);
+        if (ready > 0) {
+            return true;
+        }
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+bool handoff_receive(int socket_fd, HandoffBuffer *buffer, int timeout_ms) {
+    long deadline = handoff_now_ms() + timeout_ms;
+    unsigned char header[HANDOFF_HEADER_SIZE];
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(header) };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+
+    if (!wait_readable(socket_fd, deadline) || recvmsg(socket_fd, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(header)) {
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (buffer->fd_count < HANDOFF_MAX_FDS) {
+                    buffer->fds[buffer->fd_count++] = fd;
+                }
+                else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    if (decode_u32(header) != HANDOFF_MAGIC || decode_u32(header + 4) != HANDOFF_VERSION
+        || (message.msg_flags & MSG_CTRUNC) || (uint32_t)buffer->fd_count != decode_u32(header + 12)) {
+        return false;
+    }
+
+    size_t length = decode_u32(header + 8);
+    buffer->data = malloc(length > 0 ? length : 1);
+    if (buffer->data == NULL) {
+        return false;
+    }
+    buffer->capacity = length;
+
+    while (buffer->length < length) {
+        if (!wait_readable(socket_fd, deadline)) {
+            return false;
+        }
+        ssize_t received = recv(socket_fd, buffer->data + buffer->length, length - buffer->length, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        buffer->length += received;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Serialized state and open fds handed from a running server to its replacement over a Unix
+// socket. Values are written field by field in a fixed byte order, so the new binary does not
+// depend on the old one's struct layouts, and fds travel as SCM_RIGHTS next to the bytes.
+
+#define HANDOFF_MAGIC 0x4853484fu
+#define HANDOFF_VERSION 5
+#define HANDOFF_MAX_FDS 16
+// the replacement finds its end of the socket in this variable
+#define HANDOFF_FD_ENV "BATTLESHIP_HANDOFF_FD"
+
+typedef struct HandoffBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+    // read position while restoring
+    size_t offset;
+    // set by any put that ran out of memory or get that ran past the end, checked once at the end
+    bool failed;
+    int fds[HANDOFF_MAX_FDS];
+    int fd_count;
+} HandoffBuffer;
+
+void init_handoff_buffer(HandoffBuffer *buffer);
+// frees the bytes, and closes the fds when 'close_fds' is set (a restore that failed half way)
+void free_handoff_buffer(HandoffBuffer *buffer, bool close_fds);
+
+void handoff_put_i32(HandoffBuffer *buffer, int32_t value);
+void handoff_put_i64(HandoffBuffer *buffer, int64_t value);
+void handoff_put_double(HandoffBuffer *buffer, double value);
+void handoff_put_bytes(HandoffBuffer *buffer, const void *bytes, size_t length);
+void handoff_put_string(HandoffBuffer *buffer, const char *string);
+// queues 'fd' for SCM_RIGHTS and stores its slot, -1 stays -1
+void handoff_put_fd(HandoffBuffer *buffer, int fd);
+
+int32_t handoff_get_i32(HandoffBuffer *buffer);
+int64_t handoff_get_i64(HandoffBuffer *buffer);
+double handoff_get_double(HandoffBuffer *buffer);
+void handoff_get_bytes(HandoffBuffer *buffer, void *bytes, size_t length);
+// copies at most size - 1 characters, always NUL-terminated
+void handoff_get_string(HandoffBuffer *buffer, char *string, size_t size);
+// the fd that arrived in the slot handoff_put_fd() wrote, or -1
+int handoff_get_fd(HandoffBuffer *buffer);
+
+// sends the length, the bytes and all queued fds
+bool handoff_send(int socket_fd, const HandoffBuffer *buffer);
+// receives a whole handoff_send() into an initialized buffer, waiting at most 'timeout_ms'
+bool handoff_receive(int socket_fd, HandoffBuffer *buffer, int timeout_ms);
+
+#endif
@@ -5,13 +5,46 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "analytics.h"
+#include "cluster.h"
+#include "cpu_budget.h"
+#include "engine.h"
+#include "handoff.h"
+#include "latency.h"
+#include "memory_account.h"
+#include "ratings.h"
+#include "rules.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "transport.h"
 
 #define PLAYER01_PORT 2201
 #define PLAYER02_PORT 2202
 #define BUFFER_SIZE 1024
-#define MAX_PIECES 5
+// room for "G <ships> <cursor>" in a delta Query reply, the rest of the packet holds events
+#define DELTA_QUERY_HEADER_ROOM 32
+#define RESUME_TOKEN_LENGTH 16
+// expensive operations cost one token per this many cells of the board they touch
+#define EXPENSIVE_UNIT_CELLS 100
+// CPU time an expensive operation runs before it lets other games on the core go first
+#define EXPENSIVE_SLICE_US 2000
+// the replacement binary finds its end of the handoff socket on this fd
+#define HANDOFF_CHILD_FD 3
+// how long the old process waits for the replacement to take the game over
+#define HANDOFF_TIMEOUT_MS 5000
+// gateways one backend takes matches from
+#define BACKEND_MAX_GATEWAYS 16
 
 // server responses
 
@@ -32,135 +65,474 @@
 #define INVALID_SHOOT_PACKET_CELL_OUT_OF_BOUNDS "E 400"
 #define INVALID_SHOOT_PACKET_CELL_ALREADY_GUESSED "E 401"
 
+#define INVALID_RESUME_TOKEN "E 500"
+#define INVALID_SHARED_MEMORY_CHANNEL "E 501"
+#define RATE_LIMIT_EXCEEDED "E 502"
+#define RATE_LIMIT_DISCONNECT "E 503"
+#define MEMORY_QUOTA_EXCEEDED "E 504"
+
 #define HALT_WIN "H 1"
 #define HALT_LOSS "H 0"
 
 #define ACK "A"
 
-typedef struct Board {
-    int pieces_remaining;
-    bool initialized;
-    int width;
-    int height;
-    int **board;
-} Board;
-
 typedef struct PlayerSocketConnection {
     int connection_fd;
     int listen_fd;
     struct sockaddr_in address;
     socklen_t address_len;
     int port;
+    // AF_UNIX listener next to the TCP one, -1 unless the server runs with -u
+    int unix_listen_fd;
+    char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    bool connection_is_unix;
+    // fds that arrived with the last packet over the Unix socket, claimed by an 'M' packet
+    int received_fds[SHM_HANDSHAKE_FD_COUNT];
+    int received_fd_count;
+    // set once the player switched to the shared-memory rings, NULL on a plain socket
+    Transport *shm;
+    // set once the player asked for newline-framed packets with 'P', so it can pipeline requests
+    bool framed;
+    // bytes read past the end of the last framed packet
+    char framed_input[BUFFER_SIZE];
+    int framed_length;
 } PlayerSocketConnection;
 
+// refills 'rate' tokens per second up to 'burst', a rate of 0 disables the limit
+typedef struct TokenBucket {
+    double rate;
+    double burst;
+    double tokens;
+    long last_refill_ms;
+} TokenBucket;
+
 typedef struct Player {
     int number;
     bool ready;
     bool play;
     Board *board;
     PlayerSocketConnection *socket;
+    char resume_token[RESUME_TOKEN_LENGTH + 1];
+    // set once the token has been pushed to the player, right after the first reply it gets
+    bool resume_token_issued;
+    // every packet takes one token from 'packet_bucket', I validation and queries also pay by board size
+    TokenBucket packet_bucket;
+    TokenBucket expensive_bucket;
+    // packets rejected by either bucket, the player is disconnected at server_options.max_strikes
+    int strikes;
+    // the fleet of the accepted I packet, kept for the analytics record
+    Piece fleet[MAX_FLEET_SIZE];
+    // the name given in the B packet, empty for an anonymous player, whose games are not rated
+    char identity[RATING_NAME_SIZE];
 } Player;
 
-// format: <Piece_type Piece_rotation Piece_column Piece_row>
-typedef struct Piece {
-    // ranges from 1 to 7
-    int type;
-    // ranges from 1 to 4
-    int rotation;
-    int row;
-    int col;
-} Piece;
+// per player, index 0 is unused so the player number can index directly
+typedef struct ServerCounters {
+    long packets_received[3];
+    long error_replies[3];
+    long rate_limited_packets[3];
+    long rate_limited_expensive[3];
+    long disconnected_for_abuse[3];
+} ServerCounters;
+
+// Where the time goes between a player's packet and the reply. 'wakeup' runs from the kernel
+// queueing a packet the server was already waiting for to the read returning it, which is the
+// scheduler's share, and 'turn' from the read returning to the first reply going out.
+typedef struct ServerLatency {
+    LatencyHistogram wakeup;
+    LatencyHistogram turn;
+    // when each player's last packet was read, 0 once it was answered
+    uint64_t read_at_ns[3];
+} ServerLatency;
+
+typedef struct ServerOptions {
+    // seconds a disconnected player's seat stays reserved, 0 disables session resumption
+    int resume_grace_seconds;
+    // Chrome trace-event JSON output, NULL disables span recording
+    const char *trace_path;
+    // directory for the AF_UNIX listeners, NULL serves TCP only
+    const char *unix_socket_dir;
+    double packet_rate;
+    double packet_burst;
+    // in units of EXPENSIVE_UNIT_CELLS board cells
+    double expensive_rate;
+    double expensive_burst;
+    // CPU milliseconds per second the whole game may spend on print_board(), queries and I packets
+    double cpu_budget_rate;
+    double cpu_budget_burst;
+    int max_strikes;
+    // logs every admitted packet, off by default so the per-packet cost stays out of the hot path
+    bool log_packets;
+    // Prometheus text file the counters are written to at exit, NULL disables it
+    const char *counters_path;
+    // fleet, shapes and board limits both players' boards are created with
+    RuleSet rules;
+    // bytes this game may allocate, 0 for no limit
+    size_t game_memory_limit;
+    // bytes all server processes sharing the ledger may allocate together, 0 for no limit
+    size_t host_memory_limit;
+    // ledger file shared between server processes, NULL unless -M or -L is given
+    const char *memory_ledger_path;
+    // binary exec'd on SIGUSR2 to take the game over, defaults to the one the server was started from
+    const char *upgrade_binary;
+    // directory the admin snapshot of this game is published in, NULL disables it
+    const char *snapshot_dir;
+    // directory finished games are exported to, NULL disables the analytics writer
+    const char *analytics_dir;
+    size_t analytics_rotate_bytes;
+    // busy-poll mode spins for this long on an empty socket before blocking, 0 always blocks
+    long busy_poll_spin_us;
+    // core the game thread is pinned to in busy-poll mode, -1 leaves it to the scheduler
+    int busy_poll_cpu;
+    // write-ahead log the results of rated games are appended to, NULL disables ratings
+    const char *rating_log_path;
+    // listen backlog of the player ports
+    int listen_backlog;
+    // socket a gateway hands matches to, NULL plays a single game on the player ports
+    const char *backend_path;
+} ServerOptions;
 
 // Function declarations
 
-void read_from_player_socket(int socket_fd, char *buffer);
-char* get_first_token_from_buffer(const char *buffer);
+int read_from_player_socket(int socket_fd, char *buffer);
+int receive_socket_packet(PlayerSocketConnection *player_socket, int socket_fd, char *buffer, int size, int64_t *queued_realtime_ns);
+int receive_framed_packet(PlayerSocketConnection *player_socket, int socket_fd, char *buffer, int64_t *queued_realtime_ns);
+void read_player_packet(Player *player, char *buffer);
+bool read_one_player_packet(Player *player, char *buffer);
+void wait_for_setup_packets(Player **players, int count, bool *readable);
+bool wait_for_player_reconnect(Player *player);
+void generate_resume_token(char *token);
+bool is_resume_packet(const char *buffer);
+bool resume_token_matches(const char *buffer, const char *token);
+long monotonic_time_ms(void);
+char get_packet_type(const char *buffer);
 Player* initialize_player(int number, bool ready);
 void delete_player(Player *player);
 bool is_player_ready(Player *player);
-Board* create_board(int width, int height);
-bool delete_board(Board *board);
+bool is_board_initialized(Player *player);
 void pstdout(const char *format, ...);
 void pstderr(const char *format, ...);
 void send_response(int conn_fd, const char *error);
+void issue_resume_token(int player_number);
 void send_shot_response(int conn_fd, int remaining_ships, const char miss_or_hit);
 void end_game(void);
 PlayerSocketConnection* initialize_socket_connection(int port);
+PlayerSocketConnection* initialize_routed_connection(int port, int conn_fd);
+void serve_as_backend(int *player_fds);
+void stop_backend(int signal_number);
 int accept_player_connection(PlayerSocketConnection *player_socket);
+int wait_for_player_listener(PlayerSocketConnection *player_socket, int timeout_ms);
+int initialize_unix_listener(PlayerSocketConnection *player_socket);
+void close_player_connection(PlayerSocketConnection *player_socket);
+void tune_player_connection(int conn_fd);
+void start_busy_poll_mode(void);
+void report_latency(void);
+void discard_received_fds(PlayerSocketConnection *player_socket);
+PlayerSocketConnection *player_socket_for_fd(int conn_fd);
+void attach_shared_memory_transport(Player *player);
+void initialize_token_bucket(TokenBucket *bucket, double rate, double burst);
+bool take_tokens(TokenBucket *bucket, double cost);
+bool is_bucket_full(TokenBucket *bucket);
+bool admit_expensive_operation(Player *player, Board *board);
+void record_rate_limit_strike(Player *player);
+bool parse_rate_option(const char *argument, double *rate, double *burst);
+void write_server_counters(void);
+void publish_memory_usage(const char *reason);
+void close_host_memory_ledger(void);
+void request_upgrade(int signal_number);
+void handle_pending_upgrade(void);
+void hand_off_to_new_binary(void);
+void open_admin_snapshot(void);
+void close_admin_snapshot(void);
+void size_admin_snapshot(int width, int height);
+void publish_game_snapshot(Player *changed_player, int first_cell, int cell_count);
+void publish_game_snapshot_cells(Player *changed_player, const int *cells, int cell_count);
+void write_game_snapshot(Player *changed_player, int first_cell, int cell_count, const int *cells);
+int fleet_cells(const Board *board, const Piece *pieces, int *cells);
+int append_cell_value(char *out, int value);
+void record_game_end(Player *winner, GameEndReason reason);
+void record_rated_game(Player *winner, GameEndReason reason, int64_t ended_ms);
+bool parse_player_identity(const char *text, char *identity);
+int parse_query_packet(const char *buffer, int *cursor);
+void stop_game_analytics(void);
+void serialize_game_state(HandoffBuffer *state);
+void serialize_player(HandoffBuffer *state, Player *player);
+bool restore_game_state(HandoffBuffer *state);
+Player *restore_player(HandoffBuffer *state, int number);
+bool restore_from_handoff(int handoff_fd);
+void game_process_player_begin_packet(char *buffer, int player_number);
 void game_process_player_board_initialize(char *buffer, int player_number);
 void print_board(Board *board);
 void game_process_player_play_packets(char *buffer, int player_number);
-bool are_ships_overlapping(Board *board, Piece *pieces);
-int remaining_pieces_on_board(Board *board);
-bool is_position_out_of_bounds_on_board(Board *board, int row, int col, int final_row, int final_col);
-void fill_board_with_pieces(Board *board, Piece *pieces);
-bool fill_board_with_piece(Board *board, Piece *piece, int piece_board_identifier);
-bool fill_board_index_with_value(Board *board, int piece_row, int piece_col, int row_offset, int col_offset, int value);
-bool is_board_index_empty(Board *board, int row, int col);
-char *get_game_state_from_board(Board *board);
+const char *engine_result_packet(EngineResult result);
+void get_game_state_from_board(Board *board, char *buffer);
+int player_number_for_fd(int conn_fd);
+EngineResult validate_initialize_pieces(Player *player, Piece *pieces);
 void send_query_response(Player* player, Board *board);
+void send_delta_query_response(Player* player, Board *board, int cursor);
 
 // player pointers
 
 Player *player_01 = NULL;
 Player *player_02 = NULL;
 
-int tetris_shape_offsets[7][4][4][2] = {
-    // shape 1 - rotations 1 to 4
-    {
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 1
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 2
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 3
-        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}  // rotation 4
-    },
-    // shape 2 - rotations 1 to 4
-    {
-        {{0, 0}, {1, 0}, {2, 0}, {3, 0}}, // rotation 1
-        {{0, 0}, {0, 1}, {0, 2}, {0, 3}}, // rotation 2
-        {{0, 0}, {1, 0}, {2, 0}, {3, 0}}, // rotation 3
-        {{0, 0}, {0, 1}, {0, 2}, {0, 3}}  // rotation 4
-    },
-    // shape 3 - rotations 1 to 4
-    {
-        {{0, 0}, {0, 1}, {-1, 1}, {-1, 2}}, // rotation 1
-        {{0, 0}, {1, 0}, {1, 1}, {2, 1}},   // rotation 2
-        {{0, 0}, {0, 1}, {-1, 1}, {-1, 2}}, // rotation 3
-        {{0, 0}, {1, 0}, {1, 1}, {2, 1}}    // rotation 4
-    },
-    // shape 4 - rotations 1 to 4
-    {
-        {{0, 0}, {1, 0}, {2, 0}, {2, 1}},   // rotation 1
-        {{0, 0}, {0, 1}, {0, 2}, {1, 0}},   // rotation 2
-        {{0, 0}, {0, 1}, {1, 1}, {2, 1}},   // rotation 3
-        {{0, 0}, {0, 1}, {0, 2}, {-1, 2}}   // rotation 4
-    },
-    // shape 5 - rotations 1 to 4
-    {
-        {{0, 0}, {0, 1}, {1, 1}, {1, 2}},   // rotation 1
-        {{0, 0}, {1, 0}, {0, 1}, {-1, 1}},  // rotation 2
-        {{0, 0}, {0, 1}, {1, 1}, {1, 2}},   // rotation 3
-        {{0, 0}, {1, 0}, {0, 1}, {-1, 1}}   // rotation 4
-    },
-    // shape 6 - rotations 1 to 4
-    {
-        {{0, 0}, {0, 1}, {-1, 1}, {-2, 1}}, // rotation 1
-        {{0, 0}, {1, 0}, {1, 1}, {1, 2}},   // rotation 2
-        {{0, 0}, {0, 1}, {1, 0}, {2, 0}},   // rotation 3
-        {{0, 0}, {0, 1}, {0, 2}, {1, 2}}    // rotation 4
-    },
-    // shape 7 - rotations 1 to 4
-    {
-        {{0, 0}, {0, 1}, {0, 2}, {1, 1}},   // rotation 1
-        {{0, 0}, {0, 1}, {-1, 1}, {1, 1}},  // rotation 2
-        {{0, 0}, {0, 1}, {0, 2}, {-1, 1}},  // rotation 3
-        {{0, 0}, {1, 0}, {2, 0}, {1, 1}}    // rotation 4
-    }
+ServerOptions server_options = {
+    .resume_grace_seconds = 0,
+    .trace_path = NULL,
+    .unix_socket_dir = NULL,
+    .packet_rate = 1000,
+    .packet_burst = 2000,
+    .expensive_rate = 200,
+    .expensive_burst = 400,
+    .cpu_budget_rate = 250,
+    .cpu_budget_burst = 500,
+    .max_strikes = 50,
+    .log_packets = false,
+    .counters_path = NULL,
+    .game_memory_limit = 64 << 20,
+    .host_memory_limit = 0,
+    .memory_ledger_path = NULL,
+    .upgrade_binary = NULL,
+    .snapshot_dir = NULL,
+    .analytics_dir = NULL,
+    .analytics_rotate_bytes = ANALYTICS_DEFAULT_ROTATE_BYTES,
+    .busy_poll_spin_us = 0,
+    .busy_poll_cpu = -1,
+    .rating_log_path = NULL,
+    .listen_backlog = TRANSPORT_DEFAULT_BACKLOG,
+    .backend_path = NULL
 };
 
-int main() {
+ServerCounters server_counters = {0};
+ServerLatency server_latency = {0};
+// CPU time the expensive operations of this game spend, shared by both players
+CpuBudget game_cpu_budget;
+
+// every allocation made for this game, backed by the host ledger when one is open
+MemoryAccount game_memory;
+MemoryLedger memory_ledger = { .fd = -1, .slots = NULL };
+
+// Set by SIGUSR2. The upgrade runs the next time the server waits for a packet or a connection,
+// where no packet is half processed, so the replacement starts from a consistent state.
+volatile sig_atomic_t upgrade_requested = 0;
+// set once the game is decided and only the loser's last packet is awaited, no upgrade is worth it then
+bool upgrade_blocked = false;
+char server_binary_path[PATH_MAX];
+char **server_argv = NULL;
+
+// tags trace spans, one game per server process so the pid is unique among live games
+int game_id = 0;
+
+// what admin views read, only ever written by this thread
+GameSnapshot game_snapshot = { .fd = -1, .shared = NULL };
+
+// takes the finished game off this thread, see record_game_end()
+AnalyticsWriter analytics_writer;
+// CLOCK_REALTIME milliseconds when both players were connected, carried over by upgrades
+int64_t game_started_ms = 0;
+bool game_recorded = false;
+// the rating log opened for appending, -1 without -W
+int rating_log_fd = -1;
+// the gateway's id of this match in backend mode, 0 otherwise
+uint32_t match_id = 0;
+volatile sig_atomic_t backend_stopping = 0;
+
+
+int main(int argc, char **argv) {
     // register end_game() to be called at program exit - no need to manually call end_game now
     atexit(end_game);
 
+    server_options.rules = *CLASSIC_RULES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:u:p:e:C:k:vc:R:m:M:L:X:a:A:Z:b:W:B:q:")) != -1) {
+        switch (opt) {
+            case 'r':
+                server_options.resume_grace_seconds = atoi(optarg);
+                if (server_options.resume_grace_seconds < 0) {
+                    server_options.resume_grace_seconds = 0;
+                }
+                break;
+            case 't':
+                server_options.trace_path = optarg;
+                break;
+            case 'u':
+                server_options.unix_socket_dir = optarg;
+                break;
+            case 'p':
+                if (!parse_rate_option(optarg, &server_options.packet_rate, &server_options.packet_burst)) {
+                    pstderr("Invalid packet rate '%s', expected <per_second>[/<burst>].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'e':
+                if (!parse_rate_option(optarg, &server_options.expensive_rate, &server_options.expensive_burst)) {
+                    pstderr("Invalid expensive operation rate '%s', expected <per_second>[/<burst>].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                if (!parse_rate_option(optarg, &server_options.cpu_budget_rate, &server_options.cpu_budget_burst)) {
+                    pstderr("Invalid CPU budget '%s', expected <cpu_ms_per_second>[/<burst_ms>].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k':
+                server_options.max_strikes = atoi(optarg);
+                break;
+            case 'v':
+                server_options.log_packets = true;
+                break;
+            case 'c':
+                server_options.counters_path = optarg;
+                break;
+            case 'R':
+                if (!parse_rule_set(optarg, &server_options.rules)) {
+                    pstderr("Invalid rule set '%s', expected <name>[:fleet=N,shapes=N,min=N,max=N].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                if (!parse_memory_size(optarg, &server_options.game_memory_limit)) {
+                    pstderr("Invalid game memory limit '%s', expected <bytes>[K|M|G].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                if (!parse_memory_size(optarg, &server_options.host_memory_limit)) {
+                    pstderr("Invalid host memory limit '%s', expected <bytes>[K|M|G].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                if (server_options.memory_ledger_path == NULL) {
+                    server_options.memory_ledger_path = MEMORY_LEDGER_DEFAULT_PATH;
+                }
+                break;
+            case 'L':
+                server_options.memory_ledger_path = optarg;
+                break;
+            case 'X':
+                server_options.upgrade_binary = optarg;
+                break;
+            case 'a':
+                server_options.snapshot_dir = optarg;
+                break;
+            case 'A':
+                server_options.analytics_dir = optarg;
+                break;
+            case 'Z':
+                if (!parse_memory_size(optarg, &server_options.analytics_rotate_bytes) || server_options.analytics_rotate_bytes == 0) {
+                    pstderr("Invalid analytics rotation size '%s', expected <bytes>[K|M|G].", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                if (!parse_busy_poll_option(optarg, &server_options.busy_poll_cpu, &server_options.busy_poll_spin_us)) {
+                    pstderr("Invalid busy-poll option '%s', expected <cpu>[/<spin_us>] with -1 for no pinning.", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                server_options.rating_log_path = optarg;
+                break;
+            case 'B':
+                server_options.backend_path = optarg;
+                break;
+            case 'q':
+                if (!parse_backlog_option(optarg, &server_options.listen_backlog)) {
+                    pstderr("Invalid listen backlog '%s', expected 1 to 65535.", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-r resume_grace_seconds] [-t trace.json] [-u unix_socket_dir] [-p packets_per_second[/burst]] [-e expensive_per_second[/burst]] [-C cpu_ms_per_second[/burst_ms]] [-k max_strikes] [-v] [-c counters.prom] [-R rules] [-m game_memory_limit] [-M host_memory_limit] [-L memory_ledger] [-X upgrade_binary] [-a snapshot_dir] [-A analytics_dir] [-Z analytics_rotate_size] [-b cpu[/spin_us]] [-W rating_log] [-B backend_socket] [-q listen_backlog]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    game_id = (int)getpid();
+
+    // a server started by an upgrade inherits its game from the old process instead of waiting for players
+    int handoff_fd = -1;
+    const char *handoff_variable = getenv(HANDOFF_FD_ENV);
+    if (handoff_variable != NULL) {
+        handoff_fd = atoi(handoff_variable);
+        unsetenv(HANDOFF_FD_ENV);
+    }
+
+    // a backend only forks games, each one carries on from here with both players connected
+    int routed_fds[2] = { -1, -1 };
+    if (server_options.backend_path != NULL && handoff_fd < 0) {
+        serve_as_backend(routed_fds);
+        game_id = (int)getpid();
+    }
+
+    // remembered now, a deploy that replaces the file later makes the same path point at the new build
+    server_argv = argv;
+    ssize_t path_length = readlink("/proc/self/exe", server_binary_path, sizeof(server_binary_path) - 1);
+    if (path_length > 0) {
+        server_binary_path[path_length] = '\0';
+    }
+    else {
+        snprintf(server_binary_path, sizeof(server_binary_path), "%s", argv[0]);
+    }
+    if (server_options.upgrade_binary != NULL) {
+        snprintf(server_binary_path, sizeof(server_binary_path), "%s", server_options.upgrade_binary);
+    }
+
+    struct sigaction upgrade_action = { .sa_handler = request_upgrade };
+    // no SA_RESTART: the signal has to wake the blocking read or accept up
+    sigemptyset(&upgrade_action.sa_mask);
+    sigaction(SIGUSR2, &upgrade_action, NULL);
+
+    pstdout("Playing with the %s rule set: %d pieces of %d cells, %s code path.", server_options.rules.name, server_options.rules.fleet_size,
+            server_options.rules.cells_per_piece, server_options.rules.specialized ? "specialized" : "generic");
+
+    init_memory_account(&game_memory, server_options.game_memory_limit, NULL, NULL);
+    init_cpu_budget(&game_cpu_budget, server_options.cpu_budget_rate, server_options.cpu_budget_burst, EXPENSIVE_SLICE_US);
+    if (server_options.memory_ledger_path != NULL) {
+        if (!open_memory_ledger(&memory_ledger, server_options.memory_ledger_path, server_options.host_memory_limit)) {
+            pstderr("Could not open memory ledger '%s'.", server_options.memory_ledger_path);
+            exit(EXIT_FAILURE);
+        }
+        game_memory.ledger = &memory_ledger;
+        // registered after end_game() so it runs first, the slot is dropped as a whole
+        atexit(close_host_memory_ledger);
+    }
+
+    // the old process is still writing its trace file until it exits
+    static char upgraded_trace_path[PATH_MAX];
+    if (server_options.trace_path != NULL && handoff_fd >= 0) {
+        snprintf(upgraded_trace_path, sizeof(upgraded_trace_path), "%s.%d", server_options.trace_path, (int)getpid());
+        server_options.trace_path = upgraded_trace_path;
+    }
+
+    if (server_options.trace_path != NULL) {
+        if (!trace_open(server_options.trace_path)) {
+            pstderr("Could not open trace file '%s'.", server_options.trace_path);
+            exit(EXIT_FAILURE);
+        }
+        // registered after end_game() so it runs first and the file is complete before cleanup
+        atexit(trace_close);
+        pstdout("Tracing spans for game %d to %s", game_id, server_options.trace_path);
+    }
+
+    if (server_options.analytics_dir != NULL) {
+        if (!start_analytics_writer(&analytics_writer, server_options.analytics_dir, server_options.analytics_rotate_bytes, ANALYTICS_SERVER_QUEUE_CAPACITY)) {
+            pstderr("Could not start the analytics writer for '%s'.", server_options.analytics_dir);
+            exit(EXIT_FAILURE);
+        }
+        // registered after end_game() so it runs first, the record is written before cleanup
+        atexit(stop_game_analytics);
+    }
+
+    if (server_options.rating_log_path != NULL) {
+        rating_log_fd = rating_log_open(server_options.rating_log_path);
+        if (rating_log_fd < 0) {
+            pstderr("Could not open the rating log '%s'.", server_options.rating_log_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // ********************* Begin Server Setup ***************************
     // Game server setup on ports 2201 and 2202
 
@@ -169,110 +541,121 @@ int main() {
     player_01 = initialize_player(1, false);
     player_02 = initialize_player(2, false);
 
-    player_01->socket = initialize_socket_connection(PLAYER01_PORT);
-    player_02->socket = initialize_socket_connection(PLAYER02_PORT);
+    if (server_options.counters_path != NULL) {
+        // registered after end_game() so it runs first, the counters include the last packets
+        atexit(write_server_counters);
+    }
 
-    if (player_01->socket == NULL || player_02->socket == NULL) {
-        pstderr("Failed to initialize player sockets.");
-        exit(EXIT_FAILURE);
+    if (handoff_fd >= 0) {
+        if (!restore_from_handoff(handoff_fd)) {
+            pstderr("Could not take the game over from the old server, leaving it running.");
+            // skips end_game(), the sockets and socket files still belong to the old process
+            _exit(EXIT_FAILURE);
+        }
+    }
+    else if (routed_fds[0] >= 0) {
+        player_01->socket = initialize_routed_connection(PLAYER01_PORT, routed_fds[0]);
+        player_02->socket = initialize_routed_connection(PLAYER02_PORT, routed_fds[1]);
+
+        if (player_01->socket == NULL || player_02->socket == NULL) {
+            pstderr("Failed to initialize player sockets.");
+            exit(EXIT_FAILURE);
+        }
+        pstdout("Playing match %u handed over by the gateway.", match_id);
+    }
+    else {
+        player_01->socket = initialize_socket_connection(PLAYER01_PORT);
+        player_02->socket = initialize_socket_connection(PLAYER02_PORT);
+
+        if (player_01->socket == NULL || player_02->socket == NULL) {
+            pstderr("Failed to initialize player sockets.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (server_options.snapshot_dir != NULL) {
+        open_admin_snapshot();
+    }
+
+    // registered after end_game() so it runs first, while the game's numbers are still around
+    atexit(report_latency);
+    if (server_options.busy_poll_spin_us > 0) {
+        start_busy_poll_mode();
     }
 
     pstdout("Waiting for players to connect...");
 
-    if (accept_player_connection(player_01->socket) < 0) {
-        pstderr("[Server] Player 01: accept() failed.");
-        exit(EXIT_FAILURE);
+    // a restored game may already have one or both players connected
+    while (player_01->socket->connection_fd < 0) {
+        handle_pending_upgrade();
+        if (accept_player_connection(player_01->socket) >= 0) {
+            pstdout("Player 01: accept() success.");
+        }
+        else if (errno != EINTR) {
+            pstderr("[Server] Player 01: accept() failed.");
+            exit(EXIT_FAILURE);
+        }
     }
-    pstdout("Player 01: accept() success.");
 
-    if (accept_player_connection(player_02->socket) < 0) {
-        pstderr("[Server] Player 02: accept() failed.");
-        exit(EXIT_FAILURE);
+    while (player_02->socket->connection_fd < 0) {
+        handle_pending_upgrade();
+        if (accept_player_connection(player_02->socket) >= 0) {
+            pstdout("Player 02: accept() success.");
+        }
+        else if (errno != EINTR) {
+            pstderr("[Server] Player 02: accept() failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (server_options.resume_grace_seconds > 0 && player_01->resume_token[0] == '\0') {
+        generate_resume_token(player_01->resume_token);
+        generate_resume_token(player_02->resume_token);
+        pstdout("Session resumption enabled with a %d second grace window.", server_options.resume_grace_seconds);
     }
-    pstdout("Player 02: accept() success.");
 
     pstdout("Ready to play Battleship!");
+    if (game_started_ms == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        game_started_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+    publish_game_snapshot(NULL, 0, 0);
 
     // ***************************** End Server Setup ***********************************
 
     // ************************** Server -> Main Game Loop **********************************
     while (true) {
-        while (is_player_ready(player_01) == false) {
-            read_from_player_socket(player_01->socket->connection_fd, buffer);
-            
-            char* token = get_first_token_from_buffer(buffer);
-            int width, height, extraneous_input;
-            switch (*token) {
-                case 'B':
-                    if (sscanf(buffer, "B %d %d %d", &width, &height, &extraneous_input) == 2 && width >= 10 && height >= 10) {
-                        Board *board01 = create_board(width, height);
-                        Board *board02 = create_board(width, height);
-                        player_01->board = board01;
-                        player_02->board = board02;
-
-                        player_01->ready = true;
-                        pstdout("Player 01 is ready to begin!");
-                        send_response(player_01->socket->connection_fd, ACK);
-                    }
-                    else {
-                        send_response(player_01->socket->connection_fd, INVALID_BEGIN_PACKET_TYPE_INVALID_PARAMETERS);
-                    }
-                    break;
-                case 'F':
-                    send_response(player_01->socket->connection_fd, HALT_LOSS);
-                    send_response(player_02->socket->connection_fd, HALT_WIN);
-                    free(token);
-                    exit(EXIT_SUCCESS);
-                default:
-                    send_response(player_01->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_BEGIN);
-                    break;
+        // Begin and Initialize packets are handled as they arrive, from either player. Player 2's
+        // board only exists once player 1 has picked the size, so until then its Initialize waits
+        // unread, and so does the first shot of a player whose board is already valid.
+        while (!is_board_initialized(player_01) || !is_board_initialized(player_02)) {
+            Player *setup_players[2];
+            bool readable[2];
+            int setup_count = 0;
+            if (!is_player_ready(player_01) || !is_board_initialized(player_01)) {
+                setup_players[setup_count++] = player_01;
             }
-            free(token);
-        }
-
-        while (is_player_ready(player_02) == false) {
-            read_from_player_socket(player_02->socket->connection_fd, buffer);
-            
-            char *token = get_first_token_from_buffer(buffer);
-            int extraneous_input;
-
-            switch (*token) {
-                case 'B':
-                    if (sscanf(buffer, "B %d", &extraneous_input) == 1) {
-                        send_response(player_02->socket->connection_fd, INVALID_BEGIN_PACKET_TYPE_INVALID_PARAMETERS);
-                        break;
-                    }
-                    else {
-                        player_02->ready = true;
-                        pstdout("Player 02 is ready to begin!");
-                        send_response(player_02->socket->connection_fd, ACK);
-                        break;
-                    }
-                case 'F':
-                    send_response(player_02->socket->connection_fd, HALT_LOSS);
-                    send_response(player_01->socket->connection_fd, HALT_WIN);
-                    free(token);
-                    exit(EXIT_SUCCESS);
-                default:
-                    send_response(player_02->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_BEGIN);
-                    break;
+            if (!is_player_ready(player_02) || (player_02->board != NULL && !is_board_initialized(player_02))) {
+                setup_players[setup_count++] = player_02;
             }
-            free(token);
-        }
-        
-        if (is_player_ready(player_01) && is_player_ready(player_02)) {
-            pstdout("Both Players are Ready!");
-        }
-
-        while (player_01->board->initialized == false) {
-            game_process_player_board_initialize(buffer, 1);
-        }
 
-        while (player_02->board->initialized == false) {
-            game_process_player_board_initialize(buffer, 2);
+            wait_for_setup_packets(setup_players, setup_count, readable);
+            for (int i = 0; i < setup_count; i++) {
+                if (!readable[i] || !read_one_player_packet(setup_players[i], buffer)) {
+                    continue;
+                }
+                if (!is_player_ready(setup_players[i])) {
+                    game_process_player_begin_packet(buffer, setup_players[i]->number);
+                }
+                else {
+                    game_process_player_board_initialize(buffer, setup_players[i]->number);
+                }
+            }
         }
 
-        if (player_01->board->initialized == true && player_02->board->initialized == true) {
+        // a restored game that is already under way skips straight to whoever's turn it is
+        if (player_01->board->initialized == true && player_02->board->initialized == true && !player_01->play && !player_02->play) {
             pstdout("Both Players have initialized valid boards!");
 
             pstdout("Player 01's board:");
@@ -285,6 +668,7 @@ int main() {
             
             pstdout("Player 01 will now begin playing! Have fun!");
             player_01->play = true;
+            publish_game_snapshot(NULL, 0, 0);
         }
         
         while (true) {
@@ -300,99 +684,1619 @@ int main() {
         }
     }
 
-    return EXIT_SUCCESS;
+    return EXIT_SUCCESS;
+}
+
+PlayerSocketConnection* initialize_socket_connection(int port) {
+    pstdout("initialize_socket(): Initializing socket for a player on port %d", port);
+
+    PlayerSocketConnection* player_socket = malloc(sizeof(PlayerSocketConnection));
+
+    if (player_socket == NULL) {
+        pstderr("initialize_socket(): Error malloc'ing socket");
+        free(player_socket);
+        return NULL;
+    }
+
+    player_socket->connection_fd = -1;
+    player_socket->unix_listen_fd = -1;
+    player_socket->unix_path[0] = '\0';
+    player_socket->connection_is_unix = false;
+    player_socket->received_fd_count = 0;
+    player_socket->shm = NULL;
+    player_socket->framed = false;
+    player_socket->framed_length = 0;
+
+    if ((player_socket->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+        pstderr("initialize_socket(): Socket for Player FAILED.");
+        free(player_socket);
+        return NULL;
+    }
+
+    int opt = 1;
+    if (setsockopt(player_socket->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        pstderr("initialize_socket(): setsockopt(..., SO_REUSEADDR, ...) failed for a player port.");
+        free(player_socket);
+        return NULL;
+    }
+
+    // no need to use so_reuseport as per Piazza post
+
+    player_socket->port = port;
+
+    player_socket->address.sin_family = AF_INET;
+    player_socket->address.sin_addr.s_addr = INADDR_ANY;
+    player_socket->address.sin_port = htons(port);
+
+    player_socket->address_len = sizeof(player_socket->address);
+
+    if (bind(player_socket->listen_fd, (struct sockaddr *)&player_socket->address, player_socket->address_len) < 0) {
+        pstderr("initialize_socket(): bind failed.");
+        free(player_socket);
+        return NULL;
+    }
+
+    // a client that reconnects with a cookie from an earlier connection sends its first packet with the SYN
+    if (!transport_enable_fast_open(player_socket->listen_fd, server_options.listen_backlog)) {
+        pstdout("initialize_socket(): TCP_FASTOPEN refused, clients connect without it.");
+    }
+    if (listen(player_socket->listen_fd, server_options.listen_backlog) < 0) {
+        pstderr("initialize_socket(): listen failed.");
+        free(player_socket);
+        return NULL;
+    }
+
+    if (server_options.unix_socket_dir != NULL && initialize_unix_listener(player_socket) < 0) {
+        close(player_socket->listen_fd);
+        free(player_socket);
+        return NULL;
+    }
+
+    return player_socket;
+}
+
+// A connection the gateway accepted and handed over in backend mode. There is no listener, so a
+// player who disconnects cannot come back to this game.
+PlayerSocketConnection* initialize_routed_connection(int port, int conn_fd) {
+    PlayerSocketConnection* player_socket = malloc(sizeof(PlayerSocketConnection));
+
+    if (player_socket == NULL) {
+        pstderr("initialize_routed_connection(): Error malloc'ing socket");
+        close(conn_fd);
+        return NULL;
+    }
+
+    struct sockaddr_storage local;
+    socklen_t local_length = sizeof(local);
+    player_socket->port = port;
+    player_socket->listen_fd = -1;
+    player_socket->unix_listen_fd = -1;
+    player_socket->unix_path[0] = '\0';
+    player_socket->address_len = sizeof(player_socket->address);
+    player_socket->connection_fd = conn_fd;
+    player_socket->connection_is_unix = getsockname(conn_fd, (struct sockaddr *)&local, &local_length) == 0 && local.ss_family == AF_UNIX;
+    player_socket->received_fd_count = 0;
+    player_socket->shm = NULL;
+    player_socket->framed = false;
+    player_socket->framed_length = 0;
+    tune_player_connection(conn_fd);
+
+    return player_socket;
+}
+
+// Backend mode: takes matches from gateways and forks a game process for each. Only the child
+// returns, with the players' connections in 'player_fds', and plays the game like a server whose
+// players just connected. The backend stops on SIGTERM or SIGINT and leaves its games running.
+void serve_as_backend(int *player_fds) {
+    int listen_fd = cluster_listen_backend(server_options.backend_path);
+    if (listen_fd < 0) {
+        pstderr("serve_as_backend(): could not listen on '%s'.", server_options.backend_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // the kernel reaps finished games, and an upgrade signal sent to every server is for the games
+    struct sigaction ignore_action = { .sa_handler = SIG_IGN };
+    sigemptyset(&ignore_action.sa_mask);
+    sigaction(SIGCHLD, &ignore_action, NULL);
+    sigaction(SIGUSR2, &ignore_action, NULL);
+    struct sigaction stop_action = { .sa_handler = stop_backend };
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGTERM, &stop_action, NULL);
+    sigaction(SIGINT, &stop_action, NULL);
+
+    pstdout("serve_as_backend(): Waiting for matches on %s.", server_options.backend_path);
+
+    struct pollfd pfds[1 + BACKEND_MAX_GATEWAYS];
+    int gateway_count = 0;
+    long matches = 0;
+    pfds[0] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+
+    while (!backend_stopping) {
+        if (poll(pfds, 1 + gateway_count, -1) < 0) {
+            continue;
+        }
+        if (pfds[0].revents & POLLIN) {
+            int gateway_fd = accept(listen_fd, NULL, NULL);
+            if (gateway_fd >= 0 && gateway_count < BACKEND_MAX_GATEWAYS) {
+                pfds[1 + gateway_count++] = (struct pollfd){ .fd = gateway_fd, .events = POLLIN };
+                pstdout("serve_as_backend(): A gateway connected.");
+            }
+            else if (gateway_fd >= 0) {
+                close(gateway_fd);
+            }
+        }
+
+        for (int i = 1; i <= gateway_count; i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            uint32_t received_match_id;
+            int fds[2];
+            int received = cluster_receive_match(pfds[i].fd, &received_match_id, fds);
+            if (received == 0 || (received < 0 && (pfds[i].revents & (POLLHUP | POLLERR)))) {
+                pstdout("serve_as_backend(): A gateway disconnected.");
+                close(pfds[i].fd);
+                // the last gateway takes this slot and is looked at next
+                pfds[i--] = pfds[gateway_count--];
+                continue;
+            }
+            if (received < 0) {
+                pstderr("serve_as_backend(): dropped a malformed message from a gateway.");
+                continue;
+            }
+
+            fflush(stdout);
+            fflush(stderr);
+            pid_t child = fork();
+            if (child == 0) {
+                close(listen_fd);
+                for (int j = 1; j <= gateway_count; j++) {
+                    close(pfds[j].fd);
+                }
+                struct sigaction default_action = { .sa_handler = SIG_DFL };
+                sigemptyset(&default_action.sa_mask);
+                sigaction(SIGCHLD, &default_action, NULL);
+                sigaction(SIGTERM, &default_action, NULL);
+                sigaction(SIGINT, &default_action, NULL);
+                match_id = received_match_id;
+                player_fds[0] = fds[0];
+                player_fds[1] = fds[1];
+                return;
+            }
+            close(fds[0]);
+            close(fds[1]);
+            if (child < 0) {
+                pstderr("serve_as_backend(): fork() failed, match %u is dropped.", received_match_id);
+                continue;
+            }
+            matches++;
+            pstdout("serve_as_backend(): Match %u is game %d.", received_match_id, (int)child);
+        }
+    }
+
+    close(listen_fd);
+    for (int i = 1; i <= gateway_count; i++) {
+        close(pfds[i].fd);
+    }
+    unlink(server_options.backend_path);
+    pstdout("serve_as_backend(): Stopped after %ld matches, their games keep running.", matches);
+    fflush(stdout);
+    // no end_game(), this process never had a game of its own
+    _exit(EXIT_SUCCESS);
+}
+
+void stop_backend(int signal_number) {
+    (void)signal_number;
+    backend_stopping = 1;
+}
+
+// binds <unix_socket_dir>/battleship-<port>.sock, replacing a socket file left behind by an earlier server
+int initialize_unix_listener(PlayerSocketConnection *player_socket) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    if (snprintf(address.sun_path, sizeof(address.sun_path), TRANSPORT_UNIX_PATH_FORMAT, server_options.unix_socket_dir, player_socket->port) >= (int)sizeof(address.sun_path)) {
+        pstderr("initialize_unix_listener(): socket path in '%s' is too long.", server_options.unix_socket_dir);
+        return -1;
+    }
+
+    if ((player_socket->unix_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        pstderr("initialize_unix_listener(): socket() failed.");
+        return -1;
+    }
+
+    unlink(address.sun_path);
+    if (bind(player_socket->unix_listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(player_socket->unix_listen_fd, server_options.listen_backlog) < 0) {
+        pstderr("initialize_unix_listener(): bind/listen failed for %s.", address.sun_path);
+        close(player_socket->unix_listen_fd);
+        player_socket->unix_listen_fd = -1;
+        return -1;
+    }
+
+    strcpy(player_socket->unix_path, address.sun_path);
+    pstdout("initialize_unix_listener(): Listening on %s", player_socket->unix_path);
+    return player_socket->unix_listen_fd;
+}
+
+// returns the listener with a pending connection, or -1 once 'timeout_ms' ran out (-1 waits forever)
+int wait_for_player_listener(PlayerSocketConnection *player_socket, int timeout_ms) {
+    struct pollfd pfds[2] = {
+        { .fd = player_socket->listen_fd, .events = POLLIN },
+        { .fd = player_socket->unix_listen_fd, .events = POLLIN }
+    };
+    int count = player_socket->unix_listen_fd >= 0 ? 2 : 1;
+
+    if (poll(pfds, count, timeout_ms) <= 0) {
+        return -1;
+    }
+    return (pfds[0].revents & POLLIN) ? pfds[0].fd : pfds[1].fd;
+}
+
+int accept_player_connection(PlayerSocketConnection *player_socket) {
+    int player_number = player_socket->port == PLAYER01_PORT ? 1 : 2;
+    uint64_t span = trace_span_begin(TRACE_ACCEPT, game_id, player_number);
+
+    int listen_fd = player_socket->unix_listen_fd >= 0 ? wait_for_player_listener(player_socket, -1) : player_socket->listen_fd;
+    if (listen_fd < 0) {
+        // interrupted, errno is still EINTR from poll()
+        trace_span_end(TRACE_ACCEPT, span, game_id, player_number);
+        return -1;
+    }
+    player_socket->connection_is_unix = listen_fd == player_socket->unix_listen_fd;
+    player_socket->received_fd_count = 0;
+    // a resumed connection starts unframed and asks again
+    player_socket->framed = false;
+    player_socket->framed_length = 0;
+    if (player_socket->connection_is_unix) {
+        player_socket->connection_fd = accept(listen_fd, NULL, NULL);
+    }
+    else {
+        player_socket->connection_fd = accept(listen_fd, (struct sockaddr *)&player_socket->address, &player_socket->address_len);
+    }
+    if (player_socket->connection_fd >= 0) {
+        tune_player_connection(player_socket->connection_fd);
+    }
+
+    trace_span_end(TRACE_ACCEPT, span, game_id, player_number);
+    return player_socket->connection_fd;
+}
+
+void close_player_connection(PlayerSocketConnection *player_socket) {
+    if (player_socket->shm != NULL) {
+        transport_detach_shm(player_socket->shm);
+        memory_free(&game_memory, player_socket->shm, sizeof(Transport));
+        memory_release(&game_memory, sizeof(ShmChannel));
+        player_socket->shm = NULL;
+    }
+    discard_received_fds(player_socket);
+    if (player_socket->connection_fd >= 0) {
+        // closing over unread packets sends a reset, and that drops the replies the client has not
+        // read yet: packets a client pipelined past the end of the game, or the shared-memory
+        // handshake of a player the game ended for before it got to read it
+        if (player_socket->framed || player_socket->connection_is_unix) {
+            char discarded[BUFFER_SIZE];
+            shutdown(player_socket->connection_fd, SHUT_WR);
+            while (recv(player_socket->connection_fd, discarded, sizeof(discarded), MSG_DONTWAIT) > 0) {
+            }
+        }
+        close(player_socket->connection_fd);
+    }
+    player_socket->connection_fd = -1;
+}
+
+// Kernel receive timestamps for the wakeup latency, and in busy-poll mode SO_BUSY_POLL and
+// TCP_NODELAY. The options live on the socket, so a connection handed over by an upgrade keeps them.
+void tune_player_connection(int conn_fd) {
+    int enable = 1;
+    setsockopt(conn_fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+    if (server_options.busy_poll_spin_us > 0 && !transport_tune_busy_poll_socket(conn_fd)) {
+        pstdout("tune_player_connection(): SO_BUSY_POLL refused, spinning on the socket without it.");
+    }
+}
+
+// Pins the game thread and switches every receive to spin-then-block. Called once the analytics
+// writer is running, so only this thread lands on the pinned core.
+void start_busy_poll_mode(void) {
+    transport_set_busy_poll(server_options.busy_poll_spin_us * 1000);
+    if (server_options.busy_poll_cpu >= 0 && !transport_pin_to_cpu(server_options.busy_poll_cpu)) {
+        pstderr("Could not pin the game thread to CPU %d, leaving it to the scheduler.", server_options.busy_poll_cpu);
+    }
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        pstderr("Busy-poll mode on a single CPU spins while the players wait for it, expect worse latency.");
+    }
+    // a log line per packet would otherwise be a write() on the turn path
+    static char log_buffer[1 << 16];
+    setvbuf(stdout, log_buffer, _IOFBF, sizeof(log_buffer));
+    pstdout("Busy-poll mode: spinning %ld us before blocking, game thread on CPU %d.", server_options.busy_poll_spin_us, server_options.busy_poll_cpu);
+}
+
+void discard_received_fds(PlayerSocketConnection *player_socket) {
+    for (int i = 0; i < player_socket->received_fd_count; i++) {
+        close(player_socket->received_fds[i]);
+    }
+    player_socket->received_fd_count = 0;
+}
+
+PlayerSocketConnection *player_socket_for_fd(int conn_fd) {
+    int player_number = player_number_for_fd(conn_fd);
+    if (player_number == 0) {
+        return NULL;
+    }
+    return player_number == 1 ? player_01->socket : player_02->socket;
+}
+
+void send_response(int conn_fd, const char *packet) {
+    int player_number = player_number_for_fd(conn_fd);
+    uint64_t span = trace_span_begin(TRACE_SEND, game_id, player_number);
+    PlayerSocketConnection *player_socket = player_socket_for_fd(conn_fd);
+    if (packet[0] == 'E') {
+        server_counters.error_replies[player_number]++;
+    }
+    if (server_latency.read_at_ns[player_number] != 0) {
+        latency_record(&server_latency.turn, trace_now_ns() - server_latency.read_at_ns[player_number]);
+        server_latency.read_at_ns[player_number] = 0;
+    }
+    if (player_socket != NULL && player_socket->shm != NULL) {
+        transport_send(player_socket->shm, packet, strlen(packet));
+    }
+    else if (player_socket != NULL && player_socket->framed) {
+        struct iovec iov[2] = { { .iov_base = (void *)packet, .iov_len = strlen(packet) }, { .iov_base = "\n", .iov_len = 1 } };
+        struct msghdr message = { .msg_iov = iov, .msg_iovlen = 2 };
+        sendmsg(conn_fd, &message, MSG_NOSIGNAL);
+    }
+    else {
+        // MSG_NOSIGNAL so a peer that dropped mid-game does not kill the server with SIGPIPE
+        send(conn_fd, packet, strlen(packet), MSG_NOSIGNAL);
+    }
+    trace_span_end(TRACE_SEND, span, game_id, player_number);
+    // after an 'H' there is no seat left to take back
+    if (packet[0] != 'H') {
+        issue_resume_token(player_number);
+    }
+}
+
+// Pushes "T <token>" once, behind the first reply the player gets after pairing. Sent any
+// earlier, it would be read as the answer to the client's first packet. Library clients open
+// with 'P', so their token arrives framed as soon as both players are in.
+void issue_resume_token(int player_number) {
+    Player *player = player_number == 1 ? player_01 : player_number == 2 ? player_02 : NULL;
+    if (player == NULL || player->resume_token_issued || player->resume_token[0] == '\0') {
+        return;
+    }
+    player->resume_token_issued = true;
+
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "T %s", player->resume_token);
+    send_response(player->socket->connection_fd, response);
+}
+
+void send_shot_response(int conn_fd, int remaining_ships, const char miss_or_hit) {
+    if (miss_or_hit != 'M' && miss_or_hit != 'H') {
+        pstderr("send_shot_response(): 'miss_or_hit' input '%c' is invalid!", miss_or_hit);
+        return;
+    }
+    int player_number = player_number_for_fd(conn_fd);
+    uint64_t span = trace_span_begin(TRACE_FORMAT_RESPONSE, game_id, player_number);
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "R %d %c", remaining_ships, miss_or_hit);
+    trace_span_end(TRACE_FORMAT_RESPONSE, span, game_id, player_number);
+    send_response(conn_fd, response);
+}
+
+// returns the number of bytes read, 0 or less means the player hung up or the read failed
+int read_from_player_socket(int socket_fd, char *buffer) {
+    int player_number = player_number_for_fd(socket_fd);
+
+    // includes the time spent waiting on the client, compare against the spans that follow
+    PlayerSocketConnection *player_socket = player_socket_for_fd(socket_fd);
+    uint64_t span = trace_span_begin(TRACE_READ, game_id, player_number);
+    struct timespec wait_started;
+    clock_gettime(CLOCK_REALTIME, &wait_started);
+    int64_t queued_realtime_ns = 0;
+    int nbytes;
+    if (player_socket != NULL && player_socket->shm != NULL) {
+        nbytes = transport_receive(player_socket->shm, buffer, BUFFER_SIZE);
+    }
+    else if (player_socket != NULL && player_socket->framed) {
+        nbytes = receive_framed_packet(player_socket, socket_fd, buffer, &queued_realtime_ns);
+    }
+    else if (player_socket != NULL) {
+        nbytes = receive_socket_packet(player_socket, socket_fd, buffer, BUFFER_SIZE - 1, &queued_realtime_ns);
+    }
+    else {
+        nbytes = read(socket_fd, buffer, BUFFER_SIZE - 1);
+    }
+    int read_errno = errno;
+    trace_span_end(TRACE_READ, span, game_id, player_number);
+
+    // a packet that was queued before the wait began measures the game, not the wakeup
+    int64_t wait_started_ns = (int64_t)wait_started.tv_sec * 1000000000LL + wait_started.tv_nsec;
+    if (nbytes > 0 && queued_realtime_ns >= wait_started_ns) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int64_t wakeup_ns = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec - queued_realtime_ns;
+        latency_record(&server_latency.wakeup, wakeup_ns > 0 ? (uint64_t)wakeup_ns : 0);
+    }
+    // terminating the packet is all the parsers need, no need to clear the whole buffer first
+    buffer[nbytes > 0 ? nbytes : 0] = '\0';
+    if (nbytes < 0 && read_errno == EINTR) {
+        // a signal woke the read up before anything arrived, the caller decides what to do
+    }
+    else if (nbytes <= 0) {
+        pstdout("Socket read error.");
+    }
+    else if (player_number > 0) {
+        server_counters.packets_received[player_number]++;
+        server_latency.read_at_ns[player_number] = trace_now_ns();
+    }
+    errno = read_errno;
+    return nbytes;
+}
+
+// Reads one packet from a TCP or Unix socket and sets 'queued_realtime_ns' to the kernel's receive
+// timestamp, if the socket has one. In busy-poll mode the socket is polled without blocking until
+// the spin budget runs out, and only then does the read block.
+int receive_socket_packet(PlayerSocketConnection *player_socket, int socket_fd, char *buffer, int size, int64_t *queued_realtime_ns) {
+    // a Unix socket packet can carry the fds of a shared-memory channel
+    char control[CMSG_SPACE(SHM_HANDSHAKE_FD_COUNT * sizeof(int)) + CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control };
+
+    long spin_ns = transport_busy_poll_ns();
+    uint64_t deadline = spin_ns > 0 ? trace_now_ns() + spin_ns : 0;
+    int flags = MSG_CMSG_CLOEXEC | (spin_ns > 0 ? MSG_DONTWAIT : 0);
+    int nbytes;
+    while (true) {
+        message.msg_controllen = sizeof(control);
+        nbytes = (int)recvmsg(socket_fd, &message, flags);
+        if (nbytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || !(flags & MSG_DONTWAIT)) {
+            break;
+        }
+        // the same as a signal waking a blocking read up
+        if (upgrade_requested && !upgrade_blocked) {
+            errno = EINTR;
+            break;
+        }
+        if (trace_now_ns() >= deadline) {
+            flags &= ~MSG_DONTWAIT;
+        }
+    }
+    int read_errno = errno;
+
+    discard_received_fds(player_socket);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); nbytes > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec queued;
+            memcpy(&queued, CMSG_DATA(cmsg), sizeof(queued));
+            *queued_realtime_ns = (int64_t)queued.tv_sec * 1000000000LL + queued.tv_nsec;
+        }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (player_socket->connection_is_unix && player_socket->received_fd_count < SHM_HANDSHAKE_FD_COUNT) {
+                    player_socket->received_fds[player_socket->received_fd_count++] = fd;
+                }
+                else {
+                    close(fd);
+                }
+            }
+        }
+    }
+    errno = read_errno;
+    return nbytes;
+}
+
+// Takes the next newline-terminated packet off a framed connection. Packets a client pipelined
+// arrive together, the ones after the first wait in framed_input and cost no further syscall.
+int receive_framed_packet(PlayerSocketConnection *player_socket, int socket_fd, char *buffer, int64_t *queued_realtime_ns) {
+    char *input = player_socket->framed_input;
+
+    while (true) {
+        char *end = memchr(input, '\n', player_socket->framed_length);
+        // a line that fills the whole buffer is passed on as it is, the parsers reject it
+        if (end != NULL || player_socket->framed_length == BUFFER_SIZE - 1) {
+            int length = end != NULL ? (int)(end - input) : player_socket->framed_length;
+            int consumed = end != NULL ? length + 1 : length;
+            memcpy(buffer, input, length);
+            player_socket->framed_length -= consumed;
+            memmove(input, input + consumed, player_socket->framed_length);
+            // an empty line is no packet, and a length of 0 would read as a hang-up
+            if (length > 0) {
+                return length;
+            }
+            continue;
+        }
+
+        int nbytes = receive_socket_packet(player_socket, socket_fd, input + player_socket->framed_length,
+                                           BUFFER_SIZE - 1 - player_socket->framed_length, queued_realtime_ns);
+        if (nbytes <= 0) {
+            return nbytes;
+        }
+        player_socket->framed_length += nbytes;
+    }
+}
+
+// Reads the next game packet from a player. Resume packets are answered here, and a dropped
+// connection holds the player's seat for the grace window before the game is given up.
+void read_player_packet(Player *player, char *buffer) {
+    while (!read_one_player_packet(player, buffer)) {
+    }
+}
+
+// One read of read_player_packet(). True with a game packet in 'buffer', false when the read was
+// interrupted or only carried a packet the server answers itself, so a caller that waits on both
+// players goes back to waiting instead of blocking on this one.
+bool read_one_player_packet(Player *player, char *buffer) {
+    bool resume_enabled = server_options.resume_grace_seconds > 0;
+
+    handle_pending_upgrade();
+
+    int nbytes = read_from_player_socket(player->socket->connection_fd, buffer);
+    if (nbytes < 0 && errno == EINTR) {
+        return false;
+    }
+    if (nbytes <= 0) {
+        if (!resume_enabled) {
+            record_game_end(player == player_01 ? player_02 : player_01, GAME_END_DISCONNECT);
+            exit(EXIT_FAILURE);
+        }
+        if (wait_for_player_reconnect(player)) {
+            return false;
+        }
+
+        Player *other_player = player == player_01 ? player_02 : player_01;
+        pstdout("read_player_packet(): Player %d did not reconnect in time and forfeits.", player->number);
+        send_response(other_player->socket->connection_fd, HALT_WIN);
+        record_game_end(other_player, GAME_END_DISCONNECT);
+        exit(EXIT_SUCCESS);
+    }
+
+    // a player that stayed under its limits until both buckets refilled starts over without strikes
+    bool rested = player->strikes > 0 && is_bucket_full(&player->packet_bucket) && is_bucket_full(&player->expensive_bucket);
+
+    // rejected before anything looks at the packet, and without a log line per packet
+    if (!take_tokens(&player->packet_bucket, 1)) {
+        server_counters.rate_limited_packets[player->number]++;
+        record_rate_limit_strike(player);
+        return false;
+    }
+    if (rested) {
+        pstdout("read_player_packet(): Player %d is back under its rate limit after %d rejected packets.", player->number, player->strikes);
+        player->strikes = 0;
+    }
+    if (server_options.log_packets) {
+        pstdout("read_player_packet(): Received: %s", buffer);
+    }
+
+    if (player->socket->connection_is_unix && player->socket->shm == NULL && strcmp(buffer, "M") == 0) {
+        attach_shared_memory_transport(player);
+        return false;
+    }
+    discard_received_fds(player->socket);
+
+    if (player->socket->shm == NULL && !player->socket->framed && strcmp(buffer, "P") == 0) {
+        // the 'A' is the first framed reply
+        player->socket->framed = true;
+        send_response(player->socket->connection_fd, ACK);
+        pstdout("read_player_packet(): Player %d switched to framed packets.", player->number);
+        return false;
+    }
+
+    if (resume_enabled && is_resume_packet(buffer)) {
+        // the answer is the token, there is nothing left to push behind it
+        player->resume_token_issued = true;
+        char response[BUFFER_SIZE];
+        snprintf(response, sizeof(response), "T %s", player->resume_token);
+        send_response(player->socket->connection_fd, response);
+        return false;
+    }
+
+    return true;
+}
+
+// Waits until at least one of the players the setup phase is waiting on has something to read and
+// sets 'readable' for each of them. A detached player counts as readable, its read holds the seat.
+// A framed line or a shared-memory packet that is already waiting counts without a poll(), and in
+// busy-poll mode the poll() spins for the budget before it blocks.
+void wait_for_setup_packets(Player **players, int count, bool *readable) {
+    struct pollfd pfds[4];
+    int owners[4];
+    long spin_ns = transport_busy_poll_ns();
+    uint64_t deadline = spin_ns > 0 ? trace_now_ns() + spin_ns : 0;
+
+    while (true) {
+        handle_pending_upgrade();
+
+        bool any_readable = false;
+        int pfd_count = 0;
+        for (int i = 0; i < count; i++) {
+            PlayerSocketConnection *player_socket = players[i]->socket;
+            readable[i] = player_socket->connection_fd < 0
+                          || (player_socket->framed && memchr(player_socket->framed_input, '\n', player_socket->framed_length) != NULL)
+                          || (player_socket->shm != NULL && transport_begin_wait(player_socket->shm));
+            any_readable = any_readable || readable[i];
+            if (player_socket->shm != NULL) {
+                pfds[pfd_count] = (struct pollfd){ .fd = player_socket->shm->rx_eventfd, .events = POLLIN };
+                owners[pfd_count++] = -1;
+            }
+            pfds[pfd_count] = (struct pollfd){ .fd = player_socket->connection_fd, .events = POLLIN };
+            owners[pfd_count++] = i;
+        }
+
+        int ready = any_readable ? 0 : poll(pfds, pfd_count, spin_ns > 0 && trace_now_ns() < deadline ? 0 : -1);
+        for (int i = 0; i < count; i++) {
+            if (players[i]->socket->shm != NULL) {
+                transport_end_wait(players[i]->socket->shm);
+            }
+        }
+        // an eventfd only says to look at the ring again, the socket of a shared-memory player
+        // only says it hung up
+        for (int k = 0; k < pfd_count && ready > 0; k++) {
+            if (pfds[k].revents != 0 && owners[k] >= 0) {
+                readable[owners[k]] = true;
+                any_readable = true;
+            }
+        }
+        if (any_readable) {
+            return;
+        }
+    }
+}
+
+long monotonic_time_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// Keeps the player's seat while it is detached. Only a new connection on the player's own port
+// that opens with "T <token>" can take the seat back; its board and turn state are untouched.
+// The game is a single thread, so the other player waits too until the seat is taken back or
+// the grace period runs out.
+bool wait_for_player_reconnect(Player *player) {
+    PlayerSocketConnection *player_socket = player->socket;
+    char buffer[BUFFER_SIZE];
+
+    close_player_connection(player_socket);
+    // the next connection on this seat is a stranger until it shows the token, it is never sent one
+    player->resume_token_issued = true;
+    if (player_socket->listen_fd < 0 && player_socket->unix_listen_fd < 0) {
+        pstdout("wait_for_player_reconnect(): Player %d left a game routed by the gateway, there is no listener to come back to.", player->number);
+        return false;
+    }
+
+    if (player->board != NULL && !pack_board(player->board)) {
+        pstderr("wait_for_player_reconnect(): could not pack board for Player %d, keeping it as is.", player->number);
+    }
+    publish_memory_usage("board packed");
+
+    pstdout("wait_for_player_reconnect(): Player %d disconnected, holding seat for %d seconds.", player->number, server_options.resume_grace_seconds);
+
+    long deadline = monotonic_time_ms() + server_options.resume_grace_seconds * 1000L;
+
+    while (monotonic_time_ms() < deadline) {
+        if (wait_for_player_listener(player_socket, (int)(deadline - monotonic_time_ms())) < 0) {
+            continue;
+        }
+        if (accept_player_connection(player_socket) < 0) {
+            continue;
+        }
+
+        // the first packet on the new connection has to be the resume token
+        struct pollfd pfd = { .fd = player_socket->connection_fd, .events = POLLIN };
+        long remaining = deadline - monotonic_time_ms();
+        if (remaining > 0 && poll(&pfd, 1, (int)remaining) > 0
+            && read_from_player_socket(player_socket->connection_fd, buffer) > 0
+            && resume_token_matches(buffer, player->resume_token)) {
+
+            if (player->board != NULL && player->board->packed != NULL && !unpack_board(player->board)) {
+                pstderr("wait_for_player_reconnect(): could not restore board for Player %d.", player->number);
+                return false;
+            }
+            publish_memory_usage("board restored");
+            pstdout("wait_for_player_reconnect(): Player %d resumed its session.", player->number);
+            send_response(player_socket->connection_fd, ACK);
+            return true;
+        }
+
+        pstdout("wait_for_player_reconnect(): rejected a connection for Player %d without a valid token.", player->number);
+        send_response(player_socket->connection_fd, INVALID_RESUME_TOKEN);
+        close_player_connection(player_socket);
+    }
+
+    return false;
+}
+
+// Switches a Unix socket player to the shared-memory rings whose fds came with its 'M' packet.
+// The 'A' still goes over the socket, every packet after it goes through the rings.
+void attach_shared_memory_transport(Player *player) {
+    PlayerSocketConnection *player_socket = player->socket;
+    // the mapped channel counts against the game as well
+    Transport *transport = NULL;
+    if (memory_reserve(&game_memory, sizeof(ShmChannel))) {
+        transport = memory_alloc(&game_memory, sizeof(Transport));
+        if (transport == NULL) {
+            memory_release(&game_memory, sizeof(ShmChannel));
+        }
+    }
+
+    if (transport == NULL || player_socket->received_fd_count != SHM_HANDSHAKE_FD_COUNT
+        || !transport_attach_shm_server(transport, player_socket->connection_fd, player_socket->received_fds)) {
+        pstdout("attach_shared_memory_transport(): rejected a shared-memory channel from Player %d.", player->number);
+        if (transport != NULL) {
+            memory_free(&game_memory, transport, sizeof(Transport));
+            memory_release(&game_memory, sizeof(ShmChannel));
+        }
+        discard_received_fds(player_socket);
+        send_response(player_socket->connection_fd, INVALID_SHARED_MEMORY_CHANNEL);
+        return;
+    }
+
+    // the transport owns the fds now
+    player_socket->received_fd_count = 0;
+    // the client reads the rings once it has this 'A', a token pushed behind it would be lost on the socket
+    bool token_issued = player->resume_token_issued;
+    player->resume_token_issued = true;
+    send_response(player_socket->connection_fd, ACK);
+    player_socket->shm = transport;
+    player->resume_token_issued = token_issued;
+    pstdout("attach_shared_memory_transport(): Player %d switched to the shared-memory transport.", player->number);
+    publish_memory_usage("shared-memory channel mapped");
+}
+
+void initialize_token_bucket(TokenBucket *bucket, double rate, double burst) {
+    bucket->rate = rate;
+    bucket->burst = burst > 0 ? burst : rate;
+    bucket->tokens = bucket->burst;
+    bucket->last_refill_ms = monotonic_time_ms();
+}
+
+static void refill_tokens(TokenBucket *bucket) {
+    long now = monotonic_time_ms();
+    bucket->tokens += (now - bucket->last_refill_ms) * bucket->rate / 1000.0;
+    if (bucket->tokens > bucket->burst) {
+        bucket->tokens = bucket->burst;
+    }
+    bucket->last_refill_ms = now;
+}
+
+bool take_tokens(TokenBucket *bucket, double cost) {
+    if (bucket->rate <= 0) {
+        return true;
+    }
+
+    refill_tokens(bucket);
+
+    // an operation bigger than the whole burst still goes through once the bucket is full
+    if (cost > bucket->burst) {
+        cost = bucket->burst;
+    }
+    if (bucket->tokens < cost) {
+        return false;
+    }
+    bucket->tokens -= cost;
+    return true;
+}
+
+// true once the bucket has refilled to its burst, a disabled bucket is always full
+bool is_bucket_full(TokenBucket *bucket) {
+    if (bucket->rate <= 0) {
+        return true;
+    }
+    refill_tokens(bucket);
+    return bucket->tokens >= bucket->burst;
+}
+
+// I validation and queries cost one token per EXPENSIVE_UNIT_CELLS cells of the board they walk.
+// Answers E 502 and counts a strike when the player is over its budget.
+bool admit_expensive_operation(Player *player, Board *board) {
+    double cells = board != NULL ? (double)board->width * board->height : 0;
+    double cost = cells > EXPENSIVE_UNIT_CELLS ? cells / EXPENSIVE_UNIT_CELLS : 1;
+
+    if (take_tokens(&player->expensive_bucket, cost)) {
+        return true;
+    }
+    server_counters.rate_limited_expensive[player->number]++;
+    record_rate_limit_strike(player);
+    return false;
+}
+
+// Answers a rejected packet with E 502. A player that keeps going past its limits is
+// disconnected with E 503 and forfeits, there is no resume for it. Strikes only add up while the
+// player keeps pushing, read_one_player_packet() forgives them once both buckets are full again.
+void record_rate_limit_strike(Player *player) {
+    Player *other_player = player == player_01 ? player_02 : player_01;
+
+    if (player->strikes++ == 0) {
+        pstdout("record_rate_limit_strike(): Player %d is over its rate limit, rejecting packets.", player->number);
+    }
+    if (server_options.max_strikes <= 0 || player->strikes < server_options.max_strikes) {
+        send_response(player->socket->connection_fd, RATE_LIMIT_EXCEEDED);
+        return;
+    }
+
+    pstdout("record_rate_limit_strike(): Player %d disconnected after %d rejected packets and forfeits.", player->number, player->strikes);
+    server_counters.disconnected_for_abuse[player->number]++;
+    send_response(player->socket->connection_fd, RATE_LIMIT_DISCONNECT);
+    close_player_connection(player->socket);
+    send_response(other_player->socket->connection_fd, HALT_WIN);
+    record_game_end(other_player, GAME_END_RATE_LIMIT);
+    exit(EXIT_SUCCESS);
+}
+
+// "<rate>" or "<rate>/<burst>", a burst defaults to twice the rate
+bool parse_rate_option(const char *argument, double *rate, double *burst) {
+    int parsed = sscanf(argument, "%lf/%lf", rate, burst);
+    if (parsed < 1 || *rate < 0 || (parsed == 2 && *burst < 0)) {
+        return false;
+    }
+    if (parsed == 1) {
+        *burst = 2 * *rate;
+    }
+    return true;
+}
+
+void write_server_counters(void) {
+    FILE *fp = fopen(server_options.counters_path, "w");
+    if (fp == NULL) {
+        pstderr("write_server_counters(): could not open %s.", server_options.counters_path);
+        return;
+    }
+
+    struct { const char *name; const char *help; long *values; } counters[] = {
+        { "battleship_packets_received_total", "Packets read from the player.", server_counters.packets_received },
+        { "battleship_error_replies_total", "E replies sent to the player.", server_counters.error_replies },
+        { "battleship_rate_limited_packets_total", "Packets rejected by the per-player packet bucket.", server_counters.rate_limited_packets },
+        { "battleship_rate_limited_expensive_total", "I validations and queries rejected by the expensive operation bucket.", server_counters.rate_limited_expensive },
+        { "battleship_disconnected_for_abuse_total", "Players disconnected for going over their limits.", server_counters.disconnected_for_abuse }
+    };
+
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", counters[i].name, counters[i].help, counters[i].name);
+        for (int player = 1; player <= 2; player++) {
+            fprintf(fp, "%s{game=\"%d\",player=\"%d\"} %ld\n", counters[i].name, game_id, player, counters[i].values[player]);
+        }
+    }
+
+    struct { const char *name; const char *help; size_t value; } gauges[] = {
+        { "battleship_game_memory_bytes", "Bytes allocated for this game.", memory_account_used(&game_memory) },
+        { "battleship_game_memory_peak_bytes", "Most bytes this game has held at once.", memory_account_peak(&game_memory) },
+        { "battleship_game_memory_limit_bytes", "Per-game memory quota, 0 for none.", server_options.game_memory_limit }
+    };
+
+    for (size_t i = 0; i < sizeof(gauges) / sizeof(gauges[0]); i++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n", gauges[i].name, gauges[i].help, gauges[i].name);
+        fprintf(fp, "%s{game=\"%d\"} %zu\n", gauges[i].name, game_id, gauges[i].value);
+    }
+
+    struct { const char *name; const char *help; LatencyHistogram *histogram; } summaries[] = {
+        { "battleship_wakeup_latency_seconds", "From the kernel queueing a packet the server was waiting for to the read returning it.", &server_latency.wakeup },
+        { "battleship_turn_latency_seconds", "From reading a packet to sending the first reply to it.", &server_latency.turn }
+    };
+    const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char *mode = server_options.busy_poll_spin_us > 0 ? "busy-poll" : "blocking";
+
+    for (size_t i = 0; i < sizeof(summaries) / sizeof(summaries[0]); i++) {
+        LatencyHistogram *histogram = summaries[i].histogram;
+        fprintf(fp, "# HELP %s %s\n# TYPE %s summary\n", summaries[i].name, summaries[i].help, summaries[i].name);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            fprintf(fp, "%s{game=\"%d\",mode=\"%s\",quantile=\"%g\"} %.9f\n", summaries[i].name, game_id, mode, quantiles[q],
+                    latency_percentile(histogram, quantiles[q]) / 1e9);
+        }
+        fprintf(fp, "%s_sum{game=\"%d\",mode=\"%s\"} %.9f\n", summaries[i].name, game_id, mode, histogram->sum_ns / 1e9);
+        fprintf(fp, "%s_count{game=\"%d\",mode=\"%s\"} %llu\n", summaries[i].name, game_id, mode, (unsigned long long)histogram->count);
+    }
+
+    struct { const char *name; const char *help; double value; } cpu_counters[] = {
+        { "battleship_expensive_cpu_seconds_total", "CPU time spent on print_board(), queries and I packets.", game_cpu_budget.spent_ns / 1e9 },
+        { "battleship_expensive_slices_total", "Slices those operations ran in, each followed by a yield.", (double)game_cpu_budget.slices },
+        { "battleship_expensive_throttled_seconds_total", "Time the game slept after going over its CPU budget.", game_cpu_budget.throttled_ns / 1e9 }
+    };
+    for (size_t i = 0; i < sizeof(cpu_counters) / sizeof(cpu_counters[0]); i++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", cpu_counters[i].name, cpu_counters[i].help, cpu_counters[i].name);
+        fprintf(fp, "%s{game=\"%d\"} %.9g\n", cpu_counters[i].name, game_id, cpu_counters[i].value);
+    }
+    if (memory_ledger.slots != NULL) {
+        fprintf(fp, "# HELP battleship_host_memory_bytes Bytes allocated by every server sharing the memory ledger.\n# TYPE battleship_host_memory_bytes gauge\n");
+        fprintf(fp, "battleship_host_memory_bytes %zu\n", memory_ledger_total(&memory_ledger));
+        fprintf(fp, "# HELP battleship_host_memory_limit_bytes Host-wide memory quota, 0 for none.\n# TYPE battleship_host_memory_limit_bytes gauge\n");
+        fprintf(fp, "battleship_host_memory_limit_bytes %zu\n", server_options.host_memory_limit);
+    }
+    fclose(fp);
+}
+
+// Logs the game's memory after it changed and refreshes the counters file, so the file always
+// shows live usage and not only the totals at exit.
+void publish_memory_usage(const char *reason) {
+    if (memory_ledger.slots != NULL) {
+        pstdout("Memory (%s): game %zu bytes, host %zu bytes.", reason, memory_account_used(&game_memory), memory_ledger_total(&memory_ledger));
+    }
+    else {
+        pstdout("Memory (%s): game %zu bytes.", reason, memory_account_used(&game_memory));
+    }
+
+    if (server_options.counters_path != NULL) {
+        write_server_counters();
+    }
+}
+
+void close_host_memory_ledger(void) {
+    game_memory.ledger = NULL;
+    close_memory_ledger(&memory_ledger);
+}
+
+// Publishes this game for admin views. A restored game republishes everything it inherited.
+void open_admin_snapshot(void) {
+    if (!memory_reserve(&game_memory, game_snapshot_bytes(0))
+        || !open_game_snapshot(&game_snapshot, server_options.snapshot_dir, game_id, server_options.rules.name)) {
+        pstderr("Could not publish a snapshot of game %d in '%s'.", game_id, server_options.snapshot_dir);
+        exit(EXIT_FAILURE);
+    }
+    // registered after end_game() so it runs first, the file is gone before the sockets close
+    atexit(close_admin_snapshot);
+    pstdout("open_admin_snapshot(): Publishing game %d to %s", game_id, game_snapshot.path);
+
+    if (player_01->board != NULL) {
+        size_admin_snapshot(player_01->board->width, player_01->board->height);
+        publish_game_snapshot(player_01, 0, player_01->board->width * player_01->board->height);
+        publish_game_snapshot(player_02, 0, player_02->board->width * player_02->board->height);
+    }
+    publish_game_snapshot(NULL, 0, 0);
+}
+
+void close_admin_snapshot(void) {
+    if (game_snapshot.shared == NULL) {
+        return;
+    }
+    size_t mapped = game_snapshot.mapped;
+    close_game_snapshot(&game_snapshot, false);
+    memory_release(&game_memory, mapped);
+}
+
+// Makes room for both boards' cells. Over the memory quota the listing keeps working and only
+// the board dump is unavailable, the game itself is never refused for its snapshot.
+void size_admin_snapshot(int width, int height) {
+    if (game_snapshot.shared == NULL) {
+        return;
+    }
+    size_t cells = (size_t)width * height;
+    size_t extra = game_snapshot_bytes(cells) - game_snapshot.mapped;
+    if (!memory_reserve(&game_memory, extra)) {
+        pstderr("size_admin_snapshot(): no memory left for a %d x %d board snapshot.", width, height);
+        return;
+    }
+    if (!size_game_snapshot(&game_snapshot, cells)) {
+        memory_release(&game_memory, extra);
+        pstderr("size_admin_snapshot(): could not grow %s.", game_snapshot.path);
+    }
+}
+
+// Copies the summary and 'cell_count' cells of 'changed_player's board from 'first_cell' on into
+// the snapshot, as one update. A NULL player only refreshes the summary.
+void publish_game_snapshot(Player *changed_player, int first_cell, int cell_count) {
+    write_game_snapshot(changed_player, first_cell, cell_count, NULL);
+}
+
+// like publish_game_snapshot(), for cells scattered over the board
+void publish_game_snapshot_cells(Player *changed_player, const int *cells, int cell_count) {
+    write_game_snapshot(changed_player, 0, cell_count, cells);
+}
+
+// copies the cells [first_cell, first_cell + cell_count) of the player's board, or the 'cells' listed
+void write_game_snapshot(Player *changed_player, int first_cell, int cell_count, const int *cells) {
+    if (game_snapshot.shared == NULL) {
+        return;
+    }
+
+    GameSnapshotSummary summary = {0};
+    Player *players[] = { player_01, player_02 };
+    bool connected = true;
+    for (int i = 0; i < 2; i++) {
+        Board *board = players[i]->board;
+        // the shots a player took are logged on the opponent's board
+        Board *target = players[1 - i]->board;
+        summary.ships_remaining[i] = board != NULL && board->initialized ? board->pieces_remaining : 0;
+        summary.shots_taken[i] = target != NULL ? target->shot_count : 0;
+        if (players[i]->play) {
+            summary.turn = players[i]->number;
+        }
+        if (board != NULL && board->initialized && board->pieces_remaining == 0) {
+            summary.phase = GAME_PHASE_OVER;
+        }
+        connected = connected && players[i]->socket->connection_fd >= 0;
+        if (board != NULL) {
+            summary.width = board->width;
+            summary.height = board->height;
+        }
+    }
+    if (summary.phase != GAME_PHASE_OVER) {
+        summary.phase = summary.turn != 0 ? GAME_PHASE_PLAYING : connected ? GAME_PHASE_SETUP : GAME_PHASE_WAITING;
+    }
+    else {
+        summary.turn = 0;
+    }
+
+    Board *board = changed_player != NULL ? changed_player->board : NULL;
+    bool copy_cells = board != NULL && cell_count > 0 && game_snapshot.shared->cells_per_board == (size_t)board->width * board->height;
+
+    snapshot_write_begin(&game_snapshot);
+    game_snapshot.shared->summary = summary;
+    if (copy_cells) {
+        signed char *snapshot_cells = snapshot_board_cells(&game_snapshot, changed_player->number - 1);
+        for (int i = 0; i < cell_count; i++) {
+            int cell = cells != NULL ? cells[i] : first_cell + i;
+            snapshot_cells[cell] = board->packed != NULL ? board->packed[cell] : (signed char)board->cells[cell];
+        }
+    }
+    snapshot_write_end(&game_snapshot);
+}
+
+// Appends the result to the rating log and hands the finished game to the analytics writer:
+// sizes, both fleets, every shot in turn order and the outcome. Only the first call counts, later
+// exits of the same game are not new games.
+void record_game_end(Player *winner, GameEndReason reason) {
+    if (game_recorded) {
+        return;
+    }
+    game_recorded = true;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    record_rated_game(winner, reason, now_ms);
+    if (server_options.analytics_dir == NULL) {
+        return;
+    }
+
+    Board *fired_by_1 = player_02->board;
+    Board *fired_by_2 = player_01->board;
+    int shot_count = (fired_by_1 != NULL ? fired_by_1->shot_count : 0) + (fired_by_2 != NULL ? fired_by_2->shot_count : 0);
+    GameRecord *record = create_game_record(shot_count);
+    if (record == NULL) {
+        pstderr("record_game_end(): out of memory, game %d is not exported.", game_id);
+        return;
+    }
+
+    record->game_id = game_id;
+    record->started_ms = game_started_ms;
+    record->duration_ms = game_started_ms > 0 ? now_ms - game_started_ms : 0;
+    record->width = fired_by_2 != NULL ? fired_by_2->width : 0;
+    record->height = fired_by_2 != NULL ? fired_by_2->height : 0;
+    record->winner = winner != NULL ? winner->number : 0;
+    record->end_reason = reason;
+    snprintf(record->rules, sizeof(record->rules), "%s", server_options.rules.name);
+    record->fleet_size = server_options.rules.fleet_size;
+    memcpy(record->placements[0], player_01->fleet, sizeof(player_01->fleet));
+    memcpy(record->placements[1], player_02->fleet, sizeof(player_02->fleet));
+    fill_game_record_shots(record, fired_by_1, fired_by_2);
+
+    if (!analytics_submit(&analytics_writer, record)) {
+        pstderr("record_game_end(): the analytics queue is full, game %d is not exported.", game_id);
+    }
+}
+
+// A game is rated when both players named themselves, with different names, and one of them won.
+// The leaderboard tool replays the log, this server only appends to it.
+void record_rated_game(Player *winner, GameEndReason reason, int64_t ended_ms) {
+    if (rating_log_fd < 0 || winner == NULL) {
+        return;
+    }
+    Player *loser = winner == player_01 ? player_02 : player_01;
+    if (winner->identity[0] == '\0' || loser->identity[0] == '\0' || strcmp(winner->identity, loser->identity) == 0) {
+        return;
+    }
+
+    RatingLogRecord record = { .ended_ms = ended_ms, .game_id = game_id, .reason = reason };
+    memcpy(record.winner, winner->identity, sizeof(record.winner));
+    memcpy(record.loser, loser->identity, sizeof(record.loser));
+    if (!rating_log_append(rating_log_fd, &record)) {
+        pstderr("record_rated_game(): could not append game %d to '%s'.", game_id, server_options.rating_log_path);
+        return;
+    }
+    pstdout("Rated game %d: %s beat %s.", game_id, winner->identity, loser->identity);
+}
+
+// Reads the optional name that ends a B packet into 'identity', or empties it when there is none.
+// False if anything but one valid name follows.
+bool parse_player_identity(const char *text, char *identity) {
+    char name[RATING_NAME_SIZE];
+    int consumed = 0;
+
+    identity[0] = '\0';
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    if (*text == '\0') {
+        return true;
+    }
+    if (sscanf(text, "%31s%n", name, &consumed) != 1 || !is_valid_player_name(name)) {
+        return false;
+    }
+    for (text += consumed; isspace((unsigned char)*text); text++) {
+    }
+    if (*text != '\0') {
+        return false;
+    }
+    strcpy(identity, name);
+    return true;
+}
+
+// Returns 0 for a bare "Q", 1 for "Q <seq>" with the cursor in 'cursor', and -1 for anything else.
+int parse_query_packet(const char *buffer, int *cursor) {
+    int consumed = 0;
+    int parameters = 1;
+
+    if (sscanf(buffer, " Q %d%n", cursor, &consumed) != 1) {
+        consumed = 0;
+        parameters = 0;
+        if (sscanf(buffer, " Q%n", &consumed) != 0 || consumed == 0) {
+            return -1;
+        }
+    }
+    for (buffer += consumed; isspace((unsigned char)*buffer); buffer++) {
+    }
+    return *buffer == '\0' ? parameters : -1;
+}
+
+void report_latency(void) {
+    struct { const char *name; LatencyHistogram *histogram; } histograms[] = {
+        { "wakeup", &server_latency.wakeup },
+        { "turn", &server_latency.turn }
+    };
+    for (size_t i = 0; i < sizeof(histograms) / sizeof(histograms[0]); i++) {
+        LatencyHistogram *histogram = histograms[i].histogram;
+        if (histogram->count == 0) {
+            continue;
+        }
+        pstdout("Latency (%s, %s): %llu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us.", histograms[i].name,
+                server_options.busy_poll_spin_us > 0 ? "busy-poll" : "blocking", (unsigned long long)histogram->count,
+                latency_percentile(histogram, 0.5) / 1e3, latency_percentile(histogram, 0.99) / 1e3,
+                latency_percentile(histogram, 0.999) / 1e3, histogram->max_ns / 1e3);
+    }
+}
+
+void stop_game_analytics(void) {
+    stop_analytics_writer(&analytics_writer);
+    pstdout("Analytics: %llu games exported, %llu dropped.", (unsigned long long)analytics_writer.written, (unsigned long long)analytics_writer.dropped);
+}
+
+void request_upgrade(int signal_number) {
+    (void)signal_number;
+    upgrade_requested = 1;
+}
+
+// called wherever the server is about to block, returns right away unless an upgrade is due
+void handle_pending_upgrade(void) {
+    if (!upgrade_requested || upgrade_blocked) {
+        return;
+    }
+    upgrade_requested = 0;
+    hand_off_to_new_binary();
+}
+
+// Starts the server binary again and hands it the game: the listeners, both connections, any
+// shared-memory channels and the serialized game state go over a socketpair. Once the new process
+// confirms, this one exits without closing anything. If anything fails the game carries on here.
+void hand_off_to_new_binary(void) {
+    long started = monotonic_time_ms();
+    pstdout("hand_off_to_new_binary(): Upgrade requested, starting %s.", server_binary_path);
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        pstderr("hand_off_to_new_binary(): socketpair() failed, keeping the game.");
+        return;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0) {
+        pstderr("hand_off_to_new_binary(): fork() failed, keeping the game.");
+        close(pair[0]);
+        close(pair[1]);
+        return;
+    }
+
+    if (child == 0) {
+        // only the handoff socket survives the exec, every other fd arrives through it
+        if (pair[1] == HANDOFF_CHILD_FD) {
+            fcntl(HANDOFF_CHILD_FD, F_SETFD, 0);
+        }
+        else if (dup2(pair[1], HANDOFF_CHILD_FD) < 0) {
+            _exit(127);
+        }
+        syscall(SYS_close_range, HANDOFF_CHILD_FD + 1, ~0U, 0);
+
+        char fd_text[16];
+        snprintf(fd_text, sizeof(fd_text), "%d", HANDOFF_CHILD_FD);
+        setenv(HANDOFF_FD_ENV, fd_text, 1);
+        execv(server_binary_path, server_argv);
+        _exit(127);
+    }
+    close(pair[1]);
+
+    HandoffBuffer state;
+    init_handoff_buffer(&state);
+    serialize_game_state(&state);
+
+    char reply = 0;
+    struct pollfd pfd = { .fd = pair[0], .events = POLLIN };
+    bool handed_off = handoff_send(pair[0], &state)
+        && poll(&pfd, 1, HANDOFF_TIMEOUT_MS) > 0
+        && read(pair[0], &reply, 1) == 1 && reply == 'A';
+    // the fds in 'state' are still this process's own until the exit below
+    free_handoff_buffer(&state, false);
+
+    if (handed_off) {
+        pstdout("hand_off_to_new_binary(): Game %d handed over to pid %d in %ld ms.", game_id, (int)child, monotonic_time_ms() - started);
+        if (server_options.trace_path != NULL) {
+            trace_close();
+        }
+        close_host_memory_ledger();
+        fflush(stdout);
+        fflush(stderr);
+        // no end_game(): the connections and socket files belong to the new process now
+        _exit(EXIT_SUCCESS);
+    }
+
+    pstderr("hand_off_to_new_binary(): %s did not take the game over, keeping it.", server_binary_path);
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    close(pair[0]);
 }
 
-PlayerSocketConnection* initialize_socket_connection(int port) {
-    pstdout("initialize_socket(): Initializing socket for a player on port %d", port);
+// Field by field, so the new binary does not need the same struct layouts. Boards go over at one
+// byte per cell, the same way a detached player's board is stored.
+void serialize_game_state(HandoffBuffer *state) {
+    handoff_put_string(state, server_options.rules.name);
+    handoff_put_i32(state, game_id);
+    handoff_put_i64(state, game_started_ms);
+
+    long *counters[] = {
+        server_counters.packets_received, server_counters.error_replies, server_counters.rate_limited_packets,
+        server_counters.rate_limited_expensive, server_counters.disconnected_for_abuse
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        for (int player = 1; player <= 2; player++) {
+            handoff_put_i64(state, counters[i][player]);
+        }
+    }
 
-    PlayerSocketConnection* player_socket = malloc(sizeof(PlayerSocketConnection));
+    serialize_player(state, player_01);
+    serialize_player(state, player_02);
+}
 
-    if (player_socket == NULL) {
-        pstderr("initialize_socket(): Error malloc'ing socket");
-        free(player_socket);
-        return NULL;
+void serialize_player(HandoffBuffer *state, Player *player) {
+    PlayerSocketConnection *player_socket = player->socket;
+
+    handoff_put_i32(state, player->ready);
+    handoff_put_i32(state, player->play);
+    handoff_put_string(state, player->resume_token);
+    handoff_put_i32(state, player->resume_token_issued);
+    handoff_put_double(state, player->packet_bucket.tokens);
+    handoff_put_i64(state, player->packet_bucket.last_refill_ms);
+    handoff_put_double(state, player->expensive_bucket.tokens);
+    handoff_put_i64(state, player->expensive_bucket.last_refill_ms);
+    handoff_put_i32(state, player->strikes);
+    handoff_put_string(state, player->identity);
+    for (int i = 0; i < server_options.rules.fleet_size; i++) {
+        handoff_put_i32(state, player->fleet[i].type);
+        handoff_put_i32(state, player->fleet[i].rotation);
+        handoff_put_i32(state, player->fleet[i].row);
+        handoff_put_i32(state, player->fleet[i].col);
     }
 
-    if ((player_socket->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        pstderr("initialize_socket(): Socket for Player FAILED.");
-        free(player_socket);
-        return NULL;
+    handoff_put_fd(state, player_socket->listen_fd);
+    handoff_put_fd(state, player_socket->unix_listen_fd);
+    handoff_put_string(state, player_socket->unix_path);
+    handoff_put_fd(state, player_socket->connection_fd);
+    handoff_put_i32(state, player_socket->connection_is_unix);
+    // pipelined packets the old binary read but did not get to yet
+    handoff_put_i32(state, player_socket->framed);
+    handoff_put_i32(state, player_socket->framed_length);
+    handoff_put_bytes(state, player_socket->framed_input, player_socket->framed_length);
+
+    // the rings live in the memfd, so packets already queued in them survive the switch
+    handoff_put_i32(state, player_socket->shm != NULL);
+    if (player_socket->shm != NULL) {
+        handoff_put_fd(state, player_socket->shm->channel_fd);
+        handoff_put_fd(state, player_socket->shm->rx_eventfd);
+        handoff_put_fd(state, player_socket->shm->tx_eventfd);
     }
 
-    int opt = 1;
-    if (setsockopt(player_socket->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
-        pstderr("initialize_socket(): setsockopt(..., SO_REUSEADDR, ...) failed for a player port.");
-        free(player_socket);
-        return NULL;
+    Board *board = player->board;
+    handoff_put_i32(state, board != NULL);
+    if (board == NULL) {
+        return;
+    }
+    handoff_put_i32(state, board->width);
+    handoff_put_i32(state, board->height);
+    handoff_put_i32(state, board->initialized);
+    handoff_put_i32(state, board->pieces_remaining);
+    for (int i = 0; i <= server_options.rules.fleet_size; i++) {
+        handoff_put_i32(state, board->ship_cells_remaining[i]);
+    }
+    handoff_put_i32(state, board->shot_count);
+    for (int i = 0; i < board->shot_count; i++) {
+        handoff_put_i32(state, get_logged_shot_entry(board, i));
     }
 
-    // no need to use so_reuseport as per Piazza post
+    size_t cell_count = (size_t)board->width * board->height;
+    if (board->packed != NULL) {
+        handoff_put_bytes(state, board->packed, cell_count);
+        return;
+    }
+    for (size_t i = 0; i < cell_count; i++) {
+        signed char cell = (signed char)board->cells[i];
+        handoff_put_bytes(state, &cell, 1);
+    }
+}
 
-    player_socket->port = port;
+bool restore_game_state(HandoffBuffer *state) {
+    char rules_name[RULE_SET_NAME_LENGTH];
+    handoff_get_string(state, rules_name, sizeof(rules_name));
+    if (strcmp(rules_name, server_options.rules.name) != 0) {
+        pstderr("restore_game_state(): the game uses the %s rule set, this server was started with %s.", rules_name, server_options.rules.name);
+        return false;
+    }
+    game_id = handoff_get_i32(state);
+    game_started_ms = handoff_get_i64(state);
+
+    long *counters[] = {
+        server_counters.packets_received, server_counters.error_replies, server_counters.rate_limited_packets,
+        server_counters.rate_limited_expensive, server_counters.disconnected_for_abuse
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        for (int player = 1; player <= 2; player++) {
+            counters[i][player] = (long)handoff_get_i64(state);
+        }
+    }
 
-    player_socket->address.sin_family = AF_INET;
-    player_socket->address.sin_addr.s_addr = INADDR_ANY;
-    player_socket->address.sin_port = htons(port);
+    delete_player(player_01);
+    delete_player(player_02);
+    player_01 = restore_player(state, 1);
+    player_02 = restore_player(state, 2);
+    return player_01 != NULL && player_02 != NULL && !state->failed;
+}
+
+Player *restore_player(HandoffBuffer *state, int number) {
+    Player *player = initialize_player(number, false);
+    PlayerSocketConnection *player_socket = malloc(sizeof(PlayerSocketConnection));
+    if (player == NULL || player_socket == NULL) {
+        free(player_socket);
+        return player;
+    }
+    player->socket = player_socket;
+
+    player->ready = handoff_get_i32(state);
+    player->play = handoff_get_i32(state);
+    handoff_get_string(state, player->resume_token, sizeof(player->resume_token));
+    player->resume_token_issued = handoff_get_i32(state);
+    player->packet_bucket.tokens = handoff_get_double(state);
+    player->packet_bucket.last_refill_ms = handoff_get_i64(state);
+    player->expensive_bucket.tokens = handoff_get_double(state);
+    player->expensive_bucket.last_refill_ms = handoff_get_i64(state);
+    player->strikes = handoff_get_i32(state);
+    handoff_get_string(state, player->identity, sizeof(player->identity));
+    for (int i = 0; i < server_options.rules.fleet_size; i++) {
+        player->fleet[i].type = handoff_get_i32(state);
+        player->fleet[i].rotation = handoff_get_i32(state);
+        player->fleet[i].row = handoff_get_i32(state);
+        player->fleet[i].col = handoff_get_i32(state);
+    }
 
+    player_socket->port = number == 1 ? PLAYER01_PORT : PLAYER02_PORT;
     player_socket->address_len = sizeof(player_socket->address);
+    player_socket->received_fd_count = 0;
+    player_socket->shm = NULL;
+    player_socket->listen_fd = handoff_get_fd(state);
+    player_socket->unix_listen_fd = handoff_get_fd(state);
+    handoff_get_string(state, player_socket->unix_path, sizeof(player_socket->unix_path));
+    player_socket->connection_fd = handoff_get_fd(state);
+    player_socket->connection_is_unix = handoff_get_i32(state);
+    player_socket->framed = handoff_get_i32(state);
+    player_socket->framed_length = handoff_get_i32(state);
+    if (player_socket->framed_length < 0 || player_socket->framed_length > BUFFER_SIZE - 1) {
+        player_socket->framed_length = 0;
+        state->failed = true;
+        return player;
+    }
+    handoff_get_bytes(state, player_socket->framed_input, player_socket->framed_length);
 
-    if (bind(player_socket->listen_fd, (struct sockaddr *)&player_socket->address, player_socket->address_len) < 0) {
-        pstderr("initialize_socket(): bind failed.");
-        free(player_socket);
-        return NULL;
+    if (handoff_get_i32(state)) {
+        int fds[SHM_HANDSHAKE_FD_COUNT];
+        for (int i = 0; i < SHM_HANDSHAKE_FD_COUNT; i++) {
+            fds[i] = handoff_get_fd(state);
+        }
+
+        Transport *transport = NULL;
+        if (!state->failed && memory_reserve(&game_memory, sizeof(ShmChannel))) {
+            transport = memory_alloc(&game_memory, sizeof(Transport));
+            if (transport == NULL) {
+                memory_release(&game_memory, sizeof(ShmChannel));
+            }
+        }
+        if (transport == NULL || !transport_attach_shm_server(transport, player_socket->connection_fd, fds)) {
+            pstderr("restore_player(): could not map Player %d's shared-memory channel.", number);
+            state->failed = true;
+            return player;
+        }
+        player_socket->shm = transport;
     }
 
-    if (listen(player_socket->listen_fd, 3) < 0) {
-        pstderr("initialize_socket(): listen failed.");
-        free(player_socket);
-        return NULL;
+    if (!handoff_get_i32(state) || state->failed) {
+        return player;
     }
 
-    return player_socket;
+    int width = handoff_get_i32(state);
+    int height = handoff_get_i32(state);
+    size_t board_bytes = board_memory_bytes(width, height);
+    if (board_bytes == 0 || !memory_reserve(&game_memory, board_bytes)) {
+        pstderr("restore_player(): Player %d's %d x %d board is over the memory quota.", number, width, height);
+        state->failed = true;
+        return player;
+    }
+    Board *board = create_board(&server_options.rules, width, height, &game_memory);
+    if (board == NULL) {
+        memory_release(&game_memory, board_bytes);
+        state->failed = true;
+        return player;
+    }
+    player->board = board;
+
+    board->initialized = handoff_get_i32(state);
+    board->pieces_remaining = handoff_get_i32(state);
+    for (int i = 0; i <= server_options.rules.fleet_size; i++) {
+        board->ship_cells_remaining[i] = handoff_get_i32(state);
+    }
+    board->shot_count = handoff_get_i32(state);
+    if (board->shot_count < 0 || board->shot_count > width * height) {
+        state->failed = true;
+        return player;
+    }
+    for (int i = 0; i < board->shot_count; i++) {
+        board->shot_log[i] = handoff_get_i32(state);
+    }
+    for (int i = 0; i < width * height; i++) {
+        signed char cell;
+        handoff_get_bytes(state, &cell, 1);
+        board->cells[i] = cell;
+    }
+    return player;
 }
 
-int accept_player_connection(PlayerSocketConnection *player_socket) {
-    player_socket->connection_fd = accept(player_socket->listen_fd, (struct sockaddr *)&player_socket->address, &player_socket->address_len);
-    return player_socket->connection_fd;
+// Runs in the new binary: takes over everything the old process sent, then tells it to exit.
+bool restore_from_handoff(int handoff_fd) {
+    long started = monotonic_time_ms();
+    HandoffBuffer state;
+    init_handoff_buffer(&state);
+
+    if (!handoff_receive(handoff_fd, &state, HANDOFF_TIMEOUT_MS) || !restore_game_state(&state)) {
+        free_handoff_buffer(&state, true);
+        close(handoff_fd);
+        return false;
+    }
+    // every fd is owned by a restored socket or transport now
+    free_handoff_buffer(&state, false);
+
+    if (write(handoff_fd, "A", 1) != 1) {
+        close(handoff_fd);
+        return false;
+    }
+    close(handoff_fd);
+
+    pstdout("restore_from_handoff(): Took game %d over in %ld ms.", game_id, monotonic_time_ms() - started);
+    publish_memory_usage("restored from the old server");
+    return true;
 }
 
-void send_response(int conn_fd, const char *packet) {
-    send(conn_fd, packet, strlen(packet), 0);
+bool is_resume_packet(const char *buffer) {
+    return buffer[0] == 'T' && (buffer[1] == '\0' || buffer[1] == ' ');
 }
 
-void send_shot_response(int conn_fd, int remaining_ships, const char miss_or_hit) {
-    if (miss_or_hit != 'M' && miss_or_hit != 'H') {
-        pstderr("send_shot_response(): 'miss_or_hit' input '%c' is invalid!", miss_or_hit);
-        return;
+// Checks a "T <token>" packet against the seat's token. Every byte is compared whatever the first
+// mismatch, so the time a reject takes tells a guesser nothing about how much of its token was right.
+bool resume_token_matches(const char *buffer, const char *token) {
+    if (strlen(buffer) != RESUME_TOKEN_LENGTH + 2 || buffer[0] != 'T' || buffer[1] != ' ') {
+        return false;
     }
-    char response[BUFFER_SIZE];
-    snprintf(response, sizeof(response), "R %d %c", remaining_ships, miss_or_hit);
-    send_response(conn_fd, response);
+    unsigned char difference = 0;
+    for (int i = 0; i < RESUME_TOKEN_LENGTH; i++) {
+        difference |= (unsigned char)(buffer[i + 2] ^ token[i]);
+    }
+    return difference == 0;
 }
 
-void read_from_player_socket(int socket_fd, char *buffer) {
-    memset(buffer, 0, BUFFER_SIZE);
+void generate_resume_token(char *token) {
+    static const char hex_digits[] = "0123456789abcdef";
+    unsigned char bytes[RESUME_TOKEN_LENGTH / 2];
 
-    int nbytes = read(socket_fd, buffer, BUFFER_SIZE);
-    if (nbytes <= 0) {
-        pstdout("Socket read error.");
-        exit(EXIT_FAILURE);
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) {
+        pstderr("generate_resume_token(): /dev/urandom unavailable, falling back to rand().");
+        srand((unsigned int)(time(NULL) ^ getpid()));
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = (unsigned char)rand();
+        }
     }
-    else {
-        pstdout("read_from_player_socket(): Received: %s", buffer);
+    if (fd >= 0) {
+        close(fd);
     }
-}
 
-void send_initialize_board_response(int conn_fd, const char *error_packet, char *token, Piece *pieces) {
-    send_response(conn_fd, error_packet);
-    if (token != NULL) {
-        free(token);
-        token = NULL;
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        token[2 * i] = hex_digits[bytes[i] >> 4];
+        token[2 * i + 1] = hex_digits[bytes[i] & 0x0f];
     }
-    if (pieces != NULL) {
-        free(pieces);
-        pieces = NULL;
+    token[RESUME_TOKEN_LENGTH] = '\0';
+}
+
+// A player's packets before its Begin is accepted. Player 1's Begin picks the board size and
+// creates both boards, player 2's only carries its name.
+void game_process_player_begin_packet(char *buffer, int player_number) {
+    Player *player = player_number == 1 ? player_01 : player_02;
+    Player *other_player = player_number == 2 ? player_01 : player_02;
+
+    uint64_t parse_span = trace_span_begin(TRACE_PARSE, game_id, player_number);
+    char packet_type = get_packet_type(buffer);
+    trace_span_end(TRACE_PARSE, parse_span, game_id, player_number);
+    int width, height, consumed = 0;
+
+    switch (packet_type) {
+        case 'B':
+            if (player_number == 2) {
+                if (sscanf(buffer, "B %d", &width) == 1 || !parse_player_identity(buffer + 1, player->identity)) {
+                    send_response(player->socket->connection_fd, INVALID_BEGIN_PACKET_TYPE_INVALID_PARAMETERS);
+                    break;
+                }
+            }
+            else if (sscanf(buffer, "B %d %d%n", &width, &height, &consumed) == 2 && is_valid_board_size(&server_options.rules, width, height)
+                     && parse_player_identity(buffer + consumed, player->identity)) {
+                // both boards are reserved up front, an oversized game is refused before anything is allocated
+                size_t board_bytes = board_memory_bytes(width, height);
+                if (board_bytes == 0 || board_bytes > SIZE_MAX / 2 || !memory_reserve(&game_memory, 2 * board_bytes)) {
+                    pstderr("Player 01 asked for a %d x %d board, over the memory quota.", width, height);
+                    send_response(player->socket->connection_fd, MEMORY_QUOTA_EXCEEDED);
+                    break;
+                }
+
+                Board *board01 = create_board(&server_options.rules, width, height, &game_memory);
+                Board *board02 = create_board(&server_options.rules, width, height, &game_memory);
+                if (board01 == NULL || board02 == NULL) {
+                    // a board that was created gives its reservation back when deleted
+                    memory_release(&game_memory, board_bytes * ((board01 == NULL) + (board02 == NULL)));
+                    delete_board(board01);
+                    delete_board(board02);
+                    pstderr("Out of memory for a %d x %d board.", width, height);
+                    send_response(player->socket->connection_fd, MEMORY_QUOTA_EXCEEDED);
+                    break;
+                }
+                player_01->board = board01;
+                player_02->board = board02;
+                size_admin_snapshot(width, height);
+                publish_memory_usage("boards created");
+            }
+            else {
+                send_response(player->socket->connection_fd, INVALID_BEGIN_PACKET_TYPE_INVALID_PARAMETERS);
+                break;
+            }
+
+            player->ready = true;
+            pstdout("Player %02d is ready to begin!", player_number);
+            send_response(player->socket->connection_fd, ACK);
+            if (is_player_ready(other_player)) {
+                pstdout("Both Players are Ready!");
+            }
+            break;
+        case 'F':
+            send_response(player->socket->connection_fd, HALT_LOSS);
+            send_response(other_player->socket->connection_fd, HALT_WIN);
+            record_game_end(other_player, GAME_END_FORFEIT);
+            exit(EXIT_SUCCESS);
+        default:
+            send_response(player->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_BEGIN);
+            break;
     }
 }
 
@@ -400,32 +2304,28 @@ void game_process_player_board_initialize(char *buffer, int player_number) {
     Player *player = player_number == 1 ? player_01 : player_02;
     Player *other_player = player_number == 2 ? player_01 : player_02;
 
-    read_from_player_socket(player->socket->connection_fd, buffer);
-
-    char *token = get_first_token_from_buffer(buffer);
-    if (token == NULL) {
+    uint64_t span = trace_span_begin(TRACE_PARSE, game_id, player_number);
+    char packet_type = get_packet_type(buffer);
+    trace_span_end(TRACE_PARSE, span, game_id, player_number);
+    if (packet_type == '\0') {
         pstderr("game_process_player_board_initialize(): Failed to get token from buffer.");
-        send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS, token, NULL);
+        send_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS);
         return;
     }
 
-    Piece* pieces = malloc(MAX_PIECES * sizeof(Piece));
-    if (pieces == NULL) {
-        pstderr("game_process_player_board_initialize(): malloc for 'pieces' FAILED.");
-        send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS, token, pieces);
-        exit(EXIT_FAILURE);
-    }
-
+    Piece pieces[MAX_FLEET_SIZE];
+    int fleet_size = server_options.rules.fleet_size;
     int count = 0;
     int type, rotation, col, row;
-    switch (*token) {
+    switch (packet_type) {
         case 'I':
             buffer += 2;
+            span = trace_span_begin(TRACE_PARSE, game_id, player_number);
 
             while (sscanf(buffer, "%d %d %d %d", &type, &rotation, &col, &row) == 4) {
-                if (count >= MAX_PIECES) {
+                if (count >= fleet_size) {
                     pstderr("game_process_player_board_initialize(): Too many pieces!");
-                    send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS, token, pieces);
+                    send_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS);
                     return;
                 }
 
@@ -447,87 +2347,62 @@ void game_process_player_board_initialize(char *buffer, int player_number) {
                 }
             }
 
+            trace_span_end(TRACE_PARSE, span, game_id, player_number);
             pstdout("Count for Player %d is %d", player_number, count);
             
             int extraneous_parameter;
             if (sscanf(buffer, "%d", &extraneous_parameter) == 1) {
-                send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS, token, pieces);
+                send_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS);
                 break;
             }
 
-            if (count != MAX_PIECES) {
+            if (count != fleet_size) {
                 pstderr("game_process_player_board_initialize(): Invalid initialize parameters!");
-                send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS, token, pieces);
+                send_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_TYPE_INVALID_PARAMETERS);
             } 
             else {
                 pstdout("game_process_player_board_initialize(): valid initialize parameters, checking for errors 300-303...");
 
-                for (int i = 0; i < MAX_PIECES; i++) {
+                for (int i = 0; i < fleet_size; i++) {
                     pstdout("Piece %d: Type=%d, Rotation=%d, Col=%d, Row=%d", i, pieces[i].type, pieces[i].rotation, pieces[i].col, pieces[i].row);
                 }
 
-                // run each check in its own for loop because we want to make sure that we return the lowest error code
-
-                // error 300
-                for (int i = 0; i < MAX_PIECES; i++) {
-                    if (pieces[i].type < 1 || pieces[i].type > 7) {
-                        pstderr("E 300 for type %d for piece %d", pieces[i].type, i);
-                        send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_SHAPE_OUT_OF_RANGE, token, pieces);
-                        return;
-                    } 
-                }
-
-                // error 301
-                for (int i = 0; i < MAX_PIECES; i++) {
-                    if (pieces[i].rotation < 1 || pieces[i].rotation > 4) {
-                        pstderr("E 301 for rotation %d for piece %d", pieces[i].rotation, i);
-                        send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_ROTATION_OUT_OF_RANGE, token, pieces);
-                        return;
-                    }
+                if (!admit_expensive_operation(player, player->board)) {
+                    return;
                 }
 
-                // error 302
-                for (int i = 0; i < MAX_PIECES; i++) {
-                    Piece *piece = &pieces[i];
-                    int piece_type = piece->type;
-                    int piece_rotation = piece->rotation;
-                    int piece_row = piece->row;
-                    int piece_col = piece->col;
-
-                    for(int i = 0; i < 4; i++) {
-                        int row_offset = tetris_shape_offsets[piece_type - 1][piece_rotation - 1][i][0];
-                        int col_offset = tetris_shape_offsets[piece_type - 1][piece_rotation - 1][i][1];
-
-                        if (is_position_out_of_bounds_on_board(player->board, piece_row, piece_col, row_offset, col_offset)) {
-                            send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_SHIP_DOES_NOT_FIT, token, pieces);
-                            return;
-                        }
+                cpu_budget_begin(&game_cpu_budget);
+                EngineResult result = validate_initialize_pieces(player, pieces);
+                if (result != ENGINE_OK) {
+                    cpu_budget_end(&game_cpu_budget);
+                    if (server_options.log_packets) {
+                        pstderr("game_process_player_board_initialize(): Player %d board rejected with E %d", player_number, result);
                     }
-                }
-
-
-                // error 303
-                if (are_ships_overlapping(player->board, pieces) == true) {
-                    send_initialize_board_response(player->socket->connection_fd, INVALID_INITIALIZE_PACKET_SHIPS_OVERLAP, token, pieces);
+                    send_response(player->socket->connection_fd, engine_result_packet(result));
                     return;
                 }
 
                 // if we reach this point - there are no errors! :) 
                 
+                span = trace_span_begin(TRACE_BOARD_MUTATION, game_id, player_number);
                 fill_board_with_pieces(player->board, pieces);
-
-                send_initialize_board_response(player->socket->connection_fd, ACK, token, pieces);
-                player->board->initialized = true;
+                trace_span_end(TRACE_BOARD_MUTATION, span, game_id, player_number);
+                memcpy(player->fleet, pieces, fleet_size * sizeof(Piece));
+                // the board was all water before, so only the fleet's cells changed, however large the board
+                int changed_cells[MAX_FLEET_SIZE * MAX_CELLS_PER_PIECE];
+                publish_game_snapshot_cells(player, changed_cells, fleet_cells(player->board, pieces, changed_cells));
+                cpu_budget_end(&game_cpu_budget);
+
+                send_response(player->socket->connection_fd, ACK);
             }
             break;
         case 'F':
             send_response(player->socket->connection_fd, HALT_LOSS);
             send_response(other_player->socket->connection_fd, HALT_WIN);
-            free(token);
-            free(pieces);
+            record_game_end(other_player, GAME_END_FORFEIT);
             exit(EXIT_SUCCESS);
         default:
-            send_initialize_board_response(player->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_INITIALIZE, token, pieces);
+            send_response(player->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_INITIALIZE);
             break;
     }
 }
@@ -537,49 +2412,57 @@ void game_process_player_play_packets(char *buffer, int player_number) {
     Player *player = player_number == 1 ? player_01 : player_02;
     Player *other_player = player_number == 1 ? player_02 : player_01;
 
-    read_from_player_socket(player->socket->connection_fd, buffer);
+    read_player_packet(player, buffer);
 
-    char *token = get_first_token_from_buffer(buffer);
+    uint64_t span = trace_span_begin(TRACE_PARSE, game_id, player_number);
+    char packet_type = get_packet_type(buffer);
 
     int shoot_row, shoot_col, extraneous_input;
+    int shoot_parameters = packet_type == 'S' ? sscanf(buffer, "S %d %d %d", &shoot_row, &shoot_col, &extraneous_input) : 0;
+    int query_cursor;
+    int query_parameters = packet_type == 'Q' ? parse_query_packet(buffer, &query_cursor) : 0;
+    trace_span_end(TRACE_PARSE, span, game_id, player_number);
 
-    switch (*token) {
+    switch (packet_type) {
         case 'S':
-            if (sscanf(buffer, "S %d %d %d", &shoot_row, &shoot_col, &extraneous_input) == 2) {
+            if (shoot_parameters == 2) {
                 // codes 400 and 401, and shooting logic
-                if (is_position_out_of_bounds_on_board(player->board, shoot_row, shoot_col, 0, 0)) {
-                    send_response(player->socket->connection_fd, INVALID_SHOOT_PACKET_CELL_OUT_OF_BOUNDS);
+                span = trace_span_begin(TRACE_VALIDATE_E400_E401, game_id, player_number);
+                EngineResult result = check_shot(other_player->board, shoot_row, shoot_col);
+                trace_span_end(TRACE_VALIDATE_E400_E401, span, game_id, player_number);
+                if (result != ENGINE_OK) {
+                    send_response(player->socket->connection_fd, engine_result_packet(result));
                     break;
                 }
-                else if (other_player->board->board[shoot_row][shoot_col] < 0) {
-                    send_response(player->socket->connection_fd, INVALID_SHOOT_PACKET_CELL_ALREADY_GUESSED);
-                    break; 
-                }
                 else {
-                    char hit_or_miss = other_player->board->board[shoot_row][shoot_col] > 0 ? 'H' : 'M';
-                    if (other_player->board->board[shoot_row][shoot_col] > 0) {
-                        other_player->board->board[shoot_row][shoot_col] = -2;
-                    } 
-                    else {
-                        other_player->board->board[shoot_row][shoot_col] = -1;
-                    }
+                    char hit_or_miss;
+                    span = trace_span_begin(TRACE_BOARD_MUTATION, game_id, player_number);
+                    resolve_shot(other_player->board, shoot_row, shoot_col, &hit_or_miss);
+                    trace_span_end(TRACE_BOARD_MUTATION, span, game_id, player_number);
 
+                    span = trace_span_begin(TRACE_WIN_CHECK, game_id, player_number);
                     int remaining_ships = remaining_pieces_on_board(other_player->board);
+                    trace_span_end(TRACE_WIN_CHECK, span, game_id, player_number);
 
+                    int shot_cell = shoot_row * other_player->board->width + shoot_col;
                     if (remaining_ships == 0) {
                         send_shot_response(player->socket->connection_fd, remaining_ships, hit_or_miss);
+                        publish_game_snapshot(other_player, shot_cell, 1);
+                        // recorded now, the loser's last packet does not change the outcome
+                        record_game_end(player, GAME_END_SUNK);
                         pstdout("game_process_player_play_packets(): Player %d has won!", player->number);
                         pstdout("game_process_player_play_packets(): Game will terminate once a reply from Player %d is received...", other_player->number);
-                        read_from_player_socket(other_player->socket->connection_fd, buffer);
+                        upgrade_blocked = true;
+                        read_player_packet(other_player, buffer);
                         send_response(player->socket->connection_fd, HALT_WIN);
                         send_response(other_player->socket->connection_fd, HALT_LOSS);
-                        free(token);
                         exit(EXIT_SUCCESS);
                     }
 
                     send_shot_response(player->socket->connection_fd, remaining_ships, hit_or_miss);
                     other_player->play = true;
                     player->play = false;
+                    publish_game_snapshot(other_player, shot_cell, 1);
                 }
             }
             else {
@@ -589,38 +2472,35 @@ void game_process_player_play_packets(char *buffer, int player_number) {
 
             break;
         case 'Q':
-            send_query_response(player, other_player->board);
+            // "Q <seq>" only returns the shots after the client's cursor, a bare "Q" keeps the full history.
+            // Delta replies are bounded by the packet size, only the full history pays by board size.
+            if (query_parameters < 0) {
+                send_response(player->socket->connection_fd, INVALID_SHOOT_PACKET_TYPE_INVALID_PARAMETERS);
+            }
+            else if (query_parameters == 1) {
+                send_delta_query_response(player, other_player->board, query_cursor);
+            }
+            else if (admit_expensive_operation(player, other_player->board)) {
+                send_query_response(player, other_player->board);
+            }
             break;
         case 'F':
             send_response(player->socket->connection_fd, HALT_LOSS);
             send_response(other_player->socket->connection_fd, HALT_WIN);
-            free(token);
+            record_game_end(other_player, GAME_END_FORFEIT);
             exit(EXIT_SUCCESS);
         default:
             send_response(player->socket->connection_fd, INVALID_PACKET_TYPE_EXPECTED_SHOOT_QUERY_PACKET);
             break;
     }
-
-    free(token);
 }
 
-// token is a pointer, need to 'free' it
-char* get_first_token_from_buffer(const char *buffer) {
-    char *buffer_cpy = strdup(buffer);
-    if (buffer_cpy == NULL) {
-        return NULL;
-    }
-
-    char *token = strtok(buffer_cpy, " ");
-    if (token == NULL) {
-        free(buffer_cpy);
-        return NULL;
+// first character of the first space-separated token, '\0' for an empty packet; reads the buffer in place
+char get_packet_type(const char *buffer) {
+    while (*buffer == ' ') {
+        buffer++;
     }
-
-    char *result = strdup(token);
-    
-    free(buffer_cpy);
-    return result;
+    return *buffer;
 }
 
 Player* initialize_player(int number, bool ready) {
@@ -636,6 +2516,13 @@ Player* initialize_player(int number, bool ready) {
     player->play = false;
     player->board = NULL;
     player->socket = NULL;
+    player->resume_token[0] = '\0';
+    player->resume_token_issued = false;
+    initialize_token_bucket(&player->packet_bucket, server_options.packet_rate, server_options.packet_burst);
+    initialize_token_bucket(&player->expensive_bucket, server_options.expensive_rate, server_options.expensive_burst);
+    player->strikes = 0;
+    memset(player->fleet, 0, sizeof(player->fleet));
+    player->identity[0] = '\0';
 
     return player;
 }
@@ -649,8 +2536,14 @@ void delete_player(Player *player) {
         }
 
         if (player->socket != NULL) {
-            close(player->socket->connection_fd);
-            close(player->socket->listen_fd);
+            close_player_connection(player->socket);
+            if (player->socket->listen_fd >= 0) {
+                close(player->socket->listen_fd);
+            }
+            if (player->socket->unix_listen_fd >= 0) {
+                close(player->socket->unix_listen_fd);
+                unlink(player->socket->unix_path);
+            }
             free(player->socket);
             player->socket = NULL;
         }
@@ -665,281 +2558,208 @@ bool is_player_ready(Player *player) {
     return player->ready;
 }
 
-// width is the number of cols, and height is number of rows
-Board* create_board(int width, int height) {
-    Board* board = malloc(sizeof(Board));
-
-    if (board == NULL) {
-        pstderr("create_board(): Error malloc'ing board.");
-        return NULL;
-    }
-
-    board->pieces_remaining = 5;
-    board->width = width;
-    board->height = height;
-    board->initialized = false;
-
-    board->board = malloc(board->height * sizeof(int*));
-
-    if (board->board == NULL) {
-        pstderr("create_board(): Error malloc'ing rows for board.");
-        free(board);
-        return NULL;
-    }
-
-    for (unsigned int i = 0; i < board->height; i++) {
-        board->board[i] = malloc(board->width * sizeof(int));
-        if (board->board[i] == NULL) {
-            pstderr("create_board(): Error malloc'ing cols for a row in board.");
-            
-            for (unsigned int j = 0; j < i; j++) {
-                free(board->board[j]);
-            }
-            free(board->board);
-            free(board); // Free the allocated board structure
-
-            return NULL;
-        }
-
-        memset(board->board[i], 0, board->width * sizeof(int)); // this 
-    }
-
-    // using memset instead of this
-    // for (int i = 0; i < board->height; i++) {
-    //     for (int j = 0; j < board->width; j++) {
-    //         board->board[i][j] = 0;
-    //     }
-    // }
-
-    return board;
-}
-
-void fill_board_with_pieces(Board *board, Piece *pieces) {
-    // assuming valid set of pieces as this function is only called once after error-checking
-    if (board == NULL || board->board == NULL || pieces == NULL) {
-        pstderr("fill_board_with_pieces(): board or pieces is NULL!");
-        return;
-    }
-
-    for (int p_idx = 0; p_idx < MAX_PIECES; p_idx++) {
-        Piece *piece = &pieces[p_idx];
-        fill_board_with_piece(board, piece, p_idx + 1);
-    }
-}
-
-bool fill_board_with_piece(Board *board, Piece *piece, int piece_board_identifer) {
-    if (board == NULL || board->board == NULL) {
-        pstderr("fill_board_with_piece(): board is NULL!");
-        return false;
-    }
-    if (piece == NULL) {
-        pstderr("fill_board_with_piece(): piece is NULL!");
-        return false;
-    }
-
-    int piece_type = piece->type;
-    int piece_rotation = piece->rotation;
-    int piece_row = piece->row;
-    int piece_col = piece->col;
-
-    for (int i = 0; i < 4; i++) {
-        int row_offset = tetris_shape_offsets[piece_type - 1][piece_rotation - 1][i][0];
-        int col_offset = tetris_shape_offsets[piece_type - 1][piece_rotation - 1][i][1];
-        if (fill_board_index_with_value(board, piece_row, piece_col, row_offset, col_offset, piece_board_identifer) == false) {
-            return false;
-        }
-    }
-    return true;
-}
-
-bool fill_board_index_with_value(Board *board, int piece_row, int piece_col, int row_offset, int col_offset, int value) {
-    if (board == NULL || board->board == NULL) {
-        pstderr("fill_board_index_with_value(): board is NULL!");
-        return false;
-    }
-
-    int row = piece_row + row_offset;
-    int col = piece_col + col_offset;
-
-    if (is_position_out_of_bounds_on_board(board, row, col, 0, 0)) {
-        pstderr("fill_board_index_with_value(): FAILED at (%d, %d) - Out of bounds!", row, col);
-        return false;
-    }
-    if (!is_board_index_empty(board, row, col)) {
-        pstderr("fill_board_index_with_value(): FAILED at (%d, %d) - Not 0!", row, col);
-        return false;
-    }
-    board->board[row][col] = value;
-    return true;
-}
-
-bool is_board_index_empty(Board *board, int row, int col) {
-    if (board == NULL || board->board == NULL) {
-        pstderr("fill_board_index_with_value(): board is NULL!");
-        return false;
-    }
-    if (is_position_out_of_bounds_on_board(board, row, col, 0, 0)) {
-        pstderr("is_board_index_empty(): FAILED at (%d, %d) - Out of bounds!", row, col);
-        return false;
-    }
-    return board->board[row][col] == 0;
+bool is_board_initialized(Player *player) {
+    return player->board != NULL && player->board->initialized;
 }
 
-bool are_ships_overlapping(Board *board, Piece *pieces) {
-    if (board == NULL || board->board == NULL || pieces == NULL) {
-        pstderr("are_ships_overlapping(): board or pieces is NULL!");
-        return true;
+// appends 'value' in decimal, the way "%d" prints it, and returns the number of characters
+int append_cell_value(char *out, int value) {
+    char digits[12];
+    int count = 0;
+    int length = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        out[length++] = '-';
     }
-    Board *board_cpy = create_board(board->width, board->height);
-    for (int p_idx = 0; p_idx < MAX_PIECES; p_idx++) {
-        Piece *piece = &pieces[p_idx];
-        int piece_board_identifier = p_idx + 1;
-        int piece_type = piece->type;
-        int piece_rotation = piece->rotation;
-
-        if (!fill_board_with_piece(board_cpy, piece, piece_board_identifier)) {
-            delete_board(board_cpy);
-            pstdout("are_ships_overlapping(): fill_board_with_piece() failed and deleting 'board_cpy'!");
-            return true;
-        }
+    while (count > 0) {
+        out[length++] = digits[--count];
     }
-
-    delete_board(board_cpy);
-    return false;
+    return length;
 }
 
+// Writes the board a row at a time rather than a printf() per cell, in CPU budget slices, so a
+// huge board neither holds its core nor runs over the game's budget.
 void print_board(Board *board) {
-    if (board == NULL || board->board == NULL) {
+    if (board == NULL || board->cells == NULL) {
         pstderr("print_board(): board is NULL!");
         return;
     }
 
     pstdout("Board (%d x %d):", board->width, board->height);
+    char line[BUFFER_SIZE];
+    cpu_budget_begin(&game_cpu_budget);
     for (int i = 0; i < board->height; i++) {
+        size_t length = 0;
         for (int j = 0; j < board->width; j++) {
-            printf("%d ", board->board[i][j]);
+            if (length > sizeof(line) - 16) {
+                fwrite(line, 1, length, stdout);
+                length = 0;
+            }
+            length += append_cell_value(line + length, board->cells[i * board->width + j]);
+            line[length++] = ' ';
         }
-        printf("\n");
+        line[length++] = '\n';
+        fwrite(line, 1, length, stdout);
+        cpu_budget_progress(&game_cpu_budget, board->width);
     }
+    cpu_budget_end(&game_cpu_budget);
 }
 
-bool delete_board(Board *board) {
-    if (board == NULL || board->board == NULL) {
-        pstdout("delete_board(): board is NULL.");
-        return false;
-    }
+// the cells a validated fleet covers, returns how many were written to 'cells'
+int fleet_cells(const Board *board, const Piece *pieces, int *cells) {
+    const RuleSet *rules = board->rules;
+    int count = 0;
 
-    for (int i = 0; i < board->height; i++) {
-        free(board->board[i]);
+    for (int i = 0; i < rules->fleet_size; i++) {
+        const int *offsets = &rules->shape_offsets[((pieces[i].type - 1) * rules->rotation_count + pieces[i].rotation - 1) * rules->cells_per_piece * 2];
+        for (int j = 0; j < rules->cells_per_piece; j++) {
+            cells[count++] = (pieces[i].row + offsets[2 * j]) * board->width + pieces[i].col + offsets[2 * j + 1];
+        }
     }
-
-    free(board->board);
-    board->board = NULL;
-    board->pieces_remaining = 0;
-    board->width = 0;
-    board->height = 0;
-    board->initialized = false;
-    free(board);
-    board = NULL;
-
-    return true; // Indicate successful deletion
+    return count;
 }
 
-bool board_has_ship(Board *board, int piece_number) {
-    if (board ==  NULL || board->board == NULL) {
-        pstderr("board_has_ship(): board is NULL!");
-        return false;
+// runs the engine's Initialize checks one at a time, lowest error code first, so that every
+// E code gets its own trace span
+EngineResult validate_initialize_pieces(Player *player, Piece *pieces) {
+    EngineResult result;
+
+    uint64_t span = trace_span_begin(TRACE_VALIDATE_E300, game_id, player->number);
+    result = check_piece_types(player->board, pieces);
+    trace_span_end(TRACE_VALIDATE_E300, span, game_id, player->number);
+    if (result != ENGINE_OK) {
+        return result;
     }
-    if (piece_number < 1 || piece_number > 5) {
-        pstderr("board_has_ship(): invalid 'piece_number'!");
-        return false;
+
+    span = trace_span_begin(TRACE_VALIDATE_E301, game_id, player->number);
+    result = check_piece_rotations(player->board, pieces);
+    trace_span_end(TRACE_VALIDATE_E301, span, game_id, player->number);
+    if (result != ENGINE_OK) {
+        return result;
     }
 
-    for (int i = 0; i < board->height; i++) {
-        for (int j = 0; j < board->width; j++) {
-            if (board->board[i][j] == piece_number) {
-                return true;
-            }
-        }
+    span = trace_span_begin(TRACE_VALIDATE_E302, game_id, player->number);
+    result = check_pieces_fit(player->board, pieces);
+    trace_span_end(TRACE_VALIDATE_E302, span, game_id, player->number);
+    if (result != ENGINE_OK) {
+        return result;
     }
-    return false;
+
+    span = trace_span_begin(TRACE_VALIDATE_E303, game_id, player->number);
+    result = check_pieces_overlap(player->board, pieces);
+    trace_span_end(TRACE_VALIDATE_E303, span, game_id, player->number);
+    return result;
 }
 
-int remaining_pieces_on_board(Board *board) {
-    if (board == NULL || board->board == NULL) {
-        pstderr("remaining_pieces_on_board(): board is NULL!");
-        return -1;
+int player_number_for_fd(int conn_fd) {
+    if (player_01 != NULL && player_01->socket != NULL && player_01->socket->connection_fd == conn_fd) {
+        return 1;
     }
-    int counter = 0;
+    if (player_02 != NULL && player_02->socket != NULL && player_02->socket->connection_fd == conn_fd) {
+        return 2;
+    }
+    return 0;
+}
 
-    for (int i = 1; i <= MAX_PIECES; i++) {
-        if (board_has_ship(board, i) == true) {
-            counter++;
-        }
+const char *engine_result_packet(EngineResult result) {
+    switch (result) {
+        case ENGINE_SHAPE_OUT_OF_RANGE:
+            return INVALID_INITIALIZE_PACKET_SHAPE_OUT_OF_RANGE;
+        case ENGINE_ROTATION_OUT_OF_RANGE:
+            return INVALID_INITIALIZE_PACKET_ROTATION_OUT_OF_RANGE;
+        case ENGINE_SHIP_DOES_NOT_FIT:
+            return INVALID_INITIALIZE_PACKET_SHIP_DOES_NOT_FIT;
+        case ENGINE_SHIPS_OVERLAP:
+            return INVALID_INITIALIZE_PACKET_SHIPS_OVERLAP;
+        case ENGINE_CELL_OUT_OF_BOUNDS:
+            return INVALID_SHOOT_PACKET_CELL_OUT_OF_BOUNDS;
+        case ENGINE_CELL_ALREADY_GUESSED:
+            return INVALID_SHOOT_PACKET_CELL_ALREADY_GUESSED;
+        default:
+            return ACK;
     }
-    return counter;
 }
 
 void send_query_response(Player* player, Board *board) {
-    char *state = get_game_state_from_board(board);
-    send_response(player->socket->connection_fd, state);
-    free(state);
+    uint64_t span = trace_span_begin(TRACE_FORMAT_RESPONSE, game_id, player->number);
+    cpu_budget_begin(&game_cpu_budget);
+    // on the stack like the delta reply, a game at its memory quota can still answer a bare Q
+    char response[BUFFER_SIZE];
+    get_game_state_from_board(board, response);
+    cpu_budget_end(&game_cpu_budget);
+    trace_span_end(TRACE_FORMAT_RESPONSE, span, game_id, player->number);
+    send_response(player->socket->connection_fd, response);
 }
 
-bool is_position_out_of_bounds_on_board(Board *board, int piece_row_idx, int piece_col_idx, int new_row_offset, int new_col_offset) {
-    if (board == NULL || board->board == NULL) {
-        pstderr("is_position_out_of_bounds_on_board(): board is NULL!");
-        return true;
-    }
+// Format: G <ships_remaining> <cursor> [<M or H> <col> <row>]... in the order the shots were
+// taken. If the events do not fit in one packet the cursor stops at the last one sent, so the
+// client pages through by sending it back.
+void send_delta_query_response(Player* player, Board *board, int cursor) {
+    uint64_t span = trace_span_begin(TRACE_FORMAT_RESPONSE, game_id, player->number);
 
-    if (piece_row_idx < 0 || piece_col_idx < 0) {
-        pstderr("is_position_out_of_bounds_on_board(): piece row or piece column is 0, therefore trivally out of bounds!");
-        return true;
+    if (cursor < 0) {
+        cursor = 0;
+    }
+    if (cursor > board->shot_count) {
+        cursor = board->shot_count;
     }
 
-    int new_row_idx = piece_row_idx + new_row_offset;
-    int new_col_idx = piece_col_idx + new_col_offset;
-
-    return !(new_row_idx >= 0 && new_col_idx >= 0 && new_row_idx < board->height && new_col_idx < board->width);
-
+    // everything but the room for the header, the cursor is only known once the events are in
+    char events[BUFFER_SIZE - DELTA_QUERY_HEADER_ROOM];
+    size_t events_len = 0;
+    int next = cursor;
 
-}
+    events[0] = '\0';
+    while (next < board->shot_count) {
+        int row, col;
+        char hit_or_miss;
+        char event[64];
 
-char *get_game_state_from_board(Board *board) {
-    char *buffer = malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        pstderr("get_game_state_from_board(): malloc failed!");
-        return NULL;
+        get_logged_shot(board, next, &row, &col, &hit_or_miss);
+        int event_len = snprintf(event, sizeof(event), " %c %d %d", hit_or_miss, col, row);
+        if (events_len + event_len >= sizeof(events)) {
+            break;
+        }
+        memcpy(events + events_len, event, event_len + 1);
+        events_len += event_len;
+        next++;
     }
 
-    buffer[0] = '\0';
-    strcat(buffer, "G");
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "G %d %d%.*s", remaining_pieces_on_board(board), next, (int)events_len, events);
+    trace_span_end(TRACE_FORMAT_RESPONSE, span, game_id, player->number);
 
-    char temp[BUFFER_SIZE];
+    send_response(player->socket->connection_fd, response);
+}
 
+// writes the G reply for 'board' into 'buffer', which holds BUFFER_SIZE bytes
+void get_game_state_from_board(Board *board, char *buffer) {
     int remaining_pieces = remaining_pieces_on_board(board);
-    snprintf(temp, sizeof(temp), " %d", remaining_pieces);
-    strncat(buffer, temp, BUFFER_SIZE - strlen(buffer) - 1);
-
-    for (int i = 0; i < board->height; i++) {
-        for (int j = 0; j < board->width; j++) {
-            int idx = board->board[i][j];
-            if (idx < 0) {
-                // miss
-                if (idx == -1) {
-                    snprintf(temp, sizeof(temp), " M %d %d", j, i);
-                } 
-                // hit
-                else if (idx == -2) {
-                    snprintf(temp, sizeof(temp), " H %d %d", j, i);
+    int length = snprintf(buffer, BUFFER_SIZE, "G %d", remaining_pieces);
+
+    // the scan stops as soon as the packet is full, and reports its progress a row at a time
+    for (int i = 0; i < board->height && length < BUFFER_SIZE - 1; i++) {
+        for (int j = 0; j < board->width && length < BUFFER_SIZE - 1; j++) {
+            int idx = board->cells[i * board->width + j];
+            if (idx == CELL_MISS || idx == CELL_HIT) {
+                char temp[64];
+                int temp_length = snprintf(temp, sizeof(temp), " %c %d %d", idx == CELL_HIT ? 'H' : 'M', j, i);
+                // the last event is cut off at the end of the packet, as it always was
+                if (temp_length > BUFFER_SIZE - 1 - length) {
+                    temp_length = BUFFER_SIZE - 1 - length;
                 }
-
-                strncat(buffer, temp, BUFFER_SIZE - strlen(buffer) - 1);
+                memcpy(buffer + length, temp, temp_length);
+                length += temp_length;
             }
         }
+        cpu_budget_progress(&game_cpu_budget, board->width);
     }
-
-    return buffer;
+    buffer[length] = '\0';
 }
 
 void pstdout(const char *format, ...) {
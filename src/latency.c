@@ -0,0 +1,48 @@
+#include "latency.h"
+
+static int latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    int sub_bucket = (int)((ns >> (exponent - 3)) & (LATENCY_SUB_BUCKETS - 1));
+    return (exponent - 2) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+static uint64_t latency_bucket_upper_bound(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+    int exponent = bucket / LATENCY_SUB_BUCKETS + 2;
+    uint64_t lower = (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (exponent - 3);
+    return lower + ((uint64_t)1 << (exponent - 3)) - 1;
+}
+
+void latency_record(LatencyHistogram *histogram, uint64_t ns) {
+    histogram->buckets[latency_bucket(ns)]++;
+    histogram->count++;
+    histogram->sum_ns += ns;
+    if (ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+uint64_t latency_percentile(const LatencyHistogram *histogram, double quantile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    // the rank of the sample, 1-based, so quantile 1 is the largest one
+    uint64_t rank = (uint64_t)(quantile * histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t bound = latency_bucket_upper_bound(bucket);
+            return bound < histogram->max_ns ? bound : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
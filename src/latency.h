@@ -0,0 +1,23 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Log-linear latency histogram: eight buckets per power of two, so a percentile read back from it
+// is within 12.5% of the real value. A zeroed histogram is empty, recording never allocates.
+
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+typedef struct LatencyHistogram {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+void latency_record(LatencyHistogram *histogram, uint64_t ns);
+// the upper bound of the bucket holding the 'quantile' sample (0 to 1), 0 for an empty histogram
+uint64_t latency_percentile(const LatencyHistogram *histogram, double quantile);
+
+#endif
@@ -0,0 +1,201 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ratings.h"
+
+// Leaderboard of the rated games servers started with -W append to their log. The tool loads
+// the checkpoint next to the log, if there is one, replays the records written after it and
+// answers from the in-memory index.
+//
+//   ./build/leaderboard [-w log] top [count [from_rank]]   the players from a rank down, best first
+//   ./build/leaderboard [-w log] rank <name> ...           rank and rating of each player
+//   ./build/leaderboard [-w log] checkpoint                saves <log>.checkpoint, later runs replay less
+//   ./build/leaderboard bench <players> <games>            rates random games in memory and times the queries
+
+#define DEFAULT_RATING_LOG "/tmp/battleship-ratings.wal"
+#define DEFAULT_TOP_COUNT 10
+#define BENCH_QUERIES 100000
+
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void print_player(const RatedPlayer *player, size_t rank) {
+    printf("%-8zu %-31s %7.1f %6.1f %8u %8u\n", rank, player->name, player->rating, player->deviation, player->games, player->wins);
+}
+
+void print_header(void) {
+    printf("%-8s %-31s %7s %6s %8s %8s\n", "RANK", "PLAYER", "RATING", "RD", "GAMES", "WINS");
+}
+
+bool load_store(RatingStore *store, const char *log_path, const char *checkpoint_path) {
+    if (!rating_store_init(store)) {
+        fprintf(stderr, "[Leaderboard] - [ERROR] Out of memory.\n");
+        return false;
+    }
+    if (access(checkpoint_path, F_OK) == 0 && !rating_store_load_checkpoint(store, checkpoint_path)) {
+        fprintf(stderr, "[Leaderboard] - [WARNING] '%s' is damaged, replaying the whole log.\n", checkpoint_path);
+    }
+    if (!rating_store_replay(store, log_path)) {
+        fprintf(stderr, "[Leaderboard] - [ERROR] Could not replay '%s'.\n", log_path);
+        rating_store_free(store);
+        return false;
+    }
+    if (store->skipped_bytes > 0) {
+        fprintf(stderr, "[Leaderboard] - [WARNING] Skipped %lld damaged bytes of '%s'.\n", (long long)store->skipped_bytes, log_path);
+    }
+    return true;
+}
+
+int print_top(const RatingStore *store, long count, long from_rank) {
+    if (count < 1 || from_rank < 1) {
+        fprintf(stderr, "[Leaderboard] - [ERROR] The count and the rank start at 1.\n");
+        return EXIT_FAILURE;
+    }
+    print_header();
+    size_t rank = (size_t)from_rank;
+    const RatedPlayer *player = rating_store_at_rank(store, rank);
+    for (long i = 0; i < count && player != NULL; i++, rank++) {
+        print_player(player, rank);
+        player = rating_store_next(player);
+    }
+    printf("%zu players, %llu games\n", store->player_count, (unsigned long long)store->games);
+    return EXIT_SUCCESS;
+}
+
+int print_ranks(const RatingStore *store, char **names, int count) {
+    int status = EXIT_SUCCESS;
+    print_header();
+    for (int i = 0; i < count; i++) {
+        const RatedPlayer *player = rating_store_find(store, names[i]);
+        if (player == NULL) {
+            fprintf(stderr, "[Leaderboard] - [ERROR] '%s' has no rated games.\n", names[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        print_player(player, rating_store_rank(store, player));
+    }
+    return status;
+}
+
+// Rates random games between 'players' players, then times rank and top-100 queries.
+int run_bench(long players, long games) {
+    if (players < 2 || games < 1) {
+        fprintf(stderr, "[Leaderboard] - [ERROR] The bench needs at least 2 players and 1 game.\n");
+        return EXIT_FAILURE;
+    }
+    RatingStore store;
+    if (!rating_store_init(&store)) {
+        fprintf(stderr, "[Leaderboard] - [ERROR] Out of memory.\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    RatingLogRecord record = { .ended_ms = 1700000000000LL };
+    uint64_t start = monotonic_ns();
+    for (long game = 0; game < games; game++) {
+        // the first pass gives every player a game, the rest pair players at random
+        long winner = game < players ? game : rand() % players;
+        long loser = (winner + 1 + rand() % (players - 1)) % players;
+        snprintf(record.winner, sizeof(record.winner), "p%ld", winner);
+        snprintf(record.loser, sizeof(record.loser), "p%ld", loser);
+        record.game_id = (int32_t)game;
+        record.ended_ms += 1000;
+        if (!rating_store_apply(&store, &record)) {
+            fprintf(stderr, "[Leaderboard] - [ERROR] Out of memory after %ld games.\n", game);
+            rating_store_free(&store);
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t applied = monotonic_ns();
+    printf("[Leaderboard] - [INFO] %zu players, %ld games rated in %.3f s, %.0f ns per game.\n", store.player_count, games,
+           (applied - start) / 1e9, (double)(applied - start) / games);
+
+    size_t checksum = 0;
+    start = monotonic_ns();
+    for (int i = 0; i < BENCH_QUERIES; i++) {
+        char name[RATING_NAME_SIZE];
+        snprintf(name, sizeof(name), "p%ld", rand() % (store.player_count < (size_t)players ? (long)store.player_count : players));
+        const RatedPlayer *player = rating_store_find(&store, name);
+        if (player != NULL) {
+            checksum += rating_store_rank(&store, player);
+        }
+    }
+    uint64_t ranked = monotonic_ns();
+    for (int i = 0; i < BENCH_QUERIES / 100; i++) {
+        const RatedPlayer *player = rating_store_at_rank(&store, 1 + (size_t)rand() % store.player_count);
+        for (int k = 0; k < 100 && player != NULL; k++) {
+            checksum += player->games;
+            player = rating_store_next(player);
+        }
+    }
+    uint64_t listed = monotonic_ns();
+    printf("[Leaderboard] - [INFO] rank: %.0f ns per query, 100 players from a random rank: %.0f ns per query (checksum %zu).\n",
+           (double)(ranked - start) / BENCH_QUERIES, (double)(listed - ranked) / (BENCH_QUERIES / 100), checksum);
+
+    rating_store_free(&store);
+    return EXIT_SUCCESS;
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-w rating_log] [top [count [from_rank]] | rank <name> ... | checkpoint | bench <players> <games>]\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *log_path = DEFAULT_RATING_LOG;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:")) != -1) {
+        switch (opt) {
+            case 'w':
+                log_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    const char *command = optind < argc ? argv[optind] : "top";
+    if (strcmp(command, "bench") == 0) {
+        if (optind + 2 >= argc) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return run_bench(atol(argv[optind + 1]), atol(argv[optind + 2]));
+    }
+    if (strcmp(command, "top") != 0 && strcmp(command, "rank") != 0 && strcmp(command, "checkpoint") != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char checkpoint_path[PATH_MAX];
+    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s.checkpoint", log_path);
+    RatingStore store;
+    if (!load_store(&store, log_path, checkpoint_path)) {
+        return EXIT_FAILURE;
+    }
+
+    int status;
+    if (strcmp(command, "top") == 0) {
+        long count = optind + 1 < argc ? atol(argv[optind + 1]) : DEFAULT_TOP_COUNT;
+        long from_rank = optind + 2 < argc ? atol(argv[optind + 2]) : 1;
+        status = print_top(&store, count, from_rank);
+    } else if (strcmp(command, "rank") == 0) {
+        status = print_ranks(&store, argv + optind + 1, argc - optind - 1);
+    } else if (rating_store_save_checkpoint(&store, checkpoint_path)) {
+        printf("Checkpoint of %zu players and %llu games, up to byte %lld of the log, written to '%s'.\n", store.player_count,
+               (unsigned long long)store.games, (long long)store.log_offset, checkpoint_path);
+        status = EXIT_SUCCESS;
+    } else {
+        fprintf(stderr, "[Leaderboard] - [ERROR] Could not write '%s'.\n", checkpoint_path);
+        status = EXIT_FAILURE;
+    }
+    rating_store_free(&store);
+    return status;
+}
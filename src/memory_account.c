@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "memory_account.h"
+
+void init_memory_account(MemoryAccount *account, size_t limit, MemoryAccount *parent, MemoryLedger *ledger) {
+    account->used = 0;
+    account->peak = 0;
+    account->limit = limit;
+    account->parent = parent;
+    account->ledger = ledger;
+}
+
+static bool is_process_alive(pid_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+// Adds 'delta' to this process's slot while holding the ledger's lock. Slots of dead processes
+// are cleared on the way, so a crashed server does not keep its bytes forever.
+static bool memory_ledger_charge(MemoryLedger *ledger, int64_t delta) {
+    if (flock(ledger->fd, LOCK_EX) != 0) {
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < MEMORY_LEDGER_SLOTS; i++) {
+        MemoryLedgerSlot *slot = &ledger->slots[i];
+        if (slot->pid != 0 && i != ledger->slot_index && !is_process_alive(slot->pid)) {
+            slot->pid = 0;
+            slot->bytes = 0;
+        }
+        total += slot->bytes;
+    }
+
+    bool admitted = delta <= 0 || ledger->limit == 0 || total + (uint64_t)delta <= ledger->limit;
+    if (admitted) {
+        ledger->slots[ledger->slot_index].bytes += delta;
+    }
+
+    flock(ledger->fd, LOCK_UN);
+    return admitted;
+}
+
+static bool reserve_one(MemoryAccount *account, size_t bytes) {
+    size_t used = __atomic_load_n(&account->used, __ATOMIC_RELAXED);
+    do {
+        if (account->limit != 0 && used + bytes > account->limit) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&account->used, &used, used + bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
+
+static void update_peak(MemoryAccount *account) {
+    size_t used = __atomic_load_n(&account->used, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&account->peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&account->peak, &peak, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+bool memory_reserve(MemoryAccount *account, size_t bytes) {
+    for (MemoryAccount *current = account; current != NULL; current = current->parent) {
+        bool admitted = reserve_one(current, bytes);
+        if (admitted && current->parent == NULL && current->ledger != NULL) {
+            admitted = memory_ledger_charge(current->ledger, (int64_t)bytes);
+            if (!admitted) {
+                __atomic_fetch_sub(&current->used, bytes, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (!admitted) {
+            // undo the accounts below the one that said no
+            for (MemoryAccount *charged = account; charged != current; charged = charged->parent) {
+                __atomic_fetch_sub(&charged->used, bytes, __ATOMIC_RELAXED);
+            }
+            return false;
+        }
+    }
+
+    // only once the whole chain said yes, a refused request never shows up as a peak
+    for (MemoryAccount *current = account; current != NULL; current = current->parent) {
+        update_peak(current);
+    }
+    return true;
+}
+
+void memory_release(MemoryAccount *account, size_t bytes) {
+    for (MemoryAccount *current = account; current != NULL; current = current->parent) {
+        __atomic_fetch_sub(&current->used, bytes, __ATOMIC_RELAXED);
+        if (current->parent == NULL && current->ledger != NULL) {
+            memory_ledger_charge(current->ledger, -(int64_t)bytes);
+        }
+    }
+}
+
+size_t memory_account_used(const MemoryAccount *account) {
+    return __atomic_load_n(&account->used, __ATOMIC_RELAXED);
+}
+
+size_t memory_account_peak(const MemoryAccount *account) {
+    return __atomic_load_n(&account->peak, __ATOMIC_RELAXED);
+}
+
+void *memory_alloc(MemoryAccount *account, size_t bytes) {
+    if (!memory_reserve(account, bytes)) {
+        return NULL;
+    }
+
+    void *pointer = malloc(bytes);
+    if (pointer == NULL) {
+        memory_release(account, bytes);
+    }
+    return pointer;
+}
+
+void *memory_calloc(MemoryAccount *account, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    if (!memory_reserve(account, count * size)) {
+        return NULL;
+    }
+
+    void *pointer = calloc(count, size);
+    if (pointer == NULL) {
+        memory_release(account, count * size);
+    }
+    return pointer;
+}
+
+void memory_free(MemoryAccount *account, void *pointer, size_t bytes) {
+    if (pointer == NULL) {
+        return;
+    }
+    free(pointer);
+    memory_release(account, bytes);
+}
+
+bool open_memory_ledger(MemoryLedger *ledger, const char *path, size_t limit) {
+    size_t size = MEMORY_LEDGER_SLOTS * sizeof(MemoryLedgerSlot);
+
+    ledger->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (ledger->fd < 0) {
+        return false;
+    }
+    // a new file reads back as zeroes, which is an empty ledger
+    if (ftruncate(ledger->fd, size) != 0) {
+        close(ledger->fd);
+        return false;
+    }
+
+    ledger->slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ledger->fd, 0);
+    if (ledger->slots == MAP_FAILED) {
+        close(ledger->fd);
+        return false;
+    }
+    ledger->limit = limit;
+    ledger->slot_index = -1;
+
+    flock(ledger->fd, LOCK_EX);
+    for (int i = 0; i < MEMORY_LEDGER_SLOTS && ledger->slot_index < 0; i++) {
+        MemoryLedgerSlot *slot = &ledger->slots[i];
+        if (slot->pid == 0 || !is_process_alive(slot->pid)) {
+            slot->pid = getpid();
+            slot->bytes = 0;
+            ledger->slot_index = i;
+        }
+    }
+    flock(ledger->fd, LOCK_UN);
+
+    if (ledger->slot_index < 0) {
+        munmap(ledger->slots, size);
+        close(ledger->fd);
+        return false;
+    }
+    return true;
+}
+
+void close_memory_ledger(MemoryLedger *ledger) {
+    if (ledger->slots == NULL) {
+        return;
+    }
+
+    flock(ledger->fd, LOCK_EX);
+    ledger->slots[ledger->slot_index].pid = 0;
+    ledger->slots[ledger->slot_index].bytes = 0;
+    flock(ledger->fd, LOCK_UN);
+
+    munmap(ledger->slots, MEMORY_LEDGER_SLOTS * sizeof(MemoryLedgerSlot));
+    close(ledger->fd);
+    ledger->slots = NULL;
+}
+
+size_t memory_ledger_total(MemoryLedger *ledger) {
+    // a zero charge admits nothing new, it only prunes dead slots under the lock
+    memory_ledger_charge(ledger, 0);
+
+    uint64_t total = 0;
+    for (int i = 0; i < MEMORY_LEDGER_SLOTS; i++) {
+        total += __atomic_load_n(&ledger->slots[i].bytes, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+bool parse_memory_size(const char *argument, size_t *bytes) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(argument, &end, 10);
+    if (end == argument || errno != 0 || argument[0] == '-') {
+        return false;
+    }
+
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+
+    *bytes = (size_t)value << shift;
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef MEMORY_ACCOUNT_H
+#define MEMORY_ACCOUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory quotas. Everything a game allocates is reserved on the game's MemoryAccount before it
+// is allocated, so a request that would go over a limit is turned down without touching the heap.
+// Accounts form a chain: a reservation has to fit every account up to the root, and the root can
+// be backed by a MemoryLedger that shares one budget between every server process on the host.
+
+#define MEMORY_LEDGER_SLOTS 256
+#define MEMORY_LEDGER_DEFAULT_PATH "/tmp/battleship-memory.ledger"
+
+// one slot per live server process, slots of processes that died are reclaimed by the next lock holder
+typedef struct MemoryLedgerSlot {
+    int32_t pid;
+    uint64_t bytes;
+} MemoryLedgerSlot;
+
+typedef struct MemoryLedger {
+    int fd;
+    // 0 for no host-wide limit, the ledger then only reports usage
+    size_t limit;
+    MemoryLedgerSlot *slots;
+    int slot_index;
+} MemoryLedger;
+
+typedef struct MemoryAccount {
+    // updated atomically, any number of threads can charge the same account
+    size_t used;
+    size_t peak;
+    // 0 for no limit
+    size_t limit;
+    struct MemoryAccount *parent;
+    // only read on the root of a chain, NULL keeps the budget within this process
+    MemoryLedger *ledger;
+} MemoryAccount;
+
+void init_memory_account(MemoryAccount *account, size_t limit, MemoryAccount *parent, MemoryLedger *ledger);
+// charges 'bytes' to the account and all of its parents, or to none of them if one would go over
+// its limit. A NULL account is never limited.
+bool memory_reserve(MemoryAccount *account, size_t bytes);
+void memory_release(MemoryAccount *account, size_t bytes);
+size_t memory_account_used(const MemoryAccount *account);
+size_t memory_account_peak(const MemoryAccount *account);
+
+// malloc() / calloc() that reserve first and give the reservation back if the allocation fails
+void *memory_alloc(MemoryAccount *account, size_t bytes);
+void *memory_calloc(MemoryAccount *account, size_t count, size_t size);
+// 'bytes' must be what the block was allocated with
+void memory_free(MemoryAccount *account, void *pointer, size_t bytes);
+
+// maps the ledger file, creating it if needed, and claims a slot for this process
+bool open_memory_ledger(MemoryLedger *ledger, const char *path, size_t limit);
+// gives up this process's slot, so its bytes stop counting against the host
+void close_memory_ledger(MemoryLedger *ledger);
+// bytes charged by all live server processes
+size_t memory_ledger_total(MemoryLedger *ledger);
+
+// "<bytes>" with an optional K, M or G suffix
+bool parse_memory_size(const char *argument, size_t *bytes);
+
+#endif
@@ -1,69 +1,156 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
+#include "client.h"
 
-#define PORT1 2201
-#define PORT2 2202
 #define BUFFER_SIZE 1024
 
+typedef struct ScriptRun {
+    FILE *script;
+    char player;
+    // script lines sent before the first of them is answered
+    int depth;
+    bool script_done;
+    bool finished;
+    long samples[BUFFER_SIZE];
+    int sample_count;
+} ScriptRun;
+
 void getInput(char* prompt, char* buffer) {
     printf("%s", prompt);
     fgets(buffer, BUFFER_SIZE, stdin);
 }
 
-int main(int argc, char **argv) {
-    FILE *fp;
-    fp = fopen(argv[1], "r");
-    char player_number[2];
-    getInput("Which player are you? (1 or 2)", player_number);
-    int client_fd = 0;
-    struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
+int compare_long(const void *left, const void *right) {
+    long l = *(const long *)left;
+    long r = *(const long *)right;
+    return (l > r) - (l < r);
+}
+
+// every packet's time from send() to its reply, so the transports can be compared on the same script
+void print_round_trip_latency(char player, TransportKind kind, long *samples, int count) {
+    if (count == 0) {
+        return;
+    }
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(long), compare_long);
+    printf("[Client%c] Round trip over %s: %d packets, min %.1f us, avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        player, transport_kind_name(kind), count, samples[0] / 1e3, total / 1e3 / count,
+        samples[count / 2] / 1e3, samples[(count * 99) / 100] / 1e3, samples[count - 1] / 1e3);
+}
+
+// keeps up to 'depth' script lines waiting for their replies
+void send_script_lines(ClientConnection *connection) {
+    ScriptRun *run = connection->context;
+    char line[BUFFER_SIZE];
+
+    while (!run->script_done && client_outstanding(connection) < run->depth) {
+        if (fgets(line, sizeof(line), run->script) == NULL) {
+            run->script_done = true;
+            break;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] != '\0' && !client_send(connection, line, NULL)) {
+            perror("[Client] send() failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (run->script_done && client_outstanding(connection) == 0) {
+        run->finished = true;
+    }
+}
 
-    // Create socket
-    if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("[Client] socket() failed.");
+void handle_reply(ClientConnection *connection, const ClientReply *reply) {
+    ScriptRun *run = connection->context;
+
+    if (reply->type == CLIENT_REPLY_CLOSED) {
+        perror("[Client] read() failed.");
         exit(EXIT_FAILURE);
     }
+    if (!reply->unsolicited && run->sample_count < BUFFER_SIZE) {
+        run->samples[run->sample_count++] = (long)reply->round_trip_ns;
+    }
+    printf("[Client%c] Received from server: %s\n", run->player, reply->text);
+    if (reply->type == 'H') {
+        printf(reply->code == 1 ? "[Client%c] We have Won!\n" : "[Client%c] We have Lost!\n", run->player);
+        run->finished = true;
+        return;
+    }
+    send_script_lines(connection);
+}
 
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(player_number[0]=='1' ? PORT1 : PORT2);
+int main(int argc, char **argv) {
+    TransportKind kind = TRANSPORT_TCP;
+    const char *unix_dir = TRANSPORT_DEFAULT_UNIX_DIR;
+    bool report_latency = false;
+    int depth = 1;
+    int opt;
 
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) {
-        perror("[Client] Invalid address/ Address not supported.");
+    while ((opt = getopt(argc, argv, "T:d:lP:")) != -1) {
+        switch (opt) {
+            case 'T':
+                if (!parse_transport_kind(optarg, &kind)) {
+                    fprintf(stderr, "[Client] Unknown transport '%s', expected tcp, unix or shm.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                unix_dir = optarg;
+                break;
+            case 'l':
+                report_latency = true;
+                break;
+            case 'P':
+                depth = atoi(optarg);
+                if (depth < 1 || depth >= CLIENT_MAX_PIPELINE) {
+                    fprintf(stderr, "[Client] The pipeline depth is 1 to %d.\n", CLIENT_MAX_PIPELINE - 1);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-T tcp|unix|shm] [-d unix_socket_dir] [-l] [-P depth] script\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-T tcp|unix|shm] [-d unix_socket_dir] [-l] [-P depth] script\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    // Connect to server
-    if (connect(client_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+    ScriptRun run = { .script = fopen(argv[optind], "r"), .depth = depth, .script_done = false, .finished = false, .sample_count = 0 };
+    if (run.script == NULL) {
+        perror("[Client] Could not open the script.");
+        exit(EXIT_FAILURE);
+    }
+    char player_number[BUFFER_SIZE];
+    getInput("Which player are you? (1 or 2)", player_number);
+    run.player = player_number[0];
+
+    ClientLoop loop;
+    ClientConnection *connection = NULL;
+    if (!client_loop_init(&loop)
+        || (connection = client_connect(&loop, kind, run.player == '1' ? 1 : 2, unix_dir, handle_reply, &run)) == NULL) {
         perror("[Client] connect() failed.");
         exit(EXIT_FAILURE);
     }
-    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-        buffer[strcspn(buffer, "\r\n")] = 0;
-        send(client_fd, buffer, strlen(buffer), 0);
-        memset(buffer, 0, BUFFER_SIZE);
-        int nbytes = read(client_fd, buffer, BUFFER_SIZE);
-        if (nbytes <= 0) {
-            perror("[Client] read() failed.");
+    send_script_lines(connection);
+    while (!run.finished) {
+        if (client_loop_run(&loop, -1) < 0) {
+            perror("[Client] epoll_wait() failed.");
             exit(EXIT_FAILURE);
         }
-        printf("[Client%c] Received from server: %s\n", player_number[0], buffer);
-        if (strcmp(buffer, "H 1") == 0) {
-            printf("[Client%c] We have Won!\n",player_number[0]);
-            break;  
-        }
-        if (strcmp(buffer, "H 0") == 0) {
-            printf("[Client%c] We have Lost!\n",player_number[0]);
-            break;  
-        }
     }
 
-    printf("[Client%c] Shutting down.\n",player_number[0]);
-    close(client_fd);
+    if (report_latency) {
+        print_round_trip_latency(run.player, kind, run.samples, run.sample_count);
+    }
+    printf("[Client%c] Shutting down.\n", run.player);
+    fclose(run.script);
+    client_loop_close(&loop);
     return 0;
-}
\ No newline at end of file
+}
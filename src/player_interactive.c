@@ -2,70 +2,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
+#include "client.h"
 
-#define PORT1 2201
-#define PORT2 2202
 #define BUFFER_SIZE 1024
 
+typedef struct InteractivePlayer {
+    char number;
+    bool replied;
+    bool game_over;
+} InteractivePlayer;
+
 void getInput(char* prompt, char* buffer) {
     printf("%s", prompt);
     fgets(buffer, BUFFER_SIZE, stdin);
 }
 
-int main() {
-    char player_number[2];
-    getInput("Which player are you? (1 or 2)", player_number);
-    int client_fd = 0;
-    struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
+void handle_reply(ClientConnection *connection, const ClientReply *reply) {
+    InteractivePlayer *player = connection->context;
 
-    // Create socket
-    if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("[Client] socket() failed.");
+    if (reply->type == CLIENT_REPLY_CLOSED) {
+        perror("[Client] read() failed.");
         exit(EXIT_FAILURE);
     }
-
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(player_number[0]=='1' ? PORT1 : PORT2);
-
-    // Convert IPv4 and IPv6 addresses from text to binary form
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) {
-        perror("[Client] Invalid address/ Address not supported.");
-        exit(EXIT_FAILURE);
+    printf("[Client%c] Received from server: %s\n", player->number, reply->text);
+    // a pushed token answers nothing, the prompt keeps waiting
+    if (reply->type != 'T' || !reply->unsolicited) {
+        player->replied = true;
     }
+    if (reply->type == 'H') {
+        printf(reply->code == 1 ? "[Client%c] We have Won!\n" : "[Client%c] We have Lost!\n", player->number);
+        player->game_over = true;
+    }
+}
 
-    // Connect to server
-    if (connect(client_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+int main() {
+    char player_number[BUFFER_SIZE];
+    getInput("Which player are you? (1 or 2)", player_number);
+    InteractivePlayer player = { .number = player_number[0], .replied = false, .game_over = false };
+    char buffer[BUFFER_SIZE] = {0};
+
+    ClientLoop loop;
+    ClientConnection *connection = NULL;
+    if (!client_loop_init(&loop)
+        || (connection = client_connect(&loop, TRANSPORT_TCP, player.number == '1' ? 1 : 2, NULL, handle_reply, &player)) == NULL) {
         perror("[Client] connect() failed.");
         exit(EXIT_FAILURE);
     }
-    while (1) {
-        printf("[Client%c] Enter message: ",player_number[0]);
-        memset(buffer, 0, BUFFER_SIZE);
-        fgets(buffer, BUFFER_SIZE, stdin);
-        buffer[strlen(buffer)-1] = '\0';
-        send(client_fd, buffer, strlen(buffer), 0);
-        memset(buffer, 0, BUFFER_SIZE);
-        int nbytes = read(client_fd, buffer, BUFFER_SIZE);
-        if (nbytes <= 0) {
-            perror("[Client] read() failed.");
-            exit(EXIT_FAILURE);
+    while (!player.game_over) {
+        printf("[Client%c] Enter message: ", player.number);
+        fflush(stdout);
+        if (fgets(buffer, BUFFER_SIZE, stdin) == NULL) {
+            break;
+        }
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (buffer[0] == '\0') {
+            continue;
         }
-        printf("[Client%c] Received from server: %s\n", player_number[0], buffer);
-        if (strcmp(buffer, "H 1") == 0) {
-            printf("[Client%c] We have Won!\n",player_number[0]);
-            break;  
+        if (!client_send(connection, buffer, NULL)) {
+            perror("[Client] send() failed.");
+            exit(EXIT_FAILURE);
         }
-        if (strcmp(buffer, "H 0") == 0) {
-            printf("[Client%c] We have Lost!\n",player_number[0]);
-            break;  
+        // an opponent that forfeited while we were typing answers this line with the H
+        player.replied = false;
+        while (!player.replied && client_loop_run(&loop, -1) >= 0) {
         }
-        
     }
 
-    printf("[Client2] Shutting down.\n");
-    close(client_fd);
+    printf("[Client%c] Shutting down.\n", player.number);
+    client_loop_close(&loop);
     return 0;
-}
\ No newline at end of file
+}
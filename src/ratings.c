@@ -0,0 +1,641 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ratings.h"
+
+#define RATING_INITIAL_BUCKETS 1024
+#define RATING_REPLAY_RECORDS 4096
+#define RATING_CHECKPOINT_HEADER_SIZE 32
+#define RATING_CHECKPOINT_ENTRY_SIZE 64
+#define RATING_DAY_MS 86400000.0
+
+// Glicko's q, ln(10) / 400
+#define GLICKO_Q 0.0057564627324851142
+#define GLICKO_PI 3.14159265358979323846
+
+// ---------------------------------------------------------------- encoding
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+// CRC-32 (IEEE), the one zlib and gzip use
+static uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t length) {
+    if (!crc_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            crc_table[i] = value;
+        }
+        crc_table_ready = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static void put_double(unsigned char *out, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u64(out, bits);
+}
+
+static double get_double(const unsigned char *in) {
+    uint64_t bits = get_u64(in);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool is_valid_player_name(const char *name) {
+    if (!isalpha((unsigned char)name[0])) {
+        return false;
+    }
+    size_t length = 0;
+    for (; name[length] != '\0'; length++) {
+        unsigned char c = (unsigned char)name[length];
+        if (length >= RATING_NAME_SIZE - 1 || !(isalnum(c) || c == '_' || c == '-' || c == '.')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A record is 96 bytes, little-endian:
+//   0 magic, 4 CRC-32 of bytes 8-95, 8 ended_ms, 16 game_id, 20 reason,
+//   24 winner, 56 loser (both NUL-padded), 88 reserved zeros
+static void encode_log_record(const RatingLogRecord *record, unsigned char *out) {
+    memset(out, 0, RATING_LOG_RECORD_SIZE);
+    put_u32(out, RATING_LOG_MAGIC);
+    put_u64(out + 8, (uint64_t)record->ended_ms);
+    put_u32(out + 16, (uint32_t)record->game_id);
+    put_u32(out + 20, (uint32_t)record->reason);
+    snprintf((char *)out + 24, RATING_NAME_SIZE, "%s", record->winner);
+    snprintf((char *)out + 56, RATING_NAME_SIZE, "%s", record->loser);
+    put_u32(out + 4, crc32_update(0, out + 8, RATING_LOG_RECORD_SIZE - 8));
+}
+
+static bool decode_log_record(const unsigned char *in, RatingLogRecord *record) {
+    if (get_u32(in) != RATING_LOG_MAGIC || get_u32(in + 4) != crc32_update(0, in + 8, RATING_LOG_RECORD_SIZE - 8)) {
+        return false;
+    }
+    record->ended_ms = (int64_t)get_u64(in + 8);
+    record->game_id = (int32_t)get_u32(in + 16);
+    record->reason = (int32_t)get_u32(in + 20);
+    memcpy(record->winner, in + 24, RATING_NAME_SIZE);
+    memcpy(record->loser, in + 56, RATING_NAME_SIZE);
+    record->winner[RATING_NAME_SIZE - 1] = '\0';
+    record->loser[RATING_NAME_SIZE - 1] = '\0';
+    return is_valid_player_name(record->winner) && is_valid_player_name(record->loser);
+}
+
+// ---------------------------------------------------------------- log
+
+int rating_log_open(const char *path) {
+    return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+bool rating_log_append(int fd, const RatingLogRecord *record) {
+    unsigned char bytes[RATING_LOG_RECORD_SIZE];
+    encode_log_record(record, bytes);
+
+    // one write, so records from servers sharing the log never interleave
+    ssize_t written;
+    do {
+        written = write(fd, bytes, sizeof(bytes));
+    } while (written < 0 && errno == EINTR);
+    if (written != (ssize_t)sizeof(bytes)) {
+        return false;
+    }
+    return fdatasync(fd) == 0;
+}
+
+// ---------------------------------------------------------------- skip list
+
+static uint64_t next_random(RatingStore *store) {
+    // xorshift64*, seeded the same every time so a replay builds the same list
+    store->random_state ^= store->random_state >> 12;
+    store->random_state ^= store->random_state << 25;
+    store->random_state ^= store->random_state >> 27;
+    return store->random_state * 0x2545f4914f6cdd1dull;
+}
+
+static int random_levels(RatingStore *store) {
+    // each level holds a quarter of the one below
+    uint64_t bits = next_random(store);
+    int levels = 1;
+    while ((bits & 3) == 0 && levels < RATING_SKIP_LIST_LEVELS) {
+        levels++;
+        bits >>= 2;
+    }
+    return levels;
+}
+
+// true if 'player' ranks ahead of a player with 'rating' and 'name': higher ratings first, ties
+// by name
+static bool ranks_ahead(const RatedPlayer *player, double rating, const char *name) {
+    if (player->rating != rating) {
+        return player->rating > rating;
+    }
+    return strcmp(player->name, name) < 0;
+}
+
+static void skip_list_insert(RatingStore *store, RatedPlayer *player) {
+    RatedPlayer *update[RATING_SKIP_LIST_LEVELS];
+    size_t rank[RATING_SKIP_LIST_LEVELS];
+
+    RatedPlayer *at = store->head;
+    for (int level = store->levels - 1; level >= 0; level--) {
+        rank[level] = level == store->levels - 1 ? 0 : rank[level + 1];
+        while (at->links[level].next != NULL && ranks_ahead(at->links[level].next, player->rating, player->name)) {
+            rank[level] += at->links[level].span;
+            at = at->links[level].next;
+        }
+        update[level] = at;
+    }
+    if (player->levels > store->levels) {
+        for (int level = store->levels; level < player->levels; level++) {
+            rank[level] = 0;
+            update[level] = store->head;
+            store->head->links[level].span = store->player_count;
+        }
+        store->levels = player->levels;
+    }
+
+    for (int level = 0; level < player->levels; level++) {
+        RatingLink *before = &update[level]->links[level];
+        player->links[level].next = before->next;
+        player->links[level].span = before->span - (rank[0] - rank[level]);
+        before->next = player;
+        before->span = rank[0] - rank[level] + 1;
+    }
+    for (int level = player->levels; level < store->levels; level++) {
+        update[level]->links[level].span++;
+    }
+    store->player_count++;
+}
+
+static void skip_list_remove(RatingStore *store, RatedPlayer *player) {
+    RatedPlayer *update[RATING_SKIP_LIST_LEVELS];
+
+    RatedPlayer *at = store->head;
+    for (int level = store->levels - 1; level >= 0; level--) {
+        while (at->links[level].next != NULL && ranks_ahead(at->links[level].next, player->rating, player->name)) {
+            at = at->links[level].next;
+        }
+        update[level] = at;
+    }
+
+    for (int level = 0; level < store->levels; level++) {
+        RatingLink *before = &update[level]->links[level];
+        if (before->next == player) {
+            before->span += player->links[level].span - 1;
+            before->next = player->links[level].next;
+        } else {
+            before->span--;
+        }
+    }
+    while (store->levels > 1 && store->head->links[store->levels - 1].next == NULL) {
+        store->levels--;
+    }
+    store->player_count--;
+}
+
+size_t rating_store_rank(const RatingStore *store, const RatedPlayer *player) {
+    size_t rank = 0;
+    const RatedPlayer *at = store->head;
+    for (int level = store->levels - 1; level >= 0; level--) {
+        while (at->links[level].next != NULL
+               && (at->links[level].next == player || ranks_ahead(at->links[level].next, player->rating, player->name))) {
+            rank += at->links[level].span;
+            at = at->links[level].next;
+        }
+        if (at == player) {
+            return rank;
+        }
+    }
+    return 0;
+}
+
+const RatedPlayer *rating_store_at_rank(const RatingStore *store, size_t rank) {
+    size_t passed = 0;
+    const RatedPlayer *at = store->head;
+    for (int level = store->levels - 1; level >= 0; level--) {
+        while (at->links[level].next != NULL && passed + at->links[level].span <= rank) {
+            passed += at->links[level].span;
+            at = at->links[level].next;
+        }
+        if (passed == rank) {
+            return at != store->head ? at : NULL;
+        }
+    }
+    return NULL;
+}
+
+const RatedPlayer *rating_store_next(const RatedPlayer *player) {
+    return player->links[0].next;
+}
+
+// ---------------------------------------------------------------- players by name
+
+static uint64_t hash_name(const char *name) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static RatedPlayer *find_player(const RatingStore *store, const char *name) {
+    RatedPlayer *player = store->buckets[hash_name(name) & (store->bucket_count - 1)];
+    while (player != NULL && strcmp(player->name, name) != 0) {
+        player = player->next_in_bucket;
+    }
+    return player;
+}
+
+const RatedPlayer *rating_store_find(const RatingStore *store, const char *name) {
+    return find_player(store, name);
+}
+
+static bool add_to_buckets(RatingStore *store, RatedPlayer *player) {
+    if (store->player_count >= store->bucket_count) {
+        size_t bucket_count = store->bucket_count * 2;
+        RatedPlayer **buckets = calloc(bucket_count, sizeof(RatedPlayer *));
+        if (buckets == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < store->bucket_count; i++) {
+            RatedPlayer *moved = store->buckets[i];
+            while (moved != NULL) {
+                RatedPlayer *next = moved->next_in_bucket;
+                size_t bucket = hash_name(moved->name) & (bucket_count - 1);
+                moved->next_in_bucket = buckets[bucket];
+                buckets[bucket] = moved;
+                moved = next;
+            }
+        }
+        free(store->buckets);
+        store->buckets = buckets;
+        store->bucket_count = bucket_count;
+    }
+    size_t bucket = hash_name(player->name) & (store->bucket_count - 1);
+    player->next_in_bucket = store->buckets[bucket];
+    store->buckets[bucket] = player;
+    return true;
+}
+
+static RatedPlayer *allocate_player(int levels, const char *name) {
+    RatedPlayer *player = calloc(1, sizeof(RatedPlayer) + (size_t)levels * sizeof(RatingLink));
+    if (player != NULL) {
+        // every caller passes a name already checked by is_valid_player_name(), or the head's ""
+        memcpy(player->name, name, strlen(name) + 1);
+        player->levels = levels;
+        player->rating = RATING_INITIAL;
+        player->deviation = RATING_INITIAL_DEVIATION;
+    }
+    return player;
+}
+
+static RatedPlayer *find_or_add_player(RatingStore *store, const char *name) {
+    RatedPlayer *player = find_player(store, name);
+    if (player != NULL) {
+        return player;
+    }
+    player = allocate_player(random_levels(store), name);
+    if (player == NULL) {
+        return NULL;
+    }
+    if (!add_to_buckets(store, player)) {
+        free(player);
+        return NULL;
+    }
+    skip_list_insert(store, player);
+    return player;
+}
+
+// ---------------------------------------------------------------- store
+
+bool rating_store_init(RatingStore *store) {
+    memset(store, 0, sizeof(*store));
+    store->buckets = calloc(RATING_INITIAL_BUCKETS, sizeof(RatedPlayer *));
+    store->head = allocate_player(RATING_SKIP_LIST_LEVELS, "");
+    if (store->buckets == NULL || store->head == NULL) {
+        free(store->buckets);
+        free(store->head);
+        return false;
+    }
+    store->bucket_count = RATING_INITIAL_BUCKETS;
+    store->levels = 1;
+    store->random_state = 0x9e3779b97f4a7c15ull;
+    return true;
+}
+
+void rating_store_free(RatingStore *store) {
+    if (store->head == NULL) {
+        return;
+    }
+    RatedPlayer *player = store->head->links[0].next;
+    while (player != NULL) {
+        RatedPlayer *next = player->links[0].next;
+        free(player);
+        player = next;
+    }
+    free(store->head);
+    free(store->buckets);
+    memset(store, 0, sizeof(*store));
+}
+
+static double glicko_g(double deviation) {
+    return 1.0 / sqrt(1.0 + 3.0 * GLICKO_Q * GLICKO_Q * deviation * deviation / (GLICKO_PI * GLICKO_PI));
+}
+
+// the deviation a player starts a game ending at 'now_ms' with, grown for the days since the last one
+static double deviation_at(const RatedPlayer *player, int64_t now_ms) {
+    if (player->games == 0 || now_ms <= player->last_game_ms) {
+        return player->deviation;
+    }
+    double days = (now_ms - player->last_game_ms) / RATING_DAY_MS;
+    double deviation = sqrt(player->deviation * player->deviation + RATING_DEVIATION_GROWTH * RATING_DEVIATION_GROWTH * days);
+    return deviation < RATING_INITIAL_DEVIATION ? deviation : RATING_INITIAL_DEVIATION;
+}
+
+// Glicko-1 for a rating period holding a single game with 'score' 1 or 0
+static void glicko_update(double rating, double deviation, double opponent_rating, double opponent_deviation, double score,
+                          double *new_rating, double *new_deviation) {
+    double g = glicko_g(opponent_deviation);
+    double expected = 1.0 / (1.0 + pow(10.0, -g * (rating - opponent_rating) / 400.0));
+    double d_squared_inverse = GLICKO_Q * GLICKO_Q * g * g * expected * (1.0 - expected);
+    double precision = 1.0 / (deviation * deviation) + d_squared_inverse;
+
+    *new_rating = rating + GLICKO_Q / precision * g * (score - expected);
+    *new_deviation = sqrt(1.0 / precision);
+    if (*new_deviation < RATING_MIN_DEVIATION) {
+        *new_deviation = RATING_MIN_DEVIATION;
+    }
+}
+
+bool rating_store_apply(RatingStore *store, const RatingLogRecord *record) {
+    if (strcmp(record->winner, record->loser) == 0) {
+        return true;
+    }
+    RatedPlayer *winner = find_or_add_player(store, record->winner);
+    RatedPlayer *loser = winner != NULL ? find_or_add_player(store, record->loser) : NULL;
+    if (loser == NULL) {
+        return false;
+    }
+
+    double winner_deviation = deviation_at(winner, record->ended_ms);
+    double loser_deviation = deviation_at(loser, record->ended_ms);
+    double winner_rating, loser_rating;
+    glicko_update(winner->rating, winner_deviation, loser->rating, loser_deviation, 1.0, &winner_rating, &winner_deviation);
+    glicko_update(loser->rating, loser_deviation, winner->rating, winner_deviation, 0.0, &loser_rating, &loser_deviation);
+
+    // a player's place in the list depends on the rating, so both move
+    skip_list_remove(store, winner);
+    skip_list_remove(store, loser);
+    winner->rating = winner_rating;
+    winner->deviation = winner_deviation;
+    loser->rating = loser_rating;
+    loser->deviation = loser_deviation;
+    skip_list_insert(store, winner);
+    skip_list_insert(store, loser);
+
+    RatedPlayer *players[2] = { winner, loser };
+    for (int i = 0; i < 2; i++) {
+        players[i]->games++;
+        if (record->ended_ms > players[i]->last_game_ms) {
+            players[i]->last_game_ms = record->ended_ms;
+        }
+    }
+    winner->wins++;
+    store->games++;
+    return true;
+}
+
+bool rating_store_replay(RatingStore *store, const char *log_path) {
+    int fd = open(log_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (lseek(fd, store->log_offset, SEEK_SET) != store->log_offset) {
+        close(fd);
+        return false;
+    }
+
+    unsigned char *buffer = malloc(RATING_REPLAY_RECORDS * RATING_LOG_RECORD_SIZE);
+    if (buffer == NULL) {
+        close(fd);
+        return false;
+    }
+    size_t length = 0;
+    bool replayed = true;
+    store->skipped_bytes = 0;
+
+    for (;;) {
+        ssize_t result = read(fd, buffer + length, RATING_REPLAY_RECORDS * RATING_LOG_RECORD_SIZE - length);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            replayed = false;
+            break;
+        }
+        if (result == 0) {
+            break;
+        }
+        length += result;
+
+        size_t position = 0;
+        while (length - position >= RATING_LOG_RECORD_SIZE) {
+            RatingLogRecord record;
+            if (!decode_log_record(buffer + position, &record)) {
+                // a torn or damaged record, look for the next intact one from the following byte
+                position++;
+                store->skipped_bytes++;
+                continue;
+            }
+            if (!rating_store_apply(store, &record)) {
+                replayed = false;
+                break;
+            }
+            position += RATING_LOG_RECORD_SIZE;
+        }
+        memmove(buffer, buffer + position, length - position);
+        length -= position;
+        store->log_offset += position;
+        if (!replayed) {
+            break;
+        }
+    }
+    // a partial record at the end is left for the next replay, a server may still be writing it
+
+    free(buffer);
+    close(fd);
+    return replayed;
+}
+
+// ---------------------------------------------------------------- checkpoints
+
+// A checkpoint is a 32-byte header, magic, version, player count, games and log offset, then
+// one 64-byte entry per player in rank order, name, rating, deviation, last game, games and
+// wins, then the CRC-32 of everything before it.
+bool rating_store_save_checkpoint(const RatingStore *store, const char *path) {
+    char temporary_path[PATH_MAX];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.%d.tmp", path, (int)getpid());
+    FILE *file = fopen(temporary_path, "we");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned char header[RATING_CHECKPOINT_HEADER_SIZE];
+    put_u32(header, RATING_CHECKPOINT_MAGIC);
+    put_u32(header + 4, RATING_CHECKPOINT_VERSION);
+    put_u64(header + 8, store->player_count);
+    put_u64(header + 16, store->games);
+    put_u64(header + 24, (uint64_t)store->log_offset);
+    uint32_t crc = crc32_update(0, header, sizeof(header));
+    bool written = fwrite(header, sizeof(header), 1, file) == 1;
+
+    for (const RatedPlayer *player = store->head->links[0].next; written && player != NULL; player = player->links[0].next) {
+        unsigned char entry[RATING_CHECKPOINT_ENTRY_SIZE] = { 0 };
+        memcpy(entry, player->name, RATING_NAME_SIZE);
+        put_double(entry + 32, player->rating);
+        put_double(entry + 40, player->deviation);
+        put_u64(entry + 48, (uint64_t)player->last_game_ms);
+        put_u32(entry + 56, player->games);
+        put_u32(entry + 60, player->wins);
+        crc = crc32_update(crc, entry, sizeof(entry));
+        written = fwrite(entry, sizeof(entry), 1, file) == 1;
+    }
+
+    unsigned char trailer[4];
+    put_u32(trailer, crc);
+    written = written && fwrite(trailer, sizeof(trailer), 1, file) == 1;
+    written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary_path, path) != 0) {
+        unlink(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+bool rating_store_load_checkpoint(RatingStore *store, const char *path) {
+    FILE *file = fopen(path, "re");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned char header[RATING_CHECKPOINT_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1 || get_u32(header) != RATING_CHECKPOINT_MAGIC
+        || get_u32(header + 4) != RATING_CHECKPOINT_VERSION) {
+        fclose(file);
+        return false;
+    }
+    uint64_t player_count = get_u64(header + 8);
+    uint32_t crc = crc32_update(0, header, sizeof(header));
+
+    // the entries come best first, so each player is appended behind the last one on every level
+    // it reaches instead of being searched for
+    RatedPlayer *last[RATING_SKIP_LIST_LEVELS];
+    size_t last_rank[RATING_SKIP_LIST_LEVELS];
+    for (int level = 0; level < RATING_SKIP_LIST_LEVELS; level++) {
+        last[level] = store->head;
+        last_rank[level] = 0;
+    }
+
+    bool loaded = true;
+    for (uint64_t rank = 1; loaded && rank <= player_count; rank++) {
+        unsigned char entry[RATING_CHECKPOINT_ENTRY_SIZE];
+        if (fread(entry, sizeof(entry), 1, file) != 1) {
+            loaded = false;
+            break;
+        }
+        crc = crc32_update(crc, entry, sizeof(entry));
+        entry[RATING_NAME_SIZE - 1] = '\0';
+        const char *name = (const char *)entry;
+        double rating = get_double(entry + 32);
+        if (!is_valid_player_name(name) || find_player(store, name) != NULL
+            || (last[0] != store->head && !ranks_ahead(last[0], rating, name))) {
+            loaded = false;
+            break;
+        }
+
+        RatedPlayer *player = allocate_player(random_levels(store), name);
+        if (player == NULL || !add_to_buckets(store, player)) {
+            free(player);
+            loaded = false;
+            break;
+        }
+        player->rating = rating;
+        player->deviation = get_double(entry + 40);
+        player->last_game_ms = (int64_t)get_u64(entry + 48);
+        player->games = get_u32(entry + 56);
+        player->wins = get_u32(entry + 60);
+        for (int level = 0; level < player->levels; level++) {
+            last[level]->links[level].next = player;
+            last[level]->links[level].span = rank - last_rank[level];
+            last[level] = player;
+            last_rank[level] = rank;
+        }
+        if (player->levels > store->levels) {
+            store->levels = player->levels;
+        }
+        store->player_count++;
+    }
+    for (int level = 0; level < store->levels; level++) {
+        last[level]->links[level].span = store->player_count - last_rank[level];
+    }
+
+    unsigned char trailer[4];
+    loaded = loaded && fread(trailer, sizeof(trailer), 1, file) == 1 && get_u32(trailer) == crc;
+    fclose(file);
+    if (!loaded) {
+        // the players added so far are all on level 0, free them with the rest of the store
+        rating_store_free(store);
+        rating_store_init(store);
+        return false;
+    }
+    store->games = get_u64(header + 16);
+    store->log_offset = (off_t)get_u64(header + 24);
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef RATINGS_H
+#define RATINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Ratings of players who named themselves in their B packet. A server started with -W appends
+// the result of every rated game to a write-ahead log: one fixed-size, checksummed record per
+// game, written with a single append, so any number of servers can share the file and a crash can
+// at worst leave a torn record behind, which replay skips.
+//
+// A RatingStore replays the log into memory. Ratings are Glicko-1, updated game by game in log
+// order, so replaying the same log always gives the same ratings. Players are kept in a hash
+// table by name and in an indexable skip list ordered by rating, so a player's rank, the player
+// at a rank and each step down the leaderboard are O(log n). A checkpoint saves the store and the
+// log offset it covers, and a later start only replays the records after it.
+
+#define RATING_NAME_SIZE 32
+#define RATING_LOG_MAGIC 0x4c525342u
+#define RATING_LOG_RECORD_SIZE 96
+#define RATING_CHECKPOINT_MAGIC 0x4b435342u
+#define RATING_CHECKPOINT_VERSION 1
+#define RATING_SKIP_LIST_LEVELS 32
+
+#define RATING_INITIAL 1500.0
+#define RATING_INITIAL_DEVIATION 350.0
+#define RATING_MIN_DEVIATION 30.0
+// Glicko's c for a rating period of one day: an established deviation of 50 is back at 350 after
+// about three years without games
+#define RATING_DEVIATION_GROWTH 11.0
+
+typedef struct RatingLogRecord {
+    // CLOCK_REALTIME milliseconds when the game ended
+    int64_t ended_ms;
+    int32_t game_id;
+    // the GameEndReason of the analytics records
+    int32_t reason;
+    char winner[RATING_NAME_SIZE];
+    char loser[RATING_NAME_SIZE];
+} RatingLogRecord;
+
+typedef struct RatedPlayer RatedPlayer;
+
+typedef struct RatingLink {
+    RatedPlayer *next;
+    // players the link skips, counting the one it points at
+    size_t span;
+} RatingLink;
+
+struct RatedPlayer {
+    char name[RATING_NAME_SIZE];
+    double rating;
+    double deviation;
+    int64_t last_game_ms;
+    uint32_t games;
+    uint32_t wins;
+    RatedPlayer *next_in_bucket;
+    int levels;
+    RatingLink links[];
+};
+
+typedef struct RatingStore {
+    RatedPlayer **buckets;
+    size_t bucket_count;
+    size_t player_count;
+    // the skip list's head, with every level, ahead of the best player
+    RatedPlayer *head;
+    int levels;
+    uint64_t random_state;
+    // records applied, and how far into the log they reach
+    uint64_t games;
+    off_t log_offset;
+    // damaged bytes the last replay skipped
+    off_t skipped_bytes;
+} RatingStore;
+
+// true for 1 to RATING_NAME_SIZE - 1 letters, digits, '_', '-' and '.', starting with a letter
+bool is_valid_player_name(const char *name);
+
+// opens the log for appending, creating it if needed, -1 on failure
+int rating_log_open(const char *path);
+// appends one record and waits for it to reach the disk
+bool rating_log_append(int fd, const RatingLogRecord *record);
+
+bool rating_store_init(RatingStore *store);
+void rating_store_free(RatingStore *store);
+// Applies one game: both players are created at the initial rating if new, then rated against
+// each other. False if out of memory.
+bool rating_store_apply(RatingStore *store, const RatingLogRecord *record);
+// Applies the log from store->log_offset to its end. Damaged or torn records are skipped up to
+// the next intact one. False if the log could not be read or memory ran out.
+bool rating_store_replay(RatingStore *store, const char *log_path);
+// Writes the store to 'path' through a temporary file and a rename.
+bool rating_store_save_checkpoint(const RatingStore *store, const char *path);
+// Loads a checkpoint into an empty store. False if it is missing or damaged, the store stays empty.
+bool rating_store_load_checkpoint(RatingStore *store, const char *path);
+
+const RatedPlayer *rating_store_find(const RatingStore *store, const char *name);
+// 1 for the best player
+size_t rating_store_rank(const RatingStore *store, const RatedPlayer *player);
+// the player at a 1-based rank, NULL past the end
+const RatedPlayer *rating_store_at_rank(const RatingStore *store, size_t rank);
+// the player ranked right below 'player', NULL for the last one
+const RatedPlayer *rating_store_next(const RatedPlayer *player);
+
+#endif
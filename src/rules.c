@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <string.h>
+#include "rules.h"
+
+const int tetris_shape_offsets[7][4][4][2] = {
+    // shape 1 - rotations 1 to 4
+    {
+        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 1
+        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 2
+        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}, // rotation 3
+        {{0, 0}, {0, 1}, {1, 0}, {1, 1}}  // rotation 4
+    },
+    // shape 2 - rotations 1 to 4
+    {
+        {{0, 0}, {1, 0}, {2, 0}, {3, 0}}, // rotation 1
+        {{0, 0}, {0, 1}, {0, 2}, {0, 3}}, // rotation 2
+        {{0, 0}, {1, 0}, {2, 0}, {3, 0}}, // rotation 3
+        {{0, 0}, {0, 1}, {0, 2}, {0, 3}}  // rotation 4
+    },
+    // shape 3 - rotations 1 to 4
+    {
+        {{0, 0}, {0, 1}, {-1, 1}, {-1, 2}}, // rotation 1
+        {{0, 0}, {1, 0}, {1, 1}, {2, 1}},   // rotation 2
+        {{0, 0}, {0, 1}, {-1, 1}, {-1, 2}}, // rotation 3
+        {{0, 0}, {1, 0}, {1, 1}, {2, 1}}    // rotation 4
+    },
+    // shape 4 - rotations 1 to 4
+    {
+        {{0, 0}, {1, 0}, {2, 0}, {2, 1}},   // rotation 1
+        {{0, 0}, {0, 1}, {0, 2}, {1, 0}},   // rotation 2
+        {{0, 0}, {0, 1}, {1, 1}, {2, 1}},   // rotation 3
+        {{0, 0}, {0, 1}, {0, 2}, {-1, 2}}   // rotation 4
+    },
+    // shape 5 - rotations 1 to 4
+    {
+        {{0, 0}, {0, 1}, {1, 1}, {1, 2}},   // rotation 1
+        {{0, 0}, {1, 0}, {0, 1}, {-1, 1}},  // rotation 2
+        {{0, 0}, {0, 1}, {1, 1}, {1, 2}},   // rotation 3
+        {{0, 0}, {1, 0}, {0, 1}, {-1, 1}}   // rotation 4
+    },
+    // shape 6 - rotations 1 to 4
+    {
+        {{0, 0}, {0, 1}, {-1, 1}, {-2, 1}}, // rotation 1
+        {{0, 0}, {1, 0}, {1, 1}, {1, 2}},   // rotation 2
+        {{0, 0}, {0, 1}, {1, 0}, {2, 0}},   // rotation 3
+        {{0, 0}, {0, 1}, {0, 2}, {1, 2}}    // rotation 4
+    },
+    // shape 7 - rotations 1 to 4
+    {
+        {{0, 0}, {0, 1}, {0, 2}, {1, 1}},   // rotation 1
+        {{0, 0}, {0, 1}, {-1, 1}, {1, 1}},  // rotation 2
+        {{0, 0}, {0, 1}, {0, 2}, {-1, 1}},  // rotation 3
+        {{0, 0}, {1, 0}, {2, 0}, {1, 1}}    // rotation 4
+    }
+};
+
+// the two trominoes: a straight line and a corner
+const int tromino_shape_offsets[2][4][3][2] = {
+    // shape 1 - rotations 1 to 4
+    {
+        {{0, 0}, {1, 0}, {2, 0}},  // rotation 1
+        {{0, 0}, {0, 1}, {0, 2}},  // rotation 2
+        {{0, 0}, {1, 0}, {2, 0}},  // rotation 3
+        {{0, 0}, {0, 1}, {0, 2}}   // rotation 4
+    },
+    // shape 2 - rotations 1 to 4
+    {
+        {{0, 0}, {1, 0}, {1, 1}},  // rotation 1
+        {{0, 0}, {0, 1}, {1, 0}},  // rotation 2
+        {{0, 0}, {0, 1}, {1, 1}},  // rotation 3
+        {{0, 0}, {1, 0}, {1, -1}}  // rotation 4
+    }
+};
+
+// The checks are written once as always-inline templates. The specialized functions below call
+// them with literal constants from rule_sets.def, so the compiler unrolls the fleet and cell
+// loops and folds the table strides; the generic ones pass the RuleSet's fields instead.
+#define RULES_INLINE static inline __attribute__((always_inline))
+
+RULES_INLINE const int *piece_offsets(const int *table, int rotation_count, int cells, const Piece *piece) {
+    return &table[((piece->type - 1) * rotation_count + piece->rotation - 1) * cells * 2];
+}
+
+RULES_INLINE EngineResult check_types_impl(const Piece *pieces, int fleet, int shape_count) {
+    _Pragma("GCC unroll 16")
+    for (int i = 0; i < fleet; i++) {
+        if (pieces[i].type < 1 || pieces[i].type > shape_count) {
+            return ENGINE_SHAPE_OUT_OF_RANGE;
+        }
+    }
+    return ENGINE_OK;
+}
+
+RULES_INLINE EngineResult check_rotations_impl(const Piece *pieces, int fleet, int rotation_count) {
+    _Pragma("GCC unroll 16")
+    for (int i = 0; i < fleet; i++) {
+        if (pieces[i].rotation < 1 || pieces[i].rotation > rotation_count) {
+            return ENGINE_ROTATION_OUT_OF_RANGE;
+        }
+    }
+    return ENGINE_OK;
+}
+
+// types and rotations must already be in range
+RULES_INLINE EngineResult check_fit_impl(const Board *board, const Piece *pieces, int fleet, const int *table, int rotation_count, int cells) {
+    _Pragma("GCC unroll 16")
+    for (int i = 0; i < fleet; i++) {
+        // negative anchors are out of bounds even if an offset would bring them back on the board
+        if (pieces[i].row < 0 || pieces[i].col < 0) {
+            return ENGINE_SHIP_DOES_NOT_FIT;
+        }
+        const int *offsets = piece_offsets(table, rotation_count, cells, &pieces[i]);
+
+        _Pragma("GCC unroll 8")
+        for (int j = 0; j < cells; j++) {
+            int row = pieces[i].row + offsets[2 * j];
+            int col = pieces[i].col + offsets[2 * j + 1];
+            if (row < 0 || col < 0 || row >= board->height || col >= board->width) {
+                return ENGINE_SHIP_DOES_NOT_FIT;
+            }
+        }
+    }
+    return ENGINE_OK;
+}
+
+// Compares the cells of every piece against each other instead of drawing them on a scratch
+// board, so the cost depends on the fleet size and not on the board size.
+RULES_INLINE EngineResult check_overlap_impl(const Piece *pieces, int fleet, const int *table, int rotation_count, int cells) {
+    int rows[MAX_FLEET_SIZE * MAX_CELLS_PER_PIECE];
+    int cols[MAX_FLEET_SIZE * MAX_CELLS_PER_PIECE];
+
+    _Pragma("GCC unroll 16")
+    for (int i = 0; i < fleet; i++) {
+        const int *offsets = piece_offsets(table, rotation_count, cells, &pieces[i]);
+
+        _Pragma("GCC unroll 8")
+        for (int j = 0; j < cells; j++) {
+            int row = pieces[i].row + offsets[2 * j];
+            int col = pieces[i].col + offsets[2 * j + 1];
+
+            // cells of the same piece never collide, so only look at earlier pieces
+            for (int k = 0; k < i * cells; k++) {
+                if (rows[k] == row && cols[k] == col) {
+                    return ENGINE_SHIPS_OVERLAP;
+                }
+            }
+            rows[i * cells + j] = row;
+            cols[i * cells + j] = col;
+        }
+    }
+    return ENGINE_OK;
+}
+
+RULES_INLINE EngineResult validate_impl(const Board *board, const Piece *pieces, int fleet, const int *table, int shape_count, int rotation_count, int cells) {
+    EngineResult result;
+
+    if ((result = check_types_impl(pieces, fleet, shape_count)) != ENGINE_OK) {
+        return result;
+    }
+    if ((result = check_rotations_impl(pieces, fleet, rotation_count)) != ENGINE_OK) {
+        return result;
+    }
+    if ((result = check_fit_impl(board, pieces, fleet, table, rotation_count, cells)) != ENGINE_OK) {
+        return result;
+    }
+    return check_overlap_impl(pieces, fleet, table, rotation_count, cells);
+}
+
+RULES_INLINE void fill_impl(Board *board, const Piece *pieces, int fleet, const int *table, int rotation_count, int cells) {
+    _Pragma("GCC unroll 16")
+    for (int i = 0; i < fleet; i++) {
+        const int *offsets = piece_offsets(table, rotation_count, cells, &pieces[i]);
+
+        _Pragma("GCC unroll 8")
+        for (int j = 0; j < cells; j++) {
+            board->cells[(pieces[i].row + offsets[2 * j]) * board->width + pieces[i].col + offsets[2 * j + 1]] = i + 1;
+        }
+    }
+}
+
+// draws a single piece as ship 'piece_number' if it is in range, fits and only covers water
+RULES_INLINE bool place_piece_impl(Board *board, const Piece *piece, int piece_number, const int *table, int shape_count, int rotation_count, int cells) {
+    if (check_types_impl(piece, 1, shape_count) != ENGINE_OK || check_rotations_impl(piece, 1, rotation_count) != ENGINE_OK
+        || check_fit_impl(board, piece, 1, table, rotation_count, cells) != ENGINE_OK) {
+        return false;
+    }
+
+    const int *offsets = piece_offsets(table, rotation_count, cells, piece);
+    _Pragma("GCC unroll 8")
+    for (int j = 0; j < cells; j++) {
+        if (board->cells[(piece->row + offsets[2 * j]) * board->width + piece->col + offsets[2 * j + 1]] != CELL_EMPTY) {
+            return false;
+        }
+    }
+    _Pragma("GCC unroll 8")
+    for (int j = 0; j < cells; j++) {
+        board->cells[(piece->row + offsets[2 * j]) * board->width + piece->col + offsets[2 * j + 1]] = piece_number;
+    }
+    return true;
+}
+
+// one set of functions per line of rule_sets.def, the RuleSet argument is not even read
+#define RULE_SET(id, name, shape_table, shape_count, rotation_count, cells_per_piece, fleet_size, min_board_size, max_board_size) \
+    _Static_assert(fleet_size <= MAX_FLEET_SIZE && cells_per_piece <= MAX_CELLS_PER_PIECE, "rule set " name " exceeds the engine limits"); \
+    _Static_assert(sizeof(shape_table) == sizeof(int) * shape_count * rotation_count * cells_per_piece * 2, "rule set " name " does not match its shape table"); \
+    static EngineResult id##_check_types(const RuleSet *rules, const Board *board, const Piece *pieces) { \
+        (void)rules; (void)board; \
+        return check_types_impl(pieces, fleet_size, shape_count); \
+    } \
+    static EngineResult id##_check_rotations(const RuleSet *rules, const Board *board, const Piece *pieces) { \
+        (void)rules; (void)board; \
+        return check_rotations_impl(pieces, fleet_size, rotation_count); \
+    } \
+    static EngineResult id##_check_fit(const RuleSet *rules, const Board *board, const Piece *pieces) { \
+        (void)rules; \
+        return check_fit_impl(board, pieces, fleet_size, &shape_table[0][0][0][0], rotation_count, cells_per_piece); \
+    } \
+    static EngineResult id##_check_overlap(const RuleSet *rules, const Board *board, const Piece *pieces) { \
+        (void)rules; (void)board; \
+        return check_overlap_impl(pieces, fleet_size, &shape_table[0][0][0][0], rotation_count, cells_per_piece); \
+    } \
+    static EngineResult id##_validate(const RuleSet *rules, const Board *board, const Piece *pieces) { \
+        (void)rules; \
+        return validate_impl(board, pieces, fleet_size, &shape_table[0][0][0][0], shape_count, rotation_count, cells_per_piece); \
+    } \
+    static void id##_fill(const RuleSet *rules, Board *board, const Piece *pieces) { \
+        (void)rules; \
+        fill_impl(board, pieces, fleet_size, &shape_table[0][0][0][0], rotation_count, cells_per_piece); \
+    } \
+    static bool id##_place_piece(const RuleSet *rules, Board *board, const Piece *piece, int piece_number) { \
+        (void)rules; \
+        return place_piece_impl(board, piece, piece_number, &shape_table[0][0][0][0], shape_count, rotation_count, cells_per_piece); \
+    }
+#include "rule_sets.def"
+#undef RULE_SET
+
+static EngineResult generic_check_types(const RuleSet *rules, const Board *board, const Piece *pieces) {
+    (void)board;
+    return check_types_impl(pieces, rules->fleet_size, rules->shape_count);
+}
+
+static EngineResult generic_check_rotations(const RuleSet *rules, const Board *board, const Piece *pieces) {
+    (void)board;
+    return check_rotations_impl(pieces, rules->fleet_size, rules->rotation_count);
+}
+
+static EngineResult generic_check_fit(const RuleSet *rules, const Board *board, const Piece *pieces) {
+    return check_fit_impl(board, pieces, rules->fleet_size, rules->shape_offsets, rules->rotation_count, rules->cells_per_piece);
+}
+
+static EngineResult generic_check_overlap(const RuleSet *rules, const Board *board, const Piece *pieces) {
+    (void)board;
+    return check_overlap_impl(pieces, rules->fleet_size, rules->shape_offsets, rules->rotation_count, rules->cells_per_piece);
+}
+
+static EngineResult generic_validate(const RuleSet *rules, const Board *board, const Piece *pieces) {
+    return validate_impl(board, pieces, rules->fleet_size, rules->shape_offsets, rules->shape_count, rules->rotation_count, rules->cells_per_piece);
+}
+
+static void generic_fill(const RuleSet *rules, Board *board, const Piece *pieces) {
+    fill_impl(board, pieces, rules->fleet_size, rules->shape_offsets, rules->rotation_count, rules->cells_per_piece);
+}
+
+static bool generic_place_piece(const RuleSet *rules, Board *board, const Piece *piece, int piece_number) {
+    return place_piece_impl(board, piece, piece_number, rules->shape_offsets, rules->shape_count, rules->rotation_count, rules->cells_per_piece);
+}
+
+const RuleSet builtin_rule_sets[RULE_SET_COUNT] = {
+#define RULE_SET(id, rule_name, shape_table, shapes, rotations, cells, fleet, min_size, max_size) \
+    [RULES_##id] = { \
+        .name = rule_name, .shape_offsets = &shape_table[0][0][0][0], .shape_count = shapes, .rotation_count = rotations, \
+        .cells_per_piece = cells, .fleet_size = fleet, .min_board_size = min_size, .max_board_size = max_size, .specialized = true, \
+        .check_types = id##_check_types, .check_rotations = id##_check_rotations, .check_fit = id##_check_fit, \
+        .check_overlap = id##_check_overlap, .validate = id##_validate, .fill = id##_fill, .place_piece = id##_place_piece \
+    },
+#include "rule_sets.def"
+#undef RULE_SET
+};
+
+const RuleSet *find_rule_set(const char *name) {
+    for (int i = 0; i < RULE_SET_COUNT; i++) {
+        if (strcmp(builtin_rule_sets[i].name, name) == 0) {
+            return &builtin_rule_sets[i];
+        }
+    }
+    return NULL;
+}
+
+bool parse_rule_set(const char *spec, RuleSet *rules) {
+    char name[RULE_SET_NAME_LENGTH];
+    size_t name_length = strcspn(spec, ":");
+    if (name_length >= sizeof(name)) {
+        return false;
+    }
+    memcpy(name, spec, name_length);
+    name[name_length] = '\0';
+
+    const RuleSet *base = find_rule_set(name);
+    if (base == NULL) {
+        return false;
+    }
+    *rules = *base;
+    if (spec[name_length] == '\0') {
+        return true;
+    }
+
+    // any override leaves the specialized code, which has the base rule set's constants baked in
+    const char *cursor = spec + name_length + 1;
+    while (*cursor != '\0') {
+        char key[16];
+        int value, consumed;
+        if (sscanf(cursor, "%15[a-z]=%d%n", key, &value, &consumed) != 2) {
+            return false;
+        }
+
+        if (strcmp(key, "fleet") == 0 && value >= 1 && value <= MAX_FLEET_SIZE) {
+            rules->fleet_size = value;
+        }
+        else if (strcmp(key, "shapes") == 0 && value >= 1 && value <= base->shape_count) {
+            // the first 'value' shapes of the base rule set's table
+            rules->shape_count = value;
+        }
+        else if (strcmp(key, "min") == 0 && value >= 1) {
+            rules->min_board_size = value;
+        }
+        else if (strcmp(key, "max") == 0 && value >= 0) {
+            rules->max_board_size = value;
+        }
+        else {
+            return false;
+        }
+
+        cursor += consumed;
+        if (*cursor == ',') {
+            cursor++;
+        }
+        else if (*cursor != '\0') {
+            return false;
+        }
+    }
+
+    if (rules->max_board_size != 0 && rules->max_board_size < rules->min_board_size) {
+        return false;
+    }
+    // the smallest board the rules allow has to have room for the fleet's cells
+    if ((long long)rules->min_board_size * rules->min_board_size < (long long)rules->fleet_size * rules->cells_per_piece) {
+        return false;
+    }
+
+    snprintf(rules->name, sizeof(rules->name), "%s", spec);
+    rules->specialized = false;
+    rules->check_types = generic_check_types;
+    rules->check_rotations = generic_check_rotations;
+    rules->check_fit = generic_check_fit;
+    rules->check_overlap = generic_check_overlap;
+    rules->validate = generic_validate;
+    rules->fill = generic_fill;
+    rules->place_piece = generic_place_piece;
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdbool.h>
+#include "engine.h"
+
+// Rule sets: fleet size, shape set and board limits. The built-in ones are declared in
+// rule_sets.def and get code specialized for their constants, see rules.c.
+
+#define RULE_SET_NAME_LENGTH 64
+
+typedef struct RuleSet RuleSet;
+
+// every check looks at a whole fleet of rules->fleet_size pieces
+typedef EngineResult (*FleetCheck)(const RuleSet *rules, const Board *board, const Piece *pieces);
+
+struct RuleSet {
+    char name[RULE_SET_NAME_LENGTH];
+    // [shape][rotation][cell][row, col] offsets from the piece's anchor
+    const int *shape_offsets;
+    int shape_count;
+    int rotation_count;
+    int cells_per_piece;
+    int fleet_size;
+    int min_board_size;
+    // 0 for no upper limit
+    int max_board_size;
+    bool specialized;
+
+    FleetCheck check_types;
+    FleetCheck check_rotations;
+    FleetCheck check_fit;
+    FleetCheck check_overlap;
+    // the four checks above in order, the lowest error code wins
+    FleetCheck validate;
+    void (*fill)(const RuleSet *rules, Board *board, const Piece *pieces);
+    bool (*place_piece)(const RuleSet *rules, Board *board, const Piece *piece, int piece_number);
+};
+
+typedef enum RuleSetId {
+#define RULE_SET(id, name, shape_table, shape_count, rotation_count, cells_per_piece, fleet_size, min_board_size, max_board_size) RULES_##id,
+#include "rule_sets.def"
+#undef RULE_SET
+    RULE_SET_COUNT
+} RuleSetId;
+
+extern const RuleSet builtin_rule_sets[RULE_SET_COUNT];
+extern const int tetris_shape_offsets[7][4][4][2];
+extern const int tromino_shape_offsets[2][4][3][2];
+
+#define CLASSIC_RULES (&builtin_rule_sets[RULES_CLASSIC])
+
+const RuleSet *find_rule_set(const char *name);
+// "<name>" for a built-in rule set, or "<name>:fleet=N,shapes=N,min=N,max=N" with any of the keys
+// to derive a custom one that runs on the generic path. Returns false on an unknown name or key.
+bool parse_rule_set(const char *spec, RuleSet *rules);
+
+#endif
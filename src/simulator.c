@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "engine.h"
+#include "rules.h"
+#include "strategy.h"
+
+// Headless batch simulator: plays seeded games through the engine on every core. Each game's
+// seed only depends on the base seed and the game's index, so a run gives the same totals no
+// matter how many threads share the work.
+
+#define GAMES_PER_CLAIM 1024
+
+typedef struct SimulatorOptions {
+    long games;
+    uint64_t seed;
+    int threads;
+    int width;
+    int height;
+    RuleSet rules;
+} SimulatorOptions;
+
+typedef struct SimulatorTotals {
+    long games;
+    long player_01_wins;
+    long player_02_wins;
+    long shots;
+    // order independent sum of per game results, equal across runs with the same seed
+    uint64_t checksum;
+} SimulatorTotals;
+
+typedef struct SimulatorWorker {
+    pthread_t thread;
+    SimulatorTotals totals;
+} SimulatorWorker;
+
+SimulatorOptions simulator_options = { .games = 1000000, .seed = 1, .threads = 0, .width = 10, .height = 10 };
+long next_game_index = 0;
+
+// random shooter that never repeats a cell: shot k swaps a random untried cell into slot k
+int next_random_shot(int *order, int shots_taken, int cell_count, uint64_t *rng) {
+    int pick = shots_taken + random_below(rng, cell_count - shots_taken);
+    int cell = order[pick];
+    order[pick] = order[shots_taken];
+    order[shots_taken] = cell;
+    return cell;
+}
+
+// returns the winning player number and the number of shots fired through 'shots'
+int simulate_game(Board *boards[2], int *orders[2], uint64_t seed, int *shots) {
+    uint64_t rng = seed;
+    int cell_count = boards[0]->width * boards[0]->height;
+    int shots_taken[2] = {0, 0};
+
+    for (int p = 0; p < 2; p++) {
+        reset_board(boards[p]);
+        if (!place_random_fleet(boards[p], &rng, NULL)) {
+            fprintf(stderr, "[Simulator] - [ERROR] Found no room for the fleet on a %dx%d board.\n", boards[p]->width, boards[p]->height);
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < cell_count; i++) {
+            orders[p][i] = i;
+        }
+    }
+
+    int turn = 0;
+    while (true) {
+        Board *target = boards[1 - turn];
+        int cell = next_random_shot(orders[turn], shots_taken[turn], cell_count, &rng);
+        char hit_or_miss;
+
+        shots_taken[turn]++;
+        resolve_shot(target, cell / target->width, cell % target->width, &hit_or_miss);
+
+        if (remaining_pieces_on_board(target) == 0) {
+            *shots = shots_taken[0] + shots_taken[1];
+            return turn + 1;
+        }
+        turn = 1 - turn;
+    }
+}
+
+void *simulator_worker_main(void *arg) {
+    SimulatorWorker *worker = arg;
+    Board *boards[2];
+    int *orders[2];
+    int cell_count = simulator_options.width * simulator_options.height;
+
+    for (int p = 0; p < 2; p++) {
+        boards[p] = create_board(&simulator_options.rules, simulator_options.width, simulator_options.height, NULL);
+        orders[p] = malloc(cell_count * sizeof(int));
+        if (boards[p] == NULL || orders[p] == NULL) {
+            fprintf(stderr, "[Simulator] - [ERROR] Out of memory for a %dx%d board.\n", simulator_options.width, simulator_options.height);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (true) {
+        long first = __atomic_fetch_add(&next_game_index, GAMES_PER_CLAIM, __ATOMIC_RELAXED);
+        if (first >= simulator_options.games) {
+            break;
+        }
+        long last = first + GAMES_PER_CLAIM < simulator_options.games ? first + GAMES_PER_CLAIM : simulator_options.games;
+
+        for (long game = first; game < last; game++) {
+            uint64_t seed_state = simulator_options.seed ^ ((uint64_t)game * 0xd1b54a32d192ed03ULL);
+            uint64_t seed = splitmix64(&seed_state);
+            int shots;
+            int winner = simulate_game(boards, orders, seed, &shots);
+
+            worker->totals.games++;
+            worker->totals.shots += shots;
+            if (winner == 1) {
+                worker->totals.player_01_wins++;
+            }
+            else {
+                worker->totals.player_02_wins++;
+            }
+            uint64_t result_state = seed ^ ((uint64_t)shots << 1) ^ (uint64_t)winner;
+            worker->totals.checksum += splitmix64(&result_state);
+        }
+    }
+
+    for (int p = 0; p < 2; p++) {
+        delete_board(boards[p]);
+        free(orders[p]);
+    }
+    return NULL;
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n games] [-s seed] [-t threads] [-W width] [-H height] [-R rules]\n", program);
+}
+
+int main(int argc, char **argv) {
+    simulator_options.rules = *CLASSIC_RULES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:t:W:H:R:")) != -1) {
+        switch (opt) {
+            case 'n':
+                simulator_options.games = atol(optarg);
+                break;
+            case 's':
+                simulator_options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                simulator_options.threads = atoi(optarg);
+                break;
+            case 'W':
+                simulator_options.width = atoi(optarg);
+                break;
+            case 'H':
+                simulator_options.height = atoi(optarg);
+                break;
+            case 'R':
+                if (!parse_rule_set(optarg, &simulator_options.rules)) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!is_valid_board_size(&simulator_options.rules, simulator_options.width, simulator_options.height) || simulator_options.games < 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!random_fleet_fits(&simulator_options.rules, simulator_options.width, simulator_options.height, simulator_options.seed)) {
+        fprintf(stderr, "[Simulator] - [ERROR] The fleet of rules '%s' does not fit a %dx%d board.\n", simulator_options.rules.name, simulator_options.width, simulator_options.height);
+        return EXIT_FAILURE;
+    }
+    if (simulator_options.threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        simulator_options.threads = cores > 0 ? (int)cores : 1;
+    }
+
+    SimulatorWorker *workers = calloc(simulator_options.threads, sizeof(SimulatorWorker));
+    if (workers == NULL) {
+        fprintf(stderr, "[Simulator] - [ERROR] Could not allocate %d workers.\n", simulator_options.threads);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < simulator_options.threads; i++) {
+        pthread_create(&workers[i].thread, NULL, simulator_worker_main, &workers[i]);
+    }
+
+    SimulatorTotals totals = {0};
+    for (int i = 0; i < simulator_options.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        totals.games += workers[i].totals.games;
+        totals.player_01_wins += workers[i].totals.player_01_wins;
+        totals.player_02_wins += workers[i].totals.player_02_wins;
+        totals.shots += workers[i].totals.shots;
+        totals.checksum += workers[i].totals.checksum;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("[Simulator] - [INFO] %ld games on a %dx%d board, %s rules, seed %llu, %d threads\n", totals.games, simulator_options.width, simulator_options.height, simulator_options.rules.name, (unsigned long long)simulator_options.seed, simulator_options.threads);
+    printf("[Simulator] - [INFO] Player 01 wins: %ld, Player 02 wins: %ld, average shots per game: %.2f\n", totals.player_01_wins, totals.player_02_wins, totals.games > 0 ? (double)totals.shots / totals.games : 0.0);
+    printf("[Simulator] - [INFO] Checksum: %016llx\n", (unsigned long long)totals.checksum);
+    printf("[Simulator] - [INFO] %.3f s, %.0f games/s\n", seconds, seconds > 0 ? totals.games / seconds : 0.0);
+
+    free(workers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+// a reader gives up on a snapshot the writer keeps rewriting (or died in the middle of)
+#define SNAPSHOT_READ_ATTEMPTS 10000
+#define SNAPSHOT_SPIN_ATTEMPTS 100
+
+static int64_t realtime_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+size_t game_snapshot_bytes(size_t cells_per_board) {
+    return sizeof(GameSnapshotShared) + 2 * cells_per_board;
+}
+
+static bool map_snapshot(GameSnapshot *snapshot, size_t bytes) {
+    if (ftruncate(snapshot->fd, bytes) != 0) {
+        return false;
+    }
+    void *mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, snapshot->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    if (snapshot->shared != NULL) {
+        munmap(snapshot->shared, snapshot->mapped);
+    }
+    snapshot->shared = mapping;
+    snapshot->mapped = bytes;
+    return true;
+}
+
+bool open_game_snapshot(GameSnapshot *snapshot, const char *dir, int game_id, const char *rules_name) {
+    char temporary_path[PATH_MAX + 8];
+    snapshot->fd = -1;
+    snapshot->shared = NULL;
+    snapshot->mapped = 0;
+    if (snprintf(snapshot->path, sizeof(snapshot->path), SNAPSHOT_FILE_FORMAT, dir, game_id) >= (int)sizeof(snapshot->path)) {
+        return false;
+    }
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", snapshot->path);
+
+    snapshot->fd = open(temporary_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (snapshot->fd < 0) {
+        return false;
+    }
+    if (!map_snapshot(snapshot, game_snapshot_bytes(0))) {
+        close(snapshot->fd);
+        unlink(temporary_path);
+        snapshot->fd = -1;
+        return false;
+    }
+
+    GameSnapshotShared *shared = snapshot->shared;
+    shared->magic = SNAPSHOT_MAGIC;
+    shared->version = SNAPSHOT_VERSION;
+    shared->sequence = 0;
+    shared->game_id = game_id;
+    shared->pid = (int32_t)getpid();
+    snprintf(shared->rules, sizeof(shared->rules), "%s", rules_name);
+    shared->started_ms = realtime_ms();
+    shared->summary.updated_ms = shared->started_ms;
+
+    if (rename(temporary_path, snapshot->path) != 0) {
+        close_game_snapshot(snapshot, true);
+        unlink(temporary_path);
+        return false;
+    }
+    return true;
+}
+
+void close_game_snapshot(GameSnapshot *snapshot, bool keep_file) {
+    if (snapshot->shared == NULL) {
+        return;
+    }
+    if (!keep_file) {
+        unlink(snapshot->path);
+    }
+    munmap(snapshot->shared, snapshot->mapped);
+    close(snapshot->fd);
+    snapshot->shared = NULL;
+    snapshot->fd = -1;
+}
+
+bool size_game_snapshot(GameSnapshot *snapshot, size_t cells_per_board) {
+    // new pages read back as zeroes, which is CELL_EMPTY
+    if (!map_snapshot(snapshot, game_snapshot_bytes(cells_per_board))) {
+        return false;
+    }
+    snapshot_write_begin(snapshot);
+    snapshot->shared->cells_per_board = cells_per_board;
+    snapshot_write_end(snapshot);
+    return true;
+}
+
+void snapshot_write_begin(GameSnapshot *snapshot) {
+    uint64_t sequence = snapshot->shared->sequence;
+    __atomic_store_n(&snapshot->shared->sequence, sequence + 1, __ATOMIC_RELAXED);
+    // keeps the writes below from becoming visible before the odd sequence
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void snapshot_write_end(GameSnapshot *snapshot) {
+    snapshot->shared->summary.updated_ms = realtime_ms();
+    __atomic_store_n(&snapshot->shared->sequence, snapshot->shared->sequence + 1, __ATOMIC_RELEASE);
+}
+
+signed char *snapshot_board_cells(GameSnapshot *snapshot, int board) {
+    return (signed char *)(snapshot->shared + 1) + (size_t)board * snapshot->shared->cells_per_board;
+}
+
+static bool map_reader(GameSnapshotReader *reader) {
+    struct stat status;
+    if (fstat(reader->fd, &status) != 0 || (size_t)status.st_size < sizeof(GameSnapshotShared)) {
+        return false;
+    }
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    if (reader->shared != NULL) {
+        munmap((void *)reader->shared, reader->mapped);
+    }
+    reader->shared = mapping;
+    reader->mapped = status.st_size;
+    return true;
+}
+
+bool open_snapshot_reader(GameSnapshotReader *reader, const char *path) {
+    reader->shared = NULL;
+    reader->mapped = 0;
+    reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (reader->fd < 0) {
+        return false;
+    }
+    if (!map_reader(reader) || reader->shared->magic != SNAPSHOT_MAGIC || reader->shared->version != SNAPSHOT_VERSION) {
+        close_snapshot_reader(reader);
+        return false;
+    }
+    return true;
+}
+
+void close_snapshot_reader(GameSnapshotReader *reader) {
+    if (reader->shared != NULL) {
+        munmap((void *)reader->shared, reader->mapped);
+        reader->shared = NULL;
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+}
+
+bool read_game_snapshot(GameSnapshotReader *reader, GameSnapshotCopy *copy, int board, signed char *cells, size_t capacity) {
+    for (int attempt = 0; attempt < SNAPSHOT_READ_ATTEMPTS; attempt++) {
+        if (attempt >= SNAPSHOT_SPIN_ATTEMPTS) {
+            sched_yield();
+        }
+
+        const GameSnapshotShared *shared = reader->shared;
+        uint64_t before = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+
+        copy->game_id = shared->game_id;
+        copy->pid = shared->pid;
+        memcpy(copy->rules, shared->rules, sizeof(copy->rules));
+        copy->rules[sizeof(copy->rules) - 1] = '\0';
+        copy->started_ms = shared->started_ms;
+        copy->cells_per_board = shared->cells_per_board;
+        copy->summary = shared->summary;
+
+        bool cells_copied = true;
+        if (cells != NULL) {
+            if (game_snapshot_bytes(copy->cells_per_board) > reader->mapped) {
+                // the boards were sized after this reader mapped the file
+                cells_copied = false;
+            }
+            else if (copy->cells_per_board <= capacity) {
+                memcpy(cells, (const signed char *)(shared + 1) + (size_t)board * copy->cells_per_board, copy->cells_per_board);
+            }
+        }
+
+        // the copies above have to be done before the sequence is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) != before) {
+            continue;
+        }
+        if (!cells_copied) {
+            if (!map_reader(reader)) {
+                return false;
+            }
+            continue;
+        }
+        return cells == NULL || copy->cells_per_board <= capacity;
+    }
+    return false;
+}
+
+const char *game_phase_name(int phase) {
+    switch (phase) {
+        case GAME_PHASE_WAITING:
+            return "waiting";
+        case GAME_PHASE_SETUP:
+            return "setup";
+        case GAME_PHASE_PLAYING:
+            return "playing";
+        case GAME_PHASE_OVER:
+            return "over";
+        default:
+            return "unknown";
+    }
+}
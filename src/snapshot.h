@@ -0,0 +1,107 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Live game snapshots for admin views. A server publishes its game into a small shared file,
+// <dir>/battleship-<game_id>.game, under a sequence lock: the game thread makes the sequence odd,
+// writes, and makes it even again. Readers in any process copy what they need and start over if
+// the sequence was odd or moved meanwhile, so the game never waits for a reader and never locks.
+
+#define SNAPSHOT_MAGIC 0x4d414753u
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NAME_LENGTH 64
+#define SNAPSHOT_FILE_FORMAT "%s/battleship-%d.game"
+#define SNAPSHOT_FILE_SUFFIX ".game"
+
+typedef enum GamePhase {
+    GAME_PHASE_WAITING = 0,
+    GAME_PHASE_SETUP = 1,
+    GAME_PHASE_PLAYING = 2,
+    GAME_PHASE_OVER = 3
+} GamePhase;
+
+// everything a listing shows, index 0 of the arrays is player 1
+typedef struct GameSnapshotSummary {
+    int32_t phase;
+    // player whose shot is awaited, 0 outside of play
+    int32_t turn;
+    int32_t width;
+    int32_t height;
+    int32_t ships_remaining[2];
+    int32_t shots_taken[2];
+    // CLOCK_REALTIME milliseconds of the last update
+    int64_t updated_ms;
+} GameSnapshotSummary;
+
+// Layout of the shared file. Player 1's board and then player 2's follow the header at one byte
+// per cell, the same values as Board.cells. The file only ever grows, so a reader's mapping
+// stays valid while the writer resizes it.
+typedef struct GameSnapshotShared {
+    uint32_t magic;
+    uint32_t version;
+    // odd while the writer is in the middle of an update
+    uint64_t sequence;
+    int32_t game_id;
+    int32_t pid;
+    char rules[SNAPSHOT_NAME_LENGTH];
+    int64_t started_ms;
+    // 0 until the boards are sized
+    uint64_t cells_per_board;
+    GameSnapshotSummary summary;
+} GameSnapshotShared;
+
+// the writing side, owned by the game thread
+typedef struct GameSnapshot {
+    int fd;
+    char path[PATH_MAX];
+    GameSnapshotShared *shared;
+    size_t mapped;
+} GameSnapshot;
+
+// a consistent copy of the header
+typedef struct GameSnapshotCopy {
+    int game_id;
+    int pid;
+    char rules[SNAPSHOT_NAME_LENGTH];
+    int64_t started_ms;
+    size_t cells_per_board;
+    GameSnapshotSummary summary;
+} GameSnapshotCopy;
+
+typedef struct GameSnapshotReader {
+    int fd;
+    const GameSnapshotShared *shared;
+    size_t mapped;
+} GameSnapshotReader;
+
+// Writes an empty snapshot next to the final path and renames it into place, so a replacement
+// server (or a reused pid) never truncates a file a reader has mapped.
+bool open_game_snapshot(GameSnapshot *snapshot, const char *dir, int game_id, const char *rules_name);
+// removes the file unless 'keep_file' is set (a server handing its game over)
+void close_game_snapshot(GameSnapshot *snapshot, bool keep_file);
+// bytes the file needs for two boards of 'cells_per_board' cells
+size_t game_snapshot_bytes(size_t cells_per_board);
+// grows the file to hold both boards, only called once per game before any cells are published
+bool size_game_snapshot(GameSnapshot *snapshot, size_t cells_per_board);
+
+// One update. Between begin and end the writer may change the summary and board cells in any
+// order, readers never see half of it. End stamps summary.updated_ms.
+void snapshot_write_begin(GameSnapshot *snapshot);
+void snapshot_write_end(GameSnapshot *snapshot);
+// board 0 is player 1's, the snapshot must have been sized
+signed char *snapshot_board_cells(GameSnapshot *snapshot, int board);
+
+bool open_snapshot_reader(GameSnapshotReader *reader, const char *path);
+void close_snapshot_reader(GameSnapshotReader *reader);
+// Copies the header and, when 'cells' is not NULL, one board into 'cells' (room for
+// cells_per_board values). Returns false if the file is not a snapshot or the writer kept it
+// busy for too long.
+bool read_game_snapshot(GameSnapshotReader *reader, GameSnapshotCopy *copy, int board, signed char *cells, size_t capacity);
+
+const char *game_phase_name(int phase);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strategy.h"
+
+#define SCRIPT_LINE_SIZE 1024
+// draws of one piece before the layout is given up, and layouts before the fleet is
+#define FLEET_PIECE_ATTEMPTS 10000
+#define FLEET_LAYOUT_ATTEMPTS 16
+
+static const char *const builtin_names[] = { "random", "hunt", "parity" };
+
+// places the whole fleet or gives up on the layout, the board keeps the pieces placed so far
+static bool place_random_layout(Board *board, uint64_t *rng, Piece *placed) {
+    const RuleSet *rules = board->rules;
+    for (int i = 0; i < rules->fleet_size; i++) {
+        Piece piece;
+        int attempts = 0;
+        do {
+            if (attempts++ == FLEET_PIECE_ATTEMPTS) {
+                return false;
+            }
+            piece.type = 1 + random_below(rng, rules->shape_count);
+            piece.rotation = 1 + random_below(rng, rules->rotation_count);
+            piece.row = random_below(rng, board->height);
+            piece.col = random_below(rng, board->width);
+        } while (!try_place_piece(board, &piece, i + 1));
+        if (placed != NULL) {
+            placed[i] = piece;
+        }
+    }
+    return true;
+}
+
+bool place_random_fleet(Board *board, uint64_t *rng, Piece *placed) {
+    for (int layout = 0; layout < FLEET_LAYOUT_ATTEMPTS; layout++) {
+        if (layout > 0) {
+            reset_board(board);
+        }
+        if (place_random_layout(board, rng, placed)) {
+            board->initialized = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool random_fleet_fits(const RuleSet *rules, int width, int height, uint64_t seed) {
+    Board *board = create_board(rules, width, height, NULL);
+    if (board == NULL) {
+        return false;
+    }
+    bool fits = place_random_fleet(board, &seed, NULL);
+    delete_board(board);
+    return fits;
+}
+
+static bool bot_has_tried(const Bot *bot, int cell) {
+    return bot->position[cell] < bot->shots_taken;
+}
+
+// swaps 'cell' into the next used slot of 'order'
+static void bot_take_cell(Bot *bot, int cell) {
+    int slot = bot->position[cell];
+    int displaced = bot->order[bot->shots_taken];
+
+    bot->order[slot] = displaced;
+    bot->position[displaced] = slot;
+    bot->order[bot->shots_taken] = cell;
+    bot->position[cell] = bot->shots_taken;
+    bot->shots_taken++;
+}
+
+static int random_open_cell(Bot *bot) {
+    return bot->order[bot->shots_taken + random_below(&bot->rng, bot->cell_count - bot->shots_taken)];
+}
+
+// starts at a random open cell and walks forward to the first one on the bot's checkerboard colour
+static int parity_open_cell(Bot *bot) {
+    int open = bot->cell_count - bot->shots_taken;
+    int start = random_below(&bot->rng, open);
+
+    for (int i = 0; i < open; i++) {
+        int cell = bot->order[bot->shots_taken + (start + i) % open];
+        if ((cell / bot->width + cell % bot->width) % 2 == 0) {
+            return cell;
+        }
+    }
+    return bot->order[bot->shots_taken + start];
+}
+
+static int random_next_shot(Bot *bot) {
+    return random_open_cell(bot);
+}
+
+static int hunt_next_shot(Bot *bot) {
+    while (bot->target_count > 0) {
+        int cell = bot->targets[--bot->target_count];
+        if (!bot_has_tried(bot, cell)) {
+            return cell;
+        }
+    }
+    return bot->strategy->parity ? parity_open_cell(bot) : random_open_cell(bot);
+}
+
+static void hunt_observe_shot(Bot *bot, int cell, bool hit) {
+    if (!hit) {
+        return;
+    }
+
+    int row = cell / bot->width;
+    int col = cell % bot->width;
+    int neighbours[4][2] = { {row - 1, col}, {row + 1, col}, {row, col - 1}, {row, col + 1} };
+
+    for (int i = 0; i < 4; i++) {
+        int r = neighbours[i][0];
+        int c = neighbours[i][1];
+        if (r >= 0 && c >= 0 && r < bot->height && c < bot->width && !bot_has_tried(bot, r * bot->width + c)) {
+            bot->targets[bot->target_count++] = r * bot->width + c;
+        }
+    }
+}
+
+// replays the script's shots in order, skipping repeats, then falls back to random shots
+static int script_next_shot(Bot *bot) {
+    const Strategy *strategy = bot->strategy;
+
+    while (bot->script_next < strategy->script_shot_count) {
+        int cell = strategy->script_shots[bot->script_next++];
+        if (!bot_has_tried(bot, cell)) {
+            return cell;
+        }
+    }
+    return random_open_cell(bot);
+}
+
+// Reads a file in the scripts/ format. The last I line that is a valid fleet on a
+// width x height board under 'rules' becomes the bot's fleet, every in-bounds S line becomes a shot.
+static bool load_script_strategy(Strategy *strategy, const char *path, const RuleSet *rules, int width, int height) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    Board *board = create_board(rules, width, height, NULL);
+    strategy->script_shots = malloc((size_t)width * height * sizeof(int));
+    if (board == NULL || strategy->script_shots == NULL) {
+        delete_board(board);
+        free(strategy->script_shots);
+        strategy->script_shots = NULL;
+        fclose(fp);
+        return false;
+    }
+
+    char line[SCRIPT_LINE_SIZE];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        Piece pieces[MAX_FLEET_SIZE];
+        int row, col, extraneous_input;
+
+        if (line[0] == 'I') {
+            int count = 0;
+            char *cursor = line + 1;
+            int consumed;
+            while (count < rules->fleet_size && sscanf(cursor, "%d %d %d %d%n", &pieces[count].type, &pieces[count].rotation, &pieces[count].col, &pieces[count].row, &consumed) == 4) {
+                cursor += consumed;
+                count++;
+            }
+            if (count == rules->fleet_size && sscanf(cursor, "%d", &extraneous_input) != 1 && validate_pieces(board, pieces) == ENGINE_OK) {
+                memcpy(strategy->script_fleet, pieces, count * sizeof(Piece));
+                strategy->has_script_fleet = true;
+            }
+        }
+        else if (sscanf(line, "S %d %d %d", &row, &col, &extraneous_input) == 2 && !is_position_out_of_bounds_on_board(board, row, col, 0, 0)
+                 && strategy->script_shot_count < width * height) {
+            strategy->script_shots[strategy->script_shot_count++] = row * width + col;
+        }
+    }
+
+    delete_board(board);
+    fclose(fp);
+
+    const char *base_name = strrchr(path, '/');
+    snprintf(strategy->name, sizeof(strategy->name), "%s", base_name != NULL ? base_name + 1 : path);
+    strategy->next_shot = script_next_shot;
+    return true;
+}
+
+bool load_strategy(Strategy *strategy, const char *name_or_path, const RuleSet *rules, int width, int height) {
+    memset(strategy, 0, sizeof(Strategy));
+    snprintf(strategy->name, sizeof(strategy->name), "%s", name_or_path);
+
+    if (strcmp(name_or_path, "random") == 0) {
+        strategy->next_shot = random_next_shot;
+        return true;
+    }
+    if (strcmp(name_or_path, "hunt") == 0 || strcmp(name_or_path, "parity") == 0) {
+        strategy->next_shot = hunt_next_shot;
+        strategy->observe_shot = hunt_observe_shot;
+        strategy->parity = strcmp(name_or_path, "parity") == 0;
+        return true;
+    }
+    return load_script_strategy(strategy, name_or_path, rules, width, height);
+}
+
+void unload_strategy(Strategy *strategy) {
+    free(strategy->script_shots);
+    strategy->script_shots = NULL;
+    strategy->script_shot_count = 0;
+}
+
+const char *const *builtin_strategy_names(int *count) {
+    *count = sizeof(builtin_names) / sizeof(builtin_names[0]);
+    return builtin_names;
+}
+
+bool create_bot(Bot *bot, int width, int height) {
+    memset(bot, 0, sizeof(Bot));
+    bot->width = width;
+    bot->height = height;
+    bot->cell_count = width * height;
+    bot->order = malloc(bot->cell_count * sizeof(int));
+    bot->position = malloc(bot->cell_count * sizeof(int));
+    // every hit pushes at most four neighbours and a cell is only hit once
+    bot->targets = malloc(4 * (size_t)bot->cell_count * sizeof(int));
+
+    if (bot->order == NULL || bot->position == NULL || bot->targets == NULL) {
+        delete_bot(bot);
+        return false;
+    }
+    return true;
+}
+
+void delete_bot(Bot *bot) {
+    free(bot->order);
+    free(bot->position);
+    free(bot->targets);
+    bot->order = NULL;
+    bot->position = NULL;
+    bot->targets = NULL;
+}
+
+bool start_bot_game(Bot *bot, const Strategy *strategy, Board *own_board, uint64_t seed) {
+    bot->strategy = strategy;
+    bot->rng = seed;
+    bot->shots_taken = 0;
+    bot->target_count = 0;
+    bot->script_next = 0;
+
+    for (int i = 0; i < bot->cell_count; i++) {
+        bot->order[i] = i;
+        bot->position[i] = i;
+    }
+
+    reset_board(own_board);
+    if (strategy->has_script_fleet) {
+        fill_board_with_pieces(own_board, strategy->script_fleet);
+        memcpy(bot->fleet, strategy->script_fleet, sizeof(bot->fleet));
+        return true;
+    }
+    return place_random_fleet(own_board, &bot->rng, bot->fleet);
+}
+
+int bot_next_shot(Bot *bot) {
+    int cell = bot->strategy->next_shot(bot);
+    bot_take_cell(bot, cell);
+    return cell;
+}
+
+void bot_observe_shot(Bot *bot, int cell, bool hit) {
+    if (bot->strategy->observe_shot != NULL) {
+        bot->strategy->observe_shot(bot, cell, hit);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef STRATEGY_H
+#define STRATEGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "engine.h"
+#include "rules.h"
+
+// Bot strategies for headless play. A Strategy is shared and read-only once loaded, each game
+// gets its own Bot with the strategy's scratch state, so games can run on any thread.
+
+#define STRATEGY_NAME_LENGTH 64
+
+typedef struct Bot Bot;
+
+typedef struct Strategy {
+    char name[STRATEGY_NAME_LENGTH];
+    // picks the next cell (row * width + col) among the ones the bot has not tried yet
+    int (*next_shot)(Bot *bot);
+    // told about every shot the bot took, NULL if the strategy does not care
+    void (*observe_shot)(Bot *bot, int cell, bool hit);
+    // parity strategies shoot one colour of the checkerboard first
+    bool parity;
+    // script strategies, loaded from files in the scripts/ format
+    bool has_script_fleet;
+    Piece script_fleet[MAX_FLEET_SIZE];
+    int *script_shots;
+    int script_shot_count;
+} Strategy;
+
+struct Bot {
+    const Strategy *strategy;
+    int width;
+    int height;
+    int cell_count;
+    uint64_t rng;
+    int shots_taken;
+    // order[0 .. shots_taken) are the cells already tried, the rest are still open
+    int *order;
+    // where each cell currently sits in 'order'
+    int *position;
+    // cells next to hits that hunting strategies want to try first
+    int *targets;
+    int target_count;
+    int script_next;
+    // the fleet this game's board was laid out with
+    Piece fleet[MAX_FLEET_SIZE];
+};
+
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// multiply-shift instead of a modulo, the bias is negligible for board-sized bounds
+static inline int random_below(uint64_t *state, int bound) {
+    return (int)(((splitmix64(state) >> 32) * (uint64_t)bound) >> 32);
+}
+
+// places pieces one at a time, redrawing a piece until it fits next to the ones already placed,
+// and copies them to 'placed' unless it is NULL. Starts over with an empty board when a piece
+// finds no room, and returns false after a bounded number of layouts.
+bool place_random_fleet(Board *board, uint64_t *rng, Piece *placed);
+// tries one random layout on a scratch board, for tools to reject rules whose fleet the board
+// cannot hold before any game starts
+bool random_fleet_fits(const RuleSet *rules, int width, int height, uint64_t seed);
+
+// built-in strategies are "random", "hunt" and "parity", anything else is read as a script whose
+// fleet has to be valid under 'rules'
+bool load_strategy(Strategy *strategy, const char *name_or_path, const RuleSet *rules, int width, int height);
+void unload_strategy(Strategy *strategy);
+const char *const *builtin_strategy_names(int *count);
+
+bool create_bot(Bot *bot, int width, int height);
+void delete_bot(Bot *bot);
+// resets the bot's scratch state for a new game with 'strategy' and lays out its fleet,
+// false if a random fleet found no room
+bool start_bot_game(Bot *bot, const Strategy *strategy, Board *own_board, uint64_t seed);
+int bot_next_shot(Bot *bot);
+void bot_observe_shot(Bot *bot, int cell, bool hit);
+
+#endif
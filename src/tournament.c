@@ -0,0 +1,543 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "analytics.h"
+#include "engine.h"
+#include "memory_account.h"
+#include "rules.h"
+#include "strategy.h"
+#include "work_pool.h"
+
+// Tournament runner: plays round-robin or Swiss brackets between bot strategies in-process.
+// Every match is cut into chunks of games that run as tasks on a work-stealing pool, and every
+// game's seed only depends on the base seed, the pairing and the game's index, so standings
+// do not depend on the number of threads.
+
+#define GAMES_PER_TASK 64
+#define MAX_STRATEGIES 64
+
+typedef enum TournamentFormat {
+    FORMAT_ROUND_ROBIN,
+    FORMAT_SWISS
+} TournamentFormat;
+
+typedef struct TournamentOptions {
+    TournamentFormat format;
+    int rounds;
+    int games_per_match;
+    uint64_t seed;
+    int threads;
+    int width;
+    int height;
+    RuleSet rules;
+    // directory every game is exported to, NULL disables the analytics writer
+    const char *analytics_dir;
+    size_t analytics_rotate_bytes;
+} TournamentOptions;
+
+typedef struct Standing {
+    long games;
+    long wins;
+    long losses;
+    // shots fired in games this strategy won
+    long winning_shots;
+    double points;
+    // opponents already met, Swiss avoids rematches
+    bool met[MAX_STRATEGIES];
+} Standing;
+
+// one chunk of a match, the worker fills in the results
+typedef struct MatchTask {
+    int strategy_a;
+    int strategy_b;
+    uint64_t match_seed;
+    int first_game;
+    int game_count;
+    long wins_a;
+    long wins_b;
+    long winning_shots_a;
+    long winning_shots_b;
+} MatchTask;
+
+// boards and bots each worker reuses for every game it plays
+typedef struct WorkerScratch {
+    Board *boards[2];
+    Bot bots[2];
+} WorkerScratch;
+
+TournamentOptions tournament_options = { .format = FORMAT_ROUND_ROBIN, .rounds = 0, .games_per_match = 100, .seed = 1, .threads = 0, .width = 10, .height = 10,
+    .analytics_dir = NULL, .analytics_rotate_bytes = ANALYTICS_DEFAULT_ROTATE_BYTES };
+Strategy strategies[MAX_STRATEGIES];
+int strategy_count = 0;
+WorkerScratch *worker_scratch = NULL;
+AnalyticsWriter analytics_writer;
+
+int64_t realtime_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// hands the game that just ended on 'scratch' to the analytics writer, the game's seed is its id
+void export_game(WorkerScratch *scratch, uint64_t seed, int winner, int64_t started_ms) {
+    Board *fired_by_1 = scratch->boards[1];
+    Board *fired_by_2 = scratch->boards[0];
+    GameRecord *record = create_game_record(fired_by_1->shot_count + fired_by_2->shot_count);
+    if (record == NULL) {
+        return;
+    }
+
+    record->game_id = (int64_t)seed;
+    record->started_ms = started_ms;
+    record->duration_ms = realtime_ms() - started_ms;
+    record->width = tournament_options.width;
+    record->height = tournament_options.height;
+    record->winner = winner + 1;
+    record->end_reason = GAME_END_SUNK;
+    snprintf(record->rules, sizeof(record->rules), "%s", tournament_options.rules.name);
+    record->fleet_size = tournament_options.rules.fleet_size;
+    memcpy(record->placements[0], scratch->bots[0].fleet, sizeof(scratch->bots[0].fleet));
+    memcpy(record->placements[1], scratch->bots[1].fleet, sizeof(scratch->bots[1].fleet));
+    fill_game_record_shots(record, fired_by_1, fired_by_2);
+    // a full queue drops the record, the writer's counters say how many
+    analytics_submit(&analytics_writer, record);
+}
+
+// returns 0 if the first bot wins and 1 if the second bot wins, player 1 always shoots first
+int play_game(WorkerScratch *scratch, const Strategy *first, const Strategy *second, uint64_t seed, int *shots) {
+    uint64_t seed_state = seed;
+    const Strategy *players[2] = { first, second };
+
+    for (int p = 0; p < 2; p++) {
+        if (!start_bot_game(&scratch->bots[p], players[p], scratch->boards[p], splitmix64(&seed_state))) {
+            fprintf(stderr, "[Tournament] - [ERROR] Found no room for %s's fleet on a %dx%d board.\n", players[p]->name, tournament_options.width, tournament_options.height);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int turn = 0;
+    while (true) {
+        Bot *bot = &scratch->bots[turn];
+        Board *target = scratch->boards[1 - turn];
+        int cell = bot_next_shot(bot);
+        char hit_or_miss;
+
+        resolve_shot(target, cell / target->width, cell % target->width, &hit_or_miss);
+        bot_observe_shot(bot, cell, hit_or_miss == 'H');
+
+        if (remaining_pieces_on_board(target) == 0) {
+            *shots = bot->shots_taken;
+            return turn;
+        }
+        turn = 1 - turn;
+    }
+}
+
+void run_match_task(void *argument, int worker_index) {
+    MatchTask *task = argument;
+    WorkerScratch *scratch = &worker_scratch[worker_index];
+
+    for (int game = task->first_game; game < task->first_game + task->game_count; game++) {
+        uint64_t seed_state = task->match_seed ^ ((uint64_t)game * 0xd1b54a32d192ed03ULL);
+        uint64_t seed = splitmix64(&seed_state);
+        // the strategies take turns going first
+        bool a_first = game % 2 == 0;
+        int shots;
+        int64_t started_ms = tournament_options.analytics_dir != NULL ? realtime_ms() : 0;
+        int winner = play_game(scratch,
+            &strategies[a_first ? task->strategy_a : task->strategy_b],
+            &strategies[a_first ? task->strategy_b : task->strategy_a],
+            seed, &shots);
+        if (tournament_options.analytics_dir != NULL) {
+            export_game(scratch, seed, winner, started_ms);
+        }
+
+        if ((winner == 0) == a_first) {
+            task->wins_a++;
+            task->winning_shots_a += shots;
+        }
+        else {
+            task->wins_b++;
+            task->winning_shots_b += shots;
+        }
+    }
+}
+
+uint64_t pairing_seed(int round, int strategy_a, int strategy_b) {
+    uint64_t state = tournament_options.seed ^ ((uint64_t)round << 48) ^ ((uint64_t)strategy_a << 24) ^ (uint64_t)strategy_b;
+    return splitmix64(&state);
+}
+
+// queues one match as chunks of GAMES_PER_TASK games, 'tasks' must have room for them
+int submit_match(WorkPool *pool, MatchTask *tasks, int round, int strategy_a, int strategy_b) {
+    int task_count = 0;
+    uint64_t match_seed = pairing_seed(round, strategy_a, strategy_b);
+
+    for (int first = 0; first < tournament_options.games_per_match; first += GAMES_PER_TASK) {
+        MatchTask *task = &tasks[task_count++];
+        memset(task, 0, sizeof(MatchTask));
+        task->strategy_a = strategy_a;
+        task->strategy_b = strategy_b;
+        task->match_seed = match_seed;
+        task->first_game = first;
+        task->game_count = tournament_options.games_per_match - first < GAMES_PER_TASK ? tournament_options.games_per_match - first : GAMES_PER_TASK;
+        work_pool_submit(pool, run_match_task, task);
+    }
+    return task_count;
+}
+
+// folds a finished match into the standings, the match winner scores 1 point and a drawn match 0.5 each
+void record_match(Standing *standings, MatchTask *tasks, int task_count) {
+    long wins_a = 0, wins_b = 0;
+    int a = tasks[0].strategy_a;
+    int b = tasks[0].strategy_b;
+
+    for (int i = 0; i < task_count; i++) {
+        wins_a += tasks[i].wins_a;
+        wins_b += tasks[i].wins_b;
+        standings[a].winning_shots += tasks[i].winning_shots_a;
+        standings[b].winning_shots += tasks[i].winning_shots_b;
+    }
+
+    standings[a].games += wins_a + wins_b;
+    standings[b].games += wins_a + wins_b;
+    standings[a].wins += wins_a;
+    standings[a].losses += wins_b;
+    standings[b].wins += wins_b;
+    standings[b].losses += wins_a;
+    standings[a].met[b] = true;
+    standings[b].met[a] = true;
+
+    if (wins_a > wins_b) {
+        standings[a].points += 1.0;
+    }
+    else if (wins_b > wins_a) {
+        standings[b].points += 1.0;
+    }
+    else {
+        standings[a].points += 0.5;
+        standings[b].points += 0.5;
+    }
+}
+
+Standing *ranking_standings = NULL;
+
+int compare_ranking(const void *left, const void *right) {
+    const Standing *l = &ranking_standings[*(const int *)left];
+    const Standing *r = &ranking_standings[*(const int *)right];
+
+    if (l->points != r->points) {
+        return l->points < r->points ? 1 : -1;
+    }
+    if (l->wins != r->wins) {
+        return l->wins < r->wins ? 1 : -1;
+    }
+    return *(const int *)left - *(const int *)right;
+}
+
+void rank_strategies(Standing *standings, int *order) {
+    for (int i = 0; i < strategy_count; i++) {
+        order[i] = i;
+    }
+    ranking_standings = standings;
+    qsort(order, strategy_count, sizeof(int), compare_ranking);
+}
+
+int tasks_per_match(void) {
+    return (tournament_options.games_per_match + GAMES_PER_TASK - 1) / GAMES_PER_TASK;
+}
+
+void run_round_robin(WorkPool *pool, Standing *standings) {
+    int match_count = strategy_count * (strategy_count - 1) / 2;
+    int per_match = tasks_per_match();
+    MatchTask *tasks = calloc((size_t)match_count * per_match, sizeof(MatchTask));
+    if (tasks == NULL) {
+        fprintf(stderr, "[Tournament] - [ERROR] Could not allocate %d matches.\n", match_count);
+        exit(EXIT_FAILURE);
+    }
+
+    int match = 0;
+    for (int a = 0; a < strategy_count; a++) {
+        for (int b = a + 1; b < strategy_count; b++) {
+            submit_match(pool, &tasks[(size_t)match * per_match], 0, a, b);
+            match++;
+        }
+    }
+    work_pool_wait(pool);
+
+    for (int m = 0; m < match_count; m++) {
+        record_match(standings, &tasks[(size_t)m * per_match], per_match);
+    }
+    free(tasks);
+}
+
+// Each round pairs strategies with similar points that have not met yet, in ranking order.
+// With an odd field the lowest ranked strategy without a bye sits out and scores a point.
+void run_swiss(WorkPool *pool, Standing *standings) {
+    int per_match = tasks_per_match();
+    MatchTask *tasks = calloc((size_t)(strategy_count / 2) * per_match, sizeof(MatchTask));
+    int *order = malloc(strategy_count * sizeof(int));
+    bool *had_bye = calloc(strategy_count, sizeof(bool));
+    bool *paired = malloc(strategy_count * sizeof(bool));
+    if (tasks == NULL || order == NULL || had_bye == NULL || paired == NULL) {
+        fprintf(stderr, "[Tournament] - [ERROR] Could not allocate Swiss rounds.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int round = 1; round <= tournament_options.rounds; round++) {
+        rank_strategies(standings, order);
+        memset(paired, 0, strategy_count * sizeof(bool));
+
+        if (strategy_count % 2 == 1) {
+            for (int i = strategy_count - 1; i >= 0; i--) {
+                if (!had_bye[order[i]]) {
+                    had_bye[order[i]] = true;
+                    paired[order[i]] = true;
+                    standings[order[i]].points += 1.0;
+                    break;
+                }
+            }
+        }
+
+        int match_count = 0;
+        for (int i = 0; i < strategy_count; i++) {
+            int a = order[i];
+            if (paired[a]) {
+                continue;
+            }
+
+            // closest unpaired strategy in the ranking that 'a' has not met, else the closest one
+            int b = -1;
+            for (int j = i + 1; j < strategy_count; j++) {
+                if (!paired[order[j]] && !standings[a].met[order[j]]) {
+                    b = order[j];
+                    break;
+                }
+            }
+            for (int j = i + 1; b < 0 && j < strategy_count; j++) {
+                if (!paired[order[j]]) {
+                    b = order[j];
+                }
+            }
+            if (b < 0) {
+                break;
+            }
+
+            paired[a] = true;
+            paired[b] = true;
+            submit_match(pool, &tasks[(size_t)match_count * per_match], round, a, b);
+            match_count++;
+        }
+        work_pool_wait(pool);
+
+        for (int m = 0; m < match_count; m++) {
+            record_match(standings, &tasks[(size_t)m * per_match], per_match);
+        }
+    }
+
+    free(tasks);
+    free(order);
+    free(had_bye);
+    free(paired);
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-m round-robin|swiss] [-r rounds] [-n games_per_match] [-s seed] [-t threads] [-W width] [-H height] [-R rules] [-A analytics_dir] [-Z analytics_rotate_size] [strategy ...]\n", program);
+    fprintf(stderr, "Strategies are random, hunt, parity or a script file in the scripts/ format. Defaults to the built-in ones.\n");
+}
+
+int main(int argc, char **argv) {
+    tournament_options.rules = *CLASSIC_RULES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:n:s:t:W:H:R:A:Z:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "swiss") == 0) {
+                    tournament_options.format = FORMAT_SWISS;
+                }
+                else if (strcmp(optarg, "round-robin") == 0) {
+                    tournament_options.format = FORMAT_ROUND_ROBIN;
+                }
+                else {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                tournament_options.rounds = atoi(optarg);
+                break;
+            case 'n':
+                tournament_options.games_per_match = atoi(optarg);
+                break;
+            case 's':
+                tournament_options.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                tournament_options.threads = atoi(optarg);
+                break;
+            case 'W':
+                tournament_options.width = atoi(optarg);
+                break;
+            case 'H':
+                tournament_options.height = atoi(optarg);
+                break;
+            case 'R':
+                if (!parse_rule_set(optarg, &tournament_options.rules)) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'A':
+                tournament_options.analytics_dir = optarg;
+                break;
+            case 'Z':
+                if (!parse_memory_size(optarg, &tournament_options.analytics_rotate_bytes) || tournament_options.analytics_rotate_bytes == 0) {
+                    print_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!is_valid_board_size(&tournament_options.rules, tournament_options.width, tournament_options.height) || tournament_options.games_per_match <= 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int builtin_count;
+    const char *const *builtins = builtin_strategy_names(&builtin_count);
+    int requested = argc - optind > 0 ? argc - optind : builtin_count;
+    if (requested < 2 || requested > MAX_STRATEGIES) {
+        fprintf(stderr, "[Tournament] - [ERROR] Need between 2 and %d strategies.\n", MAX_STRATEGIES);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < requested; i++) {
+        const char *name = argc - optind > 0 ? argv[optind + i] : builtins[i];
+        if (!load_strategy(&strategies[strategy_count], name, &tournament_options.rules, tournament_options.width, tournament_options.height)) {
+            fprintf(stderr, "[Tournament] - [ERROR] Unknown strategy or unreadable script '%s'.\n", name);
+            return EXIT_FAILURE;
+        }
+        strategy_count++;
+    }
+    // script fleets were already checked against the board when they were loaded
+    bool random_fleets = false;
+    for (int i = 0; i < strategy_count; i++) {
+        random_fleets = random_fleets || !strategies[i].has_script_fleet;
+    }
+    if (random_fleets && !random_fleet_fits(&tournament_options.rules, tournament_options.width, tournament_options.height, tournament_options.seed)) {
+        fprintf(stderr, "[Tournament] - [ERROR] The fleet of rules '%s' does not fit a %dx%d board.\n", tournament_options.rules.name, tournament_options.width, tournament_options.height);
+        return EXIT_FAILURE;
+    }
+
+    if (tournament_options.threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        tournament_options.threads = cores > 0 ? (int)cores : 1;
+    }
+    if (tournament_options.rounds <= 0) {
+        // enough rounds to separate a unique winner
+        tournament_options.rounds = 1;
+        while ((1 << tournament_options.rounds) < strategy_count) {
+            tournament_options.rounds++;
+        }
+    }
+
+    worker_scratch = calloc(tournament_options.threads, sizeof(WorkerScratch));
+    if (worker_scratch == NULL) {
+        fprintf(stderr, "[Tournament] - [ERROR] Could not allocate %d workers.\n", tournament_options.threads);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < tournament_options.threads; i++) {
+        for (int p = 0; p < 2; p++) {
+            worker_scratch[i].boards[p] = create_board(&tournament_options.rules, tournament_options.width, tournament_options.height, NULL);
+            if (worker_scratch[i].boards[p] == NULL || !create_bot(&worker_scratch[i].bots[p], tournament_options.width, tournament_options.height)) {
+                fprintf(stderr, "[Tournament] - [ERROR] Out of memory for a %dx%d board.\n", tournament_options.width, tournament_options.height);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    WorkPool *pool = create_work_pool(tournament_options.threads);
+    Standing *standings = calloc(strategy_count, sizeof(Standing));
+    if (pool == NULL || standings == NULL) {
+        fprintf(stderr, "[Tournament] - [ERROR] Could not start the worker pool.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (tournament_options.analytics_dir != NULL
+        && !start_analytics_writer(&analytics_writer, tournament_options.analytics_dir, tournament_options.analytics_rotate_bytes, ANALYTICS_QUEUE_CAPACITY)) {
+        fprintf(stderr, "[Tournament] - [ERROR] Could not start the analytics writer for '%s'.\n", tournament_options.analytics_dir);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (tournament_options.format == FORMAT_SWISS) {
+        run_swiss(pool, standings);
+    }
+    else {
+        run_round_robin(pool, standings);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    long total_games = 0;
+    for (int i = 0; i < strategy_count; i++) {
+        total_games += standings[i].games;
+    }
+    total_games /= 2;
+
+    int order[MAX_STRATEGIES];
+    rank_strategies(standings, order);
+
+    printf("[Tournament] - [INFO] %s, %d strategies, %d games per match, %dx%d board, %s rules, seed %llu\n",
+        tournament_options.format == FORMAT_SWISS ? "Swiss" : "Round robin", strategy_count, tournament_options.games_per_match,
+        tournament_options.width, tournament_options.height, tournament_options.rules.name, (unsigned long long)tournament_options.seed);
+    if (tournament_options.format == FORMAT_SWISS) {
+        printf("[Tournament] - [INFO] %d rounds\n", tournament_options.rounds);
+    }
+    printf("%-4s %-24s %7s %9s %9s %7s %14s\n", "Rank", "Strategy", "Points", "Wins", "Losses", "Win%", "Shots per win");
+    for (int i = 0; i < strategy_count; i++) {
+        Standing *standing = &standings[order[i]];
+        printf("%-4d %-24s %7.1f %9ld %9ld %6.1f%% %14.2f\n", i + 1, strategies[order[i]].name, standing->points, standing->wins, standing->losses,
+            standing->games > 0 ? 100.0 * standing->wins / standing->games : 0.0,
+            standing->wins > 0 ? (double)standing->winning_shots / standing->wins : 0.0);
+    }
+
+    long executed = 0, stolen = 0;
+    for (int i = 0; i < pool->worker_count; i++) {
+        executed += pool->deques[i].executed;
+        stolen += pool->deques[i].stolen;
+    }
+    printf("[Tournament] - [INFO] %ld games in %.3f s, %.0f games/s on %d threads\n", total_games, seconds, seconds > 0 ? total_games / seconds : 0.0, pool->worker_count);
+    printf("[Tournament] - [INFO] %ld tasks of up to %d games, %ld stolen\n", executed, GAMES_PER_TASK, stolen);
+    if (tournament_options.analytics_dir != NULL) {
+        stop_analytics_writer(&analytics_writer);
+        printf("[Tournament] - [INFO] %llu games exported to %s, %llu dropped\n", (unsigned long long)analytics_writer.written,
+            tournament_options.analytics_dir, (unsigned long long)analytics_writer.dropped);
+    }
+
+    delete_work_pool(pool);
+    for (int i = 0; i < tournament_options.threads; i++) {
+        for (int p = 0; p < 2; p++) {
+            delete_board(worker_scratch[i].boards[p]);
+            delete_bot(&worker_scratch[i].bots[p]);
+        }
+    }
+    for (int i = 0; i < strategy_count; i++) {
+        unload_strategy(&strategies[i]);
+    }
+    free(worker_scratch);
+    free(standings);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+#define TRACE_BUFFER_CAPACITY 4096
+
+typedef struct TraceRecord {
+    TraceEvent event;
+    int game_id;
+    int player_number;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} TraceRecord;
+
+bool trace_enabled = false;
+
+// spans are buffered and appended to the file in batches so the turn path never writes per span
+static TraceRecord trace_buffer[TRACE_BUFFER_CAPACITY];
+static int trace_buffered = 0;
+static FILE *trace_file = NULL;
+static bool trace_first_record = true;
+
+static const char *trace_event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_ACCEPT] = "accept",
+    [TRACE_READ] = "read",
+    [TRACE_PARSE] = "parse",
+    [TRACE_VALIDATE_E300] = "validate E 300",
+    [TRACE_VALIDATE_E301] = "validate E 301",
+    [TRACE_VALIDATE_E302] = "validate E 302",
+    [TRACE_VALIDATE_E303] = "validate E 303",
+    [TRACE_VALIDATE_E400_E401] = "validate E 400/401",
+    [TRACE_BOARD_MUTATION] = "board mutation",
+    [TRACE_WIN_CHECK] = "win check",
+    [TRACE_FORMAT_RESPONSE] = "format response",
+    [TRACE_SEND] = "send"
+};
+
+const char *trace_event_name(TraceEvent event) {
+    if (event < 0 || event >= TRACE_EVENT_COUNT) {
+        return "unknown";
+    }
+    return trace_event_names[event];
+}
+
+bool trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        return false;
+    }
+
+    fputs("[\n", trace_file);
+    trace_first_record = true;
+    trace_buffered = 0;
+    trace_enabled = true;
+    return true;
+}
+
+static void trace_flush(void) {
+    for (int i = 0; i < trace_buffered; i++) {
+        TraceRecord *record = &trace_buffer[i];
+
+        // complete events ("ph": "X") take microseconds, pid groups a game and tid a player
+        fprintf(trace_file, "%s{\"name\":\"%s\",\"cat\":\"battleship\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"game\":%d,\"player\":%d}}",
+            trace_first_record ? "" : ",\n",
+            trace_event_name(record->event),
+            record->start_ns / 1000.0,
+            record->duration_ns / 1000.0,
+            record->game_id,
+            record->player_number,
+            record->game_id,
+            record->player_number);
+        trace_first_record = false;
+    }
+    trace_buffered = 0;
+}
+
+void trace_record(TraceEvent event, uint64_t start_ns, int game_id, int player_number) {
+    if (!trace_enabled) {
+        return;
+    }
+
+    if (trace_buffered == TRACE_BUFFER_CAPACITY) {
+        trace_flush();
+    }
+
+    TraceRecord *record = &trace_buffer[trace_buffered++];
+    record->event = event;
+    record->game_id = game_id;
+    record->player_number = player_number;
+    record->start_ns = start_ns;
+    record->duration_ns = trace_now_ns() - start_ns;
+}
+
+void trace_close(void) {
+    if (trace_file == NULL) {
+        return;
+    }
+
+    trace_flush();
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+    trace_enabled = false;
+}
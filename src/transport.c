@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include "transport.h"
+
+// polls of the ring before the consumer goes to sleep on its eventfd, a few microseconds
+#define SHM_SPIN_ITERATIONS 2000
+
+static const char *const transport_kind_names[] = { "tcp", "unix", "shm" };
+
+// default busy-poll spin for parse_busy_poll_option(), long enough to cover a bot's turn
+#define BUSY_POLL_DEFAULT_SPIN_US 1000
+
+// spinning only helps when the peer runs on another core, on one core it just delays the peer
+static int shm_spin_iterations = -1;
+// set by transport_set_busy_poll(), replaces the iteration count with a time budget
+static long busy_poll_spin_ns = 0;
+
+const char *transport_kind_name(TransportKind kind) {
+    return transport_kind_names[kind];
+}
+
+bool parse_transport_kind(const char *name, TransportKind *kind) {
+    for (int i = 0; i < (int)(sizeof(transport_kind_names) / sizeof(transport_kind_names[0])); i++) {
+        if (strcmp(name, transport_kind_names[i]) == 0) {
+            *kind = (TransportKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void transport_set_busy_poll(long spin_ns) {
+    busy_poll_spin_ns = spin_ns > 0 ? spin_ns : 0;
+}
+
+long transport_busy_poll_ns(void) {
+    return busy_poll_spin_ns;
+}
+
+bool parse_busy_poll_option(const char *argument, int *cpu, long *spin_us) {
+    char extra;
+    *spin_us = BUSY_POLL_DEFAULT_SPIN_US;
+    int parsed = sscanf(argument, "%d/%ld%c", cpu, spin_us, &extra);
+    return (parsed == 1 || parsed == 2) && *cpu >= -1 && *spin_us > 0;
+}
+
+bool transport_pin_to_cpu(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+bool transport_tune_busy_poll_socket(int socket_fd) {
+    int enable = 1;
+    // fails on AF_UNIX sockets, which have no Nagle delay to turn off
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    int spin_us = (int)(busy_poll_spin_ns / 1000);
+    return setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &spin_us, sizeof(spin_us)) == 0;
+}
+
+bool parse_backlog_option(const char *argument, int *backlog) {
+    char *end;
+    long value = strtol(argument, &end, 10);
+    if (end == argument || *end != '\0' || value < 1 || value > 65535) {
+        return false;
+    }
+    *backlog = (int)value;
+    return true;
+}
+
+bool transport_enable_fast_open(int listen_fd, int queue_length) {
+    return setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &queue_length, sizeof(queue_length)) == 0;
+}
+
+static void transport_reset(Transport *transport) {
+    memset(transport, 0, sizeof(Transport));
+    transport->socket_fd = -1;
+    transport->channel_fd = -1;
+    transport->tx_eventfd = -1;
+    transport->rx_eventfd = -1;
+}
+
+static int connect_tcp(int port) {
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_unix(const char *unix_dir, int port) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (snprintf(address.sun_path, sizeof(address.sun_path), TRANSPORT_UNIX_PATH_FORMAT, unix_dir, port) >= (int)sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// true once the peer closed the socket, nothing else is sent on it after the shared-memory handshake
+static bool shm_peer_hung_up(const Transport *transport) {
+    struct pollfd pfd = { .fd = transport->socket_fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// The memfd comes from the client, which keeps its own fd to it. Only a memfd sealed against
+// resizing is mapped, a client that shrank it later would kill the server with SIGBUS.
+static bool map_shm_channel(Transport *transport, int memfd) {
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(memfd, &st) < 0 || st.st_size < (off_t)sizeof(ShmChannel)) {
+        return false;
+    }
+
+    void *mapping = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    transport->channel = mapping;
+    return true;
+}
+
+// Creates the channel and both eventfds, sends them to the server with an 'M' packet and waits
+// for the server's 'A'. Returns false only if the channel could not be created. Any other answer
+// leaves the connection a plain Unix socket, and a game packet (the game ended first) is kept for later.
+static bool client_start_shm(Transport *transport) {
+    int memfd = memfd_create("battleship-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int to_server = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int to_client = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (memfd < 0 || to_server < 0 || to_client < 0 || ftruncate(memfd, sizeof(ShmChannel)) < 0
+        || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0 || !map_shm_channel(transport, memfd)) {
+        goto fail;
+    }
+    transport->channel->magic = SHM_CHANNEL_MAGIC;
+
+    int fds[SHM_HANDSHAKE_FD_COUNT] = { memfd, to_server, to_client };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    char packet[] = "M";
+    struct iovec iov = { .iov_base = packet, .iov_len = 1 };
+    struct msghdr message = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // a server that already hung up is reported by the next transport_receive(), like on TCP
+    char reply[SHM_RING_SLOT_SIZE] = {0};
+    int nbytes = sendmsg(transport->socket_fd, &message, MSG_NOSIGNAL) == 1 ? (int)read(transport->socket_fd, reply, sizeof(reply) - 1) : 0;
+    if (nbytes <= 0 || strcmp(reply, "A") != 0) {
+        if (reply[0] == 'E') {
+            fprintf(stderr, "[Transport] - [WARNING] Server refused the shared-memory channel (%s), staying on the Unix socket.\n", reply);
+        }
+        else if (nbytes > 0) {
+            memcpy(transport->pending, reply, nbytes);
+            transport->pending_length = nbytes;
+        }
+        munmap(transport->channel, sizeof(ShmChannel));
+        transport->channel = NULL;
+        transport->kind = TRANSPORT_UNIX;
+        close(memfd);
+        close(to_server);
+        close(to_client);
+        return true;
+    }
+
+    close(memfd);
+    transport->tx = &transport->channel->rings[0];
+    transport->rx = &transport->channel->rings[1];
+    transport->tx_eventfd = to_server;
+    transport->rx_eventfd = to_client;
+    return true;
+
+fail:
+    if (transport->channel != NULL) {
+        munmap(transport->channel, sizeof(ShmChannel));
+        transport->channel = NULL;
+    }
+    if (memfd >= 0) {
+        close(memfd);
+    }
+    if (to_server >= 0) {
+        close(to_server);
+    }
+    if (to_client >= 0) {
+        close(to_client);
+    }
+    return false;
+}
+
+bool transport_connect(Transport *transport, TransportKind kind, int player_number, const char *unix_dir) {
+    int port = player_number == 1 ? TRANSPORT_PORT_PLAYER01 : TRANSPORT_PORT_PLAYER02;
+
+    transport_reset(transport);
+    transport->kind = kind;
+    transport->socket_fd = kind == TRANSPORT_TCP ? connect_tcp(port) : connect_unix(unix_dir != NULL ? unix_dir : TRANSPORT_DEFAULT_UNIX_DIR, port);
+    if (transport->socket_fd < 0) {
+        return false;
+    }
+    if (busy_poll_spin_ns > 0) {
+        transport_tune_busy_poll_socket(transport->socket_fd);
+    }
+
+    if (kind == TRANSPORT_SHM && !client_start_shm(transport)) {
+        transport_close(transport);
+        return false;
+    }
+    return true;
+}
+
+bool transport_attach_shm_server(Transport *transport, int socket_fd, const int *fds) {
+    transport_reset(transport);
+    transport->kind = TRANSPORT_SHM;
+    transport->socket_fd = socket_fd;
+
+    if (!map_shm_channel(transport, fds[0])) {
+        return false;
+    }
+    if (transport->channel->magic != SHM_CHANNEL_MAGIC) {
+        munmap(transport->channel, sizeof(ShmChannel));
+        transport->channel = NULL;
+        return false;
+    }
+
+    transport->channel_fd = fds[0];
+    transport->rx = &transport->channel->rings[0];
+    transport->tx = &transport->channel->rings[1];
+    transport->rx_eventfd = fds[1];
+    transport->tx_eventfd = fds[2];
+    return true;
+}
+
+static bool shm_send(Transport *transport, const char *packet, size_t length) {
+    ShmRing *ring = transport->tx;
+    uint32_t head = ring->head;
+
+    // request / reply traffic never gets near a full ring, so waiting here is rare
+    while (true) {
+        uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (used > SHM_RING_SLOTS) {
+            return false;
+        }
+        if (used < SHM_RING_SLOTS) {
+            break;
+        }
+        if (shm_peer_hung_up(transport)) {
+            return false;
+        }
+        sched_yield();
+    }
+
+    ShmRingSlot *slot = &ring->slots[head % SHM_RING_SLOTS];
+    if (length > SHM_RING_SLOT_SIZE) {
+        length = SHM_RING_SLOT_SIZE;
+    }
+    memcpy(slot->data, packet, length);
+    slot->length = (uint32_t)length;
+
+    // pairs with the consumer setting consumer_sleeping and re-reading head, one of the two sees the other
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->consumer_sleeping, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(transport->tx_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int shm_take(ShmRing *ring, uint32_t tail, char *buffer, size_t size) {
+    ShmRingSlot *slot = &ring->slots[tail % SHM_RING_SLOTS];
+    // the length comes from the other process, never trust it
+    size_t length = slot->length < size - 1 ? slot->length : size - 1;
+
+    memcpy(buffer, slot->data, length);
+    buffer[length] = '\0';
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return (int)length;
+}
+
+// true as soon as the producer moved head past 'tail', false once the spin budget ran out
+static bool shm_spin(ShmRing *ring, uint32_t tail) {
+    if (busy_poll_spin_ns > 0) {
+        uint64_t deadline = monotonic_ns() + busy_poll_spin_ns;
+        do {
+            // the clock costs more than a look at the ring, so it is read every 64 looks
+            for (int spin = 0; spin < 64; spin++) {
+                if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail) {
+                    return true;
+                }
+            }
+        } while (monotonic_ns() < deadline);
+        return false;
+    }
+
+    if (shm_spin_iterations < 0) {
+        shm_spin_iterations = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_ITERATIONS : 1;
+    }
+    for (int spin = 0; spin < shm_spin_iterations; spin++) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int shm_receive(Transport *transport, char *buffer, size_t size) {
+    ShmRing *ring = transport->rx;
+    uint32_t tail = ring->tail;
+
+    while (true) {
+        if (shm_spin(ring, tail)) {
+            uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            if (head - tail > SHM_RING_SLOTS) {
+                return -1;
+            }
+            return shm_take(ring, tail, buffer, size);
+        }
+
+        __atomic_store_n(&ring->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail) {
+            __atomic_store_n(&ring->consumer_sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        struct pollfd pfds[2] = {
+            { .fd = transport->rx_eventfd, .events = POLLIN },
+            { .fd = transport->socket_fd, .events = POLLIN }
+        };
+        int ready = poll(pfds, 2, -1);
+        __atomic_store_n(&ring->consumer_sleeping, 0, __ATOMIC_RELAXED);
+        // a signal hands control back to the caller, errno stays EINTR and nothing was consumed
+        if (ready < 0) {
+            return -1;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(transport->rx_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                return -1;
+            }
+        }
+        // a hang-up only counts once everything the peer sent before it has been read
+        if (pfds[1].revents != 0 && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+            return 0;
+        }
+    }
+}
+
+bool transport_send(Transport *transport, const char *packet, size_t length) {
+    if (transport->channel != NULL) {
+        return shm_send(transport, packet, length);
+    }
+    return send(transport->socket_fd, packet, length, MSG_NOSIGNAL) == (ssize_t)length;
+}
+
+int transport_receive(Transport *transport, char *buffer, size_t size) {
+    if (transport->pending_length > 0) {
+        int length = transport->pending_length < (int)size - 1 ? transport->pending_length : (int)size - 1;
+        memcpy(buffer, transport->pending, length);
+        buffer[length] = '\0';
+        transport->pending_length = 0;
+        return length;
+    }
+    if (transport->channel != NULL) {
+        return shm_receive(transport, buffer, size);
+    }
+
+    int nbytes = -1;
+    if (busy_poll_spin_ns > 0) {
+        uint64_t deadline = monotonic_ns() + busy_poll_spin_ns;
+        do {
+            nbytes = (int)recv(transport->socket_fd, buffer, size - 1, MSG_DONTWAIT);
+        } while (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && monotonic_ns() < deadline);
+    }
+    if (nbytes < 0 && (busy_poll_spin_ns == 0 || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        nbytes = (int)read(transport->socket_fd, buffer, size - 1);
+    }
+    buffer[nbytes > 0 ? nbytes : 0] = '\0';
+    return nbytes;
+}
+
+int transport_receive_nonblocking(Transport *transport, char *buffer, size_t size) {
+    if (transport->pending_length > 0) {
+        return transport_receive(transport, buffer, size);
+    }
+    if (transport->channel == NULL) {
+        int nbytes = (int)recv(transport->socket_fd, buffer, size - 1, MSG_DONTWAIT);
+        buffer[nbytes > 0 ? nbytes : 0] = '\0';
+        return nbytes;
+    }
+
+    ShmRing *ring = transport->rx;
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        // drained before the last look at the ring, so a packet published after that look leaves
+        // a fresh count behind and the caller's next wait wakes up
+        uint64_t count;
+        if (read(transport->rx_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            return -1;
+        }
+        __atomic_store_n(&ring->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    }
+    if (head != tail) {
+        if (head - tail > SHM_RING_SLOTS) {
+            return -1;
+        }
+        return shm_take(ring, tail, buffer, size);
+    }
+    if (shm_peer_hung_up(transport)) {
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+bool transport_begin_wait(Transport *transport) {
+    if (transport->pending_length > 0) {
+        return true;
+    }
+    if (transport->channel == NULL) {
+        return false;
+    }
+    ShmRing *ring = transport->rx;
+    __atomic_store_n(&ring->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail;
+}
+
+void transport_end_wait(Transport *transport) {
+    if (transport->channel == NULL) {
+        return;
+    }
+    __atomic_store_n(&transport->rx->consumer_sleeping, 0, __ATOMIC_RELAXED);
+    // the eventfd never blocks, EAGAIN only means nothing was written
+    uint64_t count;
+    ssize_t drained = read(transport->rx_eventfd, &count, sizeof(count));
+    (void)drained;
+}
+
+void transport_detach_shm(Transport *transport) {
+    if (transport->channel != NULL) {
+        munmap(transport->channel, sizeof(ShmChannel));
+        transport->channel = NULL;
+    }
+    if (transport->channel_fd >= 0) {
+        close(transport->channel_fd);
+    }
+    if (transport->tx_eventfd >= 0) {
+        close(transport->tx_eventfd);
+    }
+    if (transport->rx_eventfd >= 0) {
+        close(transport->rx_eventfd);
+    }
+    transport->tx = NULL;
+    transport->rx = NULL;
+    transport->channel_fd = -1;
+    transport->tx_eventfd = -1;
+    transport->rx_eventfd = -1;
+}
+
+void transport_close(Transport *transport) {
+    transport_detach_shm(transport);
+    if (transport->socket_fd >= 0) {
+        close(transport->socket_fd);
+    }
+    transport->socket_fd = -1;
+}
@@ -0,0 +1,119 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Transports for co-located bots. Every transport carries the same packets as the TCP ports:
+//  - TRANSPORT_TCP connects to 127.0.0.1:2201 / 2202.
+//  - TRANSPORT_UNIX connects to the server's AF_UNIX sockets, <dir>/battleship-2201.sock / -2202.sock.
+//  - TRANSPORT_SHM starts as TRANSPORT_UNIX, then hands the server a shared-memory channel and two
+//    eventfds with an 'M' packet. Once the server answers 'A' every packet travels through the
+//    channel's rings and the socket is only kept to notice the peer hanging up. If the server
+//    answers anything else the connection simply stays a Unix socket.
+
+#define TRANSPORT_PORT_PLAYER01 2201
+#define TRANSPORT_PORT_PLAYER02 2202
+#define TRANSPORT_UNIX_PATH_FORMAT "%s/battleship-%d.sock"
+#define TRANSPORT_DEFAULT_UNIX_DIR "/tmp"
+// Listen backlog of the player ports unless -q says otherwise. The kernel caps it at
+// net.core.somaxconn, and the half-open connections at net.ipv4.tcp_max_syn_backlog.
+#define TRANSPORT_DEFAULT_BACKLOG 1024
+
+#define SHM_RING_SLOTS 64
+#define SHM_RING_SLOT_SIZE 1024
+#define SHM_CHANNEL_MAGIC 0x42534852u
+// fds that travel with the 'M' packet: the channel memfd, then the client -> server and the
+// server -> client eventfds
+#define SHM_HANDSHAKE_FD_COUNT 3
+
+typedef enum TransportKind {
+    TRANSPORT_TCP,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM
+} TransportKind;
+
+typedef struct ShmRingSlot {
+    uint32_t length;
+    char data[SHM_RING_SLOT_SIZE];
+} ShmRingSlot;
+
+// Single producer, single consumer. head and tail only ever grow, a slot is (index % SHM_RING_SLOTS).
+// The consumer spins for a short while, then sets consumer_sleeping and blocks on its eventfd, and
+// the producer only pays for the eventfd write when it sees the flag.
+typedef struct ShmRing {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t consumer_sleeping;
+    ShmRingSlot slots[SHM_RING_SLOTS] __attribute__((aligned(64)));
+} ShmRing;
+
+// rings[0] carries client -> server packets, rings[1] server -> client replies
+typedef struct ShmChannel {
+    uint32_t magic;
+    ShmRing rings[2];
+} ShmChannel;
+
+typedef struct Transport {
+    TransportKind kind;
+    int socket_fd;
+    ShmChannel *channel;
+    // the channel's memfd, kept by the server so a replacement process can map the same channel
+    int channel_fd;
+    ShmRing *tx;
+    ShmRing *rx;
+    // written to wake the peer, and waited on for the peer's packets
+    int tx_eventfd;
+    int rx_eventfd;
+    // a reply that arrived instead of the handshake's 'A', handed out by the next transport_receive()
+    char pending[SHM_RING_SLOT_SIZE];
+    int pending_length;
+} Transport;
+
+const char *transport_kind_name(TransportKind kind);
+bool parse_transport_kind(const char *name, TransportKind *kind);
+
+// Busy-poll mode for latency-critical games. Receives poll the socket or ring without blocking
+// for up to 'spin_ns' before they block, which trades a busy core for the scheduler's wakeup
+// latency. 0, the default, keeps the short ring spin and blocking socket reads.
+void transport_set_busy_poll(long spin_ns);
+long transport_busy_poll_ns(void);
+// Parses "<cpu>[/<spin_us>]", a cpu of -1 means no pinning.
+bool parse_busy_poll_option(const char *argument, int *cpu, long *spin_us);
+// pins the calling thread to 'cpu', meant for a core isolated from the scheduler (isolcpus)
+bool transport_pin_to_cpu(int cpu);
+// SO_BUSY_POLL and TCP_NODELAY for a busy-polled socket, false if the kernel refused SO_BUSY_POLL
+// (raising it past net.core.busy_read needs CAP_NET_ADMIN)
+bool transport_tune_busy_poll_socket(int socket_fd);
+// Parses a listen backlog, 1 to 65535.
+bool parse_backlog_option(const char *argument, int *backlog);
+// TCP_FASTOPEN on a TCP listener, so a client with a cookie from an earlier connection sends its
+// first packet with the SYN. Only honoured with bit 2 of net.ipv4.tcp_fastopen set.
+bool transport_enable_fast_open(int listen_fd, int queue_length);
+
+// client side, connects as player 1 or 2, 'unix_dir' is only used by the Unix and shared-memory transports
+bool transport_connect(Transport *transport, TransportKind kind, int player_number, const char *unix_dir);
+// server side, maps a channel the client sent with SCM_RIGHTS, takes ownership of the fds on success
+bool transport_attach_shm_server(Transport *transport, int socket_fd, const int *fds);
+
+// sends one packet, returns false if the peer is gone
+bool transport_send(Transport *transport, const char *packet, size_t length);
+// blocks for the next packet and NUL-terminates it, returns the length or 0 / -1 if the peer is gone
+int transport_receive(Transport *transport, char *buffer, size_t size);
+// Never blocks, for event loops that wait on socket_fd and rx_eventfd themselves. Returns what
+// transport_receive() would, or -1 with errno EAGAIN when nothing is waiting. A socket read may
+// hold several packets. A shared-memory transport stays flagged as asleep after this, so every
+// packet the peer sends writes rx_eventfd.
+int transport_receive_nonblocking(Transport *transport, char *buffer, size_t size);
+// For a reader that waits on several transports with one poll(). True if a packet is already
+// waiting. Otherwise a shared-memory transport is flagged as asleep, so the next packet writes
+// rx_eventfd, and the caller polls rx_eventfd and socket_fd, then calls transport_end_wait().
+bool transport_begin_wait(Transport *transport);
+// clears the flag and the eventfd count, a packet that came in meanwhile is seen by the next look
+void transport_end_wait(Transport *transport);
+// drops the shared-memory channel, the socket itself stays open
+void transport_detach_shm(Transport *transport);
+void transport_close(Transport *transport);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "transport.h"
+
+// Round-trip benchmark for the server's transports. Player 2 connects over TCP and waits, player 1
+// connects over the transport under test and sends 'Q' packets before its 'B'. The server answers
+// each one with E 100 without touching any game state, so every sample is one full request / reply
+// through the server's read, parse and send path. Player 1 forfeits with 'F' at the end.
+//
+// Run the server with -u <dir> for the unix and shm transports and send its log to /dev/null,
+// otherwise the terminal dominates the numbers. To compare busy-poll mode against the default
+// blocking reads, run both the server and the bench with -b, each pinned to its own core.
+
+#define BUFFER_SIZE 1024
+#define PING_PACKET "Q"
+
+long elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+int compare_long(const void *left, const void *right) {
+    long l = *(const long *)left;
+    long r = *(const long *)right;
+    return (l > r) - (l < r);
+}
+
+int main(int argc, char **argv) {
+    TransportKind kind = TRANSPORT_TCP;
+    const char *unix_dir = TRANSPORT_DEFAULT_UNIX_DIR;
+    int count = 10000;
+    int busy_poll_cpu = -1;
+    long busy_poll_spin_us = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "T:d:n:b:")) != -1) {
+        switch (opt) {
+            case 'T':
+                if (!parse_transport_kind(optarg, &kind)) {
+                    fprintf(stderr, "[Bench] - [ERROR] Unknown transport '%s', expected tcp, unix or shm.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd':
+                unix_dir = optarg;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'b':
+                if (!parse_busy_poll_option(optarg, &busy_poll_cpu, &busy_poll_spin_us)) {
+                    fprintf(stderr, "[Bench] - [ERROR] Invalid busy-poll option '%s', expected <cpu>[/<spin_us>].\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-T tcp|unix|shm] [-d unix_socket_dir] [-n round_trips] [-b cpu[/spin_us]]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (count <= 0) {
+        count = 1;
+    }
+    if (busy_poll_spin_us > 0) {
+        transport_set_busy_poll(busy_poll_spin_us * 1000);
+        if (busy_poll_cpu >= 0 && !transport_pin_to_cpu(busy_poll_cpu)) {
+            fprintf(stderr, "[Bench] - [WARNING] Could not pin to CPU %d.\n", busy_poll_cpu);
+        }
+    }
+
+    long *samples = malloc(count * sizeof(long));
+    if (samples == NULL) {
+        fprintf(stderr, "[Bench] - [ERROR] Could not allocate %d samples.\n", count);
+        return EXIT_FAILURE;
+    }
+
+    // player 2 first: the server only reads player 1 once both seats are taken, and the
+    // shared-memory handshake needs that read
+    Transport opponent, transport;
+    if (!transport_connect(&opponent, TRANSPORT_TCP, 2, NULL)) {
+        perror("[Bench] - [ERROR] Player 2 could not connect");
+        return EXIT_FAILURE;
+    }
+    if (!transport_connect(&transport, kind, 1, unix_dir)) {
+        perror("[Bench] - [ERROR] Player 1 could not connect");
+        return EXIT_FAILURE;
+    }
+
+    char buffer[BUFFER_SIZE];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < count; i++) {
+        struct timespec sent, received;
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        if (!transport_send(&transport, PING_PACKET, strlen(PING_PACKET)) || transport_receive(&transport, buffer, sizeof(buffer)) <= 0) {
+            fprintf(stderr, "[Bench] - [ERROR] Server hung up after %d round trips.\n", i);
+            return EXIT_FAILURE;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &received);
+        samples[i] = elapsed_ns(&sent, &received);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    transport_send(&transport, "F", 1);
+    transport_receive(&transport, buffer, sizeof(buffer));
+    transport_receive(&opponent, buffer, sizeof(buffer));
+    transport_close(&transport);
+    transport_close(&opponent);
+
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, count, sizeof(long), compare_long);
+
+    double seconds = elapsed_ns(&start, &end) / 1e9;
+    printf("[Bench] - [INFO] %s%s: %d round trips, %.0f per second\n", transport_kind_name(kind), busy_poll_spin_us > 0 ? " busy-poll" : "", count, count / seconds);
+    printf("[Bench] - [INFO] min %.1f us, avg %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+        samples[0] / 1e3, total / 1e3 / count, samples[count / 2] / 1e3, samples[(long)count * 99 / 100] / 1e3,
+        samples[(long)count * 999 / 1000] / 1e3, samples[count - 1] / 1e3);
+
+    free(samples);
+    return EXIT_SUCCESS;
+}
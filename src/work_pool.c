@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include "work_pool.h"
+
+#define WORK_DEQUE_INITIAL_CAPACITY 64
+
+typedef struct WorkerStart {
+    WorkPool *pool;
+    int worker_index;
+} WorkerStart;
+
+// index of the pool worker running on this thread, -1 outside the pool
+static __thread int current_worker_index = -1;
+
+static bool work_deque_push_bottom(WorkDeque *deque, WorkItem item) {
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->bottom - deque->top == deque->capacity) {
+        int new_capacity = deque->capacity * 2;
+        WorkItem *items = malloc(new_capacity * sizeof(WorkItem));
+        if (items == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (long i = deque->top; i < deque->bottom; i++) {
+            items[i % new_capacity] = deque->items[i % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->capacity = new_capacity;
+    }
+
+    deque->items[deque->bottom % deque->capacity] = item;
+    deque->bottom++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static bool work_deque_pop_bottom(WorkDeque *deque, WorkItem *item) {
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        deque->bottom--;
+        *item = deque->items[deque->bottom % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+static bool work_deque_steal_top(WorkDeque *deque, WorkItem *item) {
+    bool found = false;
+
+    // a busy victim is skipped rather than waited on, the thief just tries the next deque
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return false;
+    }
+    if (deque->bottom > deque->top) {
+        *item = deque->items[deque->top % deque->capacity];
+        deque->top++;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+static bool work_pool_take(WorkPool *pool, int worker_index, WorkItem *item) {
+    WorkDeque *own = &pool->deques[worker_index];
+
+    if (work_deque_pop_bottom(own, item)) {
+        return true;
+    }
+
+    for (int i = 1; i < pool->worker_count; i++) {
+        int victim = (worker_index + i) % pool->worker_count;
+        if (work_deque_steal_top(&pool->deques[victim], item)) {
+            __atomic_fetch_add(&own->stolen, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *work_pool_worker_main(void *argument) {
+    WorkerStart *start = argument;
+    WorkPool *pool = start->pool;
+    int worker_index = start->worker_index;
+    free(start);
+
+    current_worker_index = worker_index;
+
+    while (true) {
+        WorkItem item;
+
+        if (work_pool_take(pool, worker_index, &item)) {
+            __atomic_fetch_sub(&pool->available, 1, __ATOMIC_ACQ_REL);
+            item.function(item.argument, worker_index);
+            pool->deques[worker_index].executed++;
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0) {
+                pthread_cond_broadcast(&pool->all_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->available, __ATOMIC_ACQUIRE) <= 0 && !pool->shutting_down) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        bool stop = pool->shutting_down && __atomic_load_n(&pool->available, __ATOMIC_ACQUIRE) <= 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+WorkPool* create_work_pool(int worker_count) {
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->worker_count = worker_count > 0 ? worker_count : 1;
+    pool->threads = calloc(pool->worker_count, sizeof(pthread_t));
+    pool->deques = calloc(pool->worker_count, sizeof(WorkDeque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].capacity = WORK_DEQUE_INITIAL_CAPACITY;
+        pool->deques[i].items = malloc(WORK_DEQUE_INITIAL_CAPACITY * sizeof(WorkItem));
+    }
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        WorkerStart *start = malloc(sizeof(WorkerStart));
+        start->pool = pool;
+        start->worker_index = i;
+        pthread_create(&pool->threads[i], NULL, work_pool_worker_main, start);
+    }
+    return pool;
+}
+
+void delete_work_pool(WorkPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    work_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+}
+
+bool work_pool_submit(WorkPool *pool, WorkFunction function, void *argument) {
+    WorkItem item = { .function = function, .argument = argument };
+    int deque_index = current_worker_index;
+
+    if (deque_index < 0 || deque_index >= pool->worker_count) {
+        deque_index = (int)(__atomic_fetch_add(&pool->next_deque, 1, __ATOMIC_RELAXED) % pool->worker_count);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!work_deque_push_bottom(&pool->deques[deque_index], item)) {
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    __atomic_fetch_add(&pool->available, 1, __ATOMIC_ACQ_REL);
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+void work_pool_wait(WorkPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,51 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its own work at the
+// bottom (newest first, warm caches) while idle workers steal from the top of other deques
+// (oldest first, usually the biggest chunks). Work submitted from outside the pool is spread
+// round-robin over the deques, work submitted from inside a task stays on that worker's deque.
+
+typedef void (*WorkFunction)(void *argument, int worker_index);
+
+typedef struct WorkItem {
+    WorkFunction function;
+    void *argument;
+} WorkItem;
+
+typedef struct WorkDeque {
+    pthread_mutex_t lock;
+    WorkItem *items;
+    int capacity;
+    // items live in [top, bottom) modulo capacity, thieves take from top, the owner from bottom
+    long top;
+    long bottom;
+    long executed;
+    long stolen;
+} WorkDeque;
+
+typedef struct WorkPool {
+    int worker_count;
+    pthread_t *threads;
+    WorkDeque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    // queued and not yet taken by a worker, workers only sleep while this is 0
+    long available;
+    // submitted and not yet finished, work_pool_wait() returns when this reaches 0
+    long pending;
+    unsigned int next_deque;
+    bool shutting_down;
+} WorkPool;
+
+WorkPool* create_work_pool(int worker_count);
+void delete_work_pool(WorkPool *pool);
+bool work_pool_submit(WorkPool *pool, WorkFunction function, void *argument);
+// blocks until every task submitted so far, and everything they submitted, has finished
+void work_pool_wait(WorkPool *pool);
+
+#endif